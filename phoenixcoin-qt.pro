@@ -138,6 +138,21 @@ contains(NEED_QT_PLUGINS, 1) {
 }
 
 
+# LevelDB for the transaction data base
+INCLUDEPATH += src/leveldb/include src/leveldb/helpers/memenv
+LIBS += $$PWD/src/leveldb/libleveldb.a $$PWD/src/leveldb/libmemenv.a $$PWD/src/leveldb/libsnappy.a
+win32 {
+    genleveldb.commands = cd $$PWD/src/leveldb && $(MAKE) -f Makefile.mingw libleveldb.a libmemenv.a libsnappy.a
+} else {
+    genleveldb.commands = cd $$PWD/src/leveldb && $(MAKE) -f Makefile.posix libleveldb.a libmemenv.a libsnappy.a
+}
+genleveldb.target = $$PWD/src/leveldb/libleveldb.a
+genleveldb.depends = FORCE
+PRE_TARGETDEPS += $$PWD/src/leveldb/libleveldb.a
+QMAKE_EXTRA_TARGETS += genleveldb
+QMAKE_CLEAN += $$PWD/src/leveldb/libleveldb.a $$PWD/src/leveldb/libmemenv.a $$PWD/src/leveldb/libsnappy.a \
+    $$PWD/src/leveldb/obj/*.o
+
 # regenerate src/build.h
 !win32|contains(USE_BUILD_INFO, 1) {
     genbuild.depends = FORCE
@@ -165,19 +180,26 @@ HEADERS += src/qt/gui.h \
     src/qt/addressvalidator.h \
     src/alert.h \
     src/addrman.h \
+    src/arith_uint256.h \
     src/base58.h \
     src/bignum.h \
+    src/blockmap.h \
+    src/secp256k1.h \
+    src/sigcache.h \
     src/checkpoints.h \
     src/compat.h \
     src/sync.h \
     src/util.h \
     src/uint256.h \
     src/serialize.h \
+    src/poolmap.h \
     src/strlcpy.h \
     src/main.h \
     src/net.h \
     src/key.h \
     src/db.h \
+    src/txdb.h \
+    src/checkqueue.h \
     src/walletdb.h \
     src/script.h \
     src/init.h \
@@ -251,13 +273,16 @@ SOURCES += src/qt/phoenixcoin.cpp \
     src/netbase.cpp \
     src/key.cpp \
     src/script.cpp \
+    src/secp256k1.cpp \
     src/main.cpp \
+    src/blockmap.cpp \
     src/init.cpp \
     src/net.cpp \
     src/irc.cpp \
     src/checkpoints.cpp \
     src/addrman.cpp \
     src/db.cpp \
+    src/txdb.cpp \
     src/walletdb.cpp \
     src/qt/clientmodel.cpp \
     src/qt/guiutil.cpp \
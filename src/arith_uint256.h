@@ -0,0 +1,210 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef ARITH_UINT256_H
+#define ARITH_UINT256_H
+
+#include <string>
+
+#include <assert.h>
+
+#include "uint256.h"
+
+/** 256-bit unsigned integer with the arithmetic required for proof-of-work
+ * and chain work calculations; replaces CBigNum there as it needs no heap
+ * allocation and no OpenSSL calls. Arithmetic is performed modulo 2^256 */
+class arith_uint256 : public base_uint256
+{
+public:
+    typedef base_uint256 basetype;
+
+    arith_uint256() {
+        for(int i = 0; i < WIDTH; i++)
+          pn[i] = 0;
+    }
+
+    arith_uint256(const basetype &b) {
+        for(int i = 0; i < WIDTH; i++)
+          pn[i] = b.pn[i];
+    }
+
+    arith_uint256 &operator=(const basetype &b) {
+        for(int i = 0; i < WIDTH; i++)
+          pn[i] = b.pn[i];
+        return(*this);
+    }
+
+    arith_uint256(uint64 b) {
+        pn[0] = (uint)b;
+        pn[1] = (uint)(b >> 32);
+        for(int i = 2; i < WIDTH; i++)
+          pn[i] = 0;
+    }
+
+    arith_uint256 &operator=(uint64 b) {
+        pn[0] = (uint)b;
+        pn[1] = (uint)(b >> 32);
+        for(int i = 2; i < WIDTH; i++)
+          pn[i] = 0;
+        return(*this);
+    }
+
+    explicit arith_uint256(const std::string &str) {
+        SetHex(str);
+    }
+
+    const arith_uint256 operator~() const {
+        return(arith_uint256(basetype::operator~()));
+    }
+
+    const arith_uint256 operator-() const {
+        return(arith_uint256(basetype::operator-()));
+    }
+
+    arith_uint256 &operator*=(uint b32) {
+        uint64 carry = 0;
+        for(int i = 0; i < WIDTH; i++) {
+            uint64 n = carry + (uint64)b32 * pn[i];
+            pn[i] = (uint)n;
+            carry = n >> 32;
+        }
+        return(*this);
+    }
+
+    arith_uint256 &operator*=(const arith_uint256 &b) {
+        arith_uint256 a;
+        for(int j = 0; j < WIDTH; j++) {
+            uint64 carry = 0;
+            for(int i = 0; i + j < WIDTH; i++) {
+                uint64 n = carry + a.pn[i + j] + (uint64)pn[j] * b.pn[i];
+                a.pn[i + j] = (uint)n;
+                carry = n >> 32;
+            }
+        }
+        *this = a;
+        return(*this);
+    }
+
+    /* Long division by shift and subtract; the divisor must not be zero */
+    arith_uint256 &operator/=(const arith_uint256 &b) {
+        arith_uint256 div = b;
+        arith_uint256 num = *this;
+        *this = 0;
+        int num_bits = num.bits();
+        int div_bits = div.bits();
+        assert(div_bits);
+        /* The result is zero if the divisor is larger */
+        if(div_bits > num_bits)
+          return(*this);
+        int shift = num_bits - div_bits;
+        div <<= shift;
+        while(shift >= 0) {
+            if(num >= div) {
+                num -= div;
+                pn[shift / 32] |= (1U << (shift & 31));
+            }
+            div >>= 1;
+            shift--;
+        }
+        return(*this);
+    }
+
+    /* Position of the highest bit set plus one, zero if nothing set */
+    uint bits() const {
+        for(int pos = WIDTH - 1; pos >= 0; pos--) {
+            if(pn[pos]) {
+                for(int nbits = 31; nbits > 0; nbits--) {
+                    if(pn[pos] & (1U << nbits))
+                      return(32 * pos + nbits + 1);
+                }
+                return(32 * pos + 1);
+            }
+        }
+        return(0);
+    }
+
+    double getdouble() const {
+        double ret = 0.0;
+        double fact = 1.0;
+        for(int i = 0; i < WIDTH; i++) {
+            ret += fact * pn[i];
+            fact *= 4294967296.0;
+        }
+        return(ret);
+    }
+
+    uint64 GetLow64() const {
+        return(pn[0] | (uint64)pn[1] << 32);
+    }
+
+    /* Decodes the compact representation used for nBits; the sign bit and
+     * values not fitting into 256 bits are reported through the flags,
+     * but CBigNum compatible otherwise */
+    arith_uint256 &SetCompact(uint nCompact, bool *pfNegative = NULL, bool *pfOverflow = NULL) {
+        int nSize = nCompact >> 24;
+        uint nWord = nCompact & 0x007FFFFF;
+        if(nSize <= 3) {
+            nWord >>= 8 * (3 - nSize);
+            *this = nWord;
+        } else {
+            *this = nWord;
+            *this <<= 8 * (nSize - 3);
+        }
+        if(pfNegative)
+          *pfNegative = nWord && (nCompact & 0x00800000);
+        if(pfOverflow)
+          *pfOverflow = nWord && ((nSize > 34) ||
+            ((nWord > 0xFF) && (nSize > 33)) ||
+            ((nWord > 0xFFFF) && (nSize > 32)));
+        return(*this);
+    }
+
+    /* Encodes into the compact representation used for nBits */
+    uint GetCompact(bool fNegative = false) const {
+        int nSize = (bits() + 7) / 8;
+        uint nCompact = 0;
+        if(nSize <= 3) {
+            nCompact = (uint)(GetLow64() << 8 * (3 - nSize));
+        } else {
+            arith_uint256 bn = *this;
+            bn >>= 8 * (nSize - 3);
+            nCompact = (uint)bn.GetLow64();
+        }
+        /* The mantissa is signed, so move it down a byte if the sign bit is taken */
+        if(nCompact & 0x00800000) {
+            nCompact >>= 8;
+            nSize++;
+        }
+        nCompact |= nSize << 24;
+        nCompact |= (fNegative && (nCompact & 0x007FFFFF) ? 0x00800000 : 0);
+        return(nCompact);
+    }
+};
+
+inline bool operator==(const arith_uint256 &a, uint64 b)                         { return((base_uint256)a == b); }
+inline bool operator!=(const arith_uint256 &a, uint64 b)                         { return((base_uint256)a != b); }
+inline const arith_uint256 operator<<(const arith_uint256 &a, uint shift)        { return(arith_uint256(a) <<= shift); }
+inline const arith_uint256 operator>>(const arith_uint256 &a, uint shift)        { return(arith_uint256(a) >>= shift); }
+
+inline bool operator<(const arith_uint256 &a, const arith_uint256 &b)            { return((base_uint256)a <  (base_uint256)b); }
+inline bool operator<=(const arith_uint256 &a, const arith_uint256 &b)           { return((base_uint256)a <= (base_uint256)b); }
+inline bool operator>(const arith_uint256 &a, const arith_uint256 &b)            { return((base_uint256)a >  (base_uint256)b); }
+inline bool operator>=(const arith_uint256 &a, const arith_uint256 &b)           { return((base_uint256)a >= (base_uint256)b); }
+inline bool operator==(const arith_uint256 &a, const arith_uint256 &b)           { return((base_uint256)a == (base_uint256)b); }
+inline bool operator!=(const arith_uint256 &a, const arith_uint256 &b)           { return((base_uint256)a != (base_uint256)b); }
+inline const arith_uint256 operator^(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) ^= b); }
+inline const arith_uint256 operator&(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) &= b); }
+inline const arith_uint256 operator|(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) |= b); }
+inline const arith_uint256 operator+(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) += b); }
+inline const arith_uint256 operator-(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) -= b); }
+inline const arith_uint256 operator*(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) *= b); }
+inline const arith_uint256 operator/(const arith_uint256 &a, const arith_uint256 &b) { return(arith_uint256(a) /= b); }
+inline const arith_uint256 operator*(const arith_uint256 &a, uint b)             { return(arith_uint256(a) *= b); }
+
+/* Conversions between the opaque hash type and the arithmetic type;
+ * both share the same little endian limb layout */
+inline arith_uint256 UintToArith256(const uint256 &a) { return(arith_uint256((const base_uint256 &)a)); }
+inline uint256 ArithToUint256(const arith_uint256 &a) { return(uint256((const base_uint256 &)a)); }
+
+#endif /* ARITH_UINT256_H */
@@ -0,0 +1,121 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#include <list>
+#include <map>
+
+#ifndef WINDOWS
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "main.h"
+#include "sync.h"
+#include "util.h"
+#include "blockmap.h"
+
+using namespace std;
+
+static CCriticalSection cs_BlockFileMaps;
+static map<uint, CBlockFileMapRef> mapBlockFileMaps;
+/* The most recently used go to the front */
+static list<uint> lruBlockFileMaps;
+
+CBlockFileMap::~CBlockFileMap() {
+#ifndef WINDOWS
+    if(pdata)
+      munmap((void *) pdata, (size_t)nSize);
+#endif
+}
+
+/* Maps the whole block file read-only */
+static CBlockFileMapRef MapBlockFile(uint nFile) {
+#ifndef WINDOWS
+    /* The block files take too much of a 32-bit address space */
+    if(sizeof(void *) < 8)
+      return(CBlockFileMapRef());
+
+    int fd = open(BlockFilePath(nFile).string().c_str(), O_RDONLY);
+    if(fd < 0)
+      return(CBlockFileMapRef());
+
+    struct stat st;
+    if(fstat(fd, &st) || (st.st_size <= 0)) {
+        close(fd);
+        return(CBlockFileMapRef());
+    }
+
+    void *pdata = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /* The mapping remains valid after the descriptor is closed */
+    close(fd);
+    if(pdata == MAP_FAILED) {
+        printf("MapBlockFile() : failed to map block file %u\n", nFile);
+        return(CBlockFileMapRef());
+    }
+
+#ifdef MADV_RANDOM
+    /* Records are read one by one, no need to read ahead much */
+    madvise(pdata, (size_t)st.st_size, MADV_RANDOM);
+#endif
+
+    return(CBlockFileMapRef(new CBlockFileMap((const char *) pdata, (uint64)st.st_size)));
+#else
+    return(CBlockFileMapRef());
+#endif
+}
+
+CBlockFileMapRef GetBlockFileMap(uint nFile, uint nPos, bool fRefresh) {
+    LOCK(cs_BlockFileMaps);
+
+    if((nFile < 1) || (nFile == std::numeric_limits<uint32_t>::max()))
+      return(CBlockFileMapRef());
+
+    map<uint, CBlockFileMapRef>::iterator mi = mapBlockFileMaps.find(nFile);
+    if(mi != mapBlockFileMaps.end()) {
+        lruBlockFileMaps.remove(nFile);
+        lruBlockFileMaps.push_front(nFile);
+        if((nPos < mi->second->nSize) && !fRefresh)
+          return(mi->second);
+        /* The file has grown past the mapping, the readers of the old
+         * mapping keep it until done */
+        mapBlockFileMaps.erase(mi);
+        lruBlockFileMaps.remove(nFile);
+    }
+
+    CBlockFileMapRef pmap = MapBlockFile(nFile);
+    if(!pmap || (nPos >= pmap->nSize))
+      return(CBlockFileMapRef());
+
+    mapBlockFileMaps[nFile] = pmap;
+    lruBlockFileMaps.push_front(nFile);
+    while(lruBlockFileMaps.size() > MAX_BLOCKFILE_MAPS) {
+        mapBlockFileMaps.erase(lruBlockFileMaps.back());
+        lruBlockFileMaps.pop_back();
+    }
+
+    return(pmap);
+}
+
+void CloseBlockFileMaps() {
+    LOCK(cs_BlockFileMaps);
+
+    mapBlockFileMaps.clear();
+    lruBlockFileMaps.clear();
+}
+
+void PrefetchBlockFile(uint nFile, uint nPosBegin, uint nPosEnd) {
+#if !defined(WINDOWS) && defined(MADV_WILLNEED)
+    CBlockFileMapRef pmap = GetBlockFileMap(nFile, nPosBegin);
+    if(!pmap)
+      return;
+
+    uint64 nPageSize = (uint64)sysconf(_SC_PAGESIZE);
+    uint64 nBegin = (uint64)nPosBegin & ~(nPageSize - 1);
+    uint64 nEnd = std::min((uint64)nPosEnd, pmap->nSize);
+    if(nEnd > nBegin)
+      madvise((void *) &pmap->pdata[nBegin], (size_t)(nEnd - nBegin), MADV_WILLNEED);
+#endif
+}
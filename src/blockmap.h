@@ -0,0 +1,70 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef BLOCKMAP_H
+#define BLOCKMAP_H
+
+#include <boost/shared_ptr.hpp>
+
+#include "serialize.h"
+#include "version.h"
+
+/* Maximum number of block files mapped at once */
+static const uint MAX_BLOCKFILE_MAPS = 16;
+
+/** Read-only memory mapping of a block file;
+ * unmapped when the last reference is gone */
+class CBlockFileMap {
+private:
+    CBlockFileMap(const CBlockFileMap&);
+    void operator=(const CBlockFileMap&);
+
+public:
+    const char *pdata;
+    uint64 nSize;
+
+    CBlockFileMap(const char *pdataIn, uint64 nSizeIn) : pdata(pdataIn), nSize(nSizeIn) {}
+    ~CBlockFileMap();
+};
+
+typedef boost::shared_ptr<CBlockFileMap> CBlockFileMapRef;
+
+/* Returns a mapping of the block file which covers the position given,
+ * a NULL reference if not available; maps the file again if it has grown
+ * since mapped and fRefresh is set */
+CBlockFileMapRef GetBlockFileMap(uint nFile, uint nPos, bool fRefresh = false);
+
+/* Releases all block file mappings */
+void CloseBlockFileMaps();
+
+/* Advises the system to read the range of the block file specified
+ * in advance; no effect if the file cannot be mapped */
+void PrefetchBlockFile(uint nFile, uint nPosBegin, uint nPosEnd);
+
+/* Unserialises an object directly from the mapping of a block file;
+ * returns false if not mapped or failed, the caller may try stdio then */
+template<typename T>
+bool ReadFromBlockFileMap(uint nFile, uint nPos, T &obj, int nType = SER_DISK) {
+    int i;
+
+    for(i = 0; i < 2; i++) {
+        CBlockFileMapRef pmap = GetBlockFileMap(nFile, nPos, (i > 0));
+        if(!pmap)
+          return(false);
+
+        try {
+            CMemoryStream stream(&pmap->pdata[nPos], &pmap->pdata[pmap->nSize],
+              nType, CLIENT_VERSION);
+            stream >> obj;
+            return(true);
+        } catch(std::exception &e) {
+            /* The record may extend past the mapping into the data appended
+             * since, try once again with the file mapped anew */
+        }
+    }
+
+    return(false);
+}
+
+#endif /* BLOCKMAP_H */
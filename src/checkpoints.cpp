@@ -7,12 +7,8 @@
 #include <boost/assign/list_of.hpp> // for 'map_list_of()'
 #include <boost/foreach.hpp>
 
-#if 0
-#include "txdb.h"
-#else
 #include "main.h"
-#include "db.h"
-#endif
+#include "txdb.h"
 
 #include "uint256.h"
 #include "checkpoints.h"
@@ -99,12 +95,12 @@ namespace Checkpoints {
         return(checkpoints.rbegin()->second.second);
     }
 
-    CBlockIndex *GetLastCheckpoint(const std::map<uint256, CBlockIndex *> &mapBlockIndex) {
+    CBlockIndex *GetLastCheckpoint(const CBlockIndexMap &mapBlockIndex) {
         MapCheckpoints &checkpoints = (fTestNet ? mapCheckpointsTestnet : mapCheckpoints);
 
         BOOST_REVERSE_FOREACH(const MapCheckpoints::value_type &i, checkpoints) {
             const uint256 &hash = i.second.first;
-            std::map<uint256, CBlockIndex *>::const_iterator t = mapBlockIndex.find(hash);
+            CBlockIndexMap::const_iterator t = mapBlockIndex.find(hash);
             if(t != mapBlockIndex.end()) return(t->second);
         }
         return(NULL);
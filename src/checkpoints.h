@@ -9,6 +9,7 @@
 
 #include <map>
 
+#include "poolmap.h"
 #include "sync.h"
 #include "serialize.h"
 #include "net.h"
@@ -28,6 +29,8 @@
 class uint256;
 class CBlockIndex;
 class CNode;
+
+typedef poolmap<CBlockIndex> CBlockIndexMap;
 class CSyncCheckpoint;
 
 /* Block chain checkpoints are compiled-in sanity checks
@@ -51,7 +54,7 @@ namespace Checkpoints {
     int GetTotalBlocksEstimate();
 
     /* Returns the last CBlockIndex * in mapBlockIndex that is a checkpoint */
-    CBlockIndex *GetLastCheckpoint(const std::map<uint256, CBlockIndex *> &mapBlockIndex);
+    CBlockIndex *GetLastCheckpoint(const CBlockIndexMap &mapBlockIndex);
 
     /* Returns the time stamp of the last checkpoint */
     int GetLastCheckpointTime();
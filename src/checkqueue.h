@@ -0,0 +1,247 @@
+// Copyright (c) 2012 The Bitcoin developers
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef CHECKQUEUE_H
+#define CHECKQUEUE_H
+
+#include <algorithm>
+#include <vector>
+
+#include <boost/foreach.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+
+template<typename T> class CCheckQueueControl;
+
+/* Soft failures don't stop the other verifications, so a hard failure
+ * is always found if there is any; no failures are soft by default */
+template<typename T> inline bool IsSoftCheckFailure(const T &) {
+    return(false);
+}
+
+/** Queue for verifications that have to be performed.
+ * The verifications are represented by a type T, which must provide an
+ * operator(), returning a bool.
+ *
+ * One thread (the master) is assumed to push batches of verifications
+ * onto the queue, where they are processed by N-1 worker threads. When
+ * the master is done adding work, it temporarily joins the worker pool
+ * as an N'th worker, until all jobs are done.
+ */
+template<typename T> class CCheckQueue {
+private:
+    /* Master mutex */
+    boost::mutex mutex;
+
+    /* Worker threads block on this when out of work */
+    boost::condition_variable condWorker;
+
+    /* Master thread blocks on this when out of work */
+    boost::condition_variable condMaster;
+
+    /* The queue of elements to be processed;
+     * as the order of booleans doesn't matter, it is used as a LIFO (stack) */
+    std::vector<T> queue;
+
+    /* The number of workers (including the master) that are idle */
+    int nIdle;
+
+    /* The total number of workers (including the master) */
+    int nTotal;
+
+    /* The temporary evaluation result */
+    bool fAllOk;
+
+    /* Whether any of the verifications failed hard */
+    bool fAnyHard;
+
+    /* The first verification that failed hard if any, the first one failed otherwise */
+    T checkFailed;
+
+    /* Number of verifications that haven't completed yet;
+     * includes elements that are not anymore in queue, but still in
+     * a worker's own batch */
+    unsigned int nTodo;
+
+    /* Whether we're shutting down */
+    bool fQuit;
+
+    /* The maximum number of elements to be processed in one batch */
+    unsigned int nBatchSize;
+
+    /* Internal function that does bulk of the verification work */
+    bool Loop(bool fMaster = false, T *pcheckFailed = NULL) {
+        boost::condition_variable &cond = fMaster ? condMaster : condWorker;
+        std::vector<T> vChecks;
+        vChecks.reserve(nBatchSize);
+        T checkLocal;
+        unsigned int nNow = 0;
+        bool fOk = true;
+        bool fHard = false;
+        do {
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                /* First do the clean-up of the previous loop run (allowing us to do it in the same critsect) */
+                if(nNow) {
+                    /* Keep the first failure for the master to inspect,
+                     * a hard one in preference to a soft one */
+                    if(!fOk) {
+                        if(fAllOk || (fHard && !fAnyHard))
+                          checkFailed.swap(checkLocal);
+                        T().swap(checkLocal);
+                    }
+                    fAllOk &= fOk;
+                    fAnyHard |= fHard;
+                    nTodo -= nNow;
+                    if(!nTodo && !fMaster)
+                      /* We processed the last element; inform the master it can exit and return the result */
+                      condMaster.notify_one();
+                } else {
+                    /* First iteration */
+                    nTotal++;
+                }
+                /* Logically, the do loop starts here */
+                while(queue.empty()) {
+                    if((fMaster || fQuit) && !nTodo) {
+                        nTotal--;
+                        bool fRet = fAllOk;
+                        /* Reset the status for new work later */
+                        if(fMaster) {
+                            if(!fAllOk && pcheckFailed)
+                              pcheckFailed->swap(checkFailed);
+                            T().swap(checkFailed);
+                            fAllOk = true;
+                            fAnyHard = false;
+                        }
+                        /* Return the current status */
+                        return(fRet);
+                    }
+                    nIdle++;
+                    cond.wait(lock); /* wait */
+                    nIdle--;
+                }
+                /* Decide how many work units to process now:
+                 * at least one, and at most nBatchSize;
+                 * divide the work among all threads evenly and
+                 * distribute more at the beginning to reduce the overhead */
+                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
+                vChecks.resize(nNow);
+                for(unsigned int i = 0; i < nNow; i++) {
+                    /* We want the lock on the mutex to be as short as possible,
+                     * so swap jobs from the global queue to the local batch vector
+                     * instead of copying */
+                    vChecks[i].swap(queue.back());
+                    queue.pop_back();
+                }
+                /* Check whether we need to do work at all;
+                 * soft failures don't make the result final */
+                fOk = true;
+                fHard = fAnyHard;
+            }
+            /* Execute work */
+            BOOST_FOREACH(T &check, vChecks) {
+                if(fHard)
+                  break;
+                if(!check()) {
+                    bool fSoft = IsSoftCheckFailure(check);
+                    if(fOk || !fSoft)
+                      checkLocal.swap(check);
+                    fOk = false;
+                    fHard = !fSoft;
+                }
+            }
+            vChecks.clear();
+        } while(true);
+    }
+
+public:
+    /* Create a new check queue */
+    CCheckQueue(unsigned int nBatchSizeIn) :
+      nIdle(0), nTotal(0), fAllOk(true), fAnyHard(false), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+
+    /* Worker thread */
+    void Thread() {
+        Loop();
+    }
+
+    /* Wait until execution finishes, and return whether all evaluations were successful;
+     * a failed verification is passed back through pcheckFailed, which is soft
+     * only if all of the failures are */
+    bool Wait(T *pcheckFailed = NULL) {
+        return(Loop(true, pcheckFailed));
+    }
+
+    /* Add a batch of checks to the queue */
+    void Add(std::vector<T> &vChecks) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        BOOST_FOREACH(T &check, vChecks) {
+            queue.push_back(T());
+            check.swap(queue.back());
+        }
+        nTodo += vChecks.size();
+        if(vChecks.size() == 1)
+          condWorker.notify_one();
+        else if(vChecks.size() > 1)
+          condWorker.notify_all();
+    }
+
+    /* Let the worker threads exit as soon as there is nothing left to do */
+    void Quit() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fQuit = true;
+        condWorker.notify_all();
+    }
+
+    bool IsIdle() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        return((nTotal == nIdle) && !nTodo && fAllOk);
+    }
+
+    ~CCheckQueue() {}
+
+    friend class CCheckQueueControl<T>;
+};
+
+/** RAII-style controller object for a CCheckQueue that guarantees the passed
+ * queue is finished before continuing
+ */
+template<typename T> class CCheckQueueControl {
+private:
+    CCheckQueue<T> *pqueue;
+    bool fDone;
+
+    CCheckQueueControl(const CCheckQueueControl&);
+    void operator=(const CCheckQueueControl&);
+
+public:
+    CCheckQueueControl(CCheckQueue<T> *pqueueIn) : pqueue(pqueueIn), fDone(false) {
+        /* Passed queue is supposed to be unused, or NULL */
+        if(pqueue != NULL) {
+            bool fIdle = pqueue->IsIdle();
+            assert(fIdle);
+        }
+    }
+
+    bool Wait(T *pcheckFailed = NULL) {
+        if(pqueue == NULL)
+          return(true);
+        bool fRet = pqueue->Wait(pcheckFailed);
+        fDone = true;
+        return(fRet);
+    }
+
+    void Add(std::vector<T> &vChecks) {
+        if(pqueue != NULL)
+          pqueue->Add(vChecks);
+    }
+
+    ~CCheckQueueControl() {
+        if(!fDone)
+          Wait();
+    }
+};
+
+#endif /* CHECKQUEUE_H */
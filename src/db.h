@@ -326,38 +326,20 @@ public:
 
 
 
-/** Access to the transaction database (blkindex.dat) */
-class CTxDB : public CDB
+/** Read only access to the legacy transaction database (blkindex.dat)
+ * used to import its records into LevelDB once */
+class CBlkIndexDB : public CDB
 {
 public:
-    CTxDB(const char* pszMode="r+") : CDB("blkindex.dat", pszMode) { }
-private:
-    CTxDB(const CTxDB&);
-    void operator=(const CTxDB&);
-public:
-    bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
-    bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
-    bool AddTxIndex(const CTransaction& tx, const CDiskTxPos& pos, int nHeight);
-    bool EraseTxIndex(const CTransaction& tx);
-    bool ContainsTx(uint256 hash);
-    bool ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex);
-    bool ReadDiskTx(uint256 hash, CTransaction& tx);
-    bool ReadDiskTx(COutPoint outpoint, CTransaction& tx, CTxIndex& txindex);
-    bool ReadDiskTx(COutPoint outpoint, CTransaction& tx);
-    bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
-    bool ReadHashBestChain(uint256& hashBestChain);
-    bool WriteHashBestChain(uint256 hashBestChain);
-    bool ReadBestInvalidWork(CBigNum& bnBestInvalidWork);
-    bool WriteBestInvalidWork(CBigNum bnBestInvalidWork);
-    bool LoadBlockIndex();
-
-    /* Calls related to sync checkpoints */
-    bool ReadSyncCheckpoint(uint256 &hashCheckpoint);
-    bool WriteSyncCheckpoint(uint256 hashCheckpoint);
-    bool ReadCheckpointPubKey(std::string &strPubKey);
-    bool WriteCheckpointPubKey(const std::string &strPubKey);
-private:
-    bool LoadBlockIndexGuts();
+    CBlkIndexDB() : CDB("blkindex.dat", "r") { }
+
+    Dbc *GetCursor() {
+        return(CDB::GetCursor());
+    }
+
+    int ReadAtCursor(Dbc *pcursor, CDataStream &ssKey, CDataStream &ssValue) {
+        return(CDB::ReadAtCursor(pcursor, ssKey, ssValue, DB_NEXT));
+    }
 };
 
 
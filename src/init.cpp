@@ -27,10 +27,12 @@
 #endif
 
 #include "db.h"
+#include "txdb.h"
 #include "checkpoints.h"
 #include "wallet.h"
 #include "util.h"
 #include "rpcmain.h"
+#include "secp256k1.h"
 #include "init.h"
 
 using namespace std;
@@ -40,6 +42,7 @@ CWallet *pwalletMain;
 CClientUIInterface uiInterface;
 
 uint nMsgSleep;
+uint nMsgThreads;
 std::string strClientLaunchDateTime;
 enum Checkpoints::CPMode CheckpointsMode;
 
@@ -93,6 +96,19 @@ void Shutdown(void *parg) {
         bitdb.Flush(false);
         StopNode();
         bitdb.Flush(true);
+        if(pindexBest && GetBoolArg("-indexsnapshot", true)) {
+            LOCK(cs_main);
+            CTxDB txdb("r+");
+            txdb.WriteBlockIndexSnapshot();
+        }
+        {
+            /* The block data and the index records referring to it */
+            CTxDB txdb("r");
+            if(CommitBlockFiles(true))
+              txdb.Sync();
+        }
+        CloseTxDB();
+        CloseBlockFileMaps();
         boost::filesystem::remove(GetPidFile());
         UnregisterWallet(pwalletMain);
         delete pwalletMain;
@@ -239,6 +255,11 @@ std::string HelpMessage()
         "  -datadir=<dir>         " + _("Specify data directory") + "\n" +
         "  -dbcache=<n>           " + _("Set database cache size in megabytes (default: 25)") + "\n" +
         "  -dblogsize=<n>         " + _("Set database disk log size in megabytes (default: 100)") + "\n" +
+        "  -coinscache=<n>        " + _("Set transaction output cache size in megabytes (default: 32)") + "\n" +
+        "  -par=<n>               " + _("Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)") + "\n" +
+        "  -nativeverify          " + _("Verify signatures with the native secp256k1 engine rather than OpenSSL; the public keys decoded are cached for the native engine only (default: 1)") + "\n" +
+        "  -sigcachesize=<n>      " + _("Set signature cache size in megabytes (default: 16)") + "\n" +
+        "  -headersfirst          " + _("Download block headers first and block bodies from several peers in parallel (default: 1)") + "\n" +
         "  -timeout=<n>           " + _("Specify connection timeout in milliseconds (default: 5000)") + "\n" +
         "  -proxy=<ip:port>       " + _("Connect through socks proxy") + "\n" +
         "  -socks=<n>             " + _("Select the version of socks proxy to use (4-5, default: 5)") + "\n" +
@@ -246,6 +267,7 @@ std::string HelpMessage()
         "  -dns                   " + _("Allow DNS lookups for -addnode, -seednode and -connect") + "\n" +
         "  -port=<port>           " + _("Listen for connections on <port> (default: 9555 or testnet: 19555)") + "\n" +
         "  -maxconnections=<n>    " + _("Maintain at most <n> connections to peers (default: 125)") + "\n" +
+        "  -msgthreads=<n>        " + _("Set the number of message handler threads (1 to 16, default: 4)") + "\n" +
         "  -addnode=<ip>          " + _("Add a node to connect to and attempt to keep the connection open") + "\n" +
         "  -connect=<ip>          " + _("Connect only to the specified node(s)") + "\n" +
         "  -seednode=<ip>         " + _("Connect to a node to retrieve peer addresses, and disconnect") + "\n" +
@@ -296,7 +318,11 @@ std::string HelpMessage()
         "  -salvagewallet         " + _("Attempt to recover private keys from a corrupt wallet.dat") + "\n" +
         "  -checkblocks=<n>       " + _("How many blocks to check at startup (default: 2500, 0 = all)") + "\n" +
         "  -checklevel=<n>        " + _("How thorough the block verification is (0-6, default: 1)") + "\n" +
+        "  -checkpow              " + _("Recompute the proof-of-work hashes of the blocks verified at startup") + "\n" +
+        "  -indexsnapshot         " + _("Load the block index from a snapshot written at shutdown (default: 1)") + "\n" +
         "  -loadblock=<file>      " + _("Imports blocks from external blk000?.dat file") + "\n" +
+        "  -reindex               " + _("Rebuild the block index and transaction data base from the blk000?.dat files") + "\n" +
+        "  -addrindex             " + _("Maintain an index of the outputs by address for getaddresshistory and getaddressunspent (default: 0)") + "\n" +
 
         "\n" + _("Block creation options:") + "\n" +
         "  -blockminsize=<n>      "   + _("Set minimum block size in bytes (default: 0)") + "\n" +
@@ -450,6 +476,27 @@ bool AppInit2()
     /* Polling delay for message handling, in milliseconds */
     nMsgSleep = GetArg("-msgsleep", 20);
 
+    /* Message handler threads */
+    nMsgThreads = (uint)max((int64)1, min((int64)MAX_MSGHANDLER_THREADS, GetArg("-msgthreads", 4)));
+
+    /* Script verification threads; 0 means auto, negative leaves cores free */
+    nScriptCheckThreads = GetArg("-par", 0);
+    if(nScriptCheckThreads <= 0)
+      nScriptCheckThreads += boost::thread::hardware_concurrency();
+    if(nScriptCheckThreads <= 1)
+      nScriptCheckThreads = 0;
+    else if(nScriptCheckThreads > MAX_SCRIPTCHECK_THREADS)
+      nScriptCheckThreads = MAX_SCRIPTCHECK_THREADS;
+
+    /* Signature verification engine; its tables are built in advance */
+    fNativeVerify = GetBoolArg("-nativeverify", true);
+    if(fNativeVerify)
+      Secp256k1Init();
+
+    fHeadersFirst = GetBoolArg("-headersfirst", true);
+
+    fAddrIndex = GetBoolArg("-addrindex", false);
+
     if (mapArgs.count("-timeout"))
     {
         int nNewTimeout = GetArg("-timeout", 5000);
@@ -534,6 +581,20 @@ bool AppInit2()
 
     if(fDaemon) fprintf(stdout, "Phoenixcoin server starting\n");
 
+    if(nScriptCheckThreads) {
+        printf("Using %d threads for script and proof-of-work verification\n", nScriptCheckThreads);
+        for(int i = 0; i < nScriptCheckThreads - 1; i++) {
+            if(!NewThread(ThreadScriptCheck, NULL))
+              printf("Error: NewThread(ThreadScriptCheck) failed\n");
+            if(!NewThread(ThreadPoWCheck, NULL))
+              printf("Error: NewThread(ThreadPoWCheck) failed\n");
+        }
+    }
+
+    /* Block writes are queued from now on */
+    if(!NewThread(ThreadBlockWriter, NULL))
+      printf("Error: NewThread(ThreadBlockWriter) failed\n");
+
     int64 nStart;
 
     // ********************************************************* Step 5: verify database integrity
@@ -700,11 +761,16 @@ bool AppInit2()
         return false;
     }
 
+    if(GetBoolArg("-reindex"))
+      uiInterface.InitMessage(_("Preparing to reindex..."));
+    if(!PrepareReindex(GetBoolArg("-reindex")))
+      return(InitError(_("Failed to set the block files aside for reindexing")));
+
     uiInterface.InitMessage(_("Loading block index..."));
     printf("Loading block index...\n");
     nStart = GetTimeMillis();
     if (!LoadBlockIndex())
-        return InitError(_("Error loading blkindex.dat"));
+        return InitError(_("Error loading the block index"));
 
     // as LoadBlockIndex can take several minutes, it's possible the user
     // requested to kill phoenixcoin-qt during the last operation. If so, exit.
@@ -716,6 +782,18 @@ bool AppInit2()
     }
     printf(" block index %15" PRI64d "ms\n", GetTimeMillis() - nStart);
 
+    /* The address index must cover the whole block chain */
+    {
+        CTxDB txdb;
+        bool fAddrIndexDB = false;
+        txdb.ReadFlag("addrindex", fAddrIndexDB);
+        if(fAddrIndex != fAddrIndexDB) {
+            if(fAddrIndex && (nBestHeight > 0))
+              return(InitError(_("You need to rebuild the data base using -reindex to enable -addrindex")));
+            txdb.WriteFlag("addrindex", fAddrIndex);
+        }
+    }
+
     if (GetBoolArg("-printblockindex") || GetBoolArg("-printblocktree"))
     {
         PrintBlockTree();
@@ -726,7 +804,7 @@ bool AppInit2()
     {
         string strMatch = mapArgs["-printblock"];
         int nFound = 0;
-        for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+        for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
         {
             uint256 hash = (*mi).first;
             if (strncmp(hash.ToString().c_str(), strMatch.c_str(), strMatch.size()) == 0)
@@ -831,6 +909,9 @@ bool AppInit2()
 
     // ********************************************************* Step 9: import blocks
 
+    /* The block files set aside by -reindex or left by an interrupted reindex */
+    ImportReindexFiles();
+
     if (mapArgs.count("-loadblock"))
     {
         uiInterface.InitMessage(_("Importing blockchain data file."));
@@ -8,18 +8,25 @@
 #include <map>
 #include <utility>
 #include <list>
+#include <deque>
 #include <vector>
 #include <set>
 #include <limits>
+#include <cmath>
 
 #include <boost/algorithm/string/replace.hpp>
+#include <boost/bind.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
 
 #include "init.h"
 #include "alert.h"
 #include "checkpoints.h"
+#include "checkqueue.h"
 #include "db.h"
+#include "txdb.h"
 #include "wallet.h"
 #include "util.h"
 #include "main.h"
@@ -43,25 +50,44 @@ unsigned int nTransactionsUpdated = 0;
 
 int nBaseMaturity = BASE_MATURITY;
 
-map<uint256, CBlockIndex*> mapBlockIndex;
+CBlockIndexMap mapBlockIndex;
+CChain chainActive;
 uint256 hashGenesisBlock("0xbe2f30f9e8db8f430056869c43503a992d232b28508e83eda101161a18cf7c73");
 uint256 hashGenesisBlockTestNet("0xecd47eee16536f7d03d64643cfc8c61b22093f8bf2c9358bf8b6f4dcb5f13192");
-static CBigNum bnProofOfWorkLimit(~uint256(0) >> 20);
+static arith_uint256 nProofOfWorkLimit(~arith_uint256(0) >> 20);
 /* The difficulty after switching to NeoScrypt (0.015625) */
-static CBigNum bnNeoScryptSwitch(~uint256(0) >> 26);
+static arith_uint256 nNeoScryptSwitch(~arith_uint256(0) >> 26);
 CBlockIndex* pindexGenesisBlock = NULL;
 int nBestHeight = -1;
-CBigNum bnBestChainWork = 0;
-CBigNum bnBestInvalidWork = 0;
+arith_uint256 nBestChainWork = 0;
+arith_uint256 nBestInvalidWork = 0;
 uint256 hashBestChain = 0;
 CBlockIndex* pindexBest = NULL;
 int64 nTimeBestReceived = 0;
+/* Script verification threads including the thread connecting blocks */
+int nScriptCheckThreads = 0;
+/* Maintain the address index */
+bool fAddrIndex = false;
 
 CMedianFilter<int> cPeerBlockCounts(5, 0); // Amount of blocks that other nodes claim to have
 
 map<uint256, CBlock*> mapOrphanBlocks;
 multimap<uint256, CBlock*> mapOrphanBlocksByPrev;
 
+/* Headers-first synchronisation state protected by cs_main:
+ * validated headers of blocks not in mapBlockIndex yet, the best header chain
+ * (headers only, in ascending order), the headers off it with the time
+ * they've been put aside and block requests in flight; the peer asked for
+ * headers is referenced until it responds or disconnects */
+bool fHeadersFirst = true;
+static map<uint256, CBlockIndex *> mapHeaderIndex;
+static deque<CBlockIndex *> vHeaderChain;
+static map<CBlockIndex *, int64> mapSideHeaders;
+static CBlockIndex *pindexBestHeader = NULL;
+static map<uint256, pair<CNode *, int64> > mapBlocksInFlight;
+static CNode *pnodeHeadersSync = NULL;
+static int64 nHeadersAskTime = 0;
+
 map<uint256, CDataStream*> mapOrphanTransactions;
 map<uint256, map<uint256, CDataStream*> > mapOrphanTransactionsByPrev;
 
@@ -133,10 +159,10 @@ static void EraseFromWallets(uint256 hash)
 }
 
 // make sure all wallets know about the given transaction, in the given block
-void SyncWithWallets(const CTransaction& tx, const CBlock* pblock, bool fUpdate)
+void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate)
 {
     BOOST_FOREACH(CWallet* pwallet, setpwalletRegistered)
-        pwallet->AddToWalletIfInvolvingMe(tx, pblock, fUpdate);
+        pwallet->AddToWalletIfInvolvingMe(hash, tx, pblock, fUpdate);
 }
 
 // notify wallets about a new best chain
@@ -436,7 +462,7 @@ int CMerkleTx::SetMerkleBranch(const CBlock* pblock)
     }
 
     // Is the tx in a block that's in the main chain
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -536,7 +562,7 @@ int64 CTransaction::GetMinFee(uint nBytes, bool fAllowFree,
 
 
 bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
-                        bool* pfMissingInputs)
+                        bool* pfMissingInputs, const uint256 *phash)
 {
     if (pfMissingInputs)
         *pfMissingInputs = false;
@@ -557,7 +583,7 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
         return error("CTxMemPool::accept() : nonstandard transaction type");
 
     // Do we already have it?
-    uint256 hash = tx.GetHash();
+    uint256 hash = phash ? *phash : tx.GetHash();
     {
         LOCK(cs);
         if (mapTx.count(hash))
@@ -682,9 +708,10 @@ bool CTxMemPool::accept(CTxDB& txdb, CTransaction &tx, bool fCheckInputs,
     return(true);
 }
 
-bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMissingInputs)
+bool CTransaction::AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs, bool* pfMissingInputs,
+  const uint256 *phash)
 {
-    return mempool.accept(txdb, *this, fCheckInputs, pfMissingInputs);
+    return mempool.accept(txdb, *this, fCheckInputs, pfMissingInputs, phash);
 }
 
 bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
@@ -701,12 +728,12 @@ bool CTxMemPool::addUnchecked(const uint256& hash, CTransaction &tx)
 }
 
 
-bool CTxMemPool::remove(CTransaction &tx)
+bool CTxMemPool::remove(CTransaction &tx, const uint256 *phash)
 {
     // Remove transaction from memory pool
     {
         LOCK(cs);
-        uint256 hash = tx.GetHash();
+        uint256 hash = phash ? *phash : tx.GetHash();
         if (mapTx.count(hash))
         {
             BOOST_FOREACH(const CTxIn& txin, tx.vin)
@@ -745,7 +772,7 @@ int CMerkleTx::GetDepthInMainChain(CBlockIndex* &pindexRet) const
         return 0;
 
     // Find the block it claims to be in
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -828,7 +855,7 @@ int CTxIndex::GetDepthInMainChain() const
     if (!block.ReadFromDisk(pos.nFile, pos.nBlockPos, false))
         return 0;
     // Find the block in the index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(block.GetHash());
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(block.GetHash());
     if (mi == mapBlockIndex.end())
         return 0;
     CBlockIndex* pindex = (*mi).second;
@@ -875,22 +902,90 @@ bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock)
 // CBlock and CBlockIndex
 //
 
-static CBlockIndex* pblockindexFBBHLast;
 CBlockIndex* FindBlockByHeight(int nHeight)
 {
-    CBlockIndex *pblockindex;
-    if (nHeight < nBestHeight / 2)
-        pblockindex = pindexGenesisBlock;
-    else
-        pblockindex = pindexBest;
-    if (pblockindexFBBHLast && abs(nHeight - pblockindex->nHeight) > abs(nHeight - pblockindexFBBHLast->nHeight))
-        pblockindex = pblockindexFBBHLast;
-    while (pblockindex->nHeight > nHeight)
-        pblockindex = pblockindex->pprev;
-    while (pblockindex->nHeight < nHeight)
-        pblockindex = pblockindex->pnext;
-    pblockindexFBBHLast = pblockindex;
-    return pblockindex;
+    return chainActive[nHeight];
+}
+
+void CChain::SetTip(CBlockIndex *pindex) {
+
+    if(!pindex) {
+        vChain.clear();
+        return;
+    }
+
+    vChain.resize(pindex->nHeight + 1);
+    while(pindex && (vChain[pindex->nHeight] != pindex)) {
+        vChain[pindex->nHeight] = pindex;
+        pindex = pindex->pprev;
+    }
+}
+
+/* Turns the lowest bit set off */
+static inline int InvertLowestOne(int n) {
+    return(n & (n - 1));
+}
+
+/* The height to point the skip pointer of a block at this height to;
+ * any number below the height works, but this choice makes the distance
+ * covered grow exponentially with the number of skips */
+static inline int GetSkipHeight(int nHeight) {
+
+    if(nHeight < 2)
+      return(0);
+
+    /* Odd heights jump a little bit less far back to give the even
+     * heights below them a chance to jump further */
+    return((nHeight & 1) ? InvertLowestOne(InvertLowestOne(nHeight - 1)) + 1 : InvertLowestOne(nHeight));
+}
+
+void CBlockIndex::BuildSkip() {
+    if(pprev)
+      pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
+}
+
+CBlockIndex *CBlockIndex::GetAncestor(int nHeightAncestor) {
+
+    if((nHeightAncestor > nHeight) || (nHeightAncestor < 0))
+      return(NULL);
+
+    CBlockIndex *pindexWalk = this;
+    while(pindexWalk->nHeight > nHeightAncestor) {
+        int nHeightSkip = GetSkipHeight(pindexWalk->nHeight);
+        int nHeightSkipPrev = GetSkipHeight(pindexWalk->nHeight - 1);
+        /* Take the skip unless it overshoots or the previous block
+         * offers a better one */
+        if(pindexWalk->pskip && ((nHeightSkip == nHeightAncestor) ||
+          ((nHeightSkip > nHeightAncestor) &&
+          !((nHeightSkipPrev < nHeightSkip - 2) && (nHeightSkipPrev >= nHeightAncestor))))) {
+            pindexWalk = pindexWalk->pskip;
+        } else {
+            assert(pindexWalk->pprev);
+            pindexWalk = pindexWalk->pprev;
+        }
+    }
+
+    return(pindexWalk);
+}
+
+const CBlockIndex *CBlockIndex::GetAncestor(int nHeightAncestor) const {
+    return(const_cast<CBlockIndex *>(this)->GetAncestor(nHeightAncestor));
+}
+
+/* Returns the last block both chains have in common */
+static CBlockIndex *LastCommonAncestor(CBlockIndex *pa, CBlockIndex *pb) {
+
+    if(pa->nHeight > pb->nHeight)
+      pa = pa->GetAncestor(pb->nHeight);
+    else if(pb->nHeight > pa->nHeight)
+      pb = pb->GetAncestor(pa->nHeight);
+
+    while(pa && pb && (pa != pb)) {
+        pa = pa->pprev;
+        pb = pb->pprev;
+    }
+
+    return(pa);
 }
 
 bool CBlock::ReadFromDisk(const CBlockIndex* pindex, bool fReadTransactions)
@@ -1003,11 +1098,11 @@ int64 GetMoneySupply(int nHeight) {
 }
 
 uint static GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlock *pblock) {
-    uint nProofOfWorkLimit = bnProofOfWorkLimit.GetCompact();
+    uint nBitsLimit = nProofOfWorkLimit.GetCompact();
     int i;
 
     /* The genesis block */
-    if(!pindexLast) return(nProofOfWorkLimit);
+    if(!pindexLast) return(nBitsLimit);
 
     /* The next block */
     int nHeight = pindexLast->nHeight + 1;
@@ -1045,7 +1140,7 @@ uint static GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlock *pbl
         if(!fNeoScrypt) fNeoScrypt = true;
         /* Difficulty reset after the switch */
         if(nHeight == nForkFive)
-          return(bnNeoScryptSwitch.GetCompact());
+          return(nNeoScryptSwitch.GetCompact());
     }
 
     /* 2400, 600, 108, 126 and 20 blocks respectively */
@@ -1068,12 +1163,12 @@ uint static GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlock *pbl
             // Reset the difficulty if the difference in time stamps between
             // this and the previous block is over 2x of nTargetSpacing
             if(pblock->nTime > pindexLast->nTime + nTargetSpacing*2)
-              return nProofOfWorkLimit;
+              return nBitsLimit;
             else {
                 // Return the difficulty of the last regular block
                 // with no minimal difficulty set as above
                 const CBlockIndex* pindex = pindexLast;
-                while(pindex->pprev && (pindex->nHeight % nInterval != 0) && (pindex->nBits == nProofOfWorkLimit))
+                while(pindex->pprev && (pindex->nHeight % nInterval != 0) && (pindex->nBits == nBitsLimit))
                   pindex = pindex->pprev;
                 return pindex->nBits;
             }
@@ -1155,36 +1250,234 @@ uint static GetNextWorkRequired(const CBlockIndex *pindexLast, const CBlock *pbl
     printf("RETARGET: nTargetTimespan = %d, nTargetTimespan/nActualTimespan = %.4f\n",
       nTargetTimespan, (float) nTargetTimespan/nActualTimespan);
 
-    CBigNum bnNew;
-    bnNew.SetCompact(pindexLast->nBits);
-    bnNew *= nActualTimespan;
-    bnNew /= nTargetTimespan;
+    /* The limit times the maximal time span stays below 2^256 */
+    arith_uint256 nNew, nOld;
+    nOld.SetCompact(pindexLast->nBits);
+    nNew = nOld * (uint)nActualTimespan;
+    nNew /= arith_uint256((uint64)nTargetTimespan);
 
-    if(bnNew > bnProofOfWorkLimit) bnNew = bnProofOfWorkLimit;
+    if(nNew > nProofOfWorkLimit) nNew = nProofOfWorkLimit;
 
     printf("GetNextWorkRequired RETARGET\n");
-    printf("Before: %08x  %s\n", pindexLast->nBits, CBigNum().SetCompact(pindexLast->nBits).getuint256().ToString().c_str());
-    printf("After:  %08x  %s\n", bnNew.GetCompact(), bnNew.getuint256().ToString().c_str());
+    printf("Before: %08x  %s\n", pindexLast->nBits, nOld.ToString().c_str());
+    printf("After:  %08x  %s\n", nNew.GetCompact(), nNew.ToString().c_str());
 
-    return(bnNew.GetCompact());
+    return(nNew.GetCompact());
 }
 
 bool CheckProofOfWork(uint256 hash, unsigned int nBits)
 {
-    CBigNum bnTarget;
-    bnTarget.SetCompact(nBits);
+    bool fNegative, fOverflow;
+    arith_uint256 nTarget;
+    nTarget.SetCompact(nBits, &fNegative, &fOverflow);
 
     // Check range
-    if (bnTarget <= 0 || bnTarget > bnProofOfWorkLimit)
+    if (fNegative || fOverflow || nTarget == 0 || nTarget > nProofOfWorkLimit)
         return error("CheckProofOfWork() : nBits below minimum work");
 
     // Check proof of work matches claimed amount
-    if (hash > bnTarget.getuint256())
+    if (UintToArith256(hash) > nTarget)
         return error("CheckProofOfWork() : hash doesn't match nBits");
 
     return true;
 }
 
+/* Proof-of-work hashes by block hash with the hash function profile used */
+static map<uint256, pair<uint, uint256> > mapPoWCache;
+static CCriticalSection cs_PoWCache;
+
+static bool PoWCacheLookup(const uint256 &hash, uint profile, uint256 &hashPoW) {
+    LOCK(cs_PoWCache);
+
+    map<uint256, pair<uint, uint256> >::const_iterator mi = mapPoWCache.find(hash);
+    if((mi == mapPoWCache.end()) || (mi->second.first != profile))
+      return(false);
+
+    hashPoW = mi->second.second;
+
+    return(true);
+}
+
+static void PoWCacheInsert(const uint256 &hash, uint profile, const uint256 &hashPoW) {
+    LOCK(cs_PoWCache);
+
+    while(mapPoWCache.size() >= MAX_POW_CACHE_SIZE) {
+        /* Evict a random entry */
+        map<uint256, pair<uint, uint256> >::iterator mi = mapPoWCache.lower_bound(GetRandHash());
+        if(mi == mapPoWCache.end())
+          mi = mapPoWCache.begin();
+        mapPoWCache.erase(mi);
+    }
+
+    mapPoWCache[hash] = make_pair(profile, hashPoW);
+}
+
+uint256 CBlock::GetHashPoW(int nHeight) const {
+    uint profile = GetPoWProfile(nHeight);
+    uint256 hash = GetHash(), hashPoW;
+
+    if(PoWCacheLookup(hash, profile, hashPoW))
+      return(hashPoW);
+
+    neoscrypt((uchar *) &nVersion, (uchar *) &hashPoW, profile);
+    PoWCacheInsert(hash, profile, hashPoW);
+
+    return(hashPoW);
+}
+
+uint256 CBlockIndex::GetHashPoW(CTxDB &txdb) {
+
+    if(hashPoW == 0) {
+        hashPoW = GetBlockHeader().GetHashPoW(nHeight);
+        if(!txdb.WriteBlockIndex(CDiskBlockIndex(this)))
+          printf("CBlockIndex::GetHashPoW() : failed to update the index of block %s\n",
+            GetBlockHash().ToString().substr(0,20).c_str());
+    }
+
+    return(hashPoW);
+}
+
+/* Proof-of-work verification of up to neoscrypt_batch_lanes() block headers
+ * with the same hash function profile; the hashes are cached */
+class CPoWCheck {
+private:
+    uint profile;
+    std::vector<uint256> vHash;
+    std::vector<uint> vBits;
+    std::vector<uchar> vData;
+
+public:
+    CPoWCheck() : profile(0) {}
+    CPoWCheck(uint profileIn) : profile(profileIn) {}
+
+    uint GetProfile() const {
+        return(profile);
+    }
+
+    uint size() const {
+        return(vHash.size());
+    }
+
+    void Add(const uint256 &hash, const CBlock &header) {
+        vHash.push_back(hash);
+        vBits.push_back(header.nBits);
+        vData.insert(vData.end(), (const uchar *) &header.nVersion,
+          (const uchar *) &header.nVersion + 80);
+    }
+
+    bool operator()() const {
+        std::vector<uint256> vHashPoW(vHash.size());
+        bool fOk = true;
+        uint i;
+
+        if(vHash.empty())
+          return(true);
+
+        neoscrypt_batch(&vData[0], (uchar *) &vHashPoW[0], profile, vHash.size());
+
+        for(i = 0; i < vHash.size(); i++) {
+            PoWCacheInsert(vHash[i], profile, vHashPoW[i]);
+            if(UintToArith256(vHashPoW[i]) > arith_uint256().SetCompact(vBits[i]))
+              fOk = false;
+        }
+
+        return(fOk);
+    }
+
+    void swap(CPoWCheck &check) {
+        std::swap(profile, check.profile);
+        vHash.swap(check.vHash);
+        vBits.swap(check.vBits);
+        vData.swap(check.vData);
+    }
+};
+
+static CCheckQueue<CPoWCheck> powcheckqueue(4);
+/* Serialises the users of the queue */
+static CCriticalSection cs_powcheck;
+/* The workers update their thread count concurrently */
+static CCriticalSection cs_THREAD_POWCHECK;
+
+void ThreadPoWCheck(void *parg) {
+
+    RenameThread("pxc-powcheck");
+
+    {
+        LOCK(cs_THREAD_POWCHECK);
+        vnThreadsRunning[THREAD_POWCHECK]++;
+    }
+    powcheckqueue.Thread();
+    {
+        LOCK(cs_THREAD_POWCHECK);
+        vnThreadsRunning[THREAD_POWCHECK]--;
+    }
+}
+
+void ThreadPoWCheckQuit() {
+    powcheckqueue.Quit();
+}
+
+/* Runs the checks on the workers if available, one by one otherwise;
+ * returns false if any proof-of-work doesn't match the target */
+static bool PoWCheckRun(vector<CPoWCheck> &vChecks) {
+    TRY_LOCK(cs_powcheck, lockCheck);
+
+    if(lockCheck && nScriptCheckThreads) {
+        CCheckQueueControl<CPoWCheck> control(&powcheckqueue);
+        control.Add(vChecks);
+        return(control.Wait());
+    }
+
+    BOOST_FOREACH(const CPoWCheck &check, vChecks) {
+        if(!check())
+          return(false);
+    }
+
+    return(true);
+}
+
+/* Verifies the proof-of-work of a series of linked block headers starting
+ * at the height given in chunks of POW_CHECK_CHUNK; stops at the first
+ * failure, discontinuity or time stamp before the last checkpoint
+ * as CheckBlockHeader() would do */
+static void PoWCheckHeaders(const vector<CBlock> &vHeaders, int nHeight,
+  int64 nCheckpointTime, const uint256 &hashBest) {
+    const uint nLanes = neoscrypt_batch_lanes();
+    vector<CPoWCheck> vChecks;
+    uint256 hashPrev = vHeaders.empty() ? 0 : vHeaders[0].hashPrevBlock;
+    uint nQueued = 0;
+
+    BOOST_FOREACH(const CBlock &header, vHeaders) {
+        uint256 hash = header.GetHash(), hashPoW;
+        uint profile = header.GetPoWProfile(nHeight);
+
+        if(header.hashPrevBlock != hashPrev)
+          break;
+        if((header.hashPrevBlock != hashBest) && ((int64)header.nTime < nCheckpointTime))
+          break;
+        hashPrev = hash;
+        nHeight++;
+
+        if(PoWCacheLookup(hash, profile, hashPoW))
+          continue;
+
+        if(vChecks.empty() || (vChecks.back().GetProfile() != profile) ||
+          (vChecks.back().size() >= nLanes))
+          vChecks.push_back(CPoWCheck(profile));
+        vChecks.back().Add(hash, header);
+
+        if(++nQueued >= POW_CHECK_CHUNK) {
+            if(!PoWCheckRun(vChecks))
+              return;
+            vChecks.clear();
+            nQueued = 0;
+        }
+    }
+
+    if(!vChecks.empty())
+      PoWCheckRun(vChecks);
+}
+
 // Return maximum amount of blocks that other nodes claim to have
 int GetNumBlocksOfPeers()
 {
@@ -1208,20 +1501,20 @@ bool IsInitialBlockDownload()
 
 static void InvalidChainFound(CBlockIndex* pindexNew)
 {
-    if (pindexNew->bnChainWork > bnBestInvalidWork)
+    if (pindexNew->nChainWork > nBestInvalidWork)
     {
-        bnBestInvalidWork = pindexNew->bnChainWork;
-        CTxDB().WriteBestInvalidWork(bnBestInvalidWork);
+        nBestInvalidWork = pindexNew->nChainWork;
+        CTxDB().WriteBestInvalidWork(nBestInvalidWork);
         uiInterface.NotifyBlocksChanged();
     }
-    printf("InvalidChainFound: invalid block=%s  height=%d  work=%s  date=%s\n",
+    printf("InvalidChainFound: invalid block=%s  height=%d  log2_work=%.8g  date=%s\n",
       pindexNew->GetBlockHash().ToString().substr(0,20).c_str(), pindexNew->nHeight,
-      pindexNew->bnChainWork.ToString().c_str(),
+      log(pindexNew->nChainWork.getdouble()) / log(2.0),
       DateTimeStrFormat(pindexNew->GetBlockTime()).c_str());
-    printf("InvalidChainFound:  current best=%s  height=%d  work=%s  date=%s\n",
-      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, bnBestChainWork.ToString().c_str(),
+    printf("InvalidChainFound:  current best=%s  height=%d  log2_work=%.8g  date=%s\n",
+      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight, log(nBestChainWork.getdouble()) / log(2.0),
       DateTimeStrFormat(pindexBest->GetBlockTime()).c_str());
-    if (pindexBest && bnBestInvalidWork > bnBestChainWork + pindexBest->GetBlockWork() * 6)
+    if (pindexBest && nBestInvalidWork > nBestChainWork + pindexBest->GetBlockWork() * 6U)
         printf("InvalidChainFound: Warning: Displayed transactions may not be correct! You may need to upgrade, or other nodes may need to upgrade.\n");
 }
 
@@ -1274,7 +1567,16 @@ bool CTransaction::DisconnectInputs(CTxDB& txdb)
     // This can fail if a duplicate of this transaction was in a chain that got
     // reorganized away. This is only possible if this transaction was completely
     // spent, so erasing it would be a no-op anyway.
-    txdb.EraseTxIndex(*this);
+    uint256 hash = GetHash();
+    txdb.EraseTxIndex(hash);
+    txdb.EraseCoins(hash);
+
+    /* The output records of the transactions spent from have been pruned;
+     * erase them to be rebuilt from the index entries restored above */
+    if(!IsCoinBase()) {
+        BOOST_FOREACH(const CTxIn &txin, vin)
+          txdb.EraseCoins(txin.prevout.hash);
+    }
 
     return true;
 }
@@ -1314,8 +1616,8 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         if (!fFound && (fBlock || fMiner))
             return fMiner ? false : error("FetchInputs() : %s prev tx %s index entry not found", GetHash().ToString().substr(0,10).c_str(),  prevout.hash.ToString().substr(0,10).c_str());
 
-        // Read txPrev
-        CTransaction& txPrev = inputsRet[prevout.hash].second;
+        // Read the outputs of txPrev
+        CCoins& coinsPrev = inputsRet[prevout.hash].second;
         if (!fFound || txindex.pos == CDiskTxPos(1,1,1))
         {
             // Get prev tx from single transactions in memory
@@ -1323,16 +1625,35 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
                 LOCK(mempool.cs);
                 if (!mempool.exists(prevout.hash))
                     return error("FetchInputs() : %s mempool Tx prev not found %s", GetHash().ToString().substr(0,10).c_str(),  prevout.hash.ToString().substr(0,10).c_str());
-                txPrev = mempool.lookup(prevout.hash);
+                CCoins(mempool.lookup(prevout.hash)).swap(coinsPrev);
             }
             if (!fFound)
-                txindex.vSpent.resize(txPrev.vout.size());
+                txindex.vSpent.resize(coinsPrev.vout.size());
         }
-        else
+        else if(!txdb.ReadCoins(prevout.hash, coinsPrev))
         {
-            // Get prev tx from disk
+            if(txindex.IsFullySpent()) {
+                /* No record as nothing is left to spend */
+                coinsPrev.vout.resize(txindex.vSpent.size());
+                for(uint j = 0; j < coinsPrev.vout.size(); j++)
+                  coinsPrev.Spend(j);
+                continue;
+            }
+            /* No record yet; get prev tx from disk once and keep its unspent outputs */
+            CTransaction txPrev;
             if (!txPrev.ReadFromDisk(txindex.pos))
                 return error("FetchInputs() : %s ReadFromDisk prev tx %s failed", GetHash().ToString().substr(0,10).c_str(),  prevout.hash.ToString().substr(0,10).c_str());
+            CCoins(txPrev).swap(coinsPrev);
+            for(uint j = 0; j < txindex.vSpent.size(); j++) {
+                if(!txindex.vSpent[j].IsNull())
+                  coinsPrev.Spend(j);
+            }
+            /* Stored only while connecting a block for real;
+             * the miner and the other checks may not write at all */
+            if(fBlock && txdb.IsTxnActive())
+              txdb.WriteCoins(prevout.hash, coinsPrev);
+            else
+              txdb.CacheCoins(prevout.hash, coinsPrev);
         }
     }
 
@@ -1342,17 +1663,23 @@ bool CTransaction::FetchInputs(CTxDB& txdb, const map<uint256, CTxIndex>& mapTes
         const COutPoint prevout = vin[i].prevout;
         assert(inputsRet.count(prevout.hash) != 0);
         const CTxIndex& txindex = inputsRet[prevout.hash].first;
-        const CTransaction& txPrev = inputsRet[prevout.hash].second;
-        if (prevout.n >= txPrev.vout.size() || prevout.n >= txindex.vSpent.size())
+        const CCoins& coinsPrev = inputsRet[prevout.hash].second;
+        if (prevout.n >= coinsPrev.vout.size() || prevout.n >= txindex.vSpent.size())
         {
             // Revisit this if/when transaction replacement is implemented and allows
             // adding inputs:
             fInvalid = true;
             return(DoS(100, error("FetchInputs() : %s prevout.n out of range %d " \
-              "%" PRIszu " %" PRIszu " prev tx %s\n%s",
-              GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(),
-              txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(),
-              txPrev.ToString().c_str())));
+              "%" PRIszu " %" PRIszu " prev tx %s",
+              GetHash().ToString().substr(0,10).c_str(), prevout.n, coinsPrev.vout.size(),
+              txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str())));
+        }
+        /* Not punished on purpose like the double spends in ConnectInputs() */
+        if(!coinsPrev.IsAvailable(prevout.n)) {
+            fInvalid = true;
+            return(fMiner ? false : error("FetchInputs() : %s prev tx %s output %d spent already",
+              GetHash().ToString().substr(0,10).c_str(),
+              prevout.hash.ToString().substr(0,10).c_str(), prevout.n));
         }
     }
 
@@ -1365,11 +1692,11 @@ const CTxOut& CTransaction::GetOutputFor(const CTxIn& input, const MapPrevTx& in
     if (mi == inputs.end())
         throw std::runtime_error("CTransaction::GetOutputFor() : prevout.hash not found");
 
-    const CTransaction& txPrev = (mi->second).second;
-    if (input.prevout.n >= txPrev.vout.size())
+    const CCoins& coinsPrev = (mi->second).second;
+    if (input.prevout.n >= coinsPrev.vout.size())
         throw std::runtime_error("CTransaction::GetOutputFor() : prevout.n out of range");
 
-    return txPrev.vout[input.prevout.n];
+    return coinsPrev.vout[input.prevout.n];
 }
 
 int64 CTransaction::GetValueIn(const MapPrevTx& inputs) const
@@ -1401,9 +1728,26 @@ unsigned int CTransaction::GetP2SHSigOpCount(const MapPrevTx& inputs) const
     return nSigOps;
 }
 
+bool CScriptCheck::operator()() {
+    const CScript &scriptSig = ptxTo->vin[nIn].scriptSig;
+    if(!VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, fStrictPayToScriptHash, nHashType,
+      psighash.get())) {
+        /* Same as in ConnectInputs(): P2SH transition failures are not punished */
+        fP2SHFailure = fStrictPayToScriptHash &&
+          VerifyScript(scriptSig, scriptPubKey, *ptxTo, nIn, false, nHashType, psighash.get());
+        if(fP2SHFailure)
+          return(error("CScriptCheck() : %s P2SH VerifySignature failed",
+            ptxTo->GetHash().ToString().substr(0,10).c_str()));
+        return(error("CScriptCheck() : %s VerifySignature failed",
+          ptxTo->GetHash().ToString().substr(0,10).c_str()));
+    }
+    return(true);
+}
+
 bool CTransaction::ConnectInputs(MapPrevTx inputs,
                                  map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash)
+                                 const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash,
+                                 std::vector<CScriptCheck> *pvChecks)
 {
     // Take over previous transactions' spent pointers
     // fBlock is true when this is called from AcceptBlock when a new best-block is added to the blockchain
@@ -1418,39 +1762,40 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
             COutPoint prevout = vin[i].prevout;
             assert(inputs.count(prevout.hash) > 0);
             CTxIndex& txindex = inputs[prevout.hash].first;
-            CTransaction& txPrev = inputs[prevout.hash].second;
+            CCoins& coinsPrev = inputs[prevout.hash].second;
 
-            if((prevout.n >= txPrev.vout.size()) || (prevout.n >= txindex.vSpent.size())) {
+            if((prevout.n >= coinsPrev.vout.size()) || (prevout.n >= txindex.vSpent.size())) {
                 return(DoS(100,
                   error("ConnectInputs() : %s prevout.n out of range %d " \
-                  "%" PRIszu " %" PRIszu " prev tx %s\n%s",
-                  GetHash().ToString().substr(0,10).c_str(), prevout.n, txPrev.vout.size(),
-                  txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str(),
-                  txPrev.ToString().c_str())));
+                  "%" PRIszu " %" PRIszu " prev tx %s",
+                  GetHash().ToString().substr(0,10).c_str(), prevout.n, coinsPrev.vout.size(),
+                  txindex.vSpent.size(), prevout.hash.ToString().substr(0,10).c_str())));
             }
 
             // If prev is coinbase, check that it's matured
-            if (txPrev.IsCoinBase())
+            if (coinsPrev.IsCoinBase())
                 for(const CBlockIndex *pindex = pindexBlock;
                   pindex && (pindexBlock->nHeight - pindex->nHeight < nBaseMaturity); pindex = pindex->pprev)
                     if (pindex->nBlockPos == txindex.pos.nBlockPos && pindex->nFile == txindex.pos.nFile)
                         return error("ConnectInputs() : tried to spend coinbase at depth %d", pindexBlock->nHeight - pindex->nHeight);
 
             // Check for negative or overflow input values
-            nValueIn += txPrev.vout[prevout.n].nValue;
-            if (!MoneyRange(txPrev.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
+            nValueIn += coinsPrev.vout[prevout.n].nValue;
+            if (!MoneyRange(coinsPrev.vout[prevout.n].nValue) || !MoneyRange(nValueIn))
                 return DoS(100, error("ConnectInputs() : txin values out of range"));
 
         }
         // The first loop above does all the inexpensive checks.
         // Only if ALL inputs pass do we perform expensive ECDSA signature checks.
         // Helps prevent CPU exhaustion attacks.
+        CSigHashContextRef psighash;
         for (unsigned int i = 0; i < vin.size(); i++)
         {
             COutPoint prevout = vin[i].prevout;
             assert(inputs.count(prevout.hash) > 0);
             CTxIndex& txindex = inputs[prevout.hash].first;
-            CTransaction& txPrev = inputs[prevout.hash].second;
+            CCoins& coinsPrev = inputs[prevout.hash].second;
+            const CScript& scriptPubKey = coinsPrev.vout[prevout.n].scriptPubKey;
 
             // Check for conflicts (double-spend)
             // This doesn't trigger the DoS code on purpose; if it did, it would make it easier
@@ -1463,12 +1808,23 @@ bool CTransaction::ConnectInputs(MapPrevTx inputs,
             // still computed and checked, and any change will be caught at the next checkpoint.
             if (!(fBlock && (nBestHeight < Checkpoints::GetTotalBlocksEstimate())))
             {
+                /* Serialised once for the signatures of all inputs */
+                if(!psighash)
+                  psighash.reset(new CSigHashContext(*this));
+                if(pvChecks) {
+                    /* Defer to the script check queue */
+                    pvChecks->push_back(CScriptCheck());
+                    CScriptCheck(coinsPrev, *this, i, fStrictPayToScriptHash, 0,
+                      psighash).swap(pvChecks->back());
+                }
                 // Verify signature
-                if (!VerifySignature(txPrev, *this, i, fStrictPayToScriptHash, 0))
+                else if (!VerifyScript(vin[i].scriptSig, scriptPubKey, *this, i, fStrictPayToScriptHash, 0,
+                  psighash.get()))
                 {
                     // only during transition phase for P2SH: do not invoke anti-DoS code for
                     // potentially old clients relaying bad P2SH transactions
-                    if (fStrictPayToScriptHash && VerifySignature(txPrev, *this, i, false, 0))
+                    if (fStrictPayToScriptHash && VerifyScript(vin[i].scriptSig, scriptPubKey, *this, i, false, 0,
+                      psighash.get()))
                         return error("ConnectInputs() : %s P2SH VerifySignature failed", GetHash().ToString().substr(0,10).c_str());
 
                     return DoS(100,error("ConnectInputs() : %s VerifySignature failed", GetHash().ToString().substr(0,10).c_str()));
@@ -1550,12 +1906,129 @@ bool CTransaction::ClientConnectInputs()
 
 
 
+/* P2SH transition failures don't decide the punishment of the block alone */
+template<> inline bool IsSoftCheckFailure<CScriptCheck>(const CScriptCheck &check) {
+    return(check.IsP2SHFailure());
+}
+
+static CCheckQueue<CScriptCheck> scriptcheckqueue(128);
+/* The workers update their thread count concurrently */
+static CCriticalSection cs_THREAD_SCRIPTCHECK;
+
+void ThreadScriptCheck(void *parg) {
+
+    RenameThread("pxc-scriptch");
+
+    {
+        LOCK(cs_THREAD_SCRIPTCHECK);
+        vnThreadsRunning[THREAD_SCRIPTCHECK]++;
+    }
+    scriptcheckqueue.Thread();
+    {
+        LOCK(cs_THREAD_SCRIPTCHECK);
+        vnThreadsRunning[THREAD_SCRIPTCHECK]--;
+    }
+}
+
+void ThreadScriptCheckQuit() {
+    scriptcheckqueue.Quit();
+}
+
+bool UpdateAddrIndex(CTxDB &txdb, const uint256 &hashTx, const CTransaction &tx,
+  const MapPrevTx &inputs, int nHeight, bool fErase) {
+    uint i;
+
+    for(i = 0; i < tx.vout.size(); i++) {
+        CAddrIndexKey key(Hash160(tx.vout[i].scriptPubKey), nHeight, hashTx, i, false);
+        if(fErase ? !txdb.EraseAddrIndex(key) :
+          !txdb.WriteAddrIndex(key, CAddrIndexValue(tx.vout[i].nValue, 0, 0)))
+          return(false);
+    }
+
+    if(tx.IsCoinBase())
+      return(true);
+
+    for(i = 0; i < tx.vin.size(); i++) {
+        const COutPoint &prevout = tx.vin[i].prevout;
+        MapPrevTx::const_iterator mi = inputs.find(prevout.hash);
+        if((mi == inputs.end()) || (prevout.n >= mi->second.second.vout.size()))
+          return(error("UpdateAddrIndex() : prev output of %s not found",
+            hashTx.ToString().substr(0,10).c_str()));
+        const CTxOut &txout = mi->second.second.vout[prevout.n];
+        CAddrIndexKey key(Hash160(txout.scriptPubKey), nHeight, hashTx, i, true);
+        if(fErase ? !txdb.EraseAddrIndex(key) :
+          !txdb.WriteAddrIndex(key, CAddrIndexValue(txout.nValue, prevout.hash, prevout.n)))
+          return(false);
+    }
+
+    return(true);
+}
+
+bool EraseAddrIndex(CTxDB &txdb, const CBlock &block, int nHeight) {
+
+    for(uint nTx = 0; nTx < block.vtx.size(); nTx++) {
+        const CTransaction &tx = block.vtx[nTx];
+        MapPrevTx inputs;
+        if(!tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn &txin, tx.vin) {
+                CCoins &coins = inputs[txin.prevout.hash].second;
+                if(coins.IsAvailable(txin.prevout.n))
+                  continue;
+                /* The outputs spent within the block are pruned already */
+                if(!txdb.ReadCoins(txin.prevout.hash, coins) ||
+                  !coins.IsAvailable(txin.prevout.n)) {
+                    CTransaction txPrev;
+                    if(!txdb.ReadDiskTx(txin.prevout.hash, txPrev))
+                      return(error("EraseAddrIndex() : prev tx %s not found",
+                        txin.prevout.hash.ToString().substr(0,10).c_str()));
+                    CCoins(txPrev).swap(coins);
+                }
+            }
+        }
+        if(!UpdateAddrIndex(txdb, block.GetTxHash(nTx), tx, inputs, nHeight, true))
+          return(false);
+    }
+
+    return(true);
+}
+
 bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 {
-    // Disconnect in reverse order
-    for (int i = vtx.size()-1; i >= 0; i--)
-        if (!vtx[i].DisconnectInputs(txdb))
-            return false;
+    /* The transactions are hashed once, see GetTxHash() */
+    BuildMerkleTree();
+
+    CBlockUndo undo;
+    bool fUndo = undo.ReadFromDisk(txdb, pindex);
+    if(fUndo) {
+        /* Restore the transactions spent from as recorded */
+        for(uint i = 0; i < undo.vTxIndex.size(); i++) {
+            if(!txdb.UpdateTxIndex(undo.vTxIndex[i].first, undo.vTxIndex[i].second))
+              return(error("DisconnectBlock() : UpdateTxIndex failed"));
+        }
+        for(uint i = 0; i < undo.vCoins.size(); i++) {
+            if(!txdb.WriteCoins(undo.vCoins[i].first, undo.vCoins[i].second))
+              return(error("DisconnectBlock() : WriteCoins failed"));
+        }
+    }
+
+    /* The outputs spent by the block are available at this point */
+    if(fAddrIndex && !EraseAddrIndex(txdb, *this, pindex->nHeight))
+      return(error("DisconnectBlock() : EraseAddrIndex failed"));
+
+    if(fUndo) {
+        for(int i = vtx.size() - 1; i >= 0; i--) {
+            uint256 hashTx = GetTxHash(i);
+            txdb.EraseTxIndex(hashTx);
+            txdb.EraseCoins(hashTx);
+        }
+        txdb.EraseBlockUndoPos(pindex->GetBlockHash());
+    } else {
+        // Disconnect in reverse order; no undo record for the blocks
+        // connected by the older versions
+        for (int i = vtx.size()-1; i >= 0; i--)
+            if (!vtx[i].DisconnectInputs(txdb))
+                return false;
+    }
 
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
@@ -1572,9 +2045,12 @@ bool CBlock::DisconnectBlock(CTxDB& txdb, CBlockIndex* pindex)
 
 bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 {
-    // Check it again in case a previous version let a bad block in
-    if (!CheckBlock(!fJustCheck, !fJustCheck))
+    // Check it again in case a previous version let a bad block in;
+    // the proof-of-work hash is taken from the index if recorded there
+    if (!CheckBlock(false, !fJustCheck))
         return false;
+    if (!fJustCheck && !CheckProofOfWork(pindex->GetHashPoW(txdb), nBits))
+        return DoS(50, error("ConnectBlock() : proof-of-work verification failed"));
 
     // Do not allow blocks that contain transactions which 'overwrite' older transactions,
     // unless those are already completely spent.
@@ -1605,12 +2081,20 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     else
         nTxPos = pindex->nBlockPos + ::GetSerializeSize(CBlock(), SER_DISK, CLIENT_VERSION) - 1 + GetSizeOfCompactSize(vtx.size());
 
+    /* Script checks are handed over to the worker threads if any
+     * and the results are collected before anything is written */
+    CCheckQueueControl<CScriptCheck> control(nScriptCheckThreads ? &scriptcheckqueue : NULL);
+
     map<uint256, CTxIndex> mapQueuedChanges;
     int64 nFees = 0;
     unsigned int nSigOps = 0;
-    BOOST_FOREACH(CTransaction& tx, vtx)
+
+    CBlockUndo undo;
+
+    for (unsigned int nTx = 0; nTx < vtx.size(); nTx++)
     {
-        uint256 hashTx = tx.GetHash();
+        CTransaction& tx = vtx[nTx];
+        uint256 hashTx = GetTxHash(nTx);
 
         if (fEnforceBIP30) {
             CTxIndex txindexOld;
@@ -1636,6 +2120,17 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             if (!tx.FetchInputs(txdb, mapQueuedChanges, true, false, mapInputs, fInvalid))
                 return false;
 
+            /* Record the state before this block of the transactions
+             * not spent from by the previous transactions of the block */
+            if(!fJustCheck) {
+                for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi) {
+                    if(!mapQueuedChanges.count(mi->first)) {
+                        undo.vTxIndex.push_back(make_pair(mi->first, mi->second.first));
+                        undo.vCoins.push_back(make_pair(mi->first, mi->second.second));
+                    }
+                }
+            }
+
             if (fStrictPayToScriptHash)
             {
                 // Add in sigops done by pay-to-script-hash inputs;
@@ -1648,11 +2143,34 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
 
             nFees += tx.GetValueIn(mapInputs)-tx.GetValueOut();
 
-            if (!tx.ConnectInputs(mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fStrictPayToScriptHash))
+            std::vector<CScriptCheck> vChecks;
+            if (!tx.ConnectInputs(mapInputs, mapQueuedChanges, posThisTx, pindex, true, false, fStrictPayToScriptHash,
+              nScriptCheckThreads ? &vChecks : NULL))
                 return false;
+            control.Add(vChecks);
+        }
+
+        if(!fJustCheck && fAddrIndex && !UpdateAddrIndex(txdb, hashTx, tx, mapInputs, pindex->nHeight, false))
+          return(error("ConnectBlock() : UpdateAddrIndex failed"));
+
+        /* Prune the outputs spent; the following transactions
+         * of the block read the records updated */
+        if(!fJustCheck && !tx.IsCoinBase()) {
+            BOOST_FOREACH(const CTxIn &txin, tx.vin)
+              mapInputs[txin.prevout.hash].second.Spend(txin.prevout.n);
+            for(MapPrevTx::const_iterator mi = mapInputs.begin(); mi != mapInputs.end(); ++mi) {
+                if(mi->second.second.IsPruned() ? !txdb.EraseCoins(mi->first) :
+                  !txdb.WriteCoins(mi->first, mi->second.second))
+                  return(error("ConnectBlock() : failed to update the outputs of %s",
+                    mi->first.ToString().substr(0,10).c_str()));
+            }
         }
 
         mapQueuedChanges[hashTx] = CTxIndex(posThisTx, tx.vout.size());
+
+        /* Outputs of this transaction may be spent later in the same block */
+        if(!fJustCheck && !txdb.WriteCoins(hashTx, CCoins(tx)))
+          return(error("ConnectBlock() : WriteCoins failed"));
     }
 
     if(vtx[0].GetValueOut() > GetProofOfWorkReward(pindex->nHeight, nFees)) {
@@ -1660,6 +2178,14 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
           vtx[0].GetValueOut(), GetProofOfWorkReward(pindex->nHeight, nFees)));
     }
 
+    /* The failure returned is a P2SH one only if all of them are */
+    CScriptCheck checkFailed;
+    if(!control.Wait(&checkFailed)) {
+        if(checkFailed.IsP2SHFailure())
+          return(error("ConnectBlock() : P2SH script verification failed"));
+        return(DoS(100, error("ConnectBlock() : script verification failed")));
+    }
+
     if (fJustCheck)
         return true;
 
@@ -1670,6 +2196,9 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
             return error("ConnectBlock() : UpdateTxIndex failed");
     }
 
+    if(!undo.WriteToDisk(txdb, pindex))
+      return(error("ConnectBlock() : failed to write the undo record"));
+
     // Update block index on disk without changing it in memory.
     // The memory index structure will be changed after the db commits.
     if (pindex->pprev)
@@ -1681,8 +2210,8 @@ bool CBlock::ConnectBlock(CTxDB& txdb, CBlockIndex* pindex, bool fJustCheck)
     }
 
     // Watch for transactions paying to me
-    BOOST_FOREACH(CTransaction& tx, vtx)
-        SyncWithWallets(tx, this, true);
+    for (unsigned int i = 0; i < vtx.size(); i++)
+        SyncWithWallets(GetTxHash(i), vtx[i], this, true);
 
     return true;
 }
@@ -1692,18 +2221,9 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
     printf("REORGANIZE\n");
 
     // Find the fork
-    CBlockIndex* pfork = pindexBest;
-    CBlockIndex* plonger = pindexNew;
-    while (pfork != plonger)
-    {
-        while (plonger->nHeight > pfork->nHeight)
-            if (!(plonger = plonger->pprev))
-                return error("Reorganize() : plonger->pprev is null");
-        if (pfork == plonger)
-            break;
-        if (!(pfork = pfork->pprev))
-            return error("Reorganize() : pfork->pprev is null");
-    }
+    CBlockIndex* pfork = LastCommonAncestor(pindexBest, pindexNew);
+    if (!pfork)
+        return error("Reorganize() : no common ancestor found");
 
     // List of what to disconnect
     vector<CBlockIndex*> vDisconnect;
@@ -1723,8 +2243,9 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
       vConnect.size(), pfork->GetBlockHash().ToString().substr(0,20).c_str(),
       pindexNew->GetBlockHash().ToString().substr(0,20).c_str());
 
-    // Disconnect shorter branch
-    vector<CTransaction> vResurrect;
+    // Disconnect shorter branch;
+    // the transactions are queued with the hashes taken by the blocks
+    vector<pair<uint256, CTransaction> > vResurrect;
     BOOST_FOREACH(CBlockIndex* pindex, vDisconnect)
     {
         CBlock block;
@@ -1734,13 +2255,13 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
             return error("Reorganize() : DisconnectBlock %s failed", pindex->GetBlockHash().ToString().substr(0,20).c_str());
 
         // Queue memory transactions to resurrect
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
-            if (!tx.IsCoinBase())
-                vResurrect.push_back(tx);
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            if (!block.vtx[i].IsCoinBase())
+                vResurrect.push_back(make_pair(block.GetTxHash(i), block.vtx[i]));
     }
 
     // Connect longer branch
-    vector<CTransaction> vDelete;
+    vector<pair<uint256, CTransaction> > vDelete;
     for (unsigned int i = 0; i < vConnect.size(); i++)
     {
         CBlockIndex* pindex = vConnect[i];
@@ -1754,8 +2275,8 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
         }
 
         // Queue memory transactions to delete
-        BOOST_FOREACH(const CTransaction& tx, block.vtx)
-            vDelete.push_back(tx);
+        for (unsigned int i = 0; i < block.vtx.size(); i++)
+            vDelete.push_back(make_pair(block.GetTxHash(i), block.vtx[i]));
     }
     if (!txdb.WriteHashBestChain(pindexNew->GetBlockHash()))
         return error("Reorganize() : WriteHashBestChain failed");
@@ -1775,12 +2296,12 @@ bool static Reorganize(CTxDB& txdb, CBlockIndex* pindexNew)
             pindex->pprev->pnext = pindex;
 
     // Resurrect memory transactions that were in the disconnected branch
-    BOOST_FOREACH(CTransaction& tx, vResurrect)
-        tx.AcceptToMemoryPool(txdb, false);
+    for (unsigned int i = 0; i < vResurrect.size(); i++)
+        vResurrect[i].second.AcceptToMemoryPool(txdb, false, NULL, &vResurrect[i].first);
 
     // Delete redundant memory transactions that are in the connected branch
-    BOOST_FOREACH(CTransaction& tx, vDelete)
-        mempool.remove(tx);
+    for (unsigned int i = 0; i < vDelete.size(); i++)
+        mempool.remove(vDelete[i].second, &vDelete[i].first);
 
     printf("REORGANIZE: done\n");
 
@@ -1807,8 +2328,10 @@ bool CBlock::SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew)
     pindexNew->pprev->pnext = pindexNew;
 
     // Delete redundant memory transactions
-    BOOST_FOREACH(CTransaction& tx, vtx)
-        mempool.remove(tx);
+    for (unsigned int i = 0; i < vtx.size(); i++) {
+        uint256 hashTx = GetTxHash(i);
+        mempool.remove(vtx[i], &hashTx);
+    }
 
     return true;
 }
@@ -1842,7 +2365,7 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
 
         // Reorganize is costly in terms of db load, as it works in a single db transaction.
         // Try to limit how much needs to be done inside
-        while (pindexIntermediate->pprev && pindexIntermediate->pprev->bnChainWork > pindexBest->bnChainWork)
+        while (pindexIntermediate->pprev && pindexIntermediate->pprev->nChainWork > pindexBest->nChainWork)
         {
             vpindexSecondary.push_back(pindexIntermediate);
             pindexIntermediate = pindexIntermediate->pprev;
@@ -1889,14 +2412,14 @@ bool CBlock::SetBestChain(CTxDB& txdb, CBlockIndex* pindexNew)
     // New best block
     hashBestChain = hash;
     pindexBest = pindexNew;
-    pblockindexFBBHLast = NULL;
+    chainActive.SetTip(pindexBest);
     nBestHeight = pindexBest->nHeight;
-    bnBestChainWork = pindexNew->bnChainWork;
+    nBestChainWork = pindexNew->nChainWork;
     nTimeBestReceived = GetTime();
     nTransactionsUpdated++;
-    printf("SetBestChain: new best=%s  height=%d  work=%s  date=%s\n",
+    printf("SetBestChain: new best=%s  height=%d  log2_work=%.8g  date=%s\n",
       hashBestChain.ToString().substr(0,20).c_str(), nBestHeight,
-      bnBestChainWork.ToString().c_str(),
+      log(nBestChainWork.getdouble()) / log(2.0),
       DateTimeStrFormat(pindexBest->GetBlockTime()).c_str());
 
 #if (0)
@@ -1939,18 +2462,21 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return error("AddToBlockIndex() : %s already exists", hash.ToString().substr(0,20).c_str());
 
     // Construct new block index object
-    CBlockIndex* pindexNew = new CBlockIndex(nFile, nBlockPos, *this);
-    if (!pindexNew)
-        return error("AddToBlockIndex() : new CBlockIndex failed");
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.insert(make_pair(hash, pindexNew)).first;
+    CBlockIndexMap::iterator mi = mapBlockIndex.insert(hash).first;
+    CBlockIndex* pindexNew = (*mi).second;
+    *pindexNew = CBlockIndex(nFile, nBlockPos, *this);
     pindexNew->phashBlock = &((*mi).first);
-    map<uint256, CBlockIndex*>::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator miPrev = mapBlockIndex.find(hashPrevBlock);
     if (miPrev != mapBlockIndex.end())
     {
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
+        pindexNew->BuildSkip();
     }
-    pindexNew->bnChainWork = (pindexNew->pprev ? pindexNew->pprev->bnChainWork : 0) + pindexNew->GetBlockWork();
+    pindexNew->nChainWork = (pindexNew->pprev ? pindexNew->pprev->nChainWork : arith_uint256(0)) + pindexNew->GetBlockWork();
+
+    /* Verified and cached by CheckBlock() already */
+    pindexNew->hashPoW = GetHashPoW();
 
     CTxDB txdb;
     if (!txdb.TxnBegin())
@@ -1960,7 +2486,7 @@ bool CBlock::AddToBlockIndex(unsigned int nFile, unsigned int nBlockPos)
         return false;
 
     // New best
-    if (pindexNew->bnChainWork > bnBestChainWork)
+    if (pindexNew->nChainWork > nBestChainWork)
         if (!SetBestChain(txdb, pindexNew))
             return false;
 
@@ -2010,12 +2536,16 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot) const
         if (!tx.CheckTransaction())
             return DoS(tx.nDoS, error("CheckBlock() : CheckTransaction failed"));
 
+    /* Build the merkle tree from the transactions as they are; its leaves
+     * are the transaction hashes used later on */
+    uint256 hashMerkleRootBuilt = BuildMerkleTree();
+
     // Check for duplicate txids. This is caught by ConnectInputs(),
     // but catching it earlier avoids a potential DoS attack:
     set<uint256> uniqueTx;
-    BOOST_FOREACH(const CTransaction& tx, vtx)
+    for (unsigned int i = 0; i < vtx.size(); i++)
     {
-        uniqueTx.insert(tx.GetHash());
+        uniqueTx.insert(GetTxHash(i));
     }
     if (uniqueTx.size() != vtx.size())
         return DoS(100, error("CheckBlock() : duplicate transaction"));
@@ -2029,7 +2559,7 @@ bool CBlock::CheckBlock(bool fCheckPOW, bool fCheckMerkleRoot) const
         return DoS(100, error("CheckBlock() : out-of-bounds SigOpCount"));
 
     // Check merkle root
-    if (fCheckMerkleRoot && hashMerkleRoot != BuildMerkleTree())
+    if (fCheckMerkleRoot && hashMerkleRoot != hashMerkleRootBuilt)
         return DoS(100, error("CheckBlock() : hashMerkleRoot mismatch"));
 
     return true;
@@ -2043,7 +2573,7 @@ bool CBlock::AcceptBlock()
         return error("AcceptBlock() : block already in mapBlockIndex");
 
     // Get prev block index
-    map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashPrevBlock);
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hashPrevBlock);
     if (mi == mapBlockIndex.end())
         return DoS(10, error("AcceptBlock() : prev block not found"));
     CBlockIndex* pindexPrev = (*mi).second;
@@ -2242,10 +2772,13 @@ bool ProcessBlock(CNode *pfrom, CBlock *pblock) {
             mapOrphanBlocks.insert(make_pair(hash, pblock2));
             mapOrphanBlocksByPrev.insert(make_pair(pblock2->hashPrevBlock, pblock2));
 
-            pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(pblock2));
-            /* Ask directly just in case */
-            if(!IsInitialBlockDownload())
-              pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
+            /* Parents of the blocks with headers known are being downloaded already */
+            if(!mapHeaderIndex.count(hash)) {
+                pfrom->PushGetBlocks(pindexBest, GetOrphanRoot(pblock2));
+                /* Ask directly just in case */
+                if(!IsInitialBlockDownload())
+                  pfrom->AskFor(CInv(MSG_BLOCK, WantedByOrphan(pblock2)));
+            }
 
         }
 
@@ -2286,110 +2819,828 @@ bool ProcessBlock(CNode *pfrom, CBlock *pblock) {
 }
 
 
+//////////////////////////////////////////////////////////////////////////////
+//
+// Headers-first synchronisation
+//
 
+/* Looks up a block index entry either stored or known by its header only */
+static CBlockIndex *LookupBlockHeader(const uint256 &hash) {
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+    if(mi != mapBlockIndex.end()) return(mi->second);
+    map<uint256, CBlockIndex *>::iterator mih = mapHeaderIndex.find(hash);
+    if(mih != mapHeaderIndex.end()) return(mih->second);
+    return(NULL);
+}
 
+/* Sorts the headers by height, the parents first */
+static bool HeaderHeightLess(const pair<CBlockIndex *, int64> &a, const pair<CBlockIndex *, int64> &b) {
+    return(a.first->nHeight < b.first->nHeight);
+}
 
+/* Deletes the headers off the best header chain expired or the oldest of them
+ * in excess of the limit, together with the headers built on them */
+static void HeadersSidePrune(int64 nCurrentTime) {
+    if(mapSideHeaders.empty()) return;
+
+    /* Of the headers in excess, these are put aside the earliest */
+    int64 nTimeLimit = nCurrentTime - HEADERS_SIDE_EXPIRY;
+    if(mapSideHeaders.size() > MAX_SIDE_HEADERS) {
+        vector<int64> vTimes;
+        vTimes.reserve(mapSideHeaders.size());
+        map<CBlockIndex *, int64>::const_iterator mi;
+        for(mi = mapSideHeaders.begin(); mi != mapSideHeaders.end(); mi++)
+          vTimes.push_back(mi->second);
+        uint nExcess = mapSideHeaders.size() - MAX_SIDE_HEADERS;
+        nth_element(vTimes.begin(), vTimes.begin() + nExcess - 1, vTimes.end());
+        nTimeLimit = max(nTimeLimit, vTimes[nExcess - 1] + 1);
+    }
+
+    vector<pair<CBlockIndex *, int64> > vSide(mapSideHeaders.begin(), mapSideHeaders.end());
+    sort(vSide.begin(), vSide.end(), HeaderHeightLess);
+
+    set<CBlockIndex *> setPruned;
+    for(uint i = 0; i < vSide.size(); i++) {
+        CBlockIndex *pindex = vSide[i].first;
+        if((vSide[i].second >= nTimeLimit) && !setPruned.count(pindex->pprev)) continue;
+        setPruned.insert(pindex);
+        mapSideHeaders.erase(pindex);
+        mapHeaderIndex.erase(pindex->GetBlockHash());
+    }
+
+    /* The best header chain never builds on the headers put aside,
+     * so those pruned are referenced by nothing else now */
+    BOOST_FOREACH(CBlockIndex *pindex, setPruned)
+      delete pindex;
+
+    if(fDebug && !setPruned.empty())
+      printf("HeadersSidePrune() : %" PRIszu " headers off the best header chain deleted\n",
+        setPruned.size());
+}
 
+/* Rebuilds the best header chain; the headers not on it any longer
+ * are put aside, so a better chain may build on them later */
+static void HeadersChainRebuild() {
+    int64 nCurrentTime = GetTime();
+    set<CBlockIndex *> setChain;
+    deque<CBlockIndex *> vPrevChain;
+    vPrevChain.swap(vHeaderChain);
 
+    for(CBlockIndex *pindex = pindexBestHeader; pindex; pindex = pindex->pprev) {
+        map<uint256, CBlockIndex *>::iterator mi = mapHeaderIndex.find(pindex->GetBlockHash());
+        if((mi == mapHeaderIndex.end()) || (mi->second != pindex)) break;
+        vHeaderChain.push_front(pindex);
+        setChain.insert(pindex);
+        mapSideHeaders.erase(pindex);
+    }
 
-bool CheckDiskSpace(uint64 nAdditionalBytes) {
-    uint64 nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
-
-    // Check for nMinDiskSpace bytes (currently 50MB)
-    if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
-    {
-        fShutdown = true;
-        string strMessage = _("Warning: Disk space is low!");
-        strMiscWarning = strMessage;
-        printf("*** %s\n", strMessage.c_str());
-        uiInterface.ThreadSafeMessageBox(strMessage, "Phoenixcoin",
-          CClientUIInterface::OK | CClientUIInterface::ICON_EXCLAMATION | CClientUIInterface::MODAL);
-        StartShutdown();
-        return false;
+    BOOST_FOREACH(CBlockIndex *pindex, vPrevChain) {
+        if(!setChain.count(pindex))
+          mapSideHeaders.insert(make_pair(pindex, nCurrentTime));
     }
-    return true;
+
+    HeadersSidePrune(nCurrentTime);
 }
 
-static boost::filesystem::path BlockFilePath(unsigned int nFile) {
-    string strBlockFn = strprintf("blk%04u.dat", nFile);
-    return GetDataDir() / strBlockFn;
+/* Puts the best header chain aside as it's no better than the best chain;
+ * a better chain may build on it later */
+static void HeadersChainAside(int64 nCurrentTime) {
+    BOOST_FOREACH(CBlockIndex *pindex, vHeaderChain)
+      mapSideHeaders.insert(make_pair(pindex, nCurrentTime));
+    vHeaderChain.clear();
+    pindexBestHeader = NULL;
+
+    HeadersSidePrune(nCurrentTime);
 }
 
-FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
-{
-    if ((nFile < 1) || (nFile == std::numeric_limits<uint32_t>::max()))
-        return NULL;
-    FILE* file = fopen(BlockFilePath(nFile).string().c_str(), pszMode);
-    if (!file)
-        return NULL;
-    if (nBlockPos != 0 && !strchr(pszMode, 'a') && !strchr(pszMode, 'w'))
-    {
-        if (fseek(file, nBlockPos, SEEK_SET) != 0)
-        {
-            fclose(file);
-            return NULL;
+/* Removes the headers of blocks stored already from the best header chain */
+static void HeadersChainPrune() {
+    while(!vHeaderChain.empty()) {
+        CBlockIndex *pindexHeader = vHeaderChain.front();
+        uint256 hash = pindexHeader->GetBlockHash();
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+        if(mi == mapBlockIndex.end()) break;
+
+        /* Link the next header and the headers put aside to the stored block */
+        vHeaderChain.pop_front();
+        if(!vHeaderChain.empty())
+          vHeaderChain.front()->pprev = mi->second;
+        map<CBlockIndex *, int64>::const_iterator mis;
+        for(mis = mapSideHeaders.begin(); mis != mapSideHeaders.end(); mis++) {
+            if(mis->first->pprev == pindexHeader)
+              mis->first->pprev = mi->second;
         }
+        if(pindexBestHeader == pindexHeader)
+          pindexBestHeader = mi->second;
+
+        mapHeaderIndex.erase(hash);
+        delete pindexHeader;
     }
-    return file;
 }
 
-static unsigned int nCurrentBlockFile = 1;
+/* Deletes an invalid block header and the headers built on it,
+ * then rebuilds the best header chain from the headers left */
+static void HeadersInvalidate(CBlockIndex *pindexInvalid) {
+    vector<pair<CBlockIndex *, int64> > vHeaders;
+    vHeaders.reserve(mapHeaderIndex.size());
+    map<uint256, CBlockIndex *>::const_iterator mi;
+    for(mi = mapHeaderIndex.begin(); mi != mapHeaderIndex.end(); mi++)
+      vHeaders.push_back(make_pair(mi->second, (int64)0));
+    sort(vHeaders.begin(), vHeaders.end(), HeaderHeightLess);
 
-FILE* AppendBlockFile(unsigned int& nFileRet)
-{
-    nFileRet = 0;
-    while(true) {
-        FILE* file = OpenBlockFile(nCurrentBlockFile, 0, "ab");
-        if (!file)
-            return NULL;
-        if (fseek(file, 0, SEEK_END) != 0)
-            return NULL;
-        // FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB
-        if(ftell(file) < (int)(0x7F000000 - MAX_SIZE)) {
-            nFileRet = nCurrentBlockFile;
-            return(file);
-        }
-        fclose(file);
-        nCurrentBlockFile++;
+    set<CBlockIndex *> setInvalid;
+    setInvalid.insert(pindexInvalid);
+    for(uint i = 0; i < vHeaders.size(); i++) {
+        if(setInvalid.count(vHeaders[i].first->pprev))
+          setInvalid.insert(vHeaders[i].first);
     }
-}
 
-bool LoadBlockIndex(bool fAllowNew) {
+    deque<CBlockIndex *> vChain;
+    BOOST_FOREACH(CBlockIndex *pindex, vHeaderChain) {
+        if(!setInvalid.count(pindex))
+          vChain.push_back(pindex);
+    }
+    vHeaderChain.swap(vChain);
 
-    if(fTestNet) {
-        pchMessageStart[0] = 0xFE;
-        pchMessageStart[1] = 0xD0;
-        pchMessageStart[2] = 0xD8;
-        pchMessageStart[3] = 0xD4;
-        hashGenesisBlock = uint256("0xecd47eee16536f7d03d64643cfc8c61b22093f8bf2c9358bf8b6f4dcb5f13192");
-        nBaseMaturity = BASE_MATURITY_TESTNET;
+    pindexBestHeader = NULL;
+    for(uint i = 0; i < vHeaders.size(); i++) {
+        CBlockIndex *pindex = vHeaders[i].first;
+        if(setInvalid.count(pindex)) continue;
+        if(!pindexBestHeader || (pindex->nChainWork > pindexBestHeader->nChainWork))
+          pindexBestHeader = pindex;
     }
 
-    //
-    // Load block index
-    //
-    CTxDB txdb("cr");
-    if (!txdb.LoadBlockIndex())
-        return false;
-    txdb.Close();
+    BOOST_FOREACH(CBlockIndex *pindex, setInvalid) {
+        mapSideHeaders.erase(pindex);
+        mapHeaderIndex.erase(pindex->GetBlockHash());
+        delete pindex;
+    }
 
-    //
-    // Init with genesis block
-    //
-    if(mapBlockIndex.empty()) {
+    printf("HeadersInvalidate() : %" PRIszu " headers deleted\n", setInvalid.size());
 
-        if(!fAllowNew) return(false);
+    HeadersChainRebuild();
+}
 
-        CTransaction txNew;
-        CBlock block;
+/* Context dependent block header checks, a subset of those in ProcessBlock() and AcceptBlock() */
+static bool CheckBlockHeader(const CBlock &header, CBlockIndex *pindexPrev) {
+    uint256 hash = header.GetHash();
+    int nHeight = pindexPrev->nHeight + 1;
 
-        if(!fTestNet) {
+    /* Cheaper than the proof-of-work verification */
+    CBlockIndex *pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+    if(pcheckpoint && (header.hashPrevBlock != hashBestChain) &&
+      (((int64)(header.nTime) - (int64)(pcheckpoint->nTime)) < 0))
+      return(header.DoS(100, error("CheckBlockHeader() : block has a time stamp %u before the last checkpoint %u",
+        header.nTime, pcheckpoint->nTime)));
 
-            /* The Phoenixcoin genesis block:
-             * CBlock(hash=be2f30f9e8db8f430056, PoW=00000e9c6e417d3d8068, ver=1, hashPrevBlock=00000000000000000000, hashMerkleRoot=ff2aa75842, nTime=1317972665, nBits=1e0ffff0, nNonce=2084931085, vtx=1)
-             *  CTransaction(hash=ff2aa75842, ver=1, vin.size=1, vout.size=1, nLockTime=0)
-             *    CTxIn(COutPoint(0000000000, -1), coinbase 04ffff001d010446552e532e204973205765696768696e672057696465204f7665726861756c206f662057697265746170204c617773202d204e592054696d6573202d204d617920382032303133)
-             *    CTxOut(error)
+    /* No coin base to extract the height from, so the hash function
+     * is selected by the height of the header in the chain */
+    if(!CheckProofOfWork(header.GetHashPoW(nHeight), header.nBits))
+      return(header.DoS(50, error("CheckBlockHeader() : proof-of-work verification failed")));
+
+    if(header.GetBlockTime() > (GetAdjustedTime() + 2 * 60 * 60))
+      return(error("CheckBlockHeader() : block timestamp too far in the future"));
+
+    if((nHeight >= nForkFive) || (fTestNet && (nHeight >= nTestnetForkTwo))) {
+        if(header.nVersion != 2)
+          return(header.DoS(100, error("CheckBlockHeader() : incorrect block version")));
+    }
+
+    if(header.nBits != GetNextWorkRequired(pindexPrev, &header))
+      return(header.DoS(100, error("CheckBlockHeader() : incorrect proof of work for block %d", nHeight)));
+
+    if(header.nTime <= (uint)pindexPrev->GetMedianTimePast())
+      return(header.DoS(20, error("CheckBlockHeader() : block %s height %d has a time stamp behind the median",
+        hash.ToString().substr(0,20).c_str(), nHeight)));
+
+    if((fTestNet && (nHeight >= nTestnetSoftForkOne)) || (nHeight >= nSoftForkOne)) {
+
+        if(header.nTime <= (pindexPrev->GetMedianTimePast() + BLOCK_LIMITER_TIME))
+          return(header.DoS(5, error("CheckBlockHeader() : block %s height %d rejected by the block limiter",
+            hash.ToString().substr(0,20).c_str(), nHeight)));
+
+        if(header.nTime <= (pindexPrev->GetBlockTime() - 10 * 60))
+          return(header.DoS(20, error("CheckBlockHeader() : block %s height %d has a time stamp too far in the past",
+            hash.ToString().substr(0,20).c_str(), nHeight)));
+
+    }
+
+    if(!Checkpoints::CheckHardened(nHeight, hash))
+      return(header.DoS(100, error("CheckBlockHeader() : rejected by a hardened checkpoint at height %d", nHeight)));
+
+    if((CheckpointsMode == Checkpoints::STRICT) && !Checkpoints::CheckSync(hash, pindexPrev))
+      return(error("CheckBlockHeader() : block %s height %d rejected by advanced checkpointing",
+        hash.ToString().substr(0,20).c_str(), nHeight));
+
+    return(true);
+}
+
+/* Adds the block header to the index if it passes the checks */
+static bool AcceptBlockHeader(CBlock &header, CBlockIndex *pindexPrev, CBlockIndex *&pindexNew) {
+
+    if(!CheckBlockHeader(header, pindexPrev))
+      return(false);
+
+    uint256 hash = header.GetHash();
+    pindexNew = new CBlockIndex(0, 0, header);
+    map<uint256, CBlockIndex *>::iterator mi = mapHeaderIndex.insert(make_pair(hash, pindexNew)).first;
+    pindexNew->phashBlock = &((*mi).first);
+    pindexNew->pprev = pindexPrev;
+    pindexNew->nHeight = pindexPrev->nHeight + 1;
+    pindexNew->nChainWork = pindexPrev->nChainWork + pindexNew->GetBlockWork();
+    /* No skip pointer as header entries are deleted when pruned */
+
+    return(true);
+}
+
+/* Releases the peer asked for headers, so another one may be asked */
+static void HeadersSyncRelease() {
+    if(!pnodeHeadersSync) return;
+
+    {
+        LOCK(cs_vNodes);
+        pnodeHeadersSync->Release();
+    }
+
+    pnodeHeadersSync = NULL;
+}
+
+bool ProcessHeaders(CNode *pfrom, vector<CBlock> &vHeaders) {
+    bool fRebuild = false, fFailed = false;
+    uint nAccepted = 0;
+
+    if(pfrom == pnodeHeadersSync)
+      HeadersSyncRelease();
+
+    BOOST_FOREACH(CBlock &header, vHeaders) {
+        uint256 hash = header.GetHash();
+
+        if(LookupBlockHeader(hash)) continue;
+
+        CBlockIndex *pindexPrev = LookupBlockHeader(header.hashPrevBlock);
+        if(!pindexPrev) {
+            printf("ProcessHeaders() : header %s doesn't connect, prev=%s\n",
+              hash.ToString().substr(0,20).c_str(), header.hashPrevBlock.ToString().substr(0,20).c_str());
+            break;
+        }
+
+        CBlockIndex *pindexNew = NULL;
+        if(!AcceptBlockHeader(header, pindexPrev, pindexNew)) {
+            if(header.nDoS) pfrom->Misbehaving(header.nDoS);
+            fFailed = true;
+            break;
+        }
+        nAccepted++;
+
+        /* Extend the best header chain or switch to a better one */
+        if(pindexBestHeader && (pindexPrev == pindexBestHeader)) {
+            vHeaderChain.push_back(pindexNew);
+            pindexBestHeader = pindexNew;
+        } else {
+            /* Off the best header chain unless it turns out better */
+            mapSideHeaders.insert(make_pair(pindexNew, GetTime()));
+            if(!pindexBestHeader || (pindexNew->nChainWork > pindexBestHeader->nChainWork))
+              pindexBestHeader = pindexNew;
+            fRebuild = true;
+        }
+    }
+
+    if(fRebuild) HeadersChainRebuild();
+
+    if(nAccepted) {
+        printf("received %u headers from peer %s, best header height %d\n",
+          nAccepted, pfrom->addr.ToString().c_str(), pindexBestHeader->nHeight);
+    }
+
+    return(!fFailed);
+}
+
+/* Completes or cancels a block request */
+static void BlockRequestRelease(map<uint256, pair<CNode *, int64> >::iterator mi) {
+    CNode *pnode = mi->second.first;
+
+    {
+        LOCK(cs_vNodes);
+        pnode->nBlocksInFlight--;
+        pnode->Release();
+    }
+
+    mapBlocksInFlight.erase(mi);
+}
+
+/* Requests block headers and block bodies of the best header chain from the peer;
+ * bodies are downloaded from multiple peers in parallel within a window
+ * ahead of the best block and connected in order by ProcessBlock() */
+static void HeadersSync(CNode *pto, int64 nCurrentTime, bool fSendTrickle) {
+
+    HeadersChainPrune();
+
+    /* Ask another peer if disconnected */
+    if(pnodeHeadersSync && pnodeHeadersSync->fDisconnect)
+      HeadersSyncRelease();
+
+    /* Cancel requests timed out or assigned to disconnected peers,
+     * these blocks are requested from other peers later */
+    if(fSendTrickle) {
+        map<uint256, pair<CNode *, int64> >::iterator mi = mapBlocksInFlight.begin();
+        while(mi != mapBlocksInFlight.end()) {
+            CNode *pnode = mi->second.first;
+            if(pnode->fDisconnect || ((nCurrentTime - mi->second.second) > BLOCK_DOWNLOAD_TIMEOUT)) {
+                printf("block %s request to peer %s cancelled\n",
+                  mi->first.ToString().substr(0,20).c_str(), pnode->addr.ToString().c_str());
+                BlockRequestRelease(mi++);
+            } else {
+                ++mi;
+            }
+        }
+    }
+
+    CBlockIndex *pindexTip = pindexBest;
+    if(pindexBestHeader && (pindexBestHeader->nChainWork > nBestChainWork))
+      pindexTip = pindexBestHeader;
+    else if(!vHeaderChain.empty())
+      HeadersChainAside(nCurrentTime);
+
+    if(pto->fClient || pto->fOneShot) return;
+
+    /* Ask for more headers, one peer at a time */
+    if((pto->nStartingHeight > pindexTip->nHeight) &&
+      (pindexTip->nHeight < (nBestHeight + HEADERS_LOOKAHEAD)) &&
+      (!pnodeHeadersSync || ((nCurrentTime - nHeadersAskTime) > HEADERS_RESPONSE_TIMEOUT))) {
+        if(pto->PushGetHeaders(pindexTip, uint256(0))) {
+            HeadersSyncRelease();
+            {
+                LOCK(cs_vNodes);
+                pto->AddRef();
+            }
+            pnodeHeadersSync = pto;
+            nHeadersAskTime = nCurrentTime;
+        }
+    }
+
+    if((pindexTip == pindexBest) || (pto->nBlocksInFlight >= MAX_BLOCKS_IN_FLIGHT))
+      return;
+
+    /* Ask for blocks not stored and not requested yet */
+    vector<CInv> vGetData;
+    int nMaxHeight = min(nBestHeight + BLOCK_DOWNLOAD_WINDOW, pto->nStartingHeight);
+    BOOST_FOREACH(CBlockIndex *pindex, vHeaderChain) {
+        if(pindex->nHeight > nMaxHeight) break;
+
+        uint256 hash = pindex->GetBlockHash();
+        if(mapOrphanBlocks.count(hash) || mapBlocksInFlight.count(hash)) continue;
+
+        mapBlocksInFlight[hash] = make_pair(pto, nCurrentTime);
+        {
+            LOCK(cs_vNodes);
+            pto->AddRef();
+            pto->nBlocksInFlight++;
+        }
+        vGetData.push_back(CInv(MSG_BLOCK, hash));
+
+        if(pto->nBlocksInFlight >= MAX_BLOCKS_IN_FLIGHT) break;
+    }
+
+    if(!vGetData.empty()) {
+        if(fDebugNet) printf("getdata %" PRIszu " blocks sent to peer %s\n",
+          vGetData.size(), pto->addr.ToString().c_str());
+        pto->PushMessage("getdata", vGetData);
+    }
+}
+
+
+
+
+
+
+
+
+bool CheckDiskSpace(uint64 nAdditionalBytes) {
+    uint64 nFreeBytesAvailable = boost::filesystem::space(GetDataDir()).available;
+
+    // Check for nMinDiskSpace bytes (currently 50MB)
+    if (nFreeBytesAvailable < nMinDiskSpace + nAdditionalBytes)
+    {
+        fShutdown = true;
+        string strMessage = _("Warning: Disk space is low!");
+        strMiscWarning = strMessage;
+        printf("*** %s\n", strMessage.c_str());
+        uiInterface.ThreadSafeMessageBox(strMessage, "Phoenixcoin",
+          CClientUIInterface::OK | CClientUIInterface::ICON_EXCLAMATION | CClientUIInterface::MODAL);
+        StartShutdown();
+        return false;
+    }
+    return true;
+}
+
+boost::filesystem::path BlockFilePath(unsigned int nFile) {
+    string strBlockFn = strprintf("blk%04u.dat", nFile);
+    return GetDataDir() / strBlockFn;
+}
+
+boost::filesystem::path UndoFilePath(unsigned int nFile) {
+    return(GetDataDir() / strprintf("rev%04u.dat", nFile));
+}
+
+bool CBlockUndo::WriteToDisk(CTxDB &txdb, const CBlockIndex *pindex) const {
+    CAutoFile fileout = CAutoFile(fopen(UndoFilePath(pindex->nFile).string().c_str(), "ab"),
+      SER_DISK, CLIENT_VERSION);
+    if(!fileout)
+      return(error("CBlockUndo::WriteToDisk() : failed to open the undo file"));
+    if(fseek(fileout, 0, SEEK_END))
+      return(error("CBlockUndo::WriteToDisk() : fseek() failed"));
+
+    /* The checksum covers the block hash, so the record cannot be
+     * applied to another block by mistake */
+    uint256 hashBlock = pindex->GetBlockHash();
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << *this;
+    uint256 hashCheck = Hash(BEGIN(hashBlock), END(hashBlock), ss.begin(), ss.end());
+    ss << hashCheck;
+
+    fileout << FLATDATA(pchMessageStart) << (uint)ss.size();
+    long nPos = ftell(fileout);
+    if(nPos < 0)
+      return(error("CBlockUndo::WriteToDisk() : ftell() failed"));
+    AllocateBlockFile(fileout, pindex->nFile, (uint)nPos + ss.size(), true);
+    fileout.write(&ss[0], ss.size());
+
+    fflush(fileout);
+    MarkBlockFileDirty(pindex->nFile, ss.size() + 8, true);
+
+    return(txdb.WriteBlockUndoPos(hashBlock, pindex->nFile, (uint)nPos));
+}
+
+bool CBlockUndo::ReadFromDisk(CTxDB &txdb, const CBlockIndex *pindex) {
+    uint256 hashBlock = pindex->GetBlockHash();
+    uint nFile, nPos;
+
+    if(!txdb.ReadBlockUndoPos(hashBlock, nFile, nPos))
+      return(false);
+
+    CAutoFile filein = CAutoFile(fopen(UndoFilePath(nFile).string().c_str(), "rb"),
+      SER_DISK, CLIENT_VERSION);
+    if(!filein)
+      return(error("CBlockUndo::ReadFromDisk() : failed to open the undo file"));
+    if((nPos < sizeof(uint)) || fseek(filein, nPos - sizeof(uint), SEEK_SET))
+      return(error("CBlockUndo::ReadFromDisk() : fseek() failed"));
+
+    try {
+        uint nSize;
+        filein >> nSize;
+        if((nSize < sizeof(uint256)) || (nSize > MAX_SIZE))
+          return(error("CBlockUndo::ReadFromDisk() : invalid record size"));
+
+        vector<char> vData(nSize);
+        filein.read(&vData[0], nSize);
+
+        uint256 hashCheck;
+        memcpy(hashCheck.begin(), &vData[nSize - sizeof(uint256)], sizeof(uint256));
+        if(Hash(BEGIN(hashBlock), END(hashBlock), vData.begin(), vData.end() - sizeof(uint256)) != hashCheck)
+          return(error("CBlockUndo::ReadFromDisk() : checksum mismatch"));
+
+        CMemoryStream ss(&vData[0], &vData[nSize - sizeof(uint256)], SER_DISK, CLIENT_VERSION);
+        ss >> *this;
+    } catch(std::exception &e) {
+        return(error("CBlockUndo::ReadFromDisk() : I/O error"));
+    }
+
+    return(true);
+}
+
+FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode)
+{
+    if ((nFile < 1) || (nFile == std::numeric_limits<uint32_t>::max()))
+        return NULL;
+    /* The data may be queued for writing yet */
+    if(!strchr(pszMode, 'a') && !strchr(pszMode, 'w'))
+      WaitBlockWrite(nFile, nBlockPos);
+    FILE* file = fopen(BlockFilePath(nFile).string().c_str(), pszMode);
+    if (!file)
+        return NULL;
+    if (nBlockPos != 0 && !strchr(pszMode, 'a') && !strchr(pszMode, 'w'))
+    {
+        if (fseek(file, nBlockPos, SEEK_SET) != 0)
+        {
+            fclose(file);
+            return NULL;
+        }
+    }
+    return file;
+}
+
+/* Block queued for writing at the position reserved in the block file */
+class CBlockWrite {
+public:
+    uint nFile;
+    /* Of the index header */
+    uint nPos;
+    vector<char> vData;
+};
+
+/* The queue of the block writer; the blocks stay queued until written,
+ * so the readers can tell the data of a block file not available yet */
+static boost::mutex mutexBlockWriter;
+static boost::condition_variable condBlockWriter;
+static deque<CBlockWrite> queueBlockWrite;
+static bool fBlockWriterRunning = false;
+static bool fBlockWriterQuit = false;
+static bool fBlockWriteFailed = false;
+/* The numbers of blocks queued and written so far */
+static uint64 nBlockWriteQueued = 0;
+static uint64 nBlockWriteDone = 0;
+/* The block file appended to and its size including the data queued */
+static uint nBlockWriteFile = 0;
+static uint nBlockWriteEnd = 0;
+/* Owned by the block writer; by the caller of QueueBlockWrite()
+ * if not running */
+static FILE *fileBlockWrite = NULL;
+static uint nFileBlockWrite = 0;
+
+static uint GetBlockFileSize(uint nFile) {
+    boost::system::error_code ec;
+    uintmax_t nSize = boost::filesystem::file_size(BlockFilePath(nFile), ec);
+    return(ec ? 0 : (uint)nSize);
+}
+
+/* Appends the data queued to its block file */
+static bool WriteBlockData(const CBlockWrite &write) {
+    if(fileBlockWrite && (nFileBlockWrite != write.nFile)) {
+        fclose(fileBlockWrite);
+        fileBlockWrite = NULL;
+    }
+    if(!fileBlockWrite) {
+        fileBlockWrite = OpenBlockFile(write.nFile, 0, "ab");
+        if(!fileBlockWrite)
+          return(error("WriteBlockData() : OpenBlockFile() failed"));
+        nFileBlockWrite = write.nFile;
+    }
+
+    if(fseek(fileBlockWrite, 0, SEEK_END))
+      return(error("WriteBlockData() : fseek() failed"));
+    if(ftell(fileBlockWrite) != (long)write.nPos)
+      return(error("WriteBlockData() : block file %u position mismatch", write.nFile));
+
+    AllocateBlockFile(fileBlockWrite, write.nFile, write.nPos + write.vData.size());
+    if(fwrite(&write.vData[0], 1, write.vData.size(), fileBlockWrite) != write.vData.size())
+      return(error("WriteBlockData() : fwrite() failed"));
+    if(fflush(fileBlockWrite))
+      return(error("WriteBlockData() : fflush() failed"));
+
+    MarkBlockFileDirty(write.nFile, write.vData.size());
+
+    return(true);
+}
+
+/* The block index refers to the data never written, so stop */
+static void BlockWriteFailed() {
+    fBlockWriteFailed = true;
+    strMiscWarning = _("Error: failed to write a block to disk");
+    printf("*** %s\n", strMiscWarning.c_str());
+    StartShutdown();
+}
+
+/* Reserves the space for the index header and block serialised and
+ * queues them for writing; the block is written right away if the block
+ * writer isn't running. Returns the block position to be recorded in
+ * the block index */
+bool QueueBlockWrite(const CDataStream &ss, uint &nFileRet, uint &nBlockPosRet) {
+    boost::unique_lock<boost::mutex> lock(mutexBlockWriter);
+
+    if(fBlockWriteFailed)
+      return(error("QueueBlockWrite() : failed to write a block previously"));
+
+    while(fBlockWriterRunning && (queueBlockWrite.size() >= BLOCK_WRITE_QUEUE_DEPTH))
+      condBlockWriter.wait(lock);
+
+    /* FAT32 file size max 4GB, fseek and ftell max 2GB, so we must stay under 2GB */
+    if(!nBlockWriteFile) {
+        nBlockWriteFile = 1;
+        nBlockWriteEnd = GetBlockFileSize(nBlockWriteFile);
+    }
+    while(nBlockWriteEnd >= (uint)(0x7F000000 - MAX_SIZE)) {
+        nBlockWriteFile++;
+        nBlockWriteEnd = GetBlockFileSize(nBlockWriteFile);
+    }
+
+    CBlockWrite write;
+    write.nFile = nBlockWriteFile;
+    write.nPos = nBlockWriteEnd;
+    nBlockWriteEnd += ss.size();
+
+    nFileRet = write.nFile;
+    nBlockPosRet = write.nPos + sizeof(pchMessageStart) + sizeof(uint);
+
+    nBlockWriteQueued++;
+
+    if(!fBlockWriterRunning) {
+        write.vData.assign(ss.begin(), ss.end());
+        if(!WriteBlockData(write)) {
+            BlockWriteFailed();
+            return(false);
+        }
+        nBlockWriteDone++;
+        return(true);
+    }
+
+    queueBlockWrite.push_back(write);
+    queueBlockWrite.back().vData.assign(ss.begin(), ss.end());
+    condBlockWriter.notify_all();
+
+    return(true);
+}
+
+/* Waits for the blocks queued at or before the position given
+ * in the block file to be written */
+void WaitBlockWrite(uint nFile, uint nPos) {
+    boost::unique_lock<boost::mutex> lock(mutexBlockWriter);
+
+    while(true) {
+        bool fPending = false;
+        BOOST_FOREACH(const CBlockWrite &write, queueBlockWrite) {
+            if((write.nFile == nFile) && (write.nPos <= nPos)) {
+                fPending = true;
+                break;
+            }
+        }
+        if(!fPending)
+          return;
+        condBlockWriter.wait(lock);
+    }
+}
+
+/* Waits for all blocks queued so far to be written;
+ * returns false if any of them failed */
+bool FlushBlockWrites() {
+    boost::unique_lock<boost::mutex> lock(mutexBlockWriter);
+
+    uint64 nQueued = nBlockWriteQueued;
+    while(nBlockWriteDone < nQueued)
+      condBlockWriter.wait(lock);
+
+    return(!fBlockWriteFailed);
+}
+
+void ThreadBlockWriter(void *parg) {
+
+    RenameThread("pxc-blockwrite");
+
+    vnThreadsRunning[THREAD_BLOCKWRITER]++;
+
+    boost::unique_lock<boost::mutex> lock(mutexBlockWriter);
+    fBlockWriterRunning = true;
+    while(true) {
+        while(!fBlockWriterQuit && queueBlockWrite.empty())
+          condBlockWriter.wait(lock);
+        if(queueBlockWrite.empty())
+          break;
+
+        /* Stays in place while the others append to the queue */
+        const CBlockWrite &write = queueBlockWrite.front();
+        if(!fBlockWriteFailed) {
+            lock.unlock();
+            bool fOk = WriteBlockData(write);
+            lock.lock();
+            if(!fOk)
+              BlockWriteFailed();
+        }
+        queueBlockWrite.pop_front();
+        nBlockWriteDone++;
+        condBlockWriter.notify_all();
+    }
+    fBlockWriterRunning = false;
+
+    if(fileBlockWrite) {
+        fclose(fileBlockWrite);
+        fileBlockWrite = NULL;
+    }
+
+    vnThreadsRunning[THREAD_BLOCKWRITER]--;
+}
+
+void ThreadBlockWriterQuit() {
+    boost::unique_lock<boost::mutex> lock(mutexBlockWriter);
+    fBlockWriterQuit = true;
+    condBlockWriter.notify_all();
+}
+
+/* The space of the block and undo files allocated so far, by file number;
+ * allocation beyond the end of file doesn't change the file size,
+ * so appending and memory mapping are not affected */
+static map<uint, uint> mapBlockFileSpace;
+static map<uint, uint> mapUndoFileSpace;
+static CCriticalSection cs_BlockFileSpace;
+
+void AllocateBlockFile(FILE *file, uint nFile, uint nEnd, bool fUndo) {
+    uint nChunkSize = fUndo ? UNDOFILE_CHUNK_SIZE : BLOCKFILE_CHUNK_SIZE;
+
+    LOCK(cs_BlockFileSpace);
+    uint &nSpace = fUndo ? mapUndoFileSpace[nFile] : mapBlockFileSpace[nFile];
+    if(nEnd <= nSpace)
+      return;
+
+    /* Allocating the part in use already after a restart costs nothing */
+    uint nNewSpace = ((nEnd + nChunkSize - 1) / nChunkSize) * nChunkSize;
+    AllocateFileRange(file, nSpace, nNewSpace - nSpace);
+    nSpace = nNewSpace;
+}
+
+/* Block and undo files written and not committed to disk yet;
+ * these are committed as a group right before the data base
+ * is synchronised, see CommitBlockFiles() */
+static set<pair<uint, bool> > setDirtyBlockFiles;
+static uint nDirtyBlockData = 0;
+static int64 nLastBlockCommit = 0;
+static CCriticalSection cs_BlockCommit;
+
+void MarkBlockFileDirty(uint nFile, uint nSize, bool fUndo) {
+    LOCK(cs_BlockCommit);
+    setDirtyBlockFiles.insert(make_pair(nFile, fUndo));
+    nDirtyBlockData += nSize;
+}
+
+/* Commits the block and undo files written to disk if either the time
+ * or the size limit of the group is exceeded or if forced; called before
+ * every data base write. Returns true if committed, so the data base
+ * may be synchronised before the write as all of the records written
+ * previously refer to the data on disk */
+bool CommitBlockFiles(bool fForce) {
+    int64 nTime = GetTimeMillis();
+    {
+        LOCK(cs_BlockCommit);
+        if(!fForce && (nDirtyBlockData < GROUP_COMMIT_SIZE) &&
+          ((nTime - nLastBlockCommit) < GROUP_COMMIT_TIME))
+          return(false);
+    }
+
+    /* The blocks queued are to be written first;
+     * the block writer marks the files dirty, so not locked here */
+    if(!FlushBlockWrites())
+      return(false);
+
+    LOCK(cs_BlockCommit);
+    bool fOk = true;
+    set<pair<uint, bool> >::const_iterator it;
+    for(it = setDirtyBlockFiles.begin(); it != setDirtyBlockFiles.end(); it++) {
+        boost::filesystem::path pathFile = it->second ? UndoFilePath(it->first) : BlockFilePath(it->first);
+        FILE *file = fopen(pathFile.string().c_str(), "ab");
+        if(!file || FileCommit(file))
+          fOk = error("CommitBlockFiles() : failed to commit %s", pathFile.string().c_str());
+        if(file)
+          fclose(file);
+    }
+    /* Try again the next time */
+    if(!fOk)
+      return(false);
+
+    if(fDebug && !setDirtyBlockFiles.empty())
+      printf("CommitBlockFiles() : %" PRIszu " files, %u bytes committed\n",
+        setDirtyBlockFiles.size(), nDirtyBlockData);
+
+    setDirtyBlockFiles.clear();
+    nDirtyBlockData = 0;
+    nLastBlockCommit = nTime;
+
+    return(true);
+}
+
+bool LoadBlockIndex(bool fAllowNew) {
+
+    if(fTestNet) {
+        pchMessageStart[0] = 0xFE;
+        pchMessageStart[1] = 0xD0;
+        pchMessageStart[2] = 0xD8;
+        pchMessageStart[3] = 0xD4;
+        hashGenesisBlock = uint256("0xecd47eee16536f7d03d64643cfc8c61b22093f8bf2c9358bf8b6f4dcb5f13192");
+        nBaseMaturity = BASE_MATURITY_TESTNET;
+    }
+
+    //
+    // Load block index
+    //
+    /* Writeable to record the proof-of-work hashes missing */
+    CTxDB txdb("cr+");
+    if (!txdb.LoadBlockIndex())
+        return false;
+    txdb.Close();
+
+    //
+    // Init with genesis block
+    //
+    if(mapBlockIndex.empty()) {
+
+        if(!fAllowNew) return(false);
+
+        CTransaction txNew;
+        CBlock block;
+
+        if(!fTestNet) {
+
+            /* The Phoenixcoin genesis block:
+             * CBlock(hash=be2f30f9e8db8f430056, PoW=00000e9c6e417d3d8068, ver=1, hashPrevBlock=00000000000000000000, hashMerkleRoot=ff2aa75842, nTime=1317972665, nBits=1e0ffff0, nNonce=2084931085, vtx=1)
+             *  CTransaction(hash=ff2aa75842, ver=1, vin.size=1, vout.size=1, nLockTime=0)
+             *    CTxIn(COutPoint(0000000000, -1), coinbase 04ffff001d010446552e532e204973205765696768696e672057696465204f7665726861756c206f662057697265746170204c617773202d204e592054696d6573202d204d617920382032303133)
+             *    CTxOut(error)
              *  vMerkleTree: ff2aa75842 */
 
             const char *pszTimestamp = "U.S. Is Weighing Wide Overhaul of Wiretap Laws - NY Times - May 8 2013";
@@ -2446,7 +3697,7 @@ bool LoadBlockIndex(bool fAllowNew) {
             printf("Genesis block mining...\n");
 
             uint profile = fNeoScrypt ? 0x0 : 0x3;
-            uint256 hashTarget = CBigNum().SetCompact(block.nBits).getuint256();
+            uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(block.nBits));
             uint256 hash;
 
             profile |= nNeoScryptOptions;
@@ -2528,7 +3779,7 @@ void PrintBlockTree()
 {
     // pre-compute tree structure
     map<CBlockIndex*, vector<CBlockIndex*> > mapNext;
-    for (map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
+    for (CBlockIndexMap::iterator mi = mapBlockIndex.begin(); mi != mapBlockIndex.end(); ++mi)
     {
         CBlockIndex* pindex = (*mi).second;
         mapNext[pindex->pprev].push_back(pindex);
@@ -2594,68 +3845,382 @@ void PrintBlockTree()
     }
 }
 
+/* Blocks are imported through a pipeline: a reader thread extracts
+ * the serialised blocks from the file, the check queue workers deserialise
+ * them and verify their proof-of-work, and the blocks are connected here
+ * in the order of the file */
+
+static const uint IMPORT_BATCH_SIZE = 128;
+static const uint IMPORT_QUEUE_DEPTH = 4;
+static const uint IMPORT_BUFFER_SIZE = 4 * 1024 * 1024;
+
+/* A block as found in the file and its deserialised form */
+struct CImportBlock {
+    vector<char> vData;
+    CBlock block;
+    bool fValid;
+
+    CImportBlock() : fValid(false) {}
+};
+
+typedef vector<CImportBlock> CImportBatch;
+typedef boost::shared_ptr<CImportBatch> CImportBatchRef;
+
+/* Bounded queue of the batches passed between the pipeline stages */
+class CImportQueue {
+private:
+    boost::mutex mutex;
+    boost::condition_variable condPush;
+    boost::condition_variable condPop;
+    std::deque<CImportBatchRef> queue;
+    bool fFinished;
+
+public:
+    CImportQueue() : fFinished(false) {}
+
+    /* Waits for space available; returns false if finished already */
+    bool Push(const CImportBatchRef &batch) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while(!fFinished && (queue.size() >= IMPORT_QUEUE_DEPTH))
+          condPush.wait(lock);
+        if(fFinished)
+          return(false);
+        queue.push_back(batch);
+        condPop.notify_one();
+        return(true);
+    }
+
+    /* Waits for a batch; returns false if finished and nothing left */
+    bool Pop(CImportBatchRef &batch) {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        while(!fFinished && queue.empty())
+          condPop.wait(lock);
+        if(queue.empty())
+          return(false);
+        batch = queue.front();
+        queue.pop_front();
+        condPush.notify_one();
+        return(true);
+    }
+
+    /* No more batches to be pushed */
+    void Finish() {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        fFinished = true;
+        condPush.notify_all();
+        condPop.notify_all();
+    }
+};
+
+/* Deserialises a block and verifies its proof-of-work; the hash is cached,
+ * so ProcessBlock() needs not to calculate it again */
+class CImportCheck {
+private:
+    CImportBlock *pitem;
+
+public:
+    CImportCheck() : pitem(NULL) {}
+    CImportCheck(CImportBlock *pitemIn) : pitem(pitemIn) {}
+
+    /* Always succeeds, invalid blocks are skipped by the caller */
+    bool operator()() const {
+        try {
+            CMemoryStream stream(&pitem->vData[0], &pitem->vData[0] + pitem->vData.size(),
+              SER_DISK, CLIENT_VERSION);
+            stream >> pitem->block;
+            pitem->fValid = CheckProofOfWork(pitem->block.GetHashPoW(), pitem->block.nBits);
+        } catch(std::exception &e) {
+            pitem->fValid = false;
+        }
+        return(true);
+    }
+
+    void swap(CImportCheck &check) {
+        std::swap(pitem, check.pitem);
+    }
+};
+
+/* Sequential reader of a block file with a buffer large enough for any block */
+class CImportReader {
+private:
+    FILE *file;
+    vector<uchar> vBuf;
+    uint nBegin;
+    uint nEnd;
+
+public:
+    CImportReader(FILE *fileIn) : file(fileIn),
+      vBuf(max(IMPORT_BUFFER_SIZE, MAX_BLOCK_SIZE + 8)), nBegin(0), nEnd(0) {}
+
+    const uchar *Data() const { return(&vBuf[nBegin]); }
+    void Skip(uint nSize) { nBegin += nSize; }
+
+    /* Makes the number of bytes specified available unless at the end of file */
+    bool Require(uint nSize) {
+        if((nEnd - nBegin) >= nSize)
+          return(true);
+        if(nBegin) {
+            memmove(&vBuf[0], &vBuf[nBegin], nEnd - nBegin);
+            nEnd -= nBegin;
+            nBegin = 0;
+        }
+        while(nEnd < nSize) {
+            size_t nRead = fread(&vBuf[nEnd], 1, vBuf.size() - nEnd, file);
+            if(!nRead)
+              return(false);
+            nEnd += nRead;
+        }
+        return(true);
+    }
+
+    /* Moves past the next message start; false if none found */
+    bool Seek() {
+        while(Require(sizeof(pchMessageStart))) {
+            const uchar *pbegin = &vBuf[nBegin], *pend = &vBuf[nEnd];
+            const uchar *pfound = search(pbegin, pend, pchMessageStart,
+              pchMessageStart + sizeof(pchMessageStart));
+            if(pfound != pend) {
+                nBegin += (pfound - pbegin) + sizeof(pchMessageStart);
+                return(true);
+            }
+            /* A partial match may remain at the end */
+            nBegin = nEnd - (sizeof(pchMessageStart) - 1);
+        }
+        return(false);
+    }
+};
+
+static void ThreadImportRead(FILE *file, CImportQueue *pqueueOut) {
+
+    RenameThread("pxc-importread");
+
+    try {
+        CImportReader reader(file);
+        CImportBatchRef batch(new CImportBatch);
+        batch->reserve(IMPORT_BATCH_SIZE);
+
+        while(!fRequestShutdown && reader.Seek()) {
+            if(!reader.Require(sizeof(uint)))
+              break;
+            uint nSize;
+            memcpy(&nSize, reader.Data(), sizeof(nSize));
+            /* Look for the next message start if the size is invalid */
+            if(!nSize || (nSize > MAX_BLOCK_SIZE))
+              continue;
+            if(!reader.Require(sizeof(uint) + nSize))
+              break;
+
+            batch->push_back(CImportBlock());
+            batch->back().vData.assign(reader.Data() + sizeof(uint),
+              reader.Data() + sizeof(uint) + nSize);
+            reader.Skip(sizeof(uint) + nSize);
+
+            if(batch->size() == IMPORT_BATCH_SIZE) {
+                if(!pqueueOut->Push(batch))
+                  break;
+                batch.reset(new CImportBatch);
+                batch->reserve(IMPORT_BATCH_SIZE);
+            }
+        }
+        if(!batch->empty())
+          pqueueOut->Push(batch);
+    } catch(std::exception &e) {
+        printf("ThreadImportRead() : %s\n", e.what());
+    }
+
+    pqueueOut->Finish();
+}
+
+static void ThreadImportCheck(CCheckQueue<CImportCheck> *pcheckqueue,
+  CImportQueue *pqueueIn, CImportQueue *pqueueOut) {
+
+    RenameThread("pxc-importcheck");
+
+    CImportBatchRef batch;
+    while(pqueueIn->Pop(batch)) {
+        CCheckQueueControl<CImportCheck> control(pcheckqueue);
+        vector<CImportCheck> vChecks;
+        vChecks.reserve(batch->size());
+        for(uint i = 0; i < batch->size(); i++)
+          vChecks.push_back(CImportCheck(&(*batch)[i]));
+        control.Add(vChecks);
+        control.Wait();
+        if(!pqueueOut->Push(batch))
+          break;
+    }
+
+    /* Stop the reader if the consumer has quit */
+    pqueueIn->Finish();
+    pqueueOut->Finish();
+}
+
+static void ThreadImportCheckWorker(CCheckQueue<CImportCheck> *pcheckqueue) {
+
+    RenameThread("pxc-importworker");
+
+    pcheckqueue->Thread();
+}
+
 bool LoadExternalBlockFile(FILE* fileIn)
 {
     int64 nStart = GetTimeMillis();
 
     int nLoaded = 0;
-    {
+    CImportQueue queueRead, queueChecked;
+    CCheckQueue<CImportCheck> importcheckqueue(16);
+
+    thread_group threadsWorker, threadsPipeline;
+    for(int i = 0; i < nScriptCheckThreads - 1; i++)
+      threadsWorker.create_thread(boost::bind(&ThreadImportCheckWorker, &importcheckqueue));
+    threadsPipeline.create_thread(boost::bind(&ThreadImportRead, fileIn, &queueRead));
+    threadsPipeline.create_thread(boost::bind(&ThreadImportCheck, &importcheckqueue,
+      &queueRead, &queueChecked));
+
+    CImportBatchRef batch;
+    while(!fRequestShutdown && queueChecked.Pop(batch)) {
         LOCK(cs_main);
-        try {
-            CAutoFile blkdat(fileIn, SER_DISK, CLIENT_VERSION);
-            unsigned int nPos = 0;
-            while (nPos != std::numeric_limits<uint32_t>::max() && blkdat.good() && !fRequestShutdown)
-            {
-                unsigned char pchData[65536];
-                do {
-                    fseek(blkdat, nPos, SEEK_SET);
-                    int nRead = fread(pchData, 1, sizeof(pchData), blkdat);
-                    if (nRead <= 8)
-                    {
-                        nPos = std::numeric_limits<uint32_t>::max();
-                        break;
-                    }
-                    void* nFind = memchr(pchData, pchMessageStart[0], nRead+1-sizeof(pchMessageStart));
-                    if (nFind)
-                    {
-                        if (memcmp(nFind, pchMessageStart, sizeof(pchMessageStart))==0)
-                        {
-                            nPos += ((unsigned char*)nFind - pchData) + sizeof(pchMessageStart);
-                            break;
-                        }
-                        nPos += ((unsigned char*)nFind - pchData) + 1;
-                    }
-                    else
-                        nPos += sizeof(pchData) - sizeof(pchMessageStart) + 1;
-                } while(!fRequestShutdown);
-                if (nPos == std::numeric_limits<uint32_t>::max())
-                    break;
-                fseek(blkdat, nPos, SEEK_SET);
-                unsigned int nSize;
-                blkdat >> nSize;
-                if (nSize > 0 && nSize <= MAX_BLOCK_SIZE)
-                {
-                    CBlock block;
-                    blkdat >> block;
-                    if (ProcessBlock(NULL,&block))
-                    {
-                        nLoaded++;
-                        nPos += 4 + nSize;
-                    }
-                }
-            }
-        }
-        catch (std::exception &e) {
-            printf("%s() : Deserialize or I/O error caught during load\n",
-                   __PRETTY_FUNCTION__);
+        BOOST_FOREACH(CImportBlock &item, *batch) {
+            if(fRequestShutdown)
+              break;
+            if(item.fValid && ProcessBlock(NULL, &item.block))
+              nLoaded++;
         }
     }
+
+    /* Stop the pipeline if terminated early */
+    queueChecked.Finish();
+    queueRead.Finish();
+    threadsPipeline.join_all();
+    importcheckqueue.Quit();
+    threadsWorker.join_all();
+    fclose(fileIn);
+
     printf("Loaded %i blocks from external file in %" PRI64d "ms\n",
       nLoaded, GetTimeMillis() - nStart);
 
     return(nLoaded > 0);
 }
 
+static boost::filesystem::path ReindexFilePath(uint nFile) {
+    return(GetDataDir() / strprintf("blk%04u.dat.reindex", nFile));
+}
+
+/* Returns the numbers of the block files waiting to be reindexed in order */
+static void GetReindexFiles(vector<uint> &vFiles) {
+    vFiles.clear();
+
+    boost::filesystem::directory_iterator itEnd;
+    for(boost::filesystem::directory_iterator it(GetDataDir()); it != itEnd; it++) {
+        const string strPath = it->path().string();
+        size_t nSep = strPath.find_last_of("/\\");
+        uint nFile;
+        if((sscanf(strPath.c_str() + nSep + 1, "blk%u.dat.reindex", &nFile) == 1) &&
+          (it->path() == ReindexFilePath(nFile)))
+          vFiles.push_back(nFile);
+    }
+
+    sort(vFiles.begin(), vFiles.end());
+}
+
+/* Marks the preparation of a reindex in progress */
+static boost::filesystem::path ReindexMarkerPath() {
+    return(GetDataDir() / "reindex.pending");
+}
+
+/* The block files are renamed before the data base is wiped; the marker
+ * covers both steps, so a failure in between is completed on the next
+ * start and no block file is left out of the reindex */
+bool PrepareReindex(bool fRequested) {
+    vector<uint> vFiles;
+    uint nFile;
+
+    try {
+        if(boost::filesystem::exists(ReindexMarkerPath())) {
+            printf("PrepareReindex() : completing the preparation interrupted\n");
+        } else {
+            if(!fRequested)
+              return(true);
+
+            GetReindexFiles(vFiles);
+            if(!vFiles.empty()) {
+                /* The blocks imported already are in the new block files */
+                printf("PrepareReindex() : resuming the reindex in progress\n");
+                return(true);
+            }
+
+            FILE *file = fopen(ReindexMarkerPath().string().c_str(), "wb");
+            if(!file)
+              return(error("PrepareReindex() : failed to create %s",
+                ReindexMarkerPath().string().c_str()));
+            bool fCommitted = !FileCommit(file);
+            fclose(file);
+            if(!fCommitted)
+              return(error("PrepareReindex() : failed to commit %s",
+                ReindexMarkerPath().string().c_str()));
+        }
+
+        CloseBlockFileMaps();
+        /* Some of the files may have been renamed already */
+        for(nFile = 1; boost::filesystem::exists(BlockFilePath(nFile)) ||
+          boost::filesystem::exists(ReindexFilePath(nFile)); nFile++) {
+            if(boost::filesystem::exists(BlockFilePath(nFile)))
+              boost::filesystem::rename(BlockFilePath(nFile), ReindexFilePath(nFile));
+            /* The undo records are written again as the blocks are connected */
+            boost::filesystem::remove(UndoFilePath(nFile));
+        }
+
+        if(!WipeTxDB())
+          return(false);
+
+        boost::filesystem::remove(ReindexMarkerPath());
+    } catch(boost::filesystem::filesystem_error &e) {
+        return(error("PrepareReindex() : %s", e.what()));
+    }
+
+    printf("PrepareReindex() : %u block files set aside for reindexing\n", nFile - 1);
+
+    return(true);
+}
+
+void ImportReindexFiles() {
+    vector<uint> vFiles;
+
+    try {
+        GetReindexFiles(vFiles);
+    } catch(boost::filesystem::filesystem_error &e) {
+        printf("ImportReindexFiles() : %s\n", e.what());
+        return;
+    }
+    if(vFiles.empty())
+      return;
+
+    uiInterface.InitMessage(_("Reindexing blocks..."));
+
+    BOOST_FOREACH(uint nFile, vFiles) {
+        if(fRequestShutdown)
+          break;
+        boost::filesystem::path pathFile = ReindexFilePath(nFile);
+        FILE *file = fopen(pathFile.string().c_str(), "rb");
+        if(!file) {
+            printf("ImportReindexFiles() : cannot open %s\n", pathFile.string().c_str());
+            break;
+        }
+        printf("Reindexing %s\n", pathFile.string().c_str());
+        LoadExternalBlockFile(file);
+        if(fRequestShutdown)
+          break;
+        /* The blocks have been written into the new block files;
+         * these and the index must be on disk before the source is gone */
+        CTxDB txdb;
+        if(!CommitBlockFiles(true) || !txdb.Sync()) {
+            printf("ImportReindexFiles() : failed to commit the blocks of %s\n",
+              pathFile.string().c_str());
+            break;
+        }
+        boost::filesystem::remove(pathFile);
+    }
+}
+
 
 
 
@@ -2755,7 +4320,8 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 
     case MSG_BLOCK:
         return mapBlockIndex.count(inv.hash) ||
-               mapOrphanBlocks.count(inv.hash);
+               mapOrphanBlocks.count(inv.hash) ||
+               mapBlocksInFlight.count(inv.hash);
     }
     // Don't know what it is, just say we already got one
     return true;
@@ -2764,7 +4330,8 @@ bool static AlreadyHave(CTxDB& txdb, const CInv& inv)
 
 extern void AddTimeData(const CNetAddr& ip, int64 nTime);
 
-bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
+bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
+  vector<CBlock> *pvBlocks = NULL)
 {
     static map<CService, CPubKey> mapReuseKey;
     RandAddSeedPerfmon();
@@ -2864,8 +4431,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             }
         }
 
-        /* Ask for inventory */
-        if(!pfrom->fClient && !pfrom->fOneShot &&
+        /* Ask for inventory; SendMessages() asks for headers instead if enabled */
+        if(!fHeadersFirst && !pfrom->fClient && !pfrom->fOneShot &&
           (pfrom->nStartingHeight > nBestHeight)) {
             pfrom->PushGetBlocks(pindexBest, uint256(0));
         }
@@ -3042,7 +4609,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if (inv.type == MSG_BLOCK)
             {
                 // Send block from disk
-                map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(inv.hash);
+                CBlockIndexMap::iterator mi = mapBlockIndex.find(inv.hash);
                 if (mi != mapBlockIndex.end())
                 {
                     CBlock block;
@@ -3165,7 +4732,7 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         if (locator.IsNull())
         {
             // If locator is null, return the hashStop block
-            map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashStop);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hashStop);
             if (mi == mapBlockIndex.end())
                 return true;
             pindex = (*mi).second;
@@ -3191,6 +4758,22 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     }
 
 
+    else if(strCommand == "headers") {
+        /* Decoded by the proof-of-work stage, if any */
+        vector<CBlock> vHeadersRecv;
+        if(!pvBlocks)
+          vRecv >> vHeadersRecv;
+        vector<CBlock> &vHeaders = pvBlocks ? *pvBlocks : vHeadersRecv;
+
+        if(vHeaders.size() > 4000) {
+            pfrom->Misbehaving(20);
+            return(error("message headers size() = %" PRIszu "", vHeaders.size()));
+        }
+
+        ProcessHeaders(pfrom, vHeaders);
+    }
+
+
     else if (strCommand == "tx")
     {
         vector<uint256> vWorkQueue;
@@ -3210,9 +4793,9 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
         }
 
         bool fMissingInputs = false;
-        if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs))
+        if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs, &inv.hash))
         {
-            SyncWithWallets(tx, NULL, true);
+            SyncWithWallets(inv.hash, tx, NULL, true);
             RelayMessage(inv, vMsg);
             mapAlreadyAskedFor.erase(inv);
             vWorkQueue.push_back(inv.hash);
@@ -3232,10 +4815,10 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
                     CInv inv(MSG_TX, tx.GetHash());
                     bool fMissingInputs2 = false;
 
-                    if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs2))
+                    if (tx.AcceptToMemoryPool(txdb, true, &fMissingInputs2, &inv.hash))
                     {
                         printf("   accepted orphan tx %s\n", inv.hash.ToString().substr(0,10).c_str());
-                        SyncWithWallets(tx, NULL, true);
+                        SyncWithWallets(inv.hash, tx, NULL, true);
                         RelayMessage(inv, vMsg);
                         mapAlreadyAskedFor.erase(inv);
                         vWorkQueue.push_back(inv.hash);
@@ -3268,11 +4851,18 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
 
     else if (strCommand == "block")
     {
-        CBlock block;
-        vRecv >> block;
+        CBlock blockRecv;
+        if(!pvBlocks)
+          vRecv >> blockRecv;
+        CBlock &block = pvBlocks ? pvBlocks->front() : blockRecv;
         uint256 hashBlock = block.GetHash();
         int nBlockHeight = block.GetBlockHeight();
 
+        /* Complete the block request, if any */
+        map<uint256, pair<CNode *, int64> >::iterator mi = mapBlocksInFlight.find(hashBlock);
+        if(mi != mapBlocksInFlight.end())
+          BlockRequestRelease(mi);
+
         if(nBlockHeight > (nBestHeight + 5000)) {
             /* Discard this block because cannot verify it any time soon */
             printf("received and discarded a distant block %s height %d\n",
@@ -3287,15 +4877,25 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
             if(ProcessBlock(pfrom, &block))
               mapAlreadyAskedFor.erase(inv);
 
-            if(block.nDoS)
-              pfrom->Misbehaving(block.nDoS);
+            if(block.nDoS) {
+                pfrom->Misbehaving(block.nDoS);
+                /* The body may be altered while the header stays valid; the block
+                 * is requested from another peer then, so the header is deleted
+                 * only if it fails the header checks itself */
+                map<uint256, CBlockIndex *>::iterator mih = mapHeaderIndex.find(hashBlock);
+                if((mih != mapHeaderIndex.end()) && !CheckBlockHeader(block, mih->second->pprev))
+                  HeadersInvalidate(mih->second);
+            }
         }
     }
 
 
     else if (strCommand == "getaddr")
     {
-        pfrom->vAddrToSend.clear();
+        {
+            LOCK(pfrom->cs_vAddrToSend);
+            pfrom->vAddrToSend.clear();
+        }
         vector<CAddress> vAddr = addrman.GetAddr();
         BOOST_FOREACH(const CAddress &addr, vAddr)
             pfrom->PushAddress(addr);
@@ -3409,10 +5009,83 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv)
     return true;
 }
 
+/* Messages processed without cs_main; their handlers must not touch
+ * the block chain, memory pool or wallet state */
+static bool IsLightMessage(const string &strCommand) {
+    return((strCommand == "ping") || (strCommand == "pong") || (strCommand == "addr") ||
+      (strCommand == "getaddr") || (strCommand == "verack"));
+}
+
+/* Proof-of-work verification stage of incoming block headers and blocks;
+ * runs without cs_main locked in advance of ProcessMessage() which finds
+ * the results cached, headers are verified in parallel; the blocks decoded
+ * are returned to be passed on instead of decoding the message again;
+ * returns false if the stage couldn't run and may be tried again */
+static bool PoWCheckMessage(const string &strCommand, const CDataStream &vMsg,
+  CBlocksRef &pblocks) {
+
+    if((strCommand != "headers") && (strCommand != "block"))
+      return(true);
+
+    if(!pblocks) {
+        CBlocksRef pblocksRecv(new vector<CBlock>());
+        try {
+            CDataStream vData(vMsg);
+            if(strCommand == "headers") {
+                vData >> *pblocksRecv;
+            } else {
+                pblocksRecv->resize(1);
+                vData >> pblocksRecv->front();
+            }
+        } catch(std::exception &e) {
+            /* Left to ProcessMessage() to report */
+            return(true);
+        }
+        pblocks = pblocksRecv;
+    }
+
+    if(strCommand == "headers") {
+        const vector<CBlock> &vHeaders = *pblocks;
+        int64 nCheckpointTime = 0;
+        uint256 hashBest;
+        int nHeight;
+
+        if(vHeaders.empty() || (vHeaders.size() > 4000))
+          return(true);
+
+        {
+            TRY_LOCK(cs_main, lockMain);
+            if(!lockMain)
+              return(false);
+            CBlockIndex *pindexPrev = LookupBlockHeader(vHeaders[0].hashPrevBlock);
+            if(!pindexPrev)
+              return(true);
+            nHeight = pindexPrev->nHeight + 1;
+            CBlockIndex *pcheckpoint = Checkpoints::GetLastCheckpoint(mapBlockIndex);
+            if(pcheckpoint)
+              nCheckpointTime = pcheckpoint->nTime;
+            hashBest = hashBestChain;
+        }
+
+        PoWCheckHeaders(vHeaders, nHeight, nCheckpointTime, hashBest);
+
+        return(true);
+    }
+
+    const CBlock &block = pblocks->front();
+    if(block.vtx.empty() || block.vtx[0].vin.empty() ||
+      block.vtx[0].vin[0].scriptSig.empty())
+      return(true);
+
+    block.GetHashPoW();
+
+    return(true);
+}
+
 bool ProcessMessages(CNode *pfrom) {
 
     CDataStream &vRecv = pfrom->vRecv;
-    if(vRecv.empty()) return(true);
+    if(vRecv.empty() && pfrom->strDeferredCommand.empty()) return(true);
 
 //    if(fDebug) printf("ProcessMessages(%u bytes)\n", vRecv.size());
 
@@ -3428,85 +5101,109 @@ bool ProcessMessages(CNode *pfrom) {
         // Don't bother if send buffer is too full to respond anyway
         if(pfrom->vSend.size() >= SendBufferSize()) break;
 
-        // Scan for message start
-        CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(),
-          BEGIN(pchMessageStart), END(pchMessageStart));
-        int nHeaderSize = vRecv.GetSerializeSize(CMessageHeader());
-        if((vRecv.end() - pstart) < nHeaderSize) {
-            if((int)vRecv.size() > nHeaderSize) {
-                if(fDebug) printf("ProcessMessages(): message start not found\n");
-                vRecv.erase(vRecv.begin(), vRecv.end() - nHeaderSize);
+        /* A message put aside while cs_main was busy is framed and verified already */
+        bool fResumed = !pfrom->strDeferredCommand.empty();
+        CDataStream vMsgRecv(vRecv.nType, vRecv.nVersion);
+        CDataStream &vMsg = fResumed ? pfrom->vDeferredMsg : vMsgRecv;
+        string strCommand;
+        uint nMessageSize;
+        bool fPoWChecked = false;
+        CBlocksRef pblocks;
+
+        if(fResumed) {
+            strCommand = pfrom->strDeferredCommand;
+            nMessageSize = vMsg.size();
+            fPoWChecked = pfrom->fDeferredPoWChecked;
+            pblocks = pfrom->pDeferredBlocks;
+        } else {
+            // Scan for message start
+            CDataStream::iterator pstart = search(vRecv.begin(), vRecv.end(),
+              BEGIN(pchMessageStart), END(pchMessageStart));
+            int nHeaderSize = vRecv.GetSerializeSize(CMessageHeader());
+            if((vRecv.end() - pstart) < nHeaderSize) {
+                if((int)vRecv.size() > nHeaderSize) {
+                    if(fDebug) printf("ProcessMessages(): message start not found\n");
+                    vRecv.erase(vRecv.begin(), vRecv.end() - nHeaderSize);
+                }
+                break;
             }
-            break;
-        }
-        if((pstart - vRecv.begin()) > 0) {
-            if(fDebug) printf("ProcessMessages(): %" PRIpdd " bytes skipped\n",
-              pstart - vRecv.begin());
-        }
-        vRecv.erase(vRecv.begin(), pstart);
-
-        // Read header
-        vector<char> vHeaderSave(vRecv.begin(), vRecv.begin() + nHeaderSize);
-        CMessageHeader hdr;
-        vRecv >> hdr;
-        if(!hdr.IsCommandValid()) {
-            if(fDebug) {
-                /* Dump the invalid command as a hex sequence */
-                printf("ProcessMessages(): invalid command ");
-                uint i;
-                for(i = 0; i < CMessageHeader::COMMAND_SIZE; i++) {
-                    printf("%02X", hdr.pchCommand[i]);
+            if((pstart - vRecv.begin()) > 0) {
+                if(fDebug) printf("ProcessMessages(): %" PRIpdd " bytes skipped\n",
+                  pstart - vRecv.begin());
+            }
+            vRecv.erase(vRecv.begin(), pstart);
+
+            // Read header
+            vector<char> vHeaderSave(vRecv.begin(), vRecv.begin() + nHeaderSize);
+            CMessageHeader hdr;
+            vRecv >> hdr;
+            if(!hdr.IsCommandValid()) {
+                if(fDebug) {
+                    /* Dump the invalid command as a hex sequence */
+                    printf("ProcessMessages(): invalid command ");
+                    uint i;
+                    for(i = 0; i < CMessageHeader::COMMAND_SIZE; i++) {
+                        printf("%02X", hdr.pchCommand[i]);
+                    }
+                    printf("\n");
                 }
-                printf("\n");
+                continue;
             }
-            continue;
-        }
 
-        // Message size
-        uint nMessageSize = hdr.nMessageSize;
-        if(nMessageSize > MAX_SIZE) {
-            if(fDebug) printf("ProcessMessages(%s): very large message %u bytes\n",
-              hdr.pchCommand, nMessageSize);
-            continue;
-        }
-        if(nMessageSize > vRecv.size()) {
-            // Rewind and wait for rest of message
-            vRecv.insert(vRecv.begin(), vHeaderSave.begin(), vHeaderSave.end());
-            break;
-        }
+            // Message size
+            nMessageSize = hdr.nMessageSize;
+            if(nMessageSize > MAX_SIZE) {
+                if(fDebug) printf("ProcessMessages(%s): very large message %u bytes\n",
+                  hdr.pchCommand, nMessageSize);
+                continue;
+            }
+            if(nMessageSize > vRecv.size()) {
+                // Rewind and wait for rest of message
+                vRecv.insert(vRecv.begin(), vHeaderSave.begin(), vHeaderSave.end());
+                break;
+            }
 
-        // Checksum
-        uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
-        uint nChecksum;
-        memcpy(&nChecksum, &hash, CMessageHeader::CHECKSUM_SIZE);
-        if(nChecksum != hdr.nChecksum) {
-            if(fDebug) printf("ProcessMessages(%s): checksum mismatch %08X %08X\n",
-              hdr.pchCommand, nChecksum, hdr.nChecksum);
-            continue;
-        }
+            // Checksum
+            uint256 hash = Hash(vRecv.begin(), vRecv.begin() + nMessageSize);
+            uint nChecksum;
+            memcpy(&nChecksum, &hash, CMessageHeader::CHECKSUM_SIZE);
+            if(nChecksum != hdr.nChecksum) {
+                if(fDebug) printf("ProcessMessages(%s): checksum mismatch %08X %08X\n",
+                  hdr.pchCommand, nChecksum, hdr.nChecksum);
+                continue;
+            }
 
-        // Copy message to its own buffer
-        CDataStream vMsg(vRecv.begin(), vRecv.begin() + nMessageSize, vRecv.nType, vRecv.nVersion);
-        vRecv.ignore(nMessageSize);
+            // Copy message to its own buffer
+            vMsgRecv = CDataStream(vRecv.begin(), vRecv.begin() + nMessageSize, vRecv.nType, vRecv.nVersion);
+            vRecv.ignore(nMessageSize);
+            strCommand = hdr.pchCommand;
+        }
 
         // Process message
-        bool fRet = false;
+        bool fRet = false, fDeferred = false;
         try {
-            {
-                LOCK(cs_main);
-                fRet = ProcessMessage(pfrom, string(hdr.pchCommand), vMsg);
+            if(IsLightMessage(strCommand)) {
+                fRet = ProcessMessage(pfrom, strCommand, vMsg);
+            } else {
+                if(!fPoWChecked)
+                  fPoWChecked = PoWCheckMessage(strCommand, vMsg, pblocks);
+                TRY_LOCK(cs_main, lockMain);
+                if(lockMain)
+                  fRet = ProcessMessage(pfrom, strCommand, vMsg, pblocks.get());
+                else
+                  fDeferred = true;
             }
             if(fShutdown) return(true);
         } catch(std::ios_base::failure &e) {
             if(strstr(e.what(), "end of data")) {
                 printf("ProcessMessages(%s, %u bytes): exception '%s' caught, "
                   "normally caused by an undersized message\n",
-                  hdr.pchCommand, nMessageSize, e.what());
+                  strCommand.c_str(), nMessageSize, e.what());
             }
             else if(strstr(e.what(), "size too large")) {
                 printf("ProcessMessages(%s, %u bytes): exception '%s' caught, "
                   "normally caused by an oversized message\n",
-                  hdr.pchCommand, nMessageSize, e.what());
+                  strCommand.c_str(), nMessageSize, e.what());
             }
             else {
                 PrintExceptionContinue(&e, "ProcessMessages()");
@@ -3517,8 +5214,25 @@ bool ProcessMessages(CNode *pfrom) {
             PrintExceptionContinue(NULL, "ProcessMessages()");
         }
 
+        /* Keep the message aside and try again later while cs_main is busy,
+         * not to be framed and verified again; the worker moves on to other peers */
+        if(fDeferred) {
+            if(!fResumed) {
+                pfrom->strDeferredCommand = strCommand;
+                pfrom->vDeferredMsg = vMsgRecv;
+            }
+            pfrom->fDeferredPoWChecked = fPoWChecked;
+            pfrom->pDeferredBlocks = pblocks;
+            break;
+        }
+        if(fResumed) {
+            pfrom->strDeferredCommand.clear();
+            pfrom->vDeferredMsg.clear();
+            pfrom->pDeferredBlocks.reset();
+        }
+
         if(!fRet)
-          printf("ProcessMessages(%s, %u bytes) FAILED\n", hdr.pchCommand, nMessageSize);
+          printf("ProcessMessages(%s, %u bytes) FAILED\n", strCommand.c_str(), nMessageSize);
     }
 
     vRecv.Compact();
@@ -3538,8 +5252,15 @@ bool SendMessages(CNode *pto, bool fSendTrickle) {
     if(lockMain) {
         int64 nCurrentTime = GetTimeMicros();
 
+        /* The send buffer is shared with the other workers and the socket handler */
+        bool fSendEmpty;
+        {
+            LOCK(pto->cs_vSend);
+            fSendEmpty = pto->vSend.empty();
+        }
+
         /* Keep-alive ping using an arbitrary nonce which is an extended time stamp */
-        if(((nCurrentTime - pto->nPingStamp) > 60 * 1000000) && pto->vSend.empty()) {
+        if(((nCurrentTime - pto->nPingStamp) > 60 * 1000000) && fSendEmpty) {
             pto->nPingStamp = nCurrentTime;
             pto->PushMessage("ping", nCurrentTime);
             if(fDebugNet) printf("ping sent to peer %s nonce %" PRI64d "\n",
@@ -3557,10 +5278,15 @@ bool SendMessages(CNode *pto, bool fSendTrickle) {
         /* Convert to seconds */
         nCurrentTime /= 1000000;
 
-        /* Ask a random peer for inventory */
+        /* Headers-first synchronisation */
+        if(fHeadersFirst)
+          HeadersSync(pto, nCurrentTime, fSendTrickle);
+
+        /* Ask a random peer for inventory;
+         * a fall back for headers-first synchronisation if it stalls */
         if(fSendTrickle && IsInitialBlockDownload() &&
           (nBestHeight < pto->nStartingHeight) &&
-          ((nCurrentTime - nTimeBestReceived) > 1LL) &&
+          ((nCurrentTime - nTimeBestReceived) > (fHeadersFirst ? (int64)BLOCK_DOWNLOAD_TIMEOUT : 1LL)) &&
           ((nCurrentTime - nGetblocksTimePolling) > 1LL)) {
             nGetblocksTimePolling = nCurrentTime;
             pto->PushGetBlocks(pindexBest, uint256(0));
@@ -3579,7 +5305,10 @@ bool SendMessages(CNode *pto, bool fSendTrickle) {
                 {
                     // Periodically clear setAddrKnown to allow refresh broadcasts
                     if (nLastRebroadcast)
+                    {
+                        LOCK(pnode->cs_vAddrToSend);
                         pnode->setAddrKnown.clear();
+                    }
 
                     // Rebroadcast our address
                     if (!fNoListen)
@@ -3598,25 +5327,25 @@ bool SendMessages(CNode *pto, bool fSendTrickle) {
         //
         if (fSendTrickle)
         {
-            vector<CAddress> vAddr;
-            vAddr.reserve(pto->vAddrToSend.size());
-            BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
+            vector<CAddress> vAddrAll;
             {
-                // returns true if wasn't already contained in the set
-                if (pto->setAddrKnown.insert(addr).second)
+                LOCK(pto->cs_vAddrToSend);
+                vAddrAll.reserve(pto->vAddrToSend.size());
+                BOOST_FOREACH(const CAddress& addr, pto->vAddrToSend)
                 {
-                    vAddr.push_back(addr);
-                    // receiver rejects addr messages larger than 1000
-                    if (vAddr.size() >= 1000)
-                    {
-                        pto->PushMessage("addr", vAddr);
-                        vAddr.clear();
-                    }
+                    // returns true if wasn't already contained in the set
+                    if (pto->setAddrKnown.insert(addr).second)
+                        vAddrAll.push_back(addr);
                 }
+                pto->vAddrToSend.clear();
             }
-            pto->vAddrToSend.clear();
-            if (!vAddr.empty())
+            // receiver rejects addr messages larger than 1000
+            for (unsigned int i = 0; i < vAddrAll.size(); i += 1000)
+            {
+                vector<CAddress> vAddr(vAddrAll.begin() + i,
+                  vAddrAll.begin() + min(i + 1000, (unsigned int)vAddrAll.size()));
                 pto->PushMessage("addr", vAddr);
+            }
         }
 
 
@@ -4076,7 +5805,7 @@ void FormatDataBuffer(CBlock *pblock, uint *pdata) {
 
 bool CheckWork(CBlock *pblock, CWallet &wallet, CReserveKey &reservekey, bool fGetWork) {
     uint256 hash = pblock->GetHashPoW();
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
 
     if(hash > hashTarget) return(false);
 
@@ -4160,27 +5889,39 @@ static void CoinMiner(CWallet *pwallet) {
         // Search
         //
         int64 nStart = GetTime();
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
 
         while(true) {
             unsigned int nHashesDone = 0;
             uint profile = fNeoScrypt ? 0x0 : 0x3;
-            uint256 hash;
+            /* Consecutive nonces hashed at once */
+            uint nLanes = neoscrypt_batch_lanes();
+            uchar input[8 * 80];
+            uint256 hash[8];
+            uint i;
 
             profile |= nNeoScryptOptions;
 
             while(true) {
-                neoscrypt((uchar *) &pblock->nVersion, (uchar *) &hash, profile);
-                if(hash <= hashTarget) {
+                for(i = 0; i < nLanes; i++) {
+                    uint nNonce = pblock->nNonce + i;
+                    memcpy(&input[i * 80], &pblock->nVersion, 76);
+                    memcpy(&input[i * 80 + 76], &nNonce, 4);
+                }
+                neoscrypt_batch(input, (uchar *) &hash[0], profile, nLanes);
+                for(i = 0; i < nLanes; i++)
+                  if(hash[i] <= hashTarget) break;
+                if(i < nLanes) {
                     // Found a solution
+                    pblock->nNonce += i;
                     SetThreadPriority(THREAD_PRIORITY_NORMAL);
                     CheckWork(pblock, *pwalletMain, reservekey, false);
                     SetThreadPriority(THREAD_PRIORITY_LOWEST);
                     break;
                 }
-                pblock->nNonce += 1;
-                nHashesDone += 1;
-                if(!(pblock->nNonce & 0xFF)) break;
+                pblock->nNonce += nLanes;
+                nHashesDone += nLanes;
+                if((pblock->nNonce & 0xFF) < nLanes) break;
             }
 
             // Meter hashes/sec
@@ -4232,7 +5973,7 @@ static void CoinMiner(CWallet *pwallet) {
 
             if(fTestNet) {
                 /* UpdateTime() can change work required on testnet */
-                hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+                hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
             }
         }
     }
@@ -14,16 +14,20 @@
 #include <set>
 #include <limits>
 
+#include "arith_uint256.h"
 #include "bignum.h"
 #include "sync.h"
 #include "net.h"
 #include "script.h"
 
+#include "blockmap.h"
+#include "poolmap.h"
 #include "neoscrypt.h"
 
 class CWallet;
 class CBlock;
 class CBlockIndex;
+class CChain;
 class CKeyItem;
 class CReserveKey;
 
@@ -57,6 +61,23 @@ static const int64 BLOCK_LIMITER_TIME = 120;
 static const int64 MIN_TX_FEE = 10000000;
 /* Fees below this value are considered absent while relaying */
 static const int64 MIN_RELAY_TX_FEE = 5000000;
+/* The max. number of script verification threads */
+static const int MAX_SCRIPTCHECK_THREADS = 16;
+/* Block index records of this format and newer carry the proof-of-work hash */
+static const int BLOCK_INDEX_POW_VERSION = 70001;
+/* The max. number of proof-of-work hashes cached */
+static const uint MAX_POW_CACHE_SIZE = 50000;
+/* Block headers verified by the proof-of-work workers at once */
+static const uint POW_CHECK_CHUNK = 256;
+/* The max. number of blocks queued for writing to disk */
+static const uint BLOCK_WRITE_QUEUE_DEPTH = 16;
+/* Block and undo files are preallocated in chunks of these sizes */
+static const uint BLOCKFILE_CHUNK_SIZE = 0x1000000;
+static const uint UNDOFILE_CHUNK_SIZE = 0x100000;
+/* Block and undo file data are committed to disk together once
+ * this time, in milliseconds, or this amount of data is exceeded */
+static const int64 GROUP_COMMIT_TIME = 1000;
+static const uint GROUP_COMMIT_SIZE = 0x1000000;
 /* The dust threshold */
 static const int64 TX_DUST = 1000000;
 /* The max. amount for a single transaction */
@@ -112,12 +133,14 @@ extern CScript COINBASE_FLAGS;
 
 
 extern CCriticalSection cs_main;
-extern std::map<uint256, CBlockIndex*> mapBlockIndex;
+typedef poolmap<CBlockIndex> CBlockIndexMap;
+extern CBlockIndexMap mapBlockIndex;
+extern CChain chainActive;
 extern uint256 hashGenesisBlock;
 extern CBlockIndex* pindexGenesisBlock;
 extern int nBestHeight;
-extern CBigNum bnBestChainWork;
-extern CBigNum bnBestInvalidWork;
+extern arith_uint256 nBestChainWork;
+extern arith_uint256 nBestInvalidWork;
 extern uint256 hashBestChain;
 extern CBlockIndex* pindexBest;
 extern unsigned int nTransactionsUpdated;
@@ -135,34 +158,73 @@ extern std::map<uint256, CBlock *> mapOrphanBlocks;
 // Settings
 extern int64 nTransactionFee;
 extern int64 nMinimumInputValue;
+extern int nScriptCheckThreads;
+extern bool fHeadersFirst;
+extern bool fAddrIndex;
 
 // Minimum disk space required - used in CheckDiskSpace()
 static const uint64 nMinDiskSpace = 52428800;
 
+/* Headers-first synchronisation limits:
+ * block headers are fetched up to this many blocks ahead of the best block */
+static const int HEADERS_LOOKAHEAD = 20000;
+/* Block bodies are requested up to this many blocks ahead of the best block */
+static const int BLOCK_DOWNLOAD_WINDOW = 1024;
+/* Maximum number of block requests in flight per peer */
+static const int MAX_BLOCKS_IN_FLIGHT = 16;
+/* Seconds to wait for a requested block before asking another peer */
+static const int BLOCK_DOWNLOAD_TIMEOUT = 60;
+/* Seconds to wait for a headers response before asking another peer */
+static const int HEADERS_RESPONSE_TIMEOUT = 30;
+/* Seconds to keep the headers off the best header chain, so a better chain
+ * received in parts may be assembled, and the max. number of them kept */
+static const int HEADERS_SIDE_EXPIRY = 60 * 60;
+static const uint MAX_SIDE_HEADERS = 10000;
+
 
 class CReserveKey;
 class CTxDB;
 class CTxIndex;
+class CCoins;
+class CScriptCheck;
 
 void RegisterWallet(CWallet* pwalletIn);
 void UnregisterWallet(CWallet* pwalletIn);
-void SyncWithWallets(const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false);
+void SyncWithWallets(const uint256 &hash, const CTransaction& tx, const CBlock* pblock = NULL, bool fUpdate = false);
 bool ProcessBlock(CNode* pfrom, CBlock* pblock);
 bool CheckDiskSpace(uint64 nAdditionalBytes=0);
+boost::filesystem::path BlockFilePath(unsigned int nFile);
+boost::filesystem::path UndoFilePath(unsigned int nFile);
 FILE* OpenBlockFile(unsigned int nFile, unsigned int nBlockPos, const char* pszMode="rb");
-FILE* AppendBlockFile(unsigned int& nFileRet);
+bool QueueBlockWrite(const CDataStream &ss, uint &nFileRet, uint &nBlockPosRet);
+void WaitBlockWrite(uint nFile, uint nPos);
+bool FlushBlockWrites();
+void AllocateBlockFile(FILE *file, uint nFile, uint nEnd, bool fUndo = false);
+void MarkBlockFileDirty(uint nFile, uint nSize, bool fUndo = false);
+bool CommitBlockFiles(bool fForce = false);
 bool LoadBlockIndex(bool fAllowNew=true);
 void PrintBlockTree();
 CBlockIndex* FindBlockByHeight(int nHeight);
 bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto, bool fSendTrickle);
+/* Validates and stores a batch of block headers received from a peer */
+bool ProcessHeaders(CNode *pfrom, std::vector<CBlock> &vHeaders);
 bool LoadExternalBlockFile(FILE* fileIn);
+/* Sets the block files aside and resets the data base for -reindex;
+ * completes a preparation interrupted */
+bool PrepareReindex(bool fRequested);
+/* Imports the block files set aside, resumes an interrupted reindex */
+void ImportReindexFiles();
 void GenerateCoins(bool fGenerate, CWallet *pwallet);
 CBlock* CreateNewBlock(CReserveKey& reservekey);
 void IncrementExtraNonce(CBlock* pblock, CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 void FormatDataBuffer(CBlock *pblock, uint *pdata);
 bool CheckWork(CBlock *pblock, CWallet &wallet, CReserveKey &reservekey, bool fGetWork);
 bool CheckProofOfWork(uint256 hash, unsigned int nBits);
+/* Runs a proof-of-work verification worker */
+void ThreadPoWCheck(void *parg);
+/* Stops all proof-of-work verification workers */
+void ThreadPoWCheckQuit();
 int64 GetProofOfWorkReward(int nHeight, int64 nFees);
 int64 GetMoneySupply(int nHeight);
 int GetNumBlocksOfPeers();
@@ -171,6 +233,14 @@ std::string GetWarnings(std::string strFor);
 bool GetTransaction(const uint256 &hash, CTransaction &tx, uint256 &hashBlock);
 uint256 WantedByOrphan(const CBlock *pblockOrphan);
 void ResendWalletTransactions(bool fForce = false);
+/* Runs a script verification worker */
+void ThreadScriptCheck(void *parg);
+/* Stops all script verification workers */
+void ThreadScriptCheckQuit();
+/* Runs the block writer */
+void ThreadBlockWriter(void *parg);
+/* Stops the block writer after the blocks queued are written */
+void ThreadBlockWriterQuit();
 
 bool GetWalletFile(CWallet* pwallet, std::string &strWalletFileOut);
 
@@ -427,7 +497,7 @@ enum GetMinFee_mode
     GMF_SEND,
 };
 
-typedef std::map<uint256, std::pair<CTxIndex, CTransaction> > MapPrevTx;
+typedef std::map<uint256, std::pair<CTxIndex, CCoins> > MapPrevTx;
 
 /** The basic transaction that is broadcasted on the network and contained in
  * blocks.  A transaction can contain multiple inputs and outputs.
@@ -590,6 +660,12 @@ public:
 
     bool ReadFromDisk(CDiskTxPos pos, FILE** pfileRet=NULL)
     {
+        WaitBlockWrite(pos.nFile, pos.nTxPos);
+
+        /* Directly from the memory mapped block file if possible */
+        if(!pfileRet && ReadFromBlockFileMap(pos.nFile, pos.nTxPos, *this))
+          return(true);
+
         CAutoFile filein = CAutoFile(OpenBlockFile(pos.nFile, 0, pfileRet ? "rb+" : "rb"), SER_DISK, CLIENT_VERSION);
         if (!filein)
             return error("CTransaction::ReadFromDisk() : OpenBlockFile failed");
@@ -676,20 +752,111 @@ public:
         @param[in] fBlock  true if called from ConnectBlock
         @param[in] fMiner  true if called from CreateNewBlock
         @param[in] fStrictPayToScriptHash  true if fully validating p2sh transactions
+        @param[out] pvChecks  if not NULL, script checks are appended here instead of being run
         @return Returns true if all checks succeed
      */
     bool ConnectInputs(MapPrevTx inputs,
                        std::map<uint256, CTxIndex>& mapTestPool, const CDiskTxPos& posThisTx,
-                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true);
+                       const CBlockIndex* pindexBlock, bool fBlock, bool fMiner, bool fStrictPayToScriptHash=true,
+                       std::vector<CScriptCheck> *pvChecks = NULL);
     bool ClientConnectInputs();
     bool CheckTransaction() const;
-    bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL);
+    /* The hash of the transaction may be supplied if taken already */
+    bool AcceptToMemoryPool(CTxDB& txdb, bool fCheckInputs=true, bool* pfMissingInputs=NULL,
+      const uint256 *phash=NULL);
 
 protected:
     const CTxOut& GetOutputFor(const CTxIn& input, const MapPrevTx& inputs) const;
 };
 
 
+/** Compact record of the outputs of a transaction not spent yet; everything
+ * a spending transaction needs to know about its inputs without the input
+ * scripts. Spent outputs are pruned in place to keep the positions of
+ * the others and the record is erased as soon as all of them are spent */
+class CCoins {
+public:
+    bool fCoinBase;
+    std::vector<CTxOut> vout;
+
+    CCoins() : fCoinBase(false) {}
+    CCoins(const CTransaction &tx) : fCoinBase(tx.IsCoinBase()), vout(tx.vout) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(fCoinBase);
+        READWRITE(vout);
+    )
+
+    bool IsCoinBase() const {
+        return(fCoinBase);
+    }
+
+    bool IsAvailable(uint n) const {
+        return((n < vout.size()) && !vout[n].IsNull());
+    }
+
+    void Spend(uint n) {
+        if(n < vout.size())
+          vout[n].SetNull();
+    }
+
+    bool IsPruned() const {
+        BOOST_FOREACH(const CTxOut &txout, vout) {
+            if(!txout.IsNull())
+              return(false);
+        }
+        return(true);
+    }
+
+    void swap(CCoins &coins) {
+        std::swap(fCoinBase, coins.fCoinBase);
+        vout.swap(coins.vout);
+    }
+};
+
+
+/** Closure representing one script verification;
+ * the spending transaction must outlive it */
+class CScriptCheck {
+private:
+    CScript scriptPubKey;
+    const CTransaction *ptxTo;
+    uint nIn;
+    bool fStrictPayToScriptHash;
+    int nHashType;
+    /* Shared by the checks of all inputs of the transaction */
+    CSigHashContextRef psighash;
+    /* Set if the script failed only because of strict P2SH validation */
+    bool fP2SHFailure;
+
+public:
+    CScriptCheck() : ptxTo(0), nIn(0), fStrictPayToScriptHash(false), nHashType(0), fP2SHFailure(false) {}
+    CScriptCheck(const CCoins &coinsFromIn, const CTransaction &txToIn, uint nInIn,
+      bool fStrictPayToScriptHashIn, int nHashTypeIn,
+      const CSigHashContextRef &psighashIn = CSigHashContextRef()) :
+      scriptPubKey(coinsFromIn.vout[txToIn.vin[nInIn].prevout.n].scriptPubKey),
+      ptxTo(&txToIn), nIn(nInIn), fStrictPayToScriptHash(fStrictPayToScriptHashIn),
+      nHashType(nHashTypeIn), psighash(psighashIn), fP2SHFailure(false) {}
+
+    bool operator()();
+
+    bool IsP2SHFailure() const {
+        return(fP2SHFailure);
+    }
+
+    void swap(CScriptCheck &check) {
+        scriptPubKey.swap(check.scriptPubKey);
+        std::swap(ptxTo, check.ptxTo);
+        std::swap(nIn, check.nIn);
+        std::swap(fStrictPayToScriptHash, check.fStrictPayToScriptHash);
+        std::swap(nHashType, check.nHashType);
+        psighash.swap(check.psighash);
+        std::swap(fP2SHFailure, check.fP2SHFailure);
+    }
+};
+
+
 
 
 
@@ -785,6 +952,14 @@ public:
         return pos.IsNull();
     }
 
+    bool IsFullySpent() const
+    {
+        BOOST_FOREACH(const CDiskTxPos& posSpent, vSpent)
+            if (posSpent.IsNull())
+                return false;
+        return true;
+    }
+
     friend bool operator==(const CTxIndex& a, const CTxIndex& b)
     {
         return (a.pos    == b.pos &&
@@ -800,6 +975,29 @@ public:
 };
 
 
+/** Undo record of a block written into rev000?.dat at connection time;
+ * holds the index entries and the output records of the transactions
+ * spent from as they were before the block, so the block can be
+ * disconnected without reading previous transactions */
+class CBlockUndo
+{
+public:
+    std::vector<std::pair<uint256, CTxIndex> > vTxIndex;
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(vTxIndex);
+        READWRITE(vCoins);
+    )
+
+    /* Appends the record to the undo file of the block and notes its position */
+    bool WriteToDisk(CTxDB &txdb, const CBlockIndex *pindex) const;
+    /* Returns false if there is no valid record for the block */
+    bool ReadFromDisk(CTxDB &txdb, const CBlockIndex *pindex);
+};
+
+
 
 
 
@@ -830,6 +1028,8 @@ public:
 
     // memory only
     mutable std::vector<uint256> vMerkleTree;
+    /* The number of transactions the merkle tree has been built for */
+    mutable uint nMerkleTreeTx;
 
     // Denial-of-service detection:
     mutable int nDoS;
@@ -855,6 +1055,11 @@ public:
             READWRITE(vtx);
         else if (fRead)
             const_cast<CBlock*>(this)->vtx.clear();
+        /* Not valid for the transactions read */
+        if(fRead) {
+            vMerkleTree.clear();
+            nMerkleTreeTx = 0;
+        }
     )
 
     void SetNull()
@@ -867,6 +1072,7 @@ public:
         nNonce = 0;
         vtx.clear();
         vMerkleTree.clear();
+        nMerkleTreeTx = 0;
         nDoS = 0;
     }
 
@@ -880,10 +1086,9 @@ public:
         return Hash(BEGIN(nVersion), END(nNonce));
     }
 
-    /* Calculates block proof-of-work hash using either NeoScrypt or Scrypt */
-    uint256 GetHashPoW() const {
+    /* Selects the proof-of-work hash function of the block at the height given */
+    uint GetPoWProfile(int nHeight) const {
         uint profile = 0x0;
-        uint256 hash;
 
         /* All blocks generated up to this time point are Scrypt only */
         if((fTestNet && (nTime < nTestnetSwitchV2)) ||
@@ -891,7 +1096,6 @@ public:
             profile = 0x3;
         } else {
             /* All these blocks must be v2+ with valid nHeight */
-            int nHeight = GetBlockHeight();
             if(fTestNet) {
                 if(nHeight < nTestnetForkTwo)
                   profile = 0x3;
@@ -901,13 +1105,18 @@ public:
             }
         }
 
-        profile |= nNeoScryptOptions;
-
-        neoscrypt((uchar *) &nVersion, (uchar *) &hash, profile);
+        return(profile | nNeoScryptOptions);
+    }
 
-        return(hash);
+    /* Calculates block proof-of-work hash using either NeoScrypt or Scrypt */
+    uint256 GetHashPoW() const {
+        return(GetHashPoW(GetBlockHeight()));
     }
 
+    /* The same for the height given, e.g. of a block header alone;
+     * the results are cached */
+    uint256 GetHashPoW(int nHeight) const;
+
     /* Extracts block height from v2+ coin base;
      * ignores nVersion because it's unrealiable */
     int GetBlockHeight() const {
@@ -940,11 +1149,21 @@ public:
     void UpdateTime(const CBlockIndex* pindexPrev);
 
 
+    /* Hash of the transaction at the position given; a leaf of the merkle
+     * tree if built for the transactions of the block, which must be done
+     * again or the tree cleared after changes to vtx */
+    uint256 GetTxHash(uint i) const {
+        if(!vMerkleTree.empty() && (nMerkleTreeTx == vtx.size()))
+          return(vMerkleTree[i]);
+        return(vtx[i].GetHash());
+    }
+
     uint256 BuildMerkleTree() const
     {
         vMerkleTree.clear();
         BOOST_FOREACH(const CTransaction& tx, vtx)
             vMerkleTree.push_back(tx.GetHash());
+        nMerkleTreeTx = vtx.size();
         int j = 0;
         for (int nSize = vtx.size(); nSize > 1; nSize = (nSize + 1) / 2)
         {
@@ -991,37 +1210,29 @@ public:
     }
 
 
+    /* Queues the block for writing by the block writer; the position
+     * in the block file is reserved and returned immediately */
     bool WriteToDisk(unsigned int& nFileRet, unsigned int& nBlockPosRet)
     {
-        // Open history file to append
-        CAutoFile fileout = CAutoFile(AppendBlockFile(nFileRet), SER_DISK, CLIENT_VERSION);
-        if(!fileout)
-          return(error("CBlock::WriteToDisk() : AppendBlockFile() failed"));
-
-        // Write index header
-        unsigned int nSize = fileout.GetSerializeSize(*this);
-        fileout << FLATDATA(pchMessageStart) << nSize;
-
-        // Write block
-        int fileOutPos = (int)ftell(fileout);
-        if(fileOutPos < 0)
-          return(error("CBlock::WriteToDisk() : ftell() failed"));
-        nBlockPosRet = fileOutPos;
-        fileout << *this;
-
-        // Flush stdio buffers and commit to disk before returning
-        fflush(fileout);
-        if(!IsInitialBlockDownload() || !((nBestHeight + 1) % 100)) {
-            if(FileCommit(fileout))
-              return(error("CBlock::WriteToDisk() : FileCommit() failed"));
-        }
+        // Index header and block
+        unsigned int nSize = ::GetSerializeSize(*this, SER_DISK, CLIENT_VERSION);
+        CDataStream ss(SER_DISK, CLIENT_VERSION);
+        ss.reserve(nSize + sizeof(pchMessageStart) + sizeof(nSize));
+        ss << FLATDATA(pchMessageStart) << nSize << *this;
 
-        return(true);
+        return(QueueBlockWrite(ss, nFileRet, nBlockPosRet));
     }
 
     bool ReadFromDisk(unsigned int nFile, unsigned int nBlockPos, bool fReadTransactions=true)
     {
         SetNull();
+        WaitBlockWrite(nFile, nBlockPos);
+
+        /* Directly from the memory mapped block file if possible */
+        if(ReadFromBlockFileMap(nFile, nBlockPos, *this,
+          fReadTransactions ? SER_DISK : (SER_DISK | SER_BLOCKHEADERONLY)))
+          return(true);
+        SetNull();
 
         // Open history file to read
         CAutoFile filein = CAutoFile(OpenBlockFile(nFile, nBlockPos, "rb"), SER_DISK, CLIENT_VERSION);
@@ -1074,6 +1285,14 @@ private:
     bool SetBestChainInner(CTxDB& txdb, CBlockIndex *pindexNew);
 };
 
+/* Writes or erases the address index records of a transaction in a block
+ * at the height given; the inputs must be known unless coin base */
+bool UpdateAddrIndex(CTxDB &txdb, const uint256 &hashTx, const CTransaction &tx,
+  const MapPrevTx &inputs, int nHeight, bool fErase);
+/* Removes the address index records of a block being disconnected;
+ * the outputs spent by the block must be available */
+bool EraseAddrIndex(CTxDB &txdb, const CBlock &block, int nHeight);
+
 
 
 
@@ -1092,10 +1311,12 @@ public:
     const uint256* phashBlock;
     CBlockIndex* pprev;
     CBlockIndex* pnext;
+    /* An ancestor further back for faster look-ups, see GetAncestor() */
+    CBlockIndex* pskip;
     unsigned int nFile;
     unsigned int nBlockPos;
     int nHeight;
-    CBigNum bnChainWork;
+    arith_uint256 nChainWork;
 
     // block header
     int nVersion;
@@ -1104,22 +1325,27 @@ public:
     unsigned int nBits;
     unsigned int nNonce;
 
+    /* The proof-of-work hash, zero if not known yet */
+    uint256 hashPoW;
+
 
     CBlockIndex()
     {
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
         nFile = 0;
         nBlockPos = 0;
         nHeight = 0;
-        bnChainWork = 0;
+        nChainWork = 0;
 
         nVersion       = 0;
         hashMerkleRoot = 0;
         nTime          = 0;
         nBits          = 0;
         nNonce         = 0;
+        hashPoW        = 0;
     }
 
     CBlockIndex(unsigned int nFileIn, unsigned int nBlockPosIn, CBlock& block)
@@ -1127,16 +1353,18 @@ public:
         phashBlock = NULL;
         pprev = NULL;
         pnext = NULL;
+        pskip = NULL;
         nFile = nFileIn;
         nBlockPos = nBlockPosIn;
         nHeight = 0;
-        bnChainWork = 0;
+        nChainWork = 0;
 
         nVersion       = block.nVersion;
         hashMerkleRoot = block.hashMerkleRoot;
         nTime          = block.nTime;
         nBits          = block.nBits;
         nNonce         = block.nNonce;
+        hashPoW        = 0;
     }
 
     CBlock GetBlockHeader() const
@@ -1162,13 +1390,29 @@ public:
         return (int64)nTime;
     }
 
-    CBigNum GetBlockWork() const
+    /* Returns the proof-of-work hash of the block; calculates it and updates
+     * the index record if not known, e.g. after an upgrade */
+    uint256 GetHashPoW(CTxDB &txdb);
+
+    /* Sets the skip pointer; pprev and nHeight must be set, and
+     * the skip pointers of all ancestors must be built already */
+    void BuildSkip();
+
+    /* Returns the ancestor at the height specified or NULL if out of range;
+     * takes logarithmic time if the skip pointers are built */
+    CBlockIndex *GetAncestor(int nHeight);
+    const CBlockIndex *GetAncestor(int nHeight) const;
+
+    arith_uint256 GetBlockWork() const
     {
-        CBigNum bnTarget;
-        bnTarget.SetCompact(nBits);
-        if (bnTarget <= 0)
+        bool fNegative, fOverflow;
+        arith_uint256 nTarget;
+        nTarget.SetCompact(nBits, &fNegative, &fOverflow);
+        if (fNegative || fOverflow || nTarget == 0)
             return 0;
-        return (CBigNum(1)<<256) / (bnTarget+1);
+        /* 2^256 / (nTarget + 1) doesn't fit into 256 bits, however
+         * it equals to ~nTarget / (nTarget + 1) + 1 */
+        return (~nTarget / (nTarget + 1)) + 1;
     }
 
     bool IsInMainChain() const
@@ -1265,6 +1509,34 @@ public:
 
 
 
+/** The best block chain as an array indexed by height */
+class CChain
+{
+private:
+    std::vector<CBlockIndex *> vChain;
+
+public:
+    /* Returns the block at the height specified or NULL if out of range */
+    CBlockIndex *operator[](int nHeight) const {
+        if((nHeight < 0) || (nHeight >= (int)vChain.size()))
+          return(NULL);
+        return(vChain[nHeight]);
+    }
+
+    CBlockIndex *Tip() const {
+        return(vChain.empty() ? NULL : vChain.back());
+    }
+
+    int Height() const {
+        return((int)vChain.size() - 1);
+    }
+
+    /* Replaces the blocks above the fork point with the ancestors of pindex */
+    void SetTip(CBlockIndex *pindex);
+};
+
+
+
 /** Used to marshal pointers into hashes for db storage. */
 class CDiskBlockIndex : public CBlockIndex
 {
@@ -1301,6 +1573,10 @@ public:
         READWRITE(nTime);
         READWRITE(nBits);
         READWRITE(nNonce);
+
+        /* The older records are upgraded when rewritten */
+        if(!(nType & SER_GETHASH) && (nVersion >= BLOCK_INDEX_POW_VERSION))
+          READWRITE(hashPoW);
     )
 
     uint256 GetBlockHash() const
@@ -1361,7 +1637,7 @@ public:
 
     explicit CBlockLocator(uint256 hashBlock)
     {
-        std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end())
             Set((*mi).second);
     }
@@ -1397,8 +1673,7 @@ public:
             vHave.push_back(pindex->GetBlockHash());
 
             // Exponentially larger steps back
-            for (int i = 0; pindex && i < nStep; i++)
-                pindex = pindex->pprev;
+            pindex = pindex->GetAncestor(pindex->nHeight - nStep);
             if (vHave.size() > 10)
                 nStep *= 2;
         }
@@ -1412,7 +1687,7 @@ public:
         int nStep = 1;
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1431,7 +1706,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1447,7 +1722,7 @@ public:
         // Find the first block the caller has in the main chain
         BOOST_FOREACH(const uint256& hash, vHave)
         {
-            std::map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hash);
+            CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
             if (mi != mapBlockIndex.end())
             {
                 CBlockIndex* pindex = (*mi).second;
@@ -1482,9 +1757,9 @@ public:
     std::map<COutPoint, CInPoint> mapNextTx;
 
     bool accept(CTxDB& txdb, CTransaction &tx,
-                bool fCheckInputs, bool* pfMissingInputs);
+                bool fCheckInputs, bool* pfMissingInputs, const uint256 *phash = NULL);
     bool addUnchecked(const uint256& hash, CTransaction &tx);
-    bool remove(CTransaction &tx);
+    bool remove(CTransaction &tx, const uint256 *phash = NULL);
     void clear();
     void queryHashes(std::vector<uint256>& vtxid);
 
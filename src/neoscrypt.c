@@ -2408,3 +2408,331 @@ uint cpu_vec_exts() {
     return(0);
 }
 #endif
+
+
+/* Multi-lane NeoScrypt:
+ * the core engine of neoscrypt() with several hashes interleaved word by
+ * word, i.e. word i of lane l is stored at [i * lanes + l], so every
+ * Salsa20 / ChaCha20 operation processes all lanes at once and only
+ * integerify() and the V look-ups are done per lane */
+
+#if defined(__GNUC__)
+
+typedef uint neoscrypt_v4 __attribute__((vector_size(16), may_alias));
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__clang__) || \
+  (__GNUC__ > 4) || ((__GNUC__ == 4) && (__GNUC_MINOR__ >= 9)))
+#define NEOSCRYPT_AVX2
+typedef uint neoscrypt_v8 __attribute__((vector_size(32), may_alias));
+#define NEOSCRYPT_ATTR_AVX2 __attribute__((target("avx2")))
+#if defined(__i386__)
+#define NEOSCRYPT_ATTR_SSE2 __attribute__((target("sse2")))
+#endif
+#endif
+
+#ifndef NEOSCRYPT_ATTR_SSE2
+#define NEOSCRYPT_ATTR_SSE2
+#endif
+
+#define NEOSCRYPT_SALSA_QR(a, b, c, d) \
+    t = x[a] + x[d]; x[b] ^= ROTL32(t,  7); \
+    t = x[b] + x[a]; x[c] ^= ROTL32(t,  9); \
+    t = x[c] + x[b]; x[d] ^= ROTL32(t, 13); \
+    t = x[d] + x[c]; x[a] ^= ROTL32(t, 18);
+
+#define NEOSCRYPT_CHACHA_QR(a, b, c, d) \
+    x[a] += x[b]; t = x[d] ^ x[a]; x[d] = ROTL32(t, 16); \
+    x[c] += x[d]; t = x[b] ^ x[c]; x[b] = ROTL32(t, 12); \
+    x[a] += x[b]; t = x[d] ^ x[a]; x[d] = ROTL32(t,  8); \
+    x[c] += x[d]; t = x[b] ^ x[c]; x[b] = ROTL32(t,  7);
+
+/* Salsa20 and ChaCha20, block mixer, SMix and the core engine
+ * for a vector type VT of L lanes */
+#define NEOSCRYPT_LANES_KERNEL(S, VT, L, ATTR) \
+\
+static ATTR void neoscrypt_salsa_##S(VT *X, uint rounds) { \
+    VT x[16], t; \
+    uint i; \
+\
+    for(i = 0; i < 16; i++) \
+      x[i] = X[i]; \
+    for(; rounds; rounds -= 2) { \
+        NEOSCRYPT_SALSA_QR( 0,  4,  8, 12); \
+        NEOSCRYPT_SALSA_QR( 5,  9, 13,  1); \
+        NEOSCRYPT_SALSA_QR(10, 14,  2,  6); \
+        NEOSCRYPT_SALSA_QR(15,  3,  7, 11); \
+        NEOSCRYPT_SALSA_QR( 0,  1,  2,  3); \
+        NEOSCRYPT_SALSA_QR( 5,  6,  7,  4); \
+        NEOSCRYPT_SALSA_QR(10, 11,  8,  9); \
+        NEOSCRYPT_SALSA_QR(15, 12, 13, 14); \
+    } \
+    for(i = 0; i < 16; i++) \
+      X[i] += x[i]; \
+} \
+\
+static ATTR void neoscrypt_chacha_##S(VT *X, uint rounds) { \
+    VT x[16], t; \
+    uint i; \
+\
+    for(i = 0; i < 16; i++) \
+      x[i] = X[i]; \
+    for(; rounds; rounds -= 2) { \
+        NEOSCRYPT_CHACHA_QR( 0,  4,  8, 12); \
+        NEOSCRYPT_CHACHA_QR( 1,  5,  9, 13); \
+        NEOSCRYPT_CHACHA_QR( 2,  6, 10, 14); \
+        NEOSCRYPT_CHACHA_QR( 3,  7, 11, 15); \
+        NEOSCRYPT_CHACHA_QR( 0,  5, 10, 15); \
+        NEOSCRYPT_CHACHA_QR( 1,  6, 11, 12); \
+        NEOSCRYPT_CHACHA_QR( 2,  7,  8, 13); \
+        NEOSCRYPT_CHACHA_QR( 3,  4,  9, 14); \
+    } \
+    for(i = 0; i < 16; i++) \
+      X[i] += x[i]; \
+} \
+\
+static ATTR void neoscrypt_blkmix_##S(VT *X, VT *Y, uint r, uint mixmode) { \
+    uint i, j, mixer, rounds; \
+    VT *B, *P; \
+\
+    mixer  = mixmode >> 8; \
+    rounds = mixmode & 0xFF; \
+\
+    for(i = 0; i < 2 * r; i++) { \
+        B = &X[16 * i]; \
+        P = i ? &X[16 * (i - 1)] : &X[16 * (2 * r - 1)]; \
+        for(j = 0; j < 16; j++) \
+          B[j] ^= P[j]; \
+        if(mixer) \
+          neoscrypt_chacha_##S(B, rounds); \
+        else \
+          neoscrypt_salsa_##S(B, rounds); \
+    } \
+    if(r > 1) { \
+        for(i = 0; i < 32 * r; i++) \
+          Y[i] = X[i]; \
+        for(i = 0; i < r; i++) { \
+            for(j = 0; j < 16; j++) { \
+                X[16 * i + j]       = Y[16 * 2 * i + j]; \
+                X[16 * (i + r) + j] = Y[16 * (2 * i + 1) + j]; \
+            } \
+        } \
+    } \
+} \
+\
+static ATTR void neoscrypt_smix_##S(VT *X, VT *Y, VT *V, uint N, uint r, \
+  uint mixmode) { \
+    const uint words = 32 * r; \
+    uint *x = (uint *) X, *v; \
+    uint i, j, k, l; \
+\
+    for(i = 0; i < N; i++) { \
+        for(k = 0; k < words; k++) \
+          V[i * words + k] = X[k]; \
+        neoscrypt_blkmix_##S(X, Y, r, mixmode); \
+    } \
+    for(i = 0; i < N; i++) { \
+        for(l = 0; l < L; l++) { \
+            /* integerify(X) mod N of this lane */ \
+            j = x[16 * (2 * r - 1) * L + l] & (N - 1); \
+            v = (uint *) &V[j * words]; \
+            for(k = 0; k < words; k++) \
+              x[k * L + l] ^= v[k * L + l]; \
+        } \
+        neoscrypt_blkmix_##S(X, Y, r, mixmode); \
+    } \
+} \
+\
+static ATTR void neoscrypt_core_##S(uint *XP, uint *ZP, uint *YP, uint *VP, \
+  uint N, uint r, uint dblmix, uint mixmode) { \
+    VT *X = (VT *) XP, *Z = (VT *) ZP, *Y = (VT *) YP, *V = (VT *) VP; \
+    uint i; \
+\
+    if(dblmix) { \
+        for(i = 0; i < 32 * r; i++) \
+          Z[i] = X[i]; \
+        neoscrypt_smix_##S(Z, Y, V, N, r, (mixmode | 0x0100)); \
+    } \
+    neoscrypt_smix_##S(X, Y, V, N, r, mixmode); \
+    if(dblmix) { \
+        for(i = 0; i < 32 * r; i++) \
+          X[i] ^= Z[i]; \
+    } \
+}
+
+NEOSCRYPT_LANES_KERNEL(x4, neoscrypt_v4, 4, NEOSCRYPT_ATTR_SSE2)
+
+#ifdef NEOSCRYPT_AVX2
+NEOSCRYPT_LANES_KERNEL(x8, neoscrypt_v8, 8, NEOSCRYPT_ATTR_AVX2)
+#endif
+
+/* Hashes 4 or 8 inputs of 80 bytes each at once;
+ * returns 0 if no memory available, 1 otherwise */
+static int neoscrypt_lanes(const uchar *password, uchar *output, uint profile,
+  uint lanes) {
+    const size_t mem_align = 0x40;
+    uint N = 128, r = 2, dblmix = 1, mixmode = 0x14;
+    uint kdf, words, i, l;
+    uint *X, *Y, *Z, *V, *T;
+    uchar *mem;
+
+    if(profile & 0x1) {
+        N = 1024;
+        r = 1;
+        dblmix = 0;
+        mixmode = 0x08;
+    }
+
+    if(profile >> 31) {
+        N = (1 << (((profile >> 8) & 0x1F) + 1));
+        r = (1 << ((profile >> 5) & 0x7));
+    }
+
+    words = 32 * r;
+
+    /* X, Z, Y and V of all lanes interleaved, T is a single lane buffer
+     * large enough for any KDF output */
+    mem = (uchar *) malloc((size_t)(N + 3) * words * lanes * sizeof(uint)
+      + MAX(words * sizeof(uint), 256) + mem_align);
+    if(!mem)
+      return(0);
+    X = (uint *) (((size_t)mem & ~(mem_align - 1)) + mem_align);
+    Z = &X[words * lanes];
+    Y = &X[2 * words * lanes];
+    V = &X[3 * words * lanes];
+    T = &V[(size_t)N * words * lanes];
+
+    kdf = (profile >> 1) & 0xF;
+
+    /* X = KDF(password, salt) for every lane */
+    for(l = 0; l < lanes; l++) {
+        const uchar *pass = &password[l * 80];
+
+        switch(kdf) {
+
+            default:
+            case(0x0):
+#ifdef NEOSCRYPT_OPT
+                neoscrypt_fastkdf_opt(pass, pass, (uchar *) T, 0);
+#else
+                neoscrypt_fastkdf(pass, 80, pass, 80, 32,
+                  (uchar *) T, r * 2 * BLOCK_SIZE);
+#endif
+                break;
+
+#ifdef NEOSCRYPT_SHA256
+            case(0x1):
+                neoscrypt_pbkdf2_sha256(pass, 80, pass, 80, 1,
+                  (uchar *) T, r * 2 * BLOCK_SIZE);
+                break;
+#endif
+
+        }
+
+        for(i = 0; i < words; i++)
+          X[i * lanes + l] = T[i];
+    }
+
+#ifdef NEOSCRYPT_AVX2
+    if(lanes == 8)
+      neoscrypt_core_x8(X, Z, Y, V, N, r, dblmix, mixmode);
+    else
+#endif
+      neoscrypt_core_x4(X, Z, Y, V, N, r, dblmix, mixmode);
+
+    /* output = KDF(password, X) for every lane */
+    for(l = 0; l < lanes; l++) {
+        const uchar *pass = &password[l * 80];
+
+        for(i = 0; i < words; i++)
+          T[i] = X[i * lanes + l];
+
+        switch(kdf) {
+
+            default:
+            case(0x0):
+#ifdef NEOSCRYPT_OPT
+                neoscrypt_fastkdf_opt(pass, (uchar *) T, &output[l * 32], 1);
+#else
+                neoscrypt_fastkdf(pass, 80, (uchar *) T,
+                  r * 2 * BLOCK_SIZE, 32, &output[l * 32], 32);
+#endif
+                break;
+
+#ifdef NEOSCRYPT_SHA256
+            case(0x1):
+                neoscrypt_pbkdf2_sha256(pass, 80, (uchar *) T,
+                  r * 2 * BLOCK_SIZE, 1, &output[l * 32], 32);
+                break;
+#endif
+
+        }
+    }
+
+    free(mem);
+
+    return(1);
+}
+
+#endif /* __GNUC__ */
+
+
+/* The number of hashes processed at once by neoscrypt_batch():
+ * 8 with AVX2, 4 with SSE2 or another native vector unit, 1 otherwise;
+ * called concurrently, so the value is published by a single atomic store
+ * of the final count and may be computed more than once harmlessly */
+uint neoscrypt_batch_lanes() {
+#if defined(__GNUC__)
+    static uint lanes = 0;
+    uint n = __atomic_load_n(&lanes, __ATOMIC_RELAXED);
+
+    if(!n) {
+        uint flags = cpu_vec_exts();
+
+#if !defined(__i386__)
+        /* SSE2 is always present on AMD64,
+         * the generic vectors map to the native vector unit elsewhere */
+        flags |= 0x00000020;
+#endif
+        n = 1;
+        if(flags & 0x00000020)
+          n = 4;
+#ifdef NEOSCRYPT_AVX2
+        if(flags & 0x00010000)
+          n = 8;
+#endif
+        __atomic_store_n(&lanes, n, __ATOMIC_RELAXED);
+    }
+
+    return(n);
+#else
+    return(1);
+#endif
+}
+
+/* Batch NeoScrypt:
+ * hashes count inputs of 80 bytes each stored back to back into count
+ * outputs of 32 bytes each, e.g. the same block header with consecutive
+ * nonces; the results are identical to those of neoscrypt() */
+void neoscrypt_batch(const uchar *password, uchar *output, uint profile,
+  uint count) {
+    uint lanes = neoscrypt_batch_lanes();
+
+#if defined(__GNUC__)
+    while(count >= 4) {
+        if(count < lanes)
+          lanes = 4;
+        if((lanes < 4) || !neoscrypt_lanes(password, output, profile, lanes))
+          break;
+        password = &password[lanes * 80];
+        output   = &output[lanes * 32];
+        count   -= lanes;
+    }
+#endif
+
+    /* The remainder one by one */
+    for(; count; count--) {
+        neoscrypt(password, output, profile);
+        password = &password[80];
+        output   = &output[32];
+    }
+}
@@ -5,6 +5,11 @@ extern "C" {
 void neoscrypt(const unsigned char *password, unsigned char *output,
   unsigned int profile);
 
+void neoscrypt_batch(const unsigned char *password, unsigned char *output,
+  unsigned int profile, unsigned int count);
+
+unsigned int neoscrypt_batch_lanes(void);
+
 void neoscrypt_blake2s(const void *input, const unsigned int input_size,
   const void *key, const unsigned char key_size,
   void *output, const unsigned char output_size);
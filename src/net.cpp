@@ -9,6 +9,11 @@
 #include <string.h>
 #endif
 
+#if defined(__linux__)
+#include <sys/epoll.h>
+#define USE_EPOLL 1
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniwget.h>
 #include <miniupnpc/miniupnpc.h>
@@ -31,6 +36,7 @@ using namespace boost;
 static const int MAX_OUTBOUND_CONNECTIONS = 32;
 
 extern uint nMsgSleep;
+extern uint nMsgThreads;
 extern CWallet *pwalletMain;
 
 void ThreadMessageHandler2(void* parg);
@@ -111,6 +117,24 @@ void CNode::PushGetBlocks(CBlockIndex *pindexBegin, uint256 hashEnd) {
       pindexBegin->nHeight, addr.ToString().c_str());
 }
 
+bool CNode::PushGetHeaders(CBlockIndex *pindexBegin, uint256 hashEnd) {
+    uint nCurrentTime = (uint)GetTime();
+
+    /* Time limit for asking a particular peer;
+     * must stay above the limit enforced by the getheaders handler */
+    if((nCurrentTime - 10U) < nGetheadersAskTime)
+      return(false);
+    else
+      nGetheadersAskTime = nCurrentTime;
+
+    PushMessage("getheaders", CBlockLocator(pindexBegin), hashEnd);
+
+    printf("getheaders height %d sent to peer %s\n",
+      pindexBegin->nHeight, addr.ToString().c_str());
+
+    return(true);
+}
+
 // find 'best' local address for a particular peer
 bool GetLocal(CService& addr, const CNetAddr *paddrPeer)
 {
@@ -707,11 +731,58 @@ void ThreadSocketHandler(void* parg)
     printf("ThreadSocketHandler exited\n");
 }
 
+#ifdef USE_EPOLL
+static const int EPOLL_MAX_EVENTS = 256;
+
+/* Registers the socket of a node with epoll or updates the events of interest */
+static void EpollUpdate(int hEpoll, CNode *pnode, uint nEvents) {
+    struct epoll_event event;
+    int nRet;
+
+    event.events = nEvents;
+    event.data.ptr = pnode;
+
+    nRet = epoll_ctl(hEpoll, pnode->nPollEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+      pnode->hSocket, &event);
+    /* The descriptor may have been closed and reused by another thread meanwhile */
+    if(nRet && (errno == EEXIST))
+      nRet = epoll_ctl(hEpoll, EPOLL_CTL_MOD, pnode->hSocket, &event);
+    if(nRet) {
+        printf("socket epoll_ctl error %d\n", errno);
+        return;
+    }
+
+    /* Send readiness is reported again on registration */
+    if(!(nEvents & EPOLLOUT))
+      pnode->fSendReady = false;
+    pnode->nPollEvents = nEvents;
+}
+#endif
+
 void ThreadSocketHandler2(void* parg)
 {
     printf("ThreadSocketHandler started\n");
     list<CNode*> vNodesDisconnected;
     unsigned int nPrevNodeCount = 0;
+    /* Some sockets have been serviced partially and can be serviced again
+     * without waiting; those with buffers locked by other threads can't */
+    bool fPending = false;
+
+#ifdef USE_EPOLL
+    /* Not limited by FD_SETSIZE; select() is a fall back */
+    int hEpoll = epoll_create(EPOLL_MAX_EVENTS);
+    if(hEpoll == -1) {
+        printf("socket epoll_create error %d, using select()\n", errno);
+    } else {
+        BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = NULL;
+            if(epoll_ctl(hEpoll, EPOLL_CTL_ADD, hListenSocket, &event))
+              printf("socket epoll_ctl error %d\n", errno);
+        }
+    }
+#endif
 
     while(true) {
         //
@@ -787,68 +858,135 @@ void ThreadSocketHandler2(void* parg)
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
+        vector<SOCKET> vListenReady;
 
-        BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket, &fdsetRecv);
-            hSocketMax = max(hSocketMax, hListenSocket);
-            have_fds = true;
-        }
-        {
-            LOCK(cs_vNodes);
-            BOOST_FOREACH(CNode* pnode, vNodes)
+#ifdef USE_EPOLL
+        if(hEpoll != -1) {
+            /* Register new sockets; send readiness is of interest
+             * only while there is something to send */
             {
-                if (pnode->hSocket == INVALID_SOCKET)
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode *pnode, vNodes) {
+                    if(pnode->hSocket == INVALID_SOCKET)
+                      continue;
+                    uint nEvents = EPOLLIN | EPOLLET;
+                    {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if(lockSend ? !pnode->vSend.empty() : (pnode->nPollEvents & EPOLLOUT))
+                          nEvents |= EPOLLOUT;
+                    }
+                    if(nEvents != pnode->nPollEvents)
+                      EpollUpdate(hEpoll, pnode, nEvents);
+                }
+            }
+
+            struct epoll_event events[EPOLL_MAX_EVENTS];
+            vnThreadsRunning[THREAD_SOCKETHANDLER]--;
+            int nEvents = epoll_wait(hEpoll, events, EPOLL_MAX_EVENTS, fPending ? 0 : 50);
+            vnThreadsRunning[THREAD_SOCKETHANDLER]++;
+            fPending = false;
+            if(fShutdown)
+              return;
+            if(nEvents < 0) {
+                if(errno != EINTR)
+                  printf("socket epoll_wait error %d\n", errno);
+                Sleep(50);
+            }
+
+            for(int i = 0; i < nEvents; i++) {
+                CNode *pnode = (CNode *)events[i].data.ptr;
+                if(!pnode) {
+                    /* Listening sockets are level triggered */
+                    vListenReady = vhListenSocket;
                     continue;
-                FD_SET(pnode->hSocket, &fdsetRecv);
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = max(hSocketMax, pnode->hSocket);
+                }
+                if(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP))
+                  pnode->fRecvReady = true;
+                if(events[i].events & EPOLLOUT)
+                  pnode->fSendReady = true;
+            }
+        } else
+#endif
+        {
+            struct timeval timeout;
+            timeout.tv_sec  = 0;
+            timeout.tv_usec = fPending ? 0 : 50000; // frequency to poll pnode->vSend
+            fPending = false;
+
+            fd_set fdsetRecv;
+            fd_set fdsetSend;
+            fd_set fdsetError;
+            FD_ZERO(&fdsetRecv);
+            FD_ZERO(&fdsetSend);
+            FD_ZERO(&fdsetError);
+            SOCKET hSocketMax = 0;
+            bool have_fds = false;
+
+            BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket) {
+                FD_SET(hListenSocket, &fdsetRecv);
+                hSocketMax = max(hSocketMax, hListenSocket);
                 have_fds = true;
+            }
+            {
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode* pnode, vNodes)
+                {
+                    if (pnode->hSocket == INVALID_SOCKET)
+                        continue;
+                    FD_SET(pnode->hSocket, &fdsetRecv);
+                    FD_SET(pnode->hSocket, &fdsetError);
+                    hSocketMax = max(hSocketMax, pnode->hSocket);
+                    have_fds = true;
+                    {
+                        TRY_LOCK(pnode->cs_vSend, lockSend);
+                        if (lockSend && !pnode->vSend.empty())
+                            FD_SET(pnode->hSocket, &fdsetSend);
+                    }
+                }
+            }
+
+            vnThreadsRunning[THREAD_SOCKETHANDLER]--;
+            int nSelect = select(have_fds ? hSocketMax + 1 : 0,
+                                 &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+            vnThreadsRunning[THREAD_SOCKETHANDLER]++;
+            if (fShutdown)
+                return;
+            if (nSelect == SOCKET_ERROR)
+            {
+                if (have_fds)
                 {
-                    TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSend.empty())
-                        FD_SET(pnode->hSocket, &fdsetSend);
+                    int nErr = WSAGetLastError();
+                    printf("socket select error %d\n", nErr);
+                    for (unsigned int i = 0; i <= hSocketMax; i++)
+                        FD_SET(i, &fdsetRecv);
                 }
+                FD_ZERO(&fdsetSend);
+                FD_ZERO(&fdsetError);
+                Sleep(timeout.tv_usec/1000);
             }
-        }
 
-        vnThreadsRunning[THREAD_SOCKETHANDLER]--;
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
-        vnThreadsRunning[THREAD_SOCKETHANDLER]++;
-        if (fShutdown)
-            return;
-        if (nSelect == SOCKET_ERROR)
-        {
-            if (have_fds)
+            BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket) {
+                if(FD_ISSET(hListenSocket, &fdsetRecv))
+                  vListenReady.push_back(hListenSocket);
+            }
             {
-                int nErr = WSAGetLastError();
-                printf("socket select error %d\n", nErr);
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LOCK(cs_vNodes);
+                BOOST_FOREACH(CNode *pnode, vNodes) {
+                    if(pnode->hSocket == INVALID_SOCKET)
+                      continue;
+                    pnode->fRecvReady = FD_ISSET(pnode->hSocket, &fdsetRecv) ||
+                      FD_ISSET(pnode->hSocket, &fdsetError);
+                    pnode->fSendReady = FD_ISSET(pnode->hSocket, &fdsetSend);
+                }
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            Sleep(timeout.tv_usec/1000);
         }
 
 
         //
         // Accept new connections
         //
-        BOOST_FOREACH(SOCKET hListenSocket, vhListenSocket)
-        if (hListenSocket != INVALID_SOCKET && FD_ISSET(hListenSocket, &fdsetRecv))
+        BOOST_FOREACH(SOCKET hListenSocket, vListenReady)
+        if (hListenSocket != INVALID_SOCKET)
         {
 #ifdef USE_IPV6
             struct sockaddr_storage sockaddr;
@@ -923,7 +1061,7 @@ void ThreadSocketHandler2(void* parg)
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            if (pnode->fRecvReady)
             {
                 TRY_LOCK(pnode->cs_vRecv, lockRecv);
                 if (lockRecv)
@@ -948,6 +1086,9 @@ void ThreadSocketHandler2(void* parg)
                             pnode->nLastRecv = GetTime();
                             pnode->nRxBytes += nBytes;
                             pnode->RecordBytesRx(nBytes);
+                            /* A short read drains the socket buffer */
+                            if(nBytes < (int)sizeof(pchBuf))
+                              pnode->fRecvReady = false;
                         }
                         else if (nBytes == 0)
                         {
@@ -959,6 +1100,7 @@ void ThreadSocketHandler2(void* parg)
                         else if (nBytes < 0)
                         {
                             // error
+                            pnode->fRecvReady = false;
                             int nErr = WSAGetLastError();
                             if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
@@ -968,6 +1110,9 @@ void ThreadSocketHandler2(void* parg)
                             }
                         }
                     }
+                    /* Edge triggered sockets not serviced completely yet */
+                    if(pnode->fRecvReady)
+                      fPending = true;
                 }
             }
 
@@ -976,7 +1121,7 @@ void ThreadSocketHandler2(void* parg)
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (pnode->fSendReady)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
                 if (lockSend)
@@ -987,6 +1132,9 @@ void ThreadSocketHandler2(void* parg)
                         int nBytes = send(pnode->hSocket, &vSend[0], vSend.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
                         if (nBytes > 0)
                         {
+                            /* A short write fills the socket buffer */
+                            if(nBytes < (int)vSend.size())
+                              pnode->fSendReady = false;
                             vSend.erase(vSend.begin(), vSend.begin() + nBytes);
                             pnode->nLastSend = GetTime();
                             pnode->nTxBytes += nBytes;
@@ -995,6 +1143,7 @@ void ThreadSocketHandler2(void* parg)
                         else if (nBytes < 0)
                         {
                             // error
+                            pnode->fSendReady = false;
                             int nErr = WSAGetLastError();
                             if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
                             {
@@ -1002,6 +1151,8 @@ void ThreadSocketHandler2(void* parg)
                                 pnode->CloseSocketDisconnect();
                             }
                         }
+                        if(pnode->fSendReady && !vSend.empty())
+                          fPending = true;
                     }
                 }
             }
@@ -1604,30 +1755,48 @@ bool OpenNetworkConnection(const CAddress& addrConnect, CSemaphoreGrant *grantOu
 
 
 
+/* The message handler workers update their thread count concurrently */
+static CCriticalSection cs_THREAD_MESSAGEHANDLER;
+
 void ThreadMessageHandler(void* parg)
 {
     // Make this thread recognisable as the message handling thread
     RenameThread("pxc-msghand");
 
-    try
     {
+        LOCK(cs_THREAD_MESSAGEHANDLER);
         vnThreadsRunning[THREAD_MESSAGEHANDLER]++;
+    }
+    try
+    {
         ThreadMessageHandler2(parg);
+        LOCK(cs_THREAD_MESSAGEHANDLER);
         vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
     }
     catch (std::exception& e) {
-        vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        {
+            LOCK(cs_THREAD_MESSAGEHANDLER);
+            vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        }
         PrintException(&e, "ThreadMessageHandler()");
     } catch (...) {
-        vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        {
+            LOCK(cs_THREAD_MESSAGEHANDLER);
+            vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        }
         PrintException(NULL, "ThreadMessageHandler()");
     }
     printf("ThreadMessageHandler exited\n");
 }
 
+/* A pool of message handler workers; any worker may serve any peer,
+ * but a peer is served by a single worker at a time */
 void ThreadMessageHandler2(void* parg)
 {
-    printf("ThreadMessageHandler started\n");
+    uint nWorker = *(uint *)parg;
+    delete (uint *)parg;
+
+    printf("ThreadMessageHandler %u started\n", nWorker);
     SetThreadPriority(THREAD_PRIORITY_BELOW_NORMAL);
     while (!fShutdown)
     {
@@ -1639,30 +1808,36 @@ void ThreadMessageHandler2(void* parg)
                 pnode->AddRef();
         }
 
-        /* Random peer */
+        /* Random peer; selected by the 1st worker only */
         CNode *pnodeTrickle = NULL;
-        if(!vNodesCopy.empty())
+        if(!nWorker && !vNodesCopy.empty())
           pnodeTrickle = vNodesCopy[GetRand(vNodesCopy.size())];
 
-        BOOST_FOREACH(CNode* pnode, vNodesCopy)
-        {
-            // Receive messages
-            {
-                TRY_LOCK(pnode->cs_vRecv, lockRecv);
-                if (lockRecv)
-                    ProcessMessages(pnode);
-            }
-            if (fShutdown)
-                return;
+        /* Workers start at different peers to spread the load */
+        uint nNodes = vNodesCopy.size();
+        uint nOffset = nNodes ? (nWorker * nNodes / nMsgThreads) : 0;
+
+        for(uint i = 0; i < nNodes; i++) {
+            CNode *pnode = vNodesCopy[(nOffset + i) % nNodes];
 
-            // Send messages
+            TRY_LOCK(pnode->cs_process, lockProcess);
+            if(!lockProcess)
+              continue;
+
+            /* Receive messages */
             {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    SendMessages(pnode, pnode == pnodeTrickle);
+                TRY_LOCK(pnode->cs_vRecv, lockRecv);
+                if(lockRecv)
+                  ProcessMessages(pnode);
             }
-            if (fShutdown)
-                return;
+            if(fShutdown)
+              return;
+
+            /* Send messages; cs_vSend is taken per message,
+             * so relaying to this peer never waits for us */
+            SendMessages(pnode, pnode == pnodeTrickle);
+            if(fShutdown)
+              return;
         }
 
         {
@@ -1674,11 +1849,17 @@ void ThreadMessageHandler2(void* parg)
         // Wait and allow messages to bunch up.
         // Reduce vnThreadsRunning so StopNode has permission to exit while
         // we're sleeping, but we must always check fShutdown after doing this.
-        vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        {
+            LOCK(cs_THREAD_MESSAGEHANDLER);
+            vnThreadsRunning[THREAD_MESSAGEHANDLER]--;
+        }
         Sleep((int64)nMsgSleep);
-        if (fRequestShutdown)
+        if (!nWorker && fRequestShutdown)
             StartShutdown();
-        vnThreadsRunning[THREAD_MESSAGEHANDLER]++;
+        {
+            LOCK(cs_THREAD_MESSAGEHANDLER);
+            vnThreadsRunning[THREAD_MESSAGEHANDLER]++;
+        }
         if (fShutdown)
             return;
     }
@@ -1898,8 +2079,10 @@ void StartNode(void* parg)
         printf("Error: NewThread(ThreadOpenConnections) failed\n");
 
     // Process messages
-    if (!NewThread(ThreadMessageHandler, NULL))
-        printf("Error: NewThread(ThreadMessageHandler) failed\n");
+    for(uint i = 0; i < nMsgThreads; i++) {
+        if(!NewThread(ThreadMessageHandler, new uint(i)))
+          printf("Error: NewThread(ThreadMessageHandler) failed\n");
+    }
 
     // Dump network addresses
     if (!NewThread(ThreadDumpAddress, NULL))
@@ -1921,6 +2104,9 @@ bool StopNode()
     printf("StopNode()\n");
     fShutdown = true;
     nTransactionsUpdated++;
+    ThreadScriptCheckQuit();
+    ThreadPoWCheckQuit();
+    ThreadBlockWriterQuit();
     int64 nStart = GetTime();
     if (semOutbound)
         for (int i=0; i<MAX_OUTBOUND_CONNECTIONS; i++)
@@ -1949,6 +2135,9 @@ bool StopNode()
     if (vnThreadsRunning[THREAD_ADDEDCONNECTIONS] > 0) printf("ThreadOpenAddedConnections still running\n");
     if (vnThreadsRunning[THREAD_DUMPADDRESS] > 0) printf("ThreadDumpAddresses still running\n");
     if(vnThreadsRunning[THREAD_NTP] > 0) printf("ThreadNtpPoller still running\n");
+    if(vnThreadsRunning[THREAD_SCRIPTCHECK] > 0) printf("ThreadScriptCheck still running\n");
+    if(vnThreadsRunning[THREAD_POWCHECK] > 0) printf("ThreadPoWCheck still running\n");
+    if(vnThreadsRunning[THREAD_BLOCKWRITER] > 0) printf("ThreadBlockWriter still running\n");
     while (vnThreadsRunning[THREAD_MESSAGEHANDLER] > 0 || vnThreadsRunning[THREAD_RPCHANDLER] > 0)
         Sleep(20);
     Sleep(50);
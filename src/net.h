@@ -20,6 +20,7 @@
 
 #include <boost/array.hpp>
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "mruset.h"
 #include "netbase.h"
@@ -31,9 +32,13 @@
 
 class CRequestTracker;
 class CNode;
+class CBlock;
 class CBlockIndex;
 extern int nBestHeight;
 
+/* Blocks or block headers decoded from a message */
+typedef boost::shared_ptr<std::vector<CBlock> > CBlocksRef;
+
 inline unsigned int ReceiveBufferSize() { return 1000*GetArg("-maxreceivebuffer", 5*1000); }
 inline unsigned int SendBufferSize() { return 1000*GetArg("-maxsendbuffer", 1*1000); }
 
@@ -115,10 +120,16 @@ enum threadId
     THREAD_DUMPADDRESS,
     THREAD_RPCHANDLER,
     THREAD_NTP,
+    THREAD_SCRIPTCHECK,
+    THREAD_POWCHECK,
+    THREAD_BLOCKWRITER,
 
     THREAD_MAX
 };
 
+/* Maximum number of message handler threads */
+static const uint MAX_MSGHANDLER_THREADS = 16;
+
 extern bool fClient;
 extern bool fDiscover;
 extern bool fUseUPnP;
@@ -173,6 +184,8 @@ public:
     CDataStream vRecv;
     CCriticalSection cs_vSend;
     CCriticalSection cs_vRecv;
+    /* Held by the message handler worker serving this peer */
+    CCriticalSection cs_process;
     int64 nLastSend;
     int64 nLastRecv;
     int64 nLastSendEmpty;
@@ -192,6 +205,17 @@ public:
     bool fNetworkNode;
     bool fSuccessfullyConnected;
     bool fDisconnect;
+    /* Socket readiness as seen by the socket handler */
+    bool fRecvReady;
+    bool fSendReady;
+    /* Events the socket is registered for with epoll, if any */
+    uint nPollEvents;
+    /* A message put aside while cs_main is busy; protected by cs_vRecv */
+    std::string strDeferredCommand;
+    CDataStream vDeferredMsg;
+    /* Whether the proof-of-work stage has run on it and what it has decoded */
+    bool fDeferredPoWChecked;
+    CBlocksRef pDeferredBlocks;
     CSemaphoreGrant grantOutbound;
 protected:
     int nRefCount;
@@ -208,15 +232,19 @@ public:
     CCriticalSection cs_mapRequests;
     uint nGetblocksAskTime;
     uint nGetblocksReceiveTime;
+    uint nGetheadersAskTime;
     uint nGetheadersReceiveTime;
     uint nPingTime;
     int64 nPingStamp;
     int64 nPongStamp;
     int nStartingHeight;
+    /* Block requests of the headers-first sync assigned to this peer */
+    int nBlocksInFlight;
 
     // flood relay
     std::vector<CAddress> vAddrToSend;
     std::set<CAddress> setAddrKnown;
+    CCriticalSection cs_vAddrToSend;
     bool fGetAddr;
     std::set<uint256> setKnown;
     /* Known sent sync-checkpoint */
@@ -228,7 +256,8 @@ public:
     CCriticalSection cs_inventory;
     std::multimap<int64, CInv> mapAskFor;
 
-    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : vSend(SER_NETWORK, MIN_PROTO_VERSION), vRecv(SER_NETWORK, MIN_PROTO_VERSION)
+    CNode(SOCKET hSocketIn, CAddress addrIn, std::string addrNameIn = "", bool fInboundIn=false) : vSend(SER_NETWORK, MIN_PROTO_VERSION), vRecv(SER_NETWORK, MIN_PROTO_VERSION),
+      vDeferredMsg(SER_NETWORK, MIN_PROTO_VERSION)
     {
         nServices = 0;
         hSocket = hSocketIn;
@@ -250,15 +279,21 @@ public:
         fNetworkNode = false;
         fSuccessfullyConnected = false;
         fDisconnect = false;
+        fRecvReady = false;
+        fSendReady = false;
+        nPollEvents = 0;
+        fDeferredPoWChecked = false;
         nRefCount = 0;
         nReleaseTime = 0;
         nGetblocksAskTime = 0;
         nGetblocksReceiveTime = 0;
+        nGetheadersAskTime = 0;
         nGetheadersReceiveTime = 0;
         nPingTime = 0;
         nPingStamp = 0;
         nPongStamp = 0;
         nStartingHeight = -1;
+        nBlocksInFlight = 0;
         fGetAddr = false;
         nMisbehavior = 0;
         hashCheckpointKnown = 0;
@@ -313,6 +348,7 @@ public:
 
     void AddAddressKnown(const CAddress& addr)
     {
+        LOCK(cs_vAddrToSend);
         setAddrKnown.insert(addr);
     }
 
@@ -321,6 +357,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (addr.IsValid() && !setAddrKnown.count(addr))
             vAddrToSend.push_back(addr);
     }
@@ -646,6 +683,7 @@ public:
 
 
     void PushGetBlocks(CBlockIndex* pindexBegin, uint256 hashEnd);
+    bool PushGetHeaders(CBlockIndex *pindexBegin, uint256 hashEnd);
     bool IsSubscribed(unsigned int nChannel);
     void Subscribe(unsigned int nChannel, unsigned int nHops=0);
     void CancelSubscribe(unsigned int nChannel);
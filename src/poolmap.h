@@ -0,0 +1,190 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef POOLMAP_H
+#define POOLMAP_H
+
+#include <algorithm>
+#include <iterator>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <openssl/rand.h>
+
+#include "uint256.h"
+
+/** STL-like map of uint256 keys to objects owned by the container.
+ * The objects are default constructed on insertion and allocated from
+ * a pool of fixed size chunks, so their addresses as well as the keys
+ * remain valid until the map is cleared; there is no removal of single
+ * elements. Lookups go through an open addressed hash table with linear
+ * probing, the keys are hashed with a per process random salt, so
+ * the table cannot be degraded by crafted keys. Iteration follows
+ * the order of insertion */
+template<typename T> class poolmap
+{
+public:
+    typedef uint256 key_type;
+    typedef std::pair<const uint256, T *> value_type;
+    typedef size_t size_type;
+
+private:
+    poolmap(const poolmap &);
+    void operator=(const poolmap &);
+
+    enum { CHUNK_BITS = 12, CHUNK_SIZE = (1 << CHUNK_BITS) };
+    enum { SLOT_EMPTY = 0xFFFFFFFF };
+
+    /* The key with a pointer to the object stored right after */
+    struct entry {
+        value_type item;
+        T object;
+        entry(const uint256 &key) : item(key, &object), object() {}
+    };
+
+    /* A part of the salted hash is kept to skip most of the key comparisons */
+    struct slot {
+        uint nIndex;
+        uint nTag;
+    };
+
+    std::vector<entry *> vChunks;
+    std::vector<slot> vSlots;
+    uint nCount;
+    uint64 nSalt[2];
+
+    entry *get(uint nIndex) const {
+        return(&vChunks[nIndex >> CHUNK_BITS][nIndex & (CHUNK_SIZE - 1)]);
+    }
+
+    uint64 hash(const uint256 &key) const {
+        uint64 h = (key.Get64(0) ^ nSalt[0]) * 0x9E3779B97F4A7C15ULL;
+        h = (h ^ key.Get64(1) ^ nSalt[1]) * 0xC2B2AE3D27D4EB4FULL;
+        return(h ^ (h >> 32));
+    }
+
+    /* Returns the slot either holding the key or to be used for it */
+    size_type probe(const uint256 &key, uint64 h) const {
+        size_type nMask = vSlots.size() - 1;
+        uint nTag = (uint)(h >> 32);
+        for(size_type i = (size_type)h & nMask; ; i = (i + 1) & nMask) {
+            const slot &s = vSlots[i];
+            if((s.nIndex == SLOT_EMPTY) ||
+              ((s.nTag == nTag) && (get(s.nIndex)->item.first == key)))
+              return(i);
+        }
+    }
+
+    void rehash(size_type nSlots) {
+        slot empty = { SLOT_EMPTY, 0 };
+        vSlots.assign(nSlots, empty);
+        for(uint i = 0; i < nCount; i++) {
+            const uint256 &key = get(i)->item.first;
+            uint64 h = hash(key);
+            slot &s = vSlots[probe(key, h)];
+            s.nIndex = i;
+            s.nTag = (uint)(h >> 32);
+        }
+    }
+
+public:
+    /** Iterates over the elements in the order of insertion */
+    class iterator {
+    private:
+        const poolmap *pmap;
+        uint nIndex;
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename poolmap::value_type value_type;
+        typedef ptrdiff_t difference_type;
+        typedef value_type *pointer;
+        typedef value_type &reference;
+
+        iterator() : pmap(NULL), nIndex(0) {}
+        iterator(const poolmap *pmapIn, uint nIndexIn) : pmap(pmapIn), nIndex(nIndexIn) {}
+        value_type &operator*() const { return(pmap->get(nIndex)->item); }
+        value_type *operator->() const { return(&pmap->get(nIndex)->item); }
+        iterator &operator++() { nIndex++; return(*this); }
+        iterator operator++(int) { iterator ret = *this; nIndex++; return(ret); }
+        bool operator==(const iterator &it) const { return(nIndex == it.nIndex); }
+        bool operator!=(const iterator &it) const { return(nIndex != it.nIndex); }
+    };
+    typedef iterator const_iterator;
+
+    poolmap() : nCount(0) {
+        nSalt[0] = 0x736F6D6570736575ULL;
+        nSalt[1] = 0x646F72616E646F6DULL;
+        RAND_bytes((uchar *) nSalt, sizeof(nSalt));
+    }
+
+    ~poolmap() { clear(); }
+
+    iterator begin() const { return(iterator(this, 0)); }
+    iterator end() const { return(iterator(this, nCount)); }
+    size_type size() const { return(nCount); }
+    bool empty() const { return(!nCount); }
+
+    iterator find(const uint256 &key) const {
+        if(!nCount)
+          return(end());
+        const slot &s = vSlots[probe(key, hash(key))];
+        if(s.nIndex == SLOT_EMPTY)
+          return(end());
+        return(iterator(this, s.nIndex));
+    }
+
+    size_type count(const uint256 &key) const {
+        return(find(key) != end());
+    }
+
+    /* Unlike std::map, never inserts; returns NULL if the key is unknown */
+    T *operator[](const uint256 &key) const {
+        iterator it = find(key);
+        return((it != end()) ? it->second : NULL);
+    }
+
+    /* Inserts a default constructed object unless the key is known already */
+    std::pair<iterator, bool> insert(const uint256 &key) {
+        /* Keep the load factor below 3/4 */
+        if((nCount + 1) * 4 > vSlots.size() * 3)
+          rehash(std::max((size_type)1024, vSlots.size() * 2));
+
+        uint64 h = hash(key);
+        slot &s = vSlots[probe(key, h)];
+        if(s.nIndex != SLOT_EMPTY)
+          return(std::make_pair(iterator(this, s.nIndex), false));
+
+        if(nCount == vChunks.size() * CHUNK_SIZE)
+          vChunks.push_back((entry *) ::operator new(sizeof(entry) * CHUNK_SIZE));
+        new(get(nCount)) entry(key);
+
+        s.nIndex = nCount;
+        s.nTag = (uint)(h >> 32);
+
+        return(std::make_pair(iterator(this, nCount++), true));
+    }
+
+    /* Prepares the hash table for the number of elements specified */
+    void reserve(size_type nSize) {
+        size_type nSlots = 1024;
+        while(nSlots * 3 < nSize * 4)
+          nSlots *= 2;
+        if(nSlots > vSlots.size())
+          rehash(nSlots);
+    }
+
+    /* Destroys all objects and releases the memory */
+    void clear() {
+        for(uint i = 0; i < nCount; i++)
+          get(i)->~entry();
+        for(uint i = 0; i < vChunks.size(); i++)
+          ::operator delete(vChunks[i]);
+        vChunks.clear();
+        vSlots.clear();
+        nCount = 0;
+    }
+};
+
+#endif /* POOLMAP_H */
@@ -94,7 +94,8 @@ QT_TRANSLATE_NOOP("pxc-core", "Connect to a node to retrieve peer addresses, and
 QT_TRANSLATE_NOOP("pxc-core", "Discover own IP address (default: 1 when listening and no -externalip)"),
 QT_TRANSLATE_NOOP("pxc-core", "Don't generate coins"),
 QT_TRANSLATE_NOOP("pxc-core", "Done loading"),
-QT_TRANSLATE_NOOP("pxc-core", "Error loading blkindex.dat"),
+QT_TRANSLATE_NOOP("pxc-core", "Download block headers first and block bodies from several peers in parallel (default: 1)"),
+QT_TRANSLATE_NOOP("pxc-core", "Error loading the block index"),
 QT_TRANSLATE_NOOP("pxc-core", "Error loading wallet.dat"),
 QT_TRANSLATE_NOOP("pxc-core", "Error loading wallet.dat: Wallet corrupted"),
 QT_TRANSLATE_NOOP("pxc-core", "Error loading wallet.dat: Wallet requires newer version of Phoenixcoin"),
@@ -103,6 +104,7 @@ QT_TRANSLATE_NOOP("pxc-core", "Error: Transaction creation failed  "),
 QT_TRANSLATE_NOOP("pxc-core", "Error: Wallet locked, unable to create transaction  "),
 QT_TRANSLATE_NOOP("pxc-core", "Error: could not start node"),
 QT_TRANSLATE_NOOP("pxc-core", "Failed to listen on any port. Use -listen=0 if you want this."),
+QT_TRANSLATE_NOOP("pxc-core", "Failed to set the block files aside for reindexing"),
 QT_TRANSLATE_NOOP("pxc-core", "Fee per KB to add to transactions you send"),
 QT_TRANSLATE_NOOP("pxc-core", "Find peers using DNS lookup (default: 1 unless -connect)"),
 QT_TRANSLATE_NOOP("pxc-core", "Find peers using internet relay chat (default: 0)"),
@@ -120,9 +122,11 @@ QT_TRANSLATE_NOOP("pxc-core", "Invalid amount for -paytxfee=<amount>: '%s'"),
 QT_TRANSLATE_NOOP("pxc-core", "Invalid amount"),
 QT_TRANSLATE_NOOP("pxc-core", "List commands"),
 QT_TRANSLATE_NOOP("pxc-core", "Listen for connections on <port> (default: 8333 or testnet: 18333)"),
+QT_TRANSLATE_NOOP("pxc-core", "Load the block index from a snapshot written at shutdown (default: 1)"),
 QT_TRANSLATE_NOOP("pxc-core", "Loading addresses..."),
 QT_TRANSLATE_NOOP("pxc-core", "Loading block index..."),
 QT_TRANSLATE_NOOP("pxc-core", "Loading wallet..."),
+QT_TRANSLATE_NOOP("pxc-core", "Maintain an index of the outputs by address for getaddresshistory and getaddressunspent (default: 0)"),
 QT_TRANSLATE_NOOP("pxc-core", "Maintain at most <n> connections to peers (default: 125)"),
 QT_TRANSLATE_NOOP("pxc-core", "Maximum per-connection receive buffer, <n>*1000 bytes (default: 5000)"),
 QT_TRANSLATE_NOOP("pxc-core", "Maximum per-connection send buffer, <n>*1000 bytes (default: 1000)"),
@@ -131,7 +135,10 @@ QT_TRANSLATE_NOOP("pxc-core", "Options:"),
 QT_TRANSLATE_NOOP("pxc-core", "Output extra debugging information. Implies all other -debug* options"),
 QT_TRANSLATE_NOOP("pxc-core", "Output extra network debugging information"),
 QT_TRANSLATE_NOOP("pxc-core", "Password for JSON-RPC connections"),
+QT_TRANSLATE_NOOP("pxc-core", "Preparing to reindex..."),
 QT_TRANSLATE_NOOP("pxc-core", "Prepend debug output with timestamp"),
+QT_TRANSLATE_NOOP("pxc-core", "Rebuild the block index and transaction data base from the blk000?.dat files"),
+QT_TRANSLATE_NOOP("pxc-core", "Reindexing blocks..."),
 QT_TRANSLATE_NOOP("pxc-core", "Rescan the block chain for missing wallet transactions"),
 QT_TRANSLATE_NOOP("pxc-core", "Rescanning..."),
 QT_TRANSLATE_NOOP("pxc-core", "Run in the background as a daemon and accept commands"),
@@ -146,6 +153,10 @@ QT_TRANSLATE_NOOP("pxc-core", "Server certificate file (default: server.cert)"),
 QT_TRANSLATE_NOOP("pxc-core", "Server private key (default: server.pem)"),
 QT_TRANSLATE_NOOP("pxc-core", "Set database cache size in megabytes (default: 25)"),
 QT_TRANSLATE_NOOP("pxc-core", "Set database disk log size in megabytes (default: 100)"),
+QT_TRANSLATE_NOOP("pxc-core", "Set transaction output cache size in megabytes (default: 32)"),
+QT_TRANSLATE_NOOP("pxc-core", "Set signature cache size in megabytes (default: 16)"),
+QT_TRANSLATE_NOOP("pxc-core", "Set the number of script verification threads (up to 16, 0 = auto, <0 = leave that many cores free, default: 0)"),
+QT_TRANSLATE_NOOP("pxc-core", "Set the number of message handler threads (1 to 16, default: 4)"),
 QT_TRANSLATE_NOOP("pxc-core", "Set key pool size to <n> (default: 100)"),
 QT_TRANSLATE_NOOP("pxc-core", "Set maximum block size in bytes (default: 250000)"),
 QT_TRANSLATE_NOOP("pxc-core", "Set minimum block size in bytes (default: 0)"),
@@ -162,6 +173,7 @@ QT_TRANSLATE_NOOP("pxc-core", "Unable to bind to %s on this computer (bind retur
 QT_TRANSLATE_NOOP("pxc-core", "Unknown -socks proxy version requested: %i"),
 QT_TRANSLATE_NOOP("pxc-core", "Unknown network specified in -onlynet: '%s'"),
 QT_TRANSLATE_NOOP("pxc-core", "Upgrade wallet to latest format"),
+QT_TRANSLATE_NOOP("pxc-core", "Upgrading block index..."),
 QT_TRANSLATE_NOOP("pxc-core", "Usage:"),
 QT_TRANSLATE_NOOP("pxc-core", "Use OpenSSL (https) for JSON-RPC connections"),
 QT_TRANSLATE_NOOP("pxc-core", "Use UPnP to map the listening port (default: 0)"),
@@ -169,9 +181,11 @@ QT_TRANSLATE_NOOP("pxc-core", "Use UPnP to map the listening port (default: 1 wh
 QT_TRANSLATE_NOOP("pxc-core", "Use proxy to reach tor hidden services (default: same as -proxy)"),
 QT_TRANSLATE_NOOP("pxc-core", "Use the test network"),
 QT_TRANSLATE_NOOP("pxc-core", "Username for JSON-RPC connections"),
+QT_TRANSLATE_NOOP("pxc-core", "Verify signatures with the native secp256k1 engine rather than OpenSSL (default: 1)"),
 QT_TRANSLATE_NOOP("pxc-core", "Verifying database integrity..."),
 QT_TRANSLATE_NOOP("pxc-core", "Wallet needed to be rewritten: restart Phoenixcoin to complete"),
 QT_TRANSLATE_NOOP("pxc-core", "Warning: Disk space is low!"),
 QT_TRANSLATE_NOOP("pxc-core", "Warning: This version is obsolete, upgrade required!"),
+QT_TRANSLATE_NOOP("pxc-core", "You need to rebuild the data base using -reindex to enable -addrindex"),
 QT_TRANSLATE_NOOP("pxc-core", "wallet.dat corrupt, salvage failed"),
 };
\ No newline at end of file
@@ -310,6 +310,8 @@ static const CRPCCommand vRPCCommands[] =
     { "importpubkey",           &importpubkey,           false,  false },
     { "importwallet",           &importwallet,           false,  false },
     { "listunspent",            &listunspent,            false,  false },
+    { "getaddresshistory",      &getaddresshistory,      false,  false },
+    { "getaddressunspent",      &getaddressunspent,      false,  false },
     { "getrawtransaction",      &getrawtransaction,      false,  false },
     { "createrawtransaction",   &createrawtransaction,   false,  false },
     { "decoderawtransaction",   &decoderawtransaction,   false,  false },
@@ -1276,6 +1278,15 @@ Array RPCConvertValues(const std::string &strMethod, const std::vector<std::stri
     if (strMethod == "listunspent"            && n > 0) ConvertTo<boost::int64_t>(params[0]);
     if (strMethod == "listunspent"            && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "listunspent"            && n > 2) ConvertTo<Array>(params[2]);
+    if((strMethod == "getaddresshistory")     && (n > 0)) ConvertTo<Array>(params[0]);
+    if((strMethod == "getaddresshistory")     && (n > 1)) ConvertTo<boost::int64_t>(params[1]);
+    if((strMethod == "getaddresshistory")     && (n > 2)) ConvertTo<boost::int64_t>(params[2]);
+    if((strMethod == "getaddresshistory")     && (n > 3)) ConvertTo<boost::int64_t>(params[3]);
+    if((strMethod == "getaddresshistory")     && (n > 4)) ConvertTo<boost::int64_t>(params[4]);
+    if((strMethod == "getaddressunspent")     && (n > 0)) ConvertTo<Array>(params[0]);
+    if((strMethod == "getaddressunspent")     && (n > 1)) ConvertTo<boost::int64_t>(params[1]);
+    if((strMethod == "getaddressunspent")     && (n > 2)) ConvertTo<boost::int64_t>(params[2]);
+    if((strMethod == "getaddressunspent")     && (n > 3)) ConvertTo<boost::int64_t>(params[3]);
     if (strMethod == "getrawtransaction"      && n > 1) ConvertTo<boost::int64_t>(params[1]);
     if (strMethod == "createrawtransaction"   && n > 0) ConvertTo<Array>(params[0]);
     if (strMethod == "createrawtransaction"   && n > 1) ConvertTo<Object>(params[1]);
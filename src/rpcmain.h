@@ -178,6 +178,8 @@ extern json_spirit::Value ntptime(const json_spirit::Array &params, bool fHelp);
 /* in rpcrawtransaction.cpp */
 extern json_spirit::Value getrawtransaction(const json_spirit::Array &params, bool fHelp);
 extern json_spirit::Value listunspent(const json_spirit::Array &params, bool fHelp);
+extern json_spirit::Value getaddresshistory(const json_spirit::Array &params, bool fHelp);
+extern json_spirit::Value getaddressunspent(const json_spirit::Array &params, bool fHelp);
 extern json_spirit::Value decodescript(const json_spirit::Array &params, bool fHelp);
 extern json_spirit::Value createrawtransaction(const json_spirit::Array &params, bool fHelp);
 extern json_spirit::Value decoderawtransaction(const json_spirit::Array &params, bool fHelp);
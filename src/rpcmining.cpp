@@ -11,6 +11,7 @@
 #include "wallet.h"
 #include "rpcmain.h"
 #include "main.h"
+#include "txdb.h"
 
 using namespace json_spirit;
 using namespace std;
@@ -93,8 +94,7 @@ Value getnetworkhashps(const Array &params, bool fHelp) {
     // If look-up is larger than block chain, then set it to the maximum allowed
     if(nRange > pindexBest->nHeight) nRange = pindexBest->nHeight;
 
-    CBlockIndex *pindexPrev = pindexBest;
-    for(int i = 0; i < nRange; i++) pindexPrev = pindexPrev->pprev;
+    CBlockIndex *pindexPrev = pindexBest->GetAncestor(pindexBest->nHeight - nRange);
 
     double timeDiff = pindexBest->GetBlockTime() - pindexPrev->GetBlockTime();
     double timePerBlock = timeDiff / nRange;
@@ -206,7 +206,7 @@ Value getwork(const Array &params, bool fHelp) {
         FormatDataBuffer(pblock, pdata);
 
         /* Get the current decompressed block target */
-        uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+        uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
 
         Object result;
         result.push_back(Pair("data",
@@ -406,7 +406,7 @@ Value getblocktemplate(const Array &params, bool fHelp) {
     Object aux;
     aux.push_back(Pair("flags", HexStr(COINBASE_FLAGS.begin(), COINBASE_FLAGS.end())));
 
-    uint256 hashTarget = CBigNum().SetCompact(pblock->nBits).getuint256();
+    uint256 hashTarget = ArithToUint256(arith_uint256().SetCompact(pblock->nBits));
 
     static Array aMutable;
     if (aMutable.empty())
@@ -470,7 +470,7 @@ Value submitblock(const Array &params, bool fHelp) {
 
     printf("GBT proof-of-work found\n   hash: 0x%s\n target: 0x%s\n",
       block.GetHashPoW().GetHex().c_str(),
-      CBigNum().SetCompact(block.nBits).getuint256().GetHex().c_str());
+      ArithToUint256(arith_uint256().SetCompact(block.nBits)).GetHex().c_str());
     block.print();
     printf("generated %s\n", FormatMoney(block.vtx[0].vout[0].nValue).c_str());
 
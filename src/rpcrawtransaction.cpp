@@ -11,7 +11,7 @@
 #include <boost/assign/list_of.hpp>
 
 #include "base58.h"
-#include "db.h"
+#include "txdb.h"
 #include "wallet.h"
 #include "rpcmain.h"
 #include "main.h"
@@ -87,7 +87,7 @@ void TxToJSON(const CTransaction& tx, const uint256 hashBlock, Object& entry)
     if (hashBlock != 0)
     {
         entry.push_back(Pair("blockhash", hashBlock.GetHex()));
-        map<uint256, CBlockIndex*>::iterator mi = mapBlockIndex.find(hashBlock);
+        CBlockIndexMap::iterator mi = mapBlockIndex.find(hashBlock);
         if (mi != mapBlockIndex.end() && (*mi).second)
         {
             CBlockIndex* pindex = (*mi).second;
@@ -211,6 +211,199 @@ Value listunspent(const Array &params, bool fHelp) {
 }
 
 
+/* Resolves the addresses specified into the scripts indexed;
+ * pay-to-pubkey outputs are found for the keys of the wallet only,
+ * because the public key can't be derived from the address */
+static void GetAddrIndexScripts(const Array &addresses, vector<pair<string, CScript> > &vScripts) {
+
+    if(!fAddrIndex)
+      throw(JSONRPCError(RPC_MISC_ERROR, "The address index is disabled, use -addrindex"));
+
+    set<string> setAddress;
+    BOOST_FOREACH(const Value &input, addresses) {
+        CCoinAddress address(input.get_str());
+        if(!address.IsValid())
+          throw(JSONRPCError(RPC_INVALID_ADDRESS_OR_KEY,
+            string("Invalid Phoenixcoin address: ") + input.get_str()));
+        if(!setAddress.insert(input.get_str()).second)
+          throw(JSONRPCError(RPC_INVALID_PARAMETER,
+            string("Invalid parameter, duplicated address: ") + input.get_str()));
+        CScript script;
+        script.SetDestination(address.Get());
+        vScripts.push_back(make_pair(input.get_str(), script));
+
+        CKeyID keyID;
+        CPubKey pubkey;
+        if(address.GetKeyID(keyID) && pwalletMain && pwalletMain->GetPubKey(keyID, pubkey)) {
+            script.clear();
+            script << pubkey << OP_CHECKSIG;
+            vScripts.push_back(make_pair(input.get_str(), script));
+        }
+    }
+}
+
+/* Merges the records of several scripts by height in the order
+ * they are read, so every script can be read up to the page only */
+struct CAddrIndexEntry {
+    uint nScript;
+    CAddrIndexKey key;
+    CAddrIndexValue value;
+
+    bool operator<(const CAddrIndexEntry &b) const {
+        if(key.IsBefore(b.key))
+          return(true);
+        if(b.key.IsBefore(key))
+          return(false);
+        return(nScript < b.nScript);
+    }
+};
+
+Value getaddresshistory(const Array &params, bool fHelp) {
+
+    if(fHelp || (params.size() < 1) || (params.size() > 5)) {
+        string msg = "getaddresshistory [\"address\",...] [startheight=0] [endheight=-1] [skip=0] [count=1000]\n"
+          "Reports the outputs received and spent by the addresses specified\n"
+          "within the range of block heights (-1 for the best block) in the order of height.\n"
+          "Requires -addrindex; pay-to-pubkey outputs are found for the keys of the wallet only.\n"
+          "Results are an array of objects, each of which has:\n"
+          "{address, category, txid, vout or vin, amount, height[, prevtxid, prevvout]}";
+        throw(runtime_error(msg));
+    }
+
+    RPCTypeCheck(params, list_of(array_type)(int_type)(int_type)(int_type)(int_type));
+
+    vector<pair<string, CScript> > vScripts;
+    GetAddrIndexScripts(params[0].get_array(), vScripts);
+
+    int nHeightStart = 0;
+    if(params.size() > 1)
+      nHeightStart = max(0, params[1].get_int());
+
+    int nHeightEnd = nBestHeight;
+    if((params.size() > 2) && (params[2].get_int() >= 0))
+      nHeightEnd = params[2].get_int();
+
+    int nSkip = 0;
+    if(params.size() > 3)
+      nSkip = max(0, params[3].get_int());
+
+    int nCount = 1000;
+    if(params.size() > 4)
+      nCount = max(0, params[4].get_int());
+
+    /* A single script is paged while reading;
+     * several are read up to the end of the page and merged */
+    uint nReadSkip = 0, nReadCount = (uint)nCount;
+    if(vScripts.size() > 1)
+      nReadCount = (uint)nSkip + (uint)nCount;
+    else
+      nReadSkip = nSkip;
+
+    vector<CAddrIndexEntry> vEntries;
+    CTxDB txdb("r");
+    for(uint i = 0; i < vScripts.size(); i++) {
+        CAddrIndexRecords vRecords;
+        if(!txdb.ReadAddrIndex(Hash160(vScripts[i].second), nHeightStart, nHeightEnd, vRecords,
+          nReadSkip, nReadCount))
+          throw(JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index"));
+        for(uint j = 0; j < vRecords.size(); j++) {
+            CAddrIndexEntry entry;
+            entry.nScript = i;
+            entry.key = vRecords[j].first;
+            entry.value = vRecords[j].second;
+            vEntries.push_back(entry);
+        }
+    }
+    sort(vEntries.begin(), vEntries.end());
+
+    Array results;
+    for(uint i = nSkip - nReadSkip; (i < vEntries.size()) && (results.size() < (uint)nCount); i++) {
+        const CAddrIndexEntry &entry = vEntries[i];
+        Object obj;
+        obj.push_back(Pair("address", vScripts[entry.nScript].first));
+        obj.push_back(Pair("category", entry.key.fSpend ? "spend" : "receive"));
+        obj.push_back(Pair("txid", entry.key.hashTx.GetHex()));
+        obj.push_back(Pair(entry.key.fSpend ? "vin" : "vout", (int)entry.key.nIndex));
+        obj.push_back(Pair("amount", ValueFromAmount(entry.value.nValue)));
+        obj.push_back(Pair("height", entry.key.nHeight));
+        if(entry.key.fSpend) {
+            obj.push_back(Pair("prevtxid", entry.value.hashPrevTx.GetHex()));
+            obj.push_back(Pair("prevvout", (int)entry.value.nPrevOut));
+        }
+        results.push_back(obj);
+    }
+
+    return(results);
+}
+
+Value getaddressunspent(const Array &params, bool fHelp) {
+
+    if(fHelp || (params.size() < 1) || (params.size() > 4)) {
+        string msg = "getaddressunspent [\"address\",...] [minconf=1] [skip=0] [count=1000]\n"
+          "Reports the unspent outputs paid to the addresses specified\n"
+          "with at least minconf confirmations in the order of height.\n"
+          "Requires -addrindex; pay-to-pubkey outputs are found for the keys of the wallet only.\n"
+          "Results are an array of objects, each of which has:\n"
+          "{address, txid, vout, scriptPubKey, amount, height, confirmations}";
+        throw(runtime_error(msg));
+    }
+
+    RPCTypeCheck(params, list_of(array_type)(int_type)(int_type)(int_type));
+
+    vector<pair<string, CScript> > vScripts;
+    GetAddrIndexScripts(params[0].get_array(), vScripts);
+
+    int nMinDepth = 1;
+    if(params.size() > 1)
+      nMinDepth = params[1].get_int();
+
+    int nSkip = 0;
+    if(params.size() > 2)
+      nSkip = max(0, params[2].get_int());
+
+    int nCount = 1000;
+    if(params.size() > 3)
+      nCount = max(0, params[3].get_int());
+
+    vector<CAddrIndexEntry> vEntries;
+    CTxDB txdb("r");
+    for(uint i = 0; i < vScripts.size(); i++) {
+        /* Spent outputs are dropped while reading */
+        CAddrIndexRecords vRecords;
+        if(!txdb.ReadAddrIndexUnspent(Hash160(vScripts[i].second), vRecords))
+          throw(JSONRPCError(RPC_DATABASE_ERROR, "Failed to read the address index"));
+
+        for(uint j = 0; j < vRecords.size(); j++) {
+            const CAddrIndexKey &key = vRecords[j].first;
+            if((nBestHeight - key.nHeight + 1) < nMinDepth)
+              continue;
+            CAddrIndexEntry entry;
+            entry.nScript = i;
+            entry.key = key;
+            entry.value = vRecords[j].second;
+            vEntries.push_back(entry);
+        }
+    }
+    sort(vEntries.begin(), vEntries.end());
+
+    Array results;
+    for(uint i = nSkip; (i < vEntries.size()) && (results.size() < (uint)nCount); i++) {
+        const CAddrIndexEntry &entry = vEntries[i];
+        const CScript &script = vScripts[entry.nScript].second;
+        Object obj;
+        obj.push_back(Pair("address", vScripts[entry.nScript].first));
+        obj.push_back(Pair("txid", entry.key.hashTx.GetHex()));
+        obj.push_back(Pair("vout", (int)entry.key.nIndex));
+        obj.push_back(Pair("scriptPubKey", HexStr(script.begin(), script.end())));
+        obj.push_back(Pair("amount", ValueFromAmount(entry.value.nValue)));
+        obj.push_back(Pair("height", entry.key.nHeight));
+        obj.push_back(Pair("confirmations", nBestHeight - entry.key.nHeight + 1));
+        results.push_back(obj);
+    }
+
+    return(results);
+}
+
 Value decodescript(const Array &params, bool fHelp) {
 
     if(fHelp || (params.size() != 1)) {
@@ -491,6 +684,7 @@ Value signrawtransaction(const Array &params, bool fHelp) {
     bool fHashSingle = ((nHashType & ~SIGHASH_ANYONECANPAY) == SIGHASH_SINGLE);
 
     // Sign what we can:
+    CSigHashContext sighash(mergedTx);
     for (unsigned int i = 0; i < mergedTx.vin.size(); i++)
     {
         CTxIn& txin = mergedTx.vin[i];
@@ -504,14 +698,14 @@ Value signrawtransaction(const Array &params, bool fHelp) {
         txin.scriptSig.clear();
         // Only sign SIGHASH_SINGLE if there's a corresponding output:
         if (!fHashSingle || (i < mergedTx.vout.size()))
-            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType);
+            SignSignature(keystore, prevPubKey, mergedTx, i, nHashType, &sighash);
 
         // ... and merge in other signatures:
         BOOST_FOREACH(const CTransaction& txv, txVariants)
         {
             txin.scriptSig = CombineSignatures(prevPubKey, mergedTx, i, txin.scriptSig, txv.vin[i].scriptSig);
         }
-        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0))
+        if (!VerifyScript(txin.scriptSig, prevPubKey, mergedTx, i, true, 0, &sighash))
             fComplete = false;
     }
 
@@ -565,10 +759,10 @@ Value sendrawtransaction(const Array &params, bool fHelp) {
     {
         // push to local node
         CTxDB txdb("r");
-        if (!tx.AcceptToMemoryPool(txdb))
+        if (!tx.AcceptToMemoryPool(txdb, true, NULL, &hashTx))
             throw JSONRPCError(RPC_DESERIALIZATION_ERROR, "TX rejected");
 
-        SyncWithWallets(tx, NULL, true);
+        SyncWithWallets(hashTx, tx, NULL, true);
     }
     RelayMessage(CInv(MSG_TX, hashTx), tx);
 
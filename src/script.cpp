@@ -8,7 +8,6 @@
 #include <set>
 
 #include <boost/foreach.hpp>
-#include <boost/tuple/tuple.hpp>
 
 #include "sync.h"
 #include "bignum.h"
@@ -17,12 +16,18 @@
 #include "util.h"
 #include "main.h"
 #include "script.h"
+#include "secp256k1.h"
+#include "sigcache.h"
 
 using namespace std;
 using namespace boost;
 
 bool CheckSig(vector<uchar> vchSig, vector<uchar> vchPubKey, CScript scriptCode,
-  const CTransaction &txTo, uint nIn, int nHashType);
+  const CTransaction &txTo, uint nIn, int nHashType, const CSigHashContext *psighash);
+static bool GetSigHash(vector<uchar> &vchSig, const CScript &scriptCode, const CTransaction &txTo,
+  uint nIn, int nHashType, const CSigHashContext *psighash, uint256 &sighash);
+static bool CheckSigHash(const vector<uchar> &vchSig, const vector<uchar> &vchPubKey,
+  const uint256 &sighash);
 
 typedef vector<uchar> valtype;
 static const valtype vchFalse(0);
@@ -350,7 +355,8 @@ const char* GetOpName(opcodetype opcode) {
     }
 }
 
-bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType) {
+bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+  const CSigHashContext *psighash) {
     CAutoBN_CTX pctx;
     CScript::const_iterator pc = script.begin();
     CScript::const_iterator pend = script.end();
@@ -857,7 +863,7 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                     CScript scriptCode(pbegincodehash, pend);
                     // Drop the signature, since there's no way for a signature to sign itself
                     scriptCode.FindAndDelete(CScript(vchSig));
-                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType);
+                    bool fSuccess = CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType, psighash);
                     popstack(stack);
                     popstack(stack);
                     stack.push_back(fSuccess ? vchTrue : vchFalse);
@@ -900,11 +906,21 @@ bool EvalScript(vector<vector<unsigned char> >& stack, const CScript& script, co
                         scriptCode.FindAndDelete(CScript(vchSig));
                     }
                     bool fSuccess = true;
+                    /* The hash of a signature is the same for every key tried */
+                    int isigHashed = 0;
+                    bool fHashed = false;
+                    valtype vchSigHashed;
+                    uint256 sighash;
                     while(fSuccess && nSigsCount > 0) {
-                        valtype& vchSig    = stacktop(-isig);
+                        if(isigHashed != isig) {
+                            vchSigHashed = stacktop(-isig);
+                            fHashed = GetSigHash(vchSigHashed, scriptCode, txTo, nIn, nHashType,
+                              psighash, sighash);
+                            isigHashed = isig;
+                        }
                         valtype& vchPubKey = stacktop(-ikey);
                         // Check signature
-                        if(CheckSig(vchSig, vchPubKey, scriptCode, txTo, nIn, nHashType)) {
+                        if(fHashed && CheckSigHash(vchSigHashed, vchPubKey, sighash)) {
                             isig++;
                             nSigsCount--;
                         }
@@ -989,57 +1005,132 @@ uint256 SignatureHash(CScript scriptCode, const CTransaction& txTo, unsigned int
     return Hash(ss.begin(), ss.end());
 }
 
-// Valid signature cache, to avoid doing expensive ECDSA signature checking
-// twice for every transaction (once when accepted into memory pool, and
-// again when accepted into the block chain)
+/* An input with the script blanked: outpoint, empty script and sequence */
+static const uint SIGHASH_INPUT_SIZE = 41;
+static const uint SIGHASH_OUTPOINT_SIZE = 36;
 
-class CSignatureCache {
-  private:
-    // sigdata_type is (signature hash, signature, public key):
-    typedef boost::tuple<uint256, std::vector<unsigned char>, std::vector<unsigned char> > sigdata_type;
-    std::set< sigdata_type> setValid;
-    CCriticalSection cs_sigcache;
+static inline void SHA256_UpdateStream(SHA256_CTX &ctx, const CDataStream &ss) {
+    if(ss.size())
+      SHA256_Update(&ctx, &ss[0], ss.size());
+}
 
-  public:
-    bool
-    Get(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey) {
-        LOCK(cs_sigcache);
-        sigdata_type k(hash, vchSig, pubKey);
-        std::set<sigdata_type>::iterator mi = setValid.find(k);
-        if(mi != setValid.end())
-            return(true);
-        return(false);
+CSigHashContext::CSigHashContext(const CTransaction &txTo) {
+    uint i, nInputs = txTo.vin.size();
+
+    CDataStream ss(SER_GETHASH, 0);
+    ss << txTo.nVersion;
+    WriteCompactSize(ss, nInputs);
+    vchHeader.assign(ss.begin(), ss.end());
+
+    ss.clear();
+    ss.reserve(nInputs * SIGHASH_INPUT_SIZE);
+    for(i = 0; i < nInputs; i++)
+      ss << txTo.vin[i].prevout << CScript() << txTo.vin[i].nSequence;
+    vchInputs.assign(ss.begin(), ss.end());
+
+    ss.clear();
+    WriteCompactSize(ss, txTo.vout.size());
+    BOOST_FOREACH(const CTxOut &txout, txTo.vout) {
+        vOutputPos.push_back(ss.size());
+        ss << txout;
+    }
+    vOutputPos.push_back(ss.size());
+    vchOutputs.assign(ss.begin(), ss.end());
+
+    nLockTime = txTo.nLockTime;
+
+    SHA256_CTX ctx;
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &vchHeader[0], vchHeader.size());
+    vMidstates.resize(nInputs);
+    for(i = 0; i < nInputs; i++) {
+        vMidstates[i] = ctx;
+        SHA256_Update(&ctx, &vchInputs[i * SIGHASH_INPUT_SIZE], SIGHASH_INPUT_SIZE);
     }
+}
 
-    void Set(uint256 hash, const std::vector<unsigned char>& vchSig, const std::vector<unsigned char>& pubKey) {
-        // DoS prevention: limit cache size to less than 10MB
-        // (~200 bytes per cache entry times 50,000 entries)
-        // Since there are a maximum of 20,000 signature operations per block
-        // 50,000 is a reasonable default.
-        int64 nMaxCacheSize = GetArg("-maxsigcachesize", 50000);
-        if(nMaxCacheSize <= 0) return;
-        LOCK(cs_sigcache);
-        while(static_cast<int64>(setValid.size()) > nMaxCacheSize) {
-            // Evict a random entry. Random because that helps
-            // foil would-be DoS attackers who might try to pre-generate
-            // and re-use a set of valid signatures just-slightly-greater
-            // than our cache size.
-            uint256 randomHash = GetRandHash();
-            std::vector<unsigned char> unused;
-            std::set<sigdata_type>::iterator it =
-                setValid.lower_bound(sigdata_type(randomHash, unused, unused));
-            if(it == setValid.end())
-                it = setValid.begin();
-            setValid.erase(*it);
+uint256 CSigHashContext::SignatureHash(CScript scriptCode, uint nIn, int nHashType) const {
+    uint i, nInputs = vMidstates.size();
+
+    if(nIn >= nInputs) {
+        printf("ERROR: CSigHashContext::SignatureHash() : nIn=%u out of range\n", nIn);
+        return(1);
+    }
+    int nBaseType = nHashType & 0x1f;
+    if((nBaseType == SIGHASH_SINGLE) && (nIn >= (vOutputPos.size() - 1))) {
+        printf("ERROR: CSigHashContext::SignatureHash() : nOut=%u out of range\n", nIn);
+        return(1);
+    }
+    scriptCode.FindAndDelete(CScript(OP_CODESEPARATOR));
+
+    /* The first input signed alone assigns itself in SignatureHash(),
+     * and the assignment of a script to itself leaves it empty */
+    if((nHashType & SIGHASH_ANYONECANPAY) && !nIn)
+      scriptCode.clear();
+
+    /* The input signed with the script code */
+    const uchar *pInput = &vchInputs[nIn * SIGHASH_INPUT_SIZE];
+    CDataStream ss(SER_GETHASH, 0);
+    ss.write((const char *) pInput, SIGHASH_OUTPOINT_SIZE);
+    ss << scriptCode;
+    ss.write((const char *) &pInput[SIGHASH_INPUT_SIZE - sizeof(uint)], sizeof(uint));
+
+    SHA256_CTX ctx;
+    if(nHashType & SIGHASH_ANYONECANPAY) {
+        /* The only input */
+        uchar nCount = 1;
+        SHA256_Init(&ctx);
+        SHA256_Update(&ctx, &vchHeader[0], sizeof(int));
+        SHA256_Update(&ctx, &nCount, sizeof(nCount));
+        SHA256_UpdateStream(ctx, ss);
+    } else if((nBaseType != SIGHASH_NONE) && (nBaseType != SIGHASH_SINGLE)) {
+        /* The inputs before this one are hashed already */
+        ctx = vMidstates[nIn];
+        SHA256_UpdateStream(ctx, ss);
+        if((nIn + 1) < nInputs)
+          SHA256_Update(&ctx, &vchInputs[(nIn + 1) * SIGHASH_INPUT_SIZE],
+            (nInputs - nIn - 1) * SIGHASH_INPUT_SIZE);
+    } else {
+        /* The other inputs with zero sequences */
+        static const uchar pchBlank[SIGHASH_INPUT_SIZE - SIGHASH_OUTPOINT_SIZE] = { 0 };
+        ctx = vMidstates[0];
+        for(i = 0; i < nInputs; i++) {
+            if(i == nIn) {
+                SHA256_UpdateStream(ctx, ss);
+                continue;
+            }
+            SHA256_Update(&ctx, &vchInputs[i * SIGHASH_INPUT_SIZE], SIGHASH_OUTPOINT_SIZE);
+            SHA256_Update(&ctx, pchBlank, sizeof(pchBlank));
         }
-        sigdata_type k(hash, vchSig, pubKey);
-        setValid.insert(k);
     }
-};
 
-bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
-              const CTransaction& txTo, unsigned int nIn, int nHashType) {
-    static CSignatureCache signatureCache;
+    ss.clear();
+    if(nBaseType == SIGHASH_NONE) {
+        /* No outputs */
+        WriteCompactSize(ss, 0);
+    } else if(nBaseType == SIGHASH_SINGLE) {
+        /* The output of the same index, the outputs before it blanked */
+        CTxOut txoutNull;
+        WriteCompactSize(ss, nIn + 1);
+        for(i = 0; i < nIn; i++)
+          ss << txoutNull;
+        ss.write((const char *) &vchOutputs[vOutputPos[nIn]], vOutputPos[nIn + 1] - vOutputPos[nIn]);
+    } else {
+        SHA256_Update(&ctx, &vchOutputs[0], vchOutputs.size());
+    }
+    ss << nLockTime << nHashType;
+    SHA256_UpdateStream(ctx, ss);
+
+    uint256 hash1, hash2;
+    SHA256_Final((uchar *) &hash1, &ctx);
+    SHA256((uchar *) &hash1, sizeof(hash1), (uchar *) &hash2);
+    return(hash2);
+}
+
+/* Removes the hash type from the signature and computes the signature hash;
+ * returns false if there is no hash type or it isn't the one expected */
+static bool GetSigHash(vector<uchar> &vchSig, const CScript &scriptCode, const CTransaction &txTo,
+  uint nIn, int nHashType, const CSigHashContext *psighash, uint256 &sighash) {
     // Hash type is one byte tacked on to the end of the signature
     if(vchSig.empty())
         return(false);
@@ -1048,9 +1139,66 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
     else if(nHashType != vchSig.back())
         return(false);
     vchSig.pop_back();
-    uint256 sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    if(psighash)
+      sighash = psighash->SignatureHash(scriptCode, nIn, nHashType);
+    else
+      sighash = SignatureHash(scriptCode, txTo, nIn, nHashType);
+    return(true);
+}
+
+/* The signature cache size in megabytes set by -sigcachesize;
+ * -maxsigcachesize of the earlier versions is a number of entries
+ * and converted into the memory taken by as many entries now */
+uint GetSigCacheSize() {
+    int64 nSize = GetArg("-sigcachesize", DEFAULT_SIGCACHE_SIZE);
+
+    if(!mapArgs.count("-sigcachesize") && mapArgs.count("-maxsigcachesize")) {
+        int64 nEntries = std::min(std::max(GetArg("-maxsigcachesize", 0), (int64)0),
+          (int64)MAX_SIGCACHE_SIZE << 15);
+        nSize = (nEntries * (int64)sizeof(uint256) + 0xFFFFF) >> 20;
+        printf("-maxsigcachesize is obsolete, %" PRI64d " entries converted to %" PRI64d " MB, " \
+          "use -sigcachesize\n", nEntries, nSize);
+    }
+
+    return((uint)std::min(std::max(nSize, (int64)0), (int64)MAX_SIGCACHE_SIZE));
+}
+
+static CSignatureCache &GetSignatureCache() {
+    static CSignatureCache signatureCache(GetSigCacheSize());
+    return(signatureCache);
+}
+
+void ClearSignatureCache() {
+    GetSignatureCache().Clear();
+}
+
+/* Verifies the signature without the hash type against the signature hash */
+static bool CheckSigHash(const vector<uchar> &vchSig, const vector<uchar> &vchPubKey,
+  const uint256 &sighash) {
+    CSignatureCache &signatureCache = GetSignatureCache();
     if(signatureCache.Get(sighash, vchSig, vchPubKey))
         return(true);
+    /* The native engine leaves the unusual encodings to OpenSSL;
+     * the public keys are cached as curve points for the native engine,
+     * OpenSSL decodes them on every verification */
+    if(fNativeVerify) {
+        static CPubKeyCache pubkeyCache;
+        CSecp256k1Point point;
+        bool fParsed = pubkeyCache.Get(vchPubKey, point);
+        if(!fParsed && Secp256k1ParsePubKey(vchPubKey, point)) {
+            pubkeyCache.Set(vchPubKey, point);
+            fParsed = true;
+        }
+        if(fParsed) {
+            int nResult = Secp256k1Verify(sighash, vchSig, point);
+            if(!nResult)
+              return(false);
+            if(nResult > 0) {
+                signatureCache.Set(sighash, vchSig, vchPubKey);
+                return(true);
+            }
+        }
+    }
     CKey key;
     if(!key.SetPubKey(vchPubKey))
         return(false);
@@ -1060,6 +1208,14 @@ bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CSc
     return(true);
 }
 
+bool CheckSig(vector<unsigned char> vchSig, vector<unsigned char> vchPubKey, CScript scriptCode,
+              const CTransaction& txTo, unsigned int nIn, int nHashType, const CSigHashContext *psighash) {
+    uint256 sighash;
+    if(!GetSigHash(vchSig, scriptCode, txTo, nIn, nHashType, psighash, sighash))
+        return(false);
+    return(CheckSigHash(vchSig, vchPubKey, sighash));
+}
+
 //
 // Return public keys or hashes from scriptPubKey, for 'standard' transaction types.
 //
@@ -1416,12 +1572,17 @@ bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, vecto
 
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType) {
+    return(VerifyScript(scriptSig, scriptPubKey, txTo, nIn, fValidatePayToScriptHash, nHashType, NULL));
+}
+
+bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey, const CTransaction &txTo, uint nIn,
+  bool fValidatePayToScriptHash, int nHashType, const CSigHashContext *psighash) {
     vector<vector<unsigned char> > stack, stackCopy;
-    if(!EvalScript(stack, scriptSig, txTo, nIn, nHashType))
+    if(!EvalScript(stack, scriptSig, txTo, nIn, nHashType, psighash))
         return(false);
     if(fValidatePayToScriptHash)
         stackCopy = stack;
-    if(!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType))
+    if(!EvalScript(stack, scriptPubKey, txTo, nIn, nHashType, psighash))
         return(false);
     if(stack.empty())
         return(false);
@@ -1434,7 +1595,7 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
         const valtype& pubKeySerialized = stackCopy.back();
         CScript pubKey2(pubKeySerialized.begin(), pubKeySerialized.end());
         popstack(stackCopy);
-        if(!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType))
+        if(!EvalScript(stackCopy, pubKey2, txTo, nIn, nHashType, psighash))
             return(false);
         if(stackCopy.empty())
             return(false);
@@ -1444,12 +1605,14 @@ bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const C
 }
 
 
-bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType) {
+bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType,
+  const CSigHashContext *psighash) {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
     // Leave out the signature from the hash, since a signature can't sign itself.
     // The checksig op will also drop the signatures from its hash.
-    uint256 hash = SignatureHash(fromPubKey, txTo, nIn, nHashType);
+    uint256 hash = psighash ? psighash->SignatureHash(fromPubKey, nIn, nHashType) :
+      SignatureHash(fromPubKey, txTo, nIn, nHashType);
     txnouttype whichType;
     if(!Solver(keystore, fromPubKey, hash, nHashType, txin.scriptSig, whichType))
         return(false);
@@ -1459,7 +1622,8 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         // and then the serialized subscript:
         CScript subscript = txin.scriptSig;
         // Recompute txn hash using subscript in place of scriptPubKey:
-        uint256 hash2 = SignatureHash(subscript, txTo, nIn, nHashType);
+        uint256 hash2 = psighash ? psighash->SignatureHash(subscript, nIn, nHashType) :
+          SignatureHash(subscript, txTo, nIn, nHashType);
         txnouttype subType;
         bool fSolved =
             Solver(keystore, subscript, hash2, nHashType, txin.scriptSig, subType) && subType != TX_SCRIPTHASH;
@@ -1468,15 +1632,16 @@ bool SignSignature(const CKeyStore &keystore, const CScript& fromPubKey, CTransa
         if(!fSolved) return(false);
     }
     // Test solution
-    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, 0);
+    return VerifyScript(txin.scriptSig, fromPubKey, txTo, nIn, true, 0, psighash);
 }
 
-bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType) {
+bool SignSignature(const CKeyStore &keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType,
+  const CSigHashContext *psighash) {
     assert(nIn < txTo.vin.size());
     CTxIn& txin = txTo.vin[nIn];
     assert(txin.prevout.n < txFrom.vout.size());
     const CTxOut& txout = txFrom.vout[txin.prevout.n];
-    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType);
+    return SignSignature(keystore, txout.scriptPubKey, txTo, nIn, nHashType, psighash);
 }
 
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType) {
@@ -1520,7 +1685,7 @@ static CScript CombineMultisig(CScript scriptPubKey, const CTransaction& txTo, u
             const valtype& pubkey = vSolutions[i+1];
             if(sigs.count(pubkey))
                 continue; // Already got a sig for this pubkey
-            if(CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0)) {
+            if(CheckSig(sig, pubkey, scriptPubKey, txTo, nIn, 0, NULL)) {
                 sigs[pubkey] = sig;
                 break;
             }
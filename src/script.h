@@ -10,6 +10,9 @@
 #include <vector>
 
 #include <boost/foreach.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include <openssl/sha.h>
 
 #include "bignum.h"
 #include "keystore.h"
@@ -573,7 +576,39 @@ public:
 
 CScript GetScriptForPubKeyHash(const CKeyID &keyID);
 
-bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType);
+/** Signature hash context of a transaction; the parts of the transaction
+ * signed by the inputs are serialised once, and the digest of an input of
+ * any hash type is streamed from these parts, identical to SignatureHash().
+ * The scripts of the inputs aren't signed, so the context remains valid
+ * while the inputs are being signed */
+class CSigHashContext {
+private:
+    CSigHashContext(const CSigHashContext &);
+    void operator=(const CSigHashContext &);
+
+    /* The version and number of inputs */
+    std::vector<uchar> vchHeader;
+    /* The inputs with the scripts blanked, SIGHASH_INPUT_SIZE bytes each */
+    std::vector<uchar> vchInputs;
+    /* The number of outputs and the outputs */
+    std::vector<uchar> vchOutputs;
+    /* The positions of the outputs above and the end position */
+    std::vector<uint> vOutputPos;
+    uint nLockTime;
+    /* The hash states of the header and inputs before each input */
+    std::vector<SHA256_CTX> vMidstates;
+
+public:
+    explicit CSigHashContext(const CTransaction &txTo);
+
+    uint256 SignatureHash(CScript scriptCode, uint nIn, int nHashType) const;
+};
+
+typedef boost::shared_ptr<const CSigHashContext> CSigHashContextRef;
+
+uint256 SignatureHash(CScript scriptCode, const CTransaction &txTo, uint nIn, int nHashType);
+bool EvalScript(std::vector<std::vector<unsigned char> >& stack, const CScript& script, const CTransaction& txTo, unsigned int nIn, int nHashType,
+  const CSigHashContext *psighash = NULL);
 bool Solver(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<std::vector<unsigned char> >& vSolutionsRet);
 int ScriptSigArgsExpected(txnouttype t, const std::vector<std::vector<unsigned char> >& vSolutions);
 bool IsStandard(const CScript& scriptPubKey);
@@ -584,11 +619,20 @@ void ExtractAffectedKeys(const CKeyStore &keystore, const CScript& scriptPubKey,
   std::vector<CKeyID> &vKeys);
 bool ExtractDestination(const CScript& scriptPubKey, CTxDestination& addressRet);
 bool ExtractDestinations(const CScript& scriptPubKey, txnouttype& typeRet, std::vector<CTxDestination>& addressRet, int& nRequiredRet);
-bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
-bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL);
+bool SignSignature(const CKeyStore& keystore, const CScript& fromPubKey, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+  const CSigHashContext *psighash = NULL);
+bool SignSignature(const CKeyStore& keystore, const CTransaction& txFrom, CTransaction& txTo, unsigned int nIn, int nHashType=SIGHASH_ALL,
+  const CSigHashContext *psighash = NULL);
 bool VerifyScript(const CScript& scriptSig, const CScript& scriptPubKey, const CTransaction& txTo, unsigned int nIn,
                   bool fValidatePayToScriptHash, int nHashType);
+/* Same as above with the signature hash context of the transaction */
+bool VerifyScript(const CScript &scriptSig, const CScript &scriptPubKey, const CTransaction &txTo, uint nIn,
+  bool fValidatePayToScriptHash, int nHashType, const CSigHashContext *psighash);
 bool VerifySignature(const CTransaction& txFrom, const CTransaction& txTo, unsigned int nIn, bool fValidatePayToScriptHash, int nHashType);
+/* The signature cache size in megabytes as configured */
+uint GetSigCacheSize();
+/* Forgets the signatures verified, so these are verified again */
+void ClearSignatureCache();
 
 // Given two sets of signatures for scriptPubKey, possibly with OP_0 placeholders,
 // combine them intelligently and return the result.
@@ -0,0 +1,894 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+/* This engine verifies signatures only and is deliberately variable-time:
+ * the scalar recoding, the group operations and the scalar inversion branch
+ * and return early on the values processed. It must never be used for
+ * signing or any other operation on private keys, which stay on OpenSSL;
+ * no such entry points are to be added here */
+
+#include <algorithm>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <boost/thread/once.hpp>
+
+#include "secp256k1.h"
+#include "util.h"
+
+bool fNativeVerify = true;
+
+#if defined(__SIZEOF_INT128__)
+
+/* ECDSA verification over secp256k1: y^2 = x^3 + 7 modulo p = 2^256 - 2^32 - 977.
+ * Field elements are 4 limbs of 64 bits kept fully reduced; the field arithmetic
+ * has no branches on the values. The points are multiplied by Strauss' method
+ * over the wNAF of the scalars split by the GLV endomorphism (x, y) -> (beta * x, y)
+ * which equals the multiplication by lambda; the odd multiples of the generator
+ * are precomputed. All inputs of verification are public, so the group
+ * operations and the scalar inversion don't run in constant time */
+
+typedef unsigned __int128 uint128;
+
+/* Field element modulo p */
+struct fe {
+    uint64 n[4];
+};
+
+/* 2^256 - p */
+static const uint64 FE_C = 0x1000003D1ULL;
+
+static const fe FE_BETA = {{
+    0xC1396C28719501EEULL, 0x9CF0497512F58995ULL, 0x6E64479EAC3434E9ULL, 0x7AE96A2B657C0710ULL }};
+
+/* Scalar modulo the group order n */
+struct sc {
+    uint64 d[4];
+};
+
+static const sc SC_N = {{
+    0xBFD25E8CD0364141ULL, 0xBAAEDCE6AF48A03BULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL }};
+static const sc SC_N_HALF = {{
+    0xDFE92F46681B20A0ULL, 0x5D576E7357A4501DULL, 0xFFFFFFFFFFFFFFFFULL, 0x7FFFFFFFFFFFFFFFULL }};
+/* 2^256 - n */
+static const uint64 SC_C[3] = { 0x402DA1732FC9BEBFULL, 0x4551231950B75FC4ULL, 1ULL };
+
+/* The constants of the scalar decomposition k = k1 + k2 * lambda */
+static const sc SC_MINUS_LAMBDA = {{
+    0xE0CFC810B51283CFULL, 0xA880B9FC8EC739C2ULL, 0x5AD9E3FD77ED9BA4ULL, 0xAC9C52B33FA3CF1FULL }};
+static const sc SC_MINUS_B1 = {{
+    0x6F547FA90ABFE4C3ULL, 0xE4437ED6010E8828ULL, 0ULL, 0ULL }};
+static const sc SC_MINUS_B2 = {{
+    0xD765CDA83DB1562CULL, 0x8A280AC50774346DULL, 0xFFFFFFFFFFFFFFFEULL, 0xFFFFFFFFFFFFFFFFULL }};
+static const sc SC_G1 = {{
+    0xE893209A45DBB031ULL, 0x3DAA8A1471E8CA7FULL, 0xE86C90E49284EB15ULL, 0x3086D221A7D46BCDULL }};
+static const sc SC_G2 = {{
+    0x1571B4AE8AC47F71ULL, 0x221208AC9DF506C6ULL, 0x6F547FA90ABFE4C4ULL, 0xE4437ED6010E8828ULL }};
+
+/* The generator */
+static const uint64 G_X[4] = {
+    0x59F2815B16F81798ULL, 0x029BFCDB2DCE28D9ULL, 0x55A06295CE870B07ULL, 0x79BE667EF9DCBBACULL };
+static const uint64 G_Y[4] = {
+    0x9C47D08FFB10D4B8ULL, 0xFD17B448A6855419ULL, 0x5DA4FBFC0E1108A8ULL, 0x483ADA7726A3C465ULL };
+
+/* wNAF window sizes for the generator and the public key */
+static const int WINDOW_G = 12;
+static const int WINDOW_A = 5;
+static const int TABLE_SIZE_G = (1 << (WINDOW_G - 2));
+static const int TABLE_SIZE_A = (1 << (WINDOW_A - 2));
+/* The scalars split are below 2^128 */
+static const int WNAF_SIZE = 130;
+
+
+static inline void fe_set_int(fe &r, uint64 a) {
+    r.n[0] = a;
+    r.n[1] = r.n[2] = r.n[3] = 0;
+}
+
+static inline bool fe_is_zero(const fe &a) {
+    return(!(a.n[0] | a.n[1] | a.n[2] | a.n[3]));
+}
+
+static inline bool fe_equal(const fe &a, const fe &b) {
+    return(!((a.n[0] ^ b.n[0]) | (a.n[1] ^ b.n[1]) | (a.n[2] ^ b.n[2]) | (a.n[3] ^ b.n[3])));
+}
+
+static inline bool fe_is_odd(const fe &a) {
+    return(a.n[0] & 1);
+}
+
+/* Reduces m + carry * 2^256 below 2 * p to the canonical value */
+static inline void fe_normalize(fe &r, const uint64 *m, uint64 carry) {
+    uint64 t[4];
+    uint128 c = (uint128)m[0] + FE_C;
+    t[0] = (uint64)c;
+    for(int i = 1; i < 4; i++) {
+        c = (uint128)m[i] + (uint64)(c >> 64);
+        t[i] = (uint64)c;
+    }
+    /* Either wrapped around or at least p */
+    uint64 mask = -(carry | (uint64)(c >> 64));
+    for(int i = 0; i < 4; i++)
+      r.n[i] = (t[i] & mask) | (m[i] & ~mask);
+}
+
+static inline void fe_add(fe &r, const fe &a, const fe &b) {
+    uint64 m[4];
+    uint128 c = 0;
+    for(int i = 0; i < 4; i++) {
+        c = (uint128)a.n[i] + b.n[i] + (uint64)(c >> 64);
+        m[i] = (uint64)c;
+    }
+    fe_normalize(r, m, (uint64)(c >> 64));
+}
+
+static inline void fe_sub(fe &r, const fe &a, const fe &b) {
+    uint64 m[4];
+    uint64 borrow = 0;
+    for(int i = 0; i < 4; i++) {
+        uint128 t = (uint128)a.n[i] - b.n[i] - borrow;
+        m[i] = (uint64)t;
+        borrow = (uint64)(t >> 64) & 1;
+    }
+    /* Adds p if negative, i.e. subtracts 2^256 - p */
+    uint64 sub = FE_C & -borrow;
+    for(int i = 0; i < 4; i++) {
+        uint128 t = (uint128)m[i] - sub;
+        r.n[i] = (uint64)t;
+        sub = (uint64)(t >> 64) & 1;
+    }
+}
+
+static inline void fe_neg(fe &r, const fe &a) {
+    fe zero;
+    fe_set_int(zero, 0);
+    fe_sub(r, zero, a);
+}
+
+/* Reduces a 512-bit product with 2^256 = 2^256 - p (mod p) */
+static inline void fe_reduce(fe &r, const uint64 *l) {
+    uint64 m[4];
+    uint128 c = 0;
+    for(int i = 0; i < 4; i++) {
+        c = (uint128)l[i + 4] * FE_C + l[i] + (uint64)(c >> 64);
+        m[i] = (uint64)c;
+    }
+    c = (uint128)(uint64)(c >> 64) * FE_C + m[0];
+    m[0] = (uint64)c;
+    for(int i = 1; i < 4; i++) {
+        c = (uint128)m[i] + (uint64)(c >> 64);
+        m[i] = (uint64)c;
+    }
+    fe_normalize(r, m, (uint64)(c >> 64));
+}
+
+static inline void fe_mul(fe &r, const fe &a, const fe &b) {
+    uint64 l[8];
+    for(int i = 0; i < 4; i++) {
+        uint128 c = 0;
+        for(int j = 0; j < 4; j++) {
+            c = (uint128)a.n[i] * b.n[j] + (i ? l[i + j] : 0) + (uint64)(c >> 64);
+            l[i + j] = (uint64)c;
+        }
+        l[i + 4] = (uint64)(c >> 64);
+    }
+    fe_reduce(r, l);
+}
+
+static inline void fe_sqr(fe &r, const fe &a) {
+    fe_mul(r, a, a);
+}
+
+static inline void fe_sqr_n(fe &r, const fe &a, int n) {
+    r = a;
+    for(int i = 0; i < n; i++)
+      fe_sqr(r, r);
+}
+
+/* Computes a^(2^223 - 1) and a^(2^22 - 1) shared by the inversion and square root */
+static void fe_pow_chain(fe &x223, fe &x22, fe &x2, const fe &a) {
+    fe x3, x6, x9, x11, x44, x88, x176, x220, t;
+
+    fe_sqr(t, a);
+    fe_mul(x2, t, a);
+    fe_sqr(t, x2);
+    fe_mul(x3, t, a);
+    fe_sqr_n(t, x3, 3);
+    fe_mul(x6, t, x3);
+    fe_sqr_n(t, x6, 3);
+    fe_mul(x9, t, x3);
+    fe_sqr_n(t, x9, 2);
+    fe_mul(x11, t, x2);
+    fe_sqr_n(t, x11, 11);
+    fe_mul(x22, t, x11);
+    fe_sqr_n(t, x22, 22);
+    fe_mul(x44, t, x22);
+    fe_sqr_n(t, x44, 44);
+    fe_mul(x88, t, x44);
+    fe_sqr_n(t, x88, 88);
+    fe_mul(x176, t, x88);
+    fe_sqr_n(t, x176, 44);
+    fe_mul(x220, t, x44);
+    fe_sqr_n(t, x220, 3);
+    fe_mul(x223, t, x3);
+}
+
+/* a^(p - 2) */
+static void fe_inv(fe &r, const fe &a) {
+    fe x223, x22, x2, t;
+
+    fe_pow_chain(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23);
+    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 5);
+    fe_mul(t, t, a);
+    fe_sqr_n(t, t, 3);
+    fe_mul(t, t, x2);
+    fe_sqr_n(t, t, 2);
+    fe_mul(r, t, a);
+}
+
+/* a^((p + 1) / 4); returns false if a is not a square */
+static bool fe_sqrt(fe &r, const fe &a) {
+    fe x223, x22, x2, t, check;
+
+    fe_pow_chain(x223, x22, x2, a);
+    fe_sqr_n(t, x223, 23);
+    fe_mul(t, t, x22);
+    fe_sqr_n(t, t, 6);
+    fe_mul(t, t, x2);
+    fe_sqr_n(r, t, 2);
+
+    fe_sqr(check, r);
+    return(fe_equal(check, a));
+}
+
+/* From 32 big endian bytes; returns false if not below p */
+static bool fe_set_b32(fe &r, const uchar *p) {
+    for(int i = 0; i < 4; i++) {
+        r.n[3 - i] = 0;
+        for(int j = 0; j < 8; j++)
+          r.n[3 - i] = (r.n[3 - i] << 8) | p[i * 8 + j];
+    }
+    return(!((r.n[3] == 0xFFFFFFFFFFFFFFFFULL) && (r.n[2] == 0xFFFFFFFFFFFFFFFFULL) &&
+      (r.n[1] == 0xFFFFFFFFFFFFFFFFULL) && (r.n[0] >= 0xFFFFFFFEFFFFFC2FULL)));
+}
+
+
+static inline bool sc_is_zero(const sc &a) {
+    return(!(a.d[0] | a.d[1] | a.d[2] | a.d[3]));
+}
+
+/* Compares as plain 256-bit numbers */
+static inline int sc_cmp(const sc &a, const sc &b) {
+    for(int i = 3; i >= 0; i--) {
+        if(a.d[i] != b.d[i])
+          return((a.d[i] > b.d[i]) ? 1 : -1);
+    }
+    return(0);
+}
+
+/* a - b as 256-bit numbers; returns the borrow */
+static inline uint64 sc_sub_raw(sc &r, const sc &a, const sc &b) {
+    uint64 borrow = 0;
+    for(int i = 0; i < 4; i++) {
+        uint128 t = (uint128)a.d[i] - b.d[i] - borrow;
+        r.d[i] = (uint64)t;
+        borrow = (uint64)(t >> 64) & 1;
+    }
+    return(borrow);
+}
+
+/* a + b as 256-bit numbers; returns the carry */
+static inline uint64 sc_add_raw(sc &r, const sc &a, const sc &b) {
+    uint128 c = 0;
+    for(int i = 0; i < 4; i++) {
+        c = (uint128)a.d[i] + b.d[i] + (uint64)(c >> 64);
+        r.d[i] = (uint64)c;
+    }
+    return((uint64)(c >> 64));
+}
+
+static inline void sc_add(sc &r, const sc &a, const sc &b) {
+    sc t;
+    uint64 carry = sc_add_raw(r, a, b);
+    uint64 borrow = sc_sub_raw(t, r, SC_N);
+    if(carry || !borrow)
+      r = t;
+}
+
+static inline void sc_neg(sc &r, const sc &a) {
+    if(sc_is_zero(a))
+      r = a;
+    else
+      sc_sub_raw(r, SC_N, a);
+}
+
+static inline void sc_mul_raw(uint64 *l, const sc &a, const sc &b) {
+    for(int i = 0; i < 4; i++) {
+        uint128 c = 0;
+        for(int j = 0; j < 4; j++) {
+            c = (uint128)a.d[i] * b.d[j] + (i ? l[i + j] : 0) + (uint64)(c >> 64);
+            l[i + j] = (uint64)c;
+        }
+        l[i + 4] = (uint64)(c >> 64);
+    }
+}
+
+/* Reduces a 512-bit number with 2^256 = 2^256 - n (mod n) */
+static void sc_reduce(sc &r, const uint64 *l) {
+    uint64 x[8];
+    memcpy(x, l, sizeof(x));
+
+    while(x[4] | x[5] | x[6] | x[7]) {
+        uint64 y[8] = { x[0], x[1], x[2], x[3], 0, 0, 0, 0 };
+        for(int i = 0; i < 4; i++) {
+            uint128 c = 0;
+            for(int j = 0; j < 3; j++) {
+                c = (uint128)x[i + 4] * SC_C[j] + y[i + j] + (uint64)(c >> 64);
+                y[i + j] = (uint64)c;
+            }
+            for(int k = i + 3; (k < 8) && (uint64)(c >> 64); k++) {
+                c = (uint128)y[k] + (uint64)(c >> 64);
+                y[k] = (uint64)c;
+            }
+        }
+        memcpy(x, y, sizeof(x));
+    }
+
+    memcpy(r.d, x, sizeof(r.d));
+    if(sc_cmp(r, SC_N) >= 0)
+      sc_sub_raw(r, r, SC_N);
+}
+
+static inline void sc_mul(sc &r, const sc &a, const sc &b) {
+    uint64 l[8];
+    sc_mul_raw(l, a, b);
+    sc_reduce(r, l);
+}
+
+/* round(a * b / 2^384) */
+static inline void sc_mul_shift_384(sc &r, const sc &a, const sc &b) {
+    uint64 l[8];
+    sc_mul_raw(l, a, b);
+    uint128 c = (uint128)l[6] + (l[5] >> 63);
+    r.d[0] = (uint64)c;
+    c = (uint128)l[7] + (uint64)(c >> 64);
+    r.d[1] = (uint64)c;
+    r.d[2] = (uint64)(c >> 64);
+    r.d[3] = 0;
+}
+
+/* From 32 big endian bytes; returns false if not below n */
+static bool sc_set_b32(sc &r, const uchar *p) {
+    for(int i = 0; i < 4; i++) {
+        r.d[3 - i] = 0;
+        for(int j = 0; j < 8; j++)
+          r.d[3 - i] = (r.d[3 - i] << 8) | p[i * 8 + j];
+    }
+    return(sc_cmp(r, SC_N) < 0);
+}
+
+static inline void sc_shr1(sc &a, uint64 top) {
+    for(int i = 0; i < 3; i++)
+      a.d[i] = (a.d[i] >> 1) | (a.d[i + 1] << 63);
+    a.d[3] = (a.d[3] >> 1) | (top << 63);
+}
+
+static inline bool sc_is_one(const sc &a) {
+    return((a.d[0] == 1) && !(a.d[1] | a.d[2] | a.d[3]));
+}
+
+/* The inverse by the binary extended Euclidean algorithm;
+ * variable time, so for public values only; a must not be zero */
+static void sc_inv_var(sc &r, const sc &a) {
+    sc u = a, v = SC_N, x1, x2;
+    memset(&x1, 0, sizeof(x1));
+    memset(&x2, 0, sizeof(x2));
+    x1.d[0] = 1;
+
+    while(!sc_is_one(u) && !sc_is_one(v)) {
+        while(!(u.d[0] & 1)) {
+            sc_shr1(u, 0);
+            uint64 carry = (x1.d[0] & 1) ? sc_add_raw(x1, x1, SC_N) : 0;
+            sc_shr1(x1, carry);
+        }
+        while(!(v.d[0] & 1)) {
+            sc_shr1(v, 0);
+            uint64 carry = (x2.d[0] & 1) ? sc_add_raw(x2, x2, SC_N) : 0;
+            sc_shr1(x2, carry);
+        }
+        if(sc_cmp(u, v) >= 0) {
+            sc_sub_raw(u, u, v);
+            if(sc_sub_raw(x1, x1, x2))
+              sc_add_raw(x1, x1, SC_N);
+        } else {
+            sc_sub_raw(v, v, u);
+            if(sc_sub_raw(x2, x2, x1))
+              sc_add_raw(x2, x2, SC_N);
+        }
+    }
+
+    r = sc_is_one(u) ? x1 : x2;
+}
+
+/* Splits k into k1 + k2 * lambda with both parts of 128 bits at most
+ * in absolute value; the parts are returned as the absolute values
+ * with the signs separately */
+static void sc_split_lambda(sc &k1, bool &fNeg1, sc &k2, bool &fNeg2, const sc &k) {
+    sc c1, c2, t1, t2;
+
+    sc_mul_shift_384(c1, k, SC_G1);
+    sc_mul_shift_384(c2, k, SC_G2);
+    sc_mul(t1, c1, SC_MINUS_B1);
+    sc_mul(t2, c2, SC_MINUS_B2);
+    sc_add(k2, t1, t2);
+    sc_mul(k1, k2, SC_MINUS_LAMBDA);
+    sc_add(k1, k1, k);
+
+    fNeg1 = (sc_cmp(k1, SC_N_HALF) > 0);
+    if(fNeg1)
+      sc_neg(k1, k1);
+    fNeg2 = (sc_cmp(k2, SC_N_HALF) > 0);
+    if(fNeg2)
+      sc_neg(k2, k2);
+}
+
+/* The width-w NAF of a scalar below 2^128; returns the number of digits */
+static int sc_wnaf(int *wnaf, const sc &a, int w) {
+    uint64 x[3] = { a.d[0], a.d[1], a.d[2] };
+    int i, nLen = 0;
+
+    for(i = 0; i < WNAF_SIZE; i++)
+      wnaf[i] = 0;
+
+    for(i = 0; (x[0] | x[1] | x[2]) && (i < WNAF_SIZE); i++) {
+        if(x[0] & 1) {
+            int d = (int)(x[0] & ((1U << w) - 1));
+            if(d >= (1 << (w - 1)))
+              d -= (1 << w);
+            wnaf[i] = d;
+            nLen = i + 1;
+            uint128 c;
+            if(d > 0) {
+                c = (uint128)x[0] - (uint64)d;
+                x[0] = (uint64)c;
+                for(int j = 1; (j < 3) && ((uint64)(c >> 64) & 1); j++) {
+                    c = (uint128)x[j] - 1;
+                    x[j] = (uint64)c;
+                }
+            } else {
+                c = (uint128)x[0] + (uint64)(-d);
+                x[0] = (uint64)c;
+                for(int j = 1; (j < 3) && (uint64)(c >> 64); j++) {
+                    c = (uint128)x[j] + 1;
+                    x[j] = (uint64)c;
+                }
+            }
+        }
+        x[0] = (x[0] >> 1) | (x[1] << 63);
+        x[1] = (x[1] >> 1) | (x[2] << 63);
+        x[2] >>= 1;
+    }
+
+    return(nLen);
+}
+
+
+/* Affine point */
+struct ge {
+    fe x, y;
+};
+
+/* Jacobian point: (x / z^2, y / z^3) */
+struct gej {
+    fe x, y, z;
+    bool fInfinity;
+};
+
+static inline void gej_set_ge(gej &r, const ge &a) {
+    r.x = a.x;
+    r.y = a.y;
+    fe_set_int(r.z, 1);
+    r.fInfinity = false;
+}
+
+static void gej_double(gej &r, const gej &a) {
+    fe A, B, C, D, E, F, t;
+
+    if(a.fInfinity || fe_is_zero(a.y)) {
+        r.fInfinity = true;
+        return;
+    }
+
+    /* Z3 = 2 * Y1 * Z1 */
+    fe_mul(t, a.y, a.z);
+    fe_add(r.z, t, t);
+
+    fe_sqr(A, a.x);
+    fe_sqr(B, a.y);
+    fe_sqr(C, B);
+    /* D = 2 * ((X1 + B)^2 - A - C) */
+    fe_add(t, a.x, B);
+    fe_sqr(t, t);
+    fe_sub(t, t, A);
+    fe_sub(t, t, C);
+    fe_add(D, t, t);
+    /* E = 3 * A */
+    fe_add(E, A, A);
+    fe_add(E, E, A);
+    fe_sqr(F, E);
+    /* X3 = F - 2 * D */
+    fe_sub(t, F, D);
+    fe_sub(r.x, t, D);
+    /* Y3 = E * (D - X3) - 8 * C */
+    fe_sub(t, D, r.x);
+    fe_mul(t, E, t);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_add(C, C, C);
+    fe_sub(r.y, t, C);
+    r.fInfinity = false;
+}
+
+/* Adds an affine point with its y given separately to be negated if needed */
+static void gej_add_ge(gej &r, const gej &a, const fe &bx, const fe &by) {
+    fe z1z1, u2, s2, h, R, hh, hhh, v, t;
+
+    if(a.fInfinity) {
+        r.x = bx;
+        r.y = by;
+        fe_set_int(r.z, 1);
+        r.fInfinity = false;
+        return;
+    }
+
+    fe_sqr(z1z1, a.z);
+    fe_mul(u2, bx, z1z1);
+    fe_mul(s2, by, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, a.x);
+    fe_sub(R, s2, a.y);
+    if(fe_is_zero(h)) {
+        if(fe_is_zero(R))
+          gej_double(r, a);
+        else
+          r.fInfinity = true;
+        return;
+    }
+
+    fe_sqr(hh, h);
+    fe_mul(hhh, h, hh);
+    fe_mul(v, a.x, hh);
+    /* Z3 = Z1 * H */
+    fe_mul(r.z, a.z, h);
+    /* Y1 * H^3 before Y1 is overwritten */
+    fe_mul(t, a.y, hhh);
+    /* X3 = R^2 - H^3 - 2 * V */
+    fe_sqr(r.x, R);
+    fe_sub(r.x, r.x, hhh);
+    fe_sub(r.x, r.x, v);
+    fe_sub(r.x, r.x, v);
+    /* Y3 = R * (V - X3) - Y1 * H^3 */
+    fe_sub(v, v, r.x);
+    fe_mul(v, R, v);
+    fe_sub(r.y, v, t);
+    r.fInfinity = false;
+}
+
+/* Adds a Jacobian point with its y given separately to be negated if needed */
+static void gej_add(gej &r, const gej &a, const gej &b, const fe &by) {
+    fe z1z1, z2z2, u1, u2, s1, s2, h, R, hh, hhh, v, t;
+
+    if(b.fInfinity) {
+        r = a;
+        return;
+    }
+    if(a.fInfinity) {
+        r = b;
+        r.y = by;
+        return;
+    }
+
+    fe_sqr(z1z1, a.z);
+    fe_sqr(z2z2, b.z);
+    fe_mul(u1, a.x, z2z2);
+    fe_mul(u2, b.x, z1z1);
+    fe_mul(s1, a.y, b.z);
+    fe_mul(s1, s1, z2z2);
+    fe_mul(s2, by, a.z);
+    fe_mul(s2, s2, z1z1);
+    fe_sub(h, u2, u1);
+    fe_sub(R, s2, s1);
+    if(fe_is_zero(h)) {
+        if(fe_is_zero(R))
+          gej_double(r, a);
+        else
+          r.fInfinity = true;
+        return;
+    }
+
+    fe_sqr(hh, h);
+    fe_mul(hhh, h, hh);
+    fe_mul(v, u1, hh);
+    /* Z3 = Z1 * Z2 * H */
+    fe_mul(t, a.z, b.z);
+    fe_mul(r.z, t, h);
+    /* X3 = R^2 - H^3 - 2 * V */
+    fe_sqr(r.x, R);
+    fe_sub(r.x, r.x, hhh);
+    fe_sub(r.x, r.x, v);
+    fe_sub(r.x, r.x, v);
+    /* Y3 = R * (V - X3) - S1 * H^3 */
+    fe_mul(t, s1, hhh);
+    fe_sub(v, v, r.x);
+    fe_mul(v, R, v);
+    fe_sub(r.y, v, t);
+    r.fInfinity = false;
+}
+
+/* The odd multiples of the generator and of lambda times the generator */
+static ge *pTableG = NULL;
+static ge *pTableLambdaG = NULL;
+static boost::once_flag onceTables = BOOST_ONCE_INIT;
+
+static void BuildTables() {
+    gej *pj = new gej[TABLE_SIZE_G];
+    fe *pz = new fe[TABLE_SIZE_G];
+    ge *pg = new ge[TABLE_SIZE_G];
+    ge *plg = new ge[TABLE_SIZE_G];
+    gej g, g2;
+    ge g2a;
+    fe zinv, zinv2, t;
+    int i;
+
+    memcpy(g.x.n, G_X, sizeof(G_X));
+    memcpy(g.y.n, G_Y, sizeof(G_Y));
+    fe_set_int(g.z, 1);
+    g.fInfinity = false;
+
+    /* 2 * G in affine coordinates */
+    gej_double(g2, g);
+    fe_inv(zinv, g2.z);
+    fe_sqr(zinv2, zinv);
+    fe_mul(g2a.x, g2.x, zinv2);
+    fe_mul(t, zinv2, zinv);
+    fe_mul(g2a.y, g2.y, t);
+
+    pj[0] = g;
+    for(i = 1; i < TABLE_SIZE_G; i++)
+      gej_add_ge(pj[i], pj[i - 1], g2a.x, g2a.y);
+
+    /* All into affine coordinates with a single inversion */
+    pz[0] = pj[0].z;
+    for(i = 1; i < TABLE_SIZE_G; i++)
+      fe_mul(pz[i], pz[i - 1], pj[i].z);
+    fe_inv(zinv, pz[TABLE_SIZE_G - 1]);
+    for(i = TABLE_SIZE_G - 1; i >= 0; i--) {
+        fe zi;
+        if(i > 0) {
+            fe_mul(zi, zinv, pz[i - 1]);
+            fe_mul(zinv, zinv, pj[i].z);
+        } else {
+            zi = zinv;
+        }
+        fe_sqr(zinv2, zi);
+        fe_mul(pg[i].x, pj[i].x, zinv2);
+        fe_mul(t, zinv2, zi);
+        fe_mul(pg[i].y, pj[i].y, t);
+        fe_mul(plg[i].x, pg[i].x, FE_BETA);
+        plg[i].y = pg[i].y;
+    }
+
+    delete[] pj;
+    delete[] pz;
+    pTableG = pg;
+    pTableLambdaG = plg;
+}
+
+void Secp256k1Init() {
+    boost::call_once(BuildTables, onceTables);
+}
+
+bool Secp256k1ParsePubKey(const std::vector<uchar> &vchPubKey, CSecp256k1Point &point) {
+    fe x, y, t;
+
+    if((vchPubKey.size() == 33) && ((vchPubKey[0] == 0x02) || (vchPubKey[0] == 0x03))) {
+        if(!fe_set_b32(x, &vchPubKey[1]))
+          return(false);
+        /* y^2 = x^3 + 7 */
+        fe_sqr(t, x);
+        fe_mul(t, t, x);
+        fe seven;
+        fe_set_int(seven, 7);
+        fe_add(t, t, seven);
+        if(!fe_sqrt(y, t))
+          return(false);
+        if(fe_is_odd(y) != (vchPubKey[0] == 0x03))
+          fe_neg(y, y);
+    } else if((vchPubKey.size() == 65) && (vchPubKey[0] == 0x04)) {
+        if(!fe_set_b32(x, &vchPubKey[1]) || !fe_set_b32(y, &vchPubKey[33]))
+          return(false);
+        fe lhs, rhs, seven;
+        fe_sqr(lhs, y);
+        fe_sqr(rhs, x);
+        fe_mul(rhs, rhs, x);
+        fe_set_int(seven, 7);
+        fe_add(rhs, rhs, seven);
+        if(!fe_equal(lhs, rhs))
+          return(false);
+    } else {
+        return(false);
+    }
+
+    memcpy(point.x, x.n, sizeof(point.x));
+    memcpy(point.y, y.n, sizeof(point.y));
+    return(true);
+}
+
+/* A positive DER integer without excessive padding into 32 bytes */
+static bool ParseDERInt(const uchar *p, uint nLen, uchar *p32) {
+    if(!nLen || (p[0] & 0x80))
+      return(false);
+    if((nLen > 1) && !p[0] && !(p[1] & 0x80))
+      return(false);
+    if(!p[0]) {
+        p++;
+        nLen--;
+    }
+    if(nLen > 32)
+      return(false);
+    memset(p32, 0, 32);
+    if(nLen)
+      memcpy(p32 + 32 - nLen, p, nLen);
+    return(true);
+}
+
+/* Strict DER: SEQUENCE { INTEGER r, INTEGER s } with short lengths */
+static bool ParseDERSig(const std::vector<uchar> &vchSig, uchar *pr, uchar *ps) {
+    uint nSize = vchSig.size();
+    if((nSize < 8) || (nSize > 72))
+      return(false);
+    const uchar *p = &vchSig[0];
+    if((p[0] != 0x30) || (p[1] != nSize - 2) || (p[2] != 0x02))
+      return(false);
+    uint nLenR = p[3];
+    if(5 + nLenR >= nSize)
+      return(false);
+    if(p[4 + nLenR] != 0x02)
+      return(false);
+    uint nLenS = p[5 + nLenR];
+    if(6 + nLenR + nLenS != nSize)
+      return(false);
+    return(ParseDERInt(&p[4], nLenR, pr) && ParseDERInt(&p[6 + nLenR], nLenS, ps));
+}
+
+int Secp256k1Verify(const uint256 &hash, const std::vector<uchar> &vchSig,
+  const CSecp256k1Point &pubkey) {
+    uchar pr[32], ps[32];
+    sc r, s, z, w, u1, u2;
+
+    if(!ParseDERSig(vchSig, pr, ps))
+      return(-1);
+    if(!sc_set_b32(r, pr) || !sc_set_b32(s, ps) || sc_is_zero(r) || sc_is_zero(s))
+      return(-1);
+
+    Secp256k1Init();
+
+    /* The digest bytes as a big endian number, the way OpenSSL takes them */
+    const uchar *ph = (const uchar *) BEGIN(hash);
+    if(!sc_set_b32(z, ph))
+      sc_sub_raw(z, z, SC_N);
+
+    /* R = (z / s) * G + (r / s) * Q */
+    sc_inv_var(w, s);
+    sc_mul(u1, z, w);
+    sc_mul(u2, r, w);
+
+    sc g1, g2, a1, a2;
+    bool fNegG1, fNegG2, fNegA1, fNegA2;
+    sc_split_lambda(g1, fNegG1, g2, fNegG2, u1);
+    sc_split_lambda(a1, fNegA1, a2, fNegA2, u2);
+
+    int wnafG1[WNAF_SIZE], wnafG2[WNAF_SIZE], wnafA1[WNAF_SIZE], wnafA2[WNAF_SIZE];
+    int nLenG1 = sc_wnaf(wnafG1, g1, WINDOW_G);
+    int nLenG2 = sc_wnaf(wnafG2, g2, WINDOW_G);
+    int nLenA1 = sc_wnaf(wnafA1, a1, WINDOW_A);
+    int nLenA2 = sc_wnaf(wnafA2, a2, WINDOW_A);
+    int nBits = std::max(std::max(nLenG1, nLenG2), std::max(nLenA1, nLenA2));
+
+    /* The odd multiples of Q and of lambda times Q */
+    gej tableA[TABLE_SIZE_A], tableLambdaA[TABLE_SIZE_A], q2;
+    fe negY[TABLE_SIZE_A];
+    memcpy(tableA[0].x.n, pubkey.x, sizeof(pubkey.x));
+    memcpy(tableA[0].y.n, pubkey.y, sizeof(pubkey.y));
+    fe_set_int(tableA[0].z, 1);
+    tableA[0].fInfinity = false;
+    gej_double(q2, tableA[0]);
+    for(int i = 1; i < TABLE_SIZE_A; i++)
+      gej_add(tableA[i], tableA[i - 1], q2, q2.y);
+    for(int i = 0; i < TABLE_SIZE_A; i++) {
+        tableLambdaA[i] = tableA[i];
+        fe_mul(tableLambdaA[i].x, tableA[i].x, FE_BETA);
+        fe_neg(negY[i], tableA[i].y);
+    }
+
+    gej acc;
+    acc.fInfinity = true;
+    for(int i = nBits - 1; i >= 0; i--) {
+        int n;
+        gej_double(acc, acc);
+        if((n = wnafA1[i])) {
+            const gej &p = tableA[(abs(n) - 1) >> 1];
+            gej_add(acc, acc, p, ((n < 0) != fNegA1) ? negY[(abs(n) - 1) >> 1] : p.y);
+        }
+        if((n = wnafA2[i])) {
+            const gej &p = tableLambdaA[(abs(n) - 1) >> 1];
+            gej_add(acc, acc, p, ((n < 0) != fNegA2) ? negY[(abs(n) - 1) >> 1] : p.y);
+        }
+        if((n = wnafG1[i])) {
+            const ge &p = pTableG[(abs(n) - 1) >> 1];
+            fe y;
+            if((n < 0) != fNegG1)
+              fe_neg(y, p.y);
+            else
+              y = p.y;
+            gej_add_ge(acc, acc, p.x, y);
+        }
+        if((n = wnafG2[i])) {
+            const ge &p = pTableLambdaG[(abs(n) - 1) >> 1];
+            fe y;
+            if((n < 0) != fNegG2)
+              fe_neg(y, p.y);
+            else
+              y = p.y;
+            gej_add_ge(acc, acc, p.x, y);
+        }
+    }
+
+    if(acc.fInfinity)
+      return(0);
+
+    /* x(R) mod n == r checked as X == r * Z^2 without an inversion;
+     * x(R) may also be r + n if that is below p */
+    fe xr, zz, t;
+    memcpy(xr.n, r.d, sizeof(xr.n));
+    fe_sqr(zz, acc.z);
+    fe_mul(t, xr, zz);
+    if(fe_equal(t, acc.x))
+      return(1);
+
+    sc rn;
+    if(!sc_add_raw(rn, r, SC_N)) {
+        uchar prn[32];
+        for(int i = 0; i < 32; i++)
+          prn[i] = (uchar)(rn.d[3 - i / 8] >> (56 - 8 * (i % 8)));
+        if(fe_set_b32(xr, prn)) {
+            fe_mul(t, xr, zz);
+            if(fe_equal(t, acc.x))
+              return(1);
+        }
+    }
+
+    return(0);
+}
+
+#else /* __SIZEOF_INT128__ */
+
+/* No native engine without 128-bit integers, OpenSSL does all the work */
+
+void Secp256k1Init() {
+}
+
+bool Secp256k1ParsePubKey(const std::vector<uchar> &vchPubKey, CSecp256k1Point &point) {
+    return(false);
+}
+
+int Secp256k1Verify(const uint256 &hash, const std::vector<uchar> &vchSig,
+  const CSecp256k1Point &pubkey) {
+    return(-1);
+}
+
+#endif /* __SIZEOF_INT128__ */
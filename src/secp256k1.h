@@ -0,0 +1,40 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef SECP256K1_H
+#define SECP256K1_H
+
+#include <vector>
+
+#include "uint256.h"
+
+/* Signatures are verified by the native engine rather than OpenSSL if set */
+extern bool fNativeVerify;
+
+/** A point of the secp256k1 curve in affine coordinates;
+ * 4 little endian 64-bit limbs each, fully reduced */
+class CSecp256k1Point
+{
+public:
+    uint64 x[4];
+    uint64 y[4];
+};
+
+/* Verification only; the engine runs in variable time and must not be
+ * used on secret data such as private keys or nonces */
+
+/* Builds the tables of the generator multiples; done on first use otherwise */
+void Secp256k1Init();
+
+/* Decodes a compressed or uncompressed public key; returns false if invalid
+ * or in an encoding left to OpenSSL, also if the native engine isn't available */
+bool Secp256k1ParsePubKey(const std::vector<uchar> &vchPubKey, CSecp256k1Point &point);
+
+/* Verifies a DER encoded signature of the hash with the public key decoded;
+ * returns 1 if valid, 0 if invalid and -1 if the signature isn't strict DER
+ * or out of range, so OpenSSL is to decide the usual way */
+int Secp256k1Verify(const uint256 &hash, const std::vector<uchar> &vchSig,
+  const CSecp256k1Point &pubkey);
+
+#endif /* SECP256K1_H */
@@ -1098,4 +1098,50 @@ public:
     }
 };
 
+/** Read-only stream over a memory range it doesn't own, e.g. a memory mapped
+ * file; unserialises objects in place without copying the data first */
+class CMemoryStream
+{
+protected:
+    const char *pbegin;
+    const char *pcur;
+    const char *pend;
+public:
+    int nType;
+    int nVersion;
+
+    CMemoryStream(const char *pbeginIn, const char *pendIn, int nTypeIn, int nVersionIn) :
+      pbegin(pbeginIn), pcur(pbeginIn), pend(pendIn), nType(nTypeIn), nVersion(nVersionIn) {}
+
+    void SetType(int n)          { nType = n; }
+    int GetType()                { return(nType); }
+    void SetVersion(int n)       { nVersion = n; }
+    int GetVersion()             { return(nVersion); }
+
+    size_t GetPos() const        { return(pcur - pbegin); }
+    size_t size() const          { return(pend - pcur); }
+    bool empty() const           { return(pcur == pend); }
+
+    CMemoryStream& read(char *pch, size_t nSize) {
+        if(nSize > (size_t)(pend - pcur))
+          throw(std::ios_base::failure("CMemoryStream::read() : end of data"));
+        memcpy(pch, pcur, nSize);
+        pcur += nSize;
+        return(*this);
+    }
+
+    CMemoryStream& ignore(size_t nSize) {
+        if(nSize > (size_t)(pend - pcur))
+          throw(std::ios_base::failure("CMemoryStream::ignore() : end of data"));
+        pcur += nSize;
+        return(*this);
+    }
+
+    template<typename T>
+    CMemoryStream& operator>>(T &obj) {
+        ::Unserialize(*this, obj, nType, nVersion);
+        return(*this);
+    }
+};
+
 #endif /* SERIALIZE_H */
@@ -0,0 +1,272 @@
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef SIGCACHE_H
+#define SIGCACHE_H
+
+#include <vector>
+
+#include <string.h>
+
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+
+#include "secp256k1.h"
+#include "sync.h"
+#include "uint256.h"
+#include "util.h"
+
+/* The default size of the signature cache, in megabytes */
+static const uint DEFAULT_SIGCACHE_SIZE = 16;
+/* The max. size of the signature cache, in megabytes */
+static const uint MAX_SIGCACHE_SIZE = 4096;
+/* The size of the public key cache, in megabytes */
+static const uint PUBKEYCACHE_SIZE = 4;
+
+/** Cache of valid signatures, so the signatures of the transactions accepted
+ * to the memory pool are not verified again when included in a block.
+ * An entry is a salted digest of the signature hash, signature and public key
+ * kept in a 4-way set associative table; the table is split into shards with
+ * a lock of its own each, so the script verification threads rarely contend.
+ * A full set has one of its entries replaced; the position depends on
+ * the salted digest and cannot be predicted by an attacker */
+class CSignatureCache
+{
+private:
+    CSignatureCache(const CSignatureCache &);
+    void operator=(const CSignatureCache &);
+
+    enum { SHARD_COUNT = 32, SET_WAYS = 4 };
+
+    struct shard {
+        CCriticalSection cs;
+        /* Zero marks an empty entry */
+        std::vector<uint256> vEntries;
+    };
+
+    shard vShards[SHARD_COUNT];
+    /* The number of sets per shard */
+    uint nSets;
+    uchar pchSalt[32];
+
+    uint256 GetEntry(const uint256 &hash, const std::vector<uchar> &vchSig,
+      const std::vector<uchar> &vchPubKey) const {
+        uint256 entry;
+        uint nSigSize = vchSig.size();
+        SHA256_CTX ctx;
+        SHA256_Init(&ctx);
+        SHA256_Update(&ctx, pchSalt, sizeof(pchSalt));
+        SHA256_Update(&ctx, BEGIN(hash), sizeof(hash));
+        /* The size separates the signature from the public key */
+        SHA256_Update(&ctx, &nSigSize, sizeof(nSigSize));
+        if(nSigSize)
+          SHA256_Update(&ctx, &vchSig[0], nSigSize);
+        if(!vchPubKey.empty())
+          SHA256_Update(&ctx, &vchPubKey[0], vchPubKey.size());
+        SHA256_Final(entry.begin(), &ctx);
+        if(entry == 0)
+          entry = 1;
+        return(entry);
+    }
+
+    shard &GetShard(const uint256 &entry) {
+        return(vShards[entry.Get64(0) % SHARD_COUNT]);
+    }
+
+    uint GetSet(const uint256 &entry) const {
+        return((uint)(entry.Get64(1) % nSets) * SET_WAYS);
+    }
+
+public:
+    /* Zero size disables the cache */
+    CSignatureCache(uint nMegabytes = DEFAULT_SIGCACHE_SIZE) {
+        RAND_bytes(pchSalt, sizeof(pchSalt));
+        if(nMegabytes > MAX_SIGCACHE_SIZE)
+          nMegabytes = MAX_SIGCACHE_SIZE;
+        nSets = (uint)(((uint64)nMegabytes << 20) / (sizeof(uint256) * SET_WAYS * SHARD_COUNT));
+        for(uint i = 0; i < SHARD_COUNT; i++)
+          vShards[i].vEntries.assign(nSets * SET_WAYS, uint256(0));
+    }
+
+    bool Get(const uint256 &hash, const std::vector<uchar> &vchSig,
+      const std::vector<uchar> &vchPubKey) {
+        if(!nSets)
+          return(false);
+
+        uint256 entry = GetEntry(hash, vchSig, vchPubKey);
+        shard &s = GetShard(entry);
+        uint nSet = GetSet(entry);
+
+        LOCK(s.cs);
+        for(uint i = nSet; i < (nSet + SET_WAYS); i++) {
+            if(s.vEntries[i] == entry)
+              return(true);
+        }
+
+        return(false);
+    }
+
+    void Set(const uint256 &hash, const std::vector<uchar> &vchSig,
+      const std::vector<uchar> &vchPubKey) {
+        if(!nSets)
+          return;
+
+        uint256 entry = GetEntry(hash, vchSig, vchPubKey);
+        shard &s = GetShard(entry);
+        uint nSet = GetSet(entry);
+
+        LOCK(s.cs);
+        for(uint i = nSet; i < (nSet + SET_WAYS); i++) {
+            if((s.vEntries[i] == entry) || (s.vEntries[i] == 0)) {
+                s.vEntries[i] = entry;
+                return;
+            }
+        }
+        s.vEntries[nSet + (uint)(entry.Get64(2) % SET_WAYS)] = entry;
+    }
+
+    void Clear() {
+        for(uint i = 0; i < SHARD_COUNT; i++) {
+            LOCK(vShards[i].cs);
+            vShards[i].vEntries.assign(vShards[i].vEntries.size(), uint256(0));
+        }
+    }
+
+    /* The max. number of entries */
+    uint GetCapacity() const {
+        return(nSets * SET_WAYS * SHARD_COUNT);
+    }
+
+    /* The number of entries in use */
+    uint GetCount() {
+        uint nCount = 0;
+        for(uint i = 0; i < SHARD_COUNT; i++) {
+            LOCK(vShards[i].cs);
+            for(uint j = 0; j < vShards[i].vEntries.size(); j++) {
+                if(vShards[i].vEntries[j] != 0)
+                  nCount++;
+            }
+        }
+        return(nCount);
+    }
+};
+
+/** Cache of public keys decoded into curve points, so the keys appearing
+ * many times (pools, exchanges, multisig cosigners) are decompressed and
+ * validated once. Organised the same way as the signature cache, although
+ * an entry holds the serialised key in full and is compared byte by byte;
+ * the set is selected by a salted mix of the key, and the keys crafted
+ * to fall into the same set can only evict each other */
+class CPubKeyCache
+{
+private:
+    CPubKeyCache(const CPubKeyCache &);
+    void operator=(const CPubKeyCache &);
+
+    enum { SHARD_COUNT = 32, SET_WAYS = 4, KEY_SIZE = 65 };
+
+    struct entry {
+        /* Zero marks an empty entry */
+        uchar nSize;
+        uchar chKey[KEY_SIZE];
+        CSecp256k1Point point;
+    };
+
+    struct shard {
+        CCriticalSection cs;
+        std::vector<entry> vEntries;
+    };
+
+    shard vShards[SHARD_COUNT];
+    /* The number of sets per shard */
+    uint nSets;
+    uint64 nSalt;
+
+    /* The first bytes of the X coordinate are random enough once salted */
+    uint64 GetIndex(const std::vector<uchar> &vchPubKey) const {
+        uint64 nIndex = nSalt ^ vchPubKey[0];
+        for(uint i = 1; i < 17; i++)
+          nIndex = (nIndex ^ vchPubKey[i]) * 0x100000001B3ULL;
+        return(nIndex ^ (nIndex >> 29));
+    }
+
+    static bool IsCacheable(const std::vector<uchar> &vchPubKey) {
+        return((vchPubKey.size() == 33) || (vchPubKey.size() == KEY_SIZE));
+    }
+
+public:
+    /* Zero size disables the cache */
+    CPubKeyCache(uint nMegabytes = PUBKEYCACHE_SIZE) {
+        RAND_bytes((uchar *) &nSalt, sizeof(nSalt));
+        entry empty;
+        memset(&empty, 0, sizeof(empty));
+        nSets = (uint)(((uint64)nMegabytes << 20) / (sizeof(entry) * SET_WAYS * SHARD_COUNT));
+        for(uint i = 0; i < SHARD_COUNT; i++)
+          vShards[i].vEntries.assign(nSets * SET_WAYS, empty);
+    }
+
+    bool Get(const std::vector<uchar> &vchPubKey, CSecp256k1Point &point) {
+        if(!nSets || !IsCacheable(vchPubKey))
+          return(false);
+
+        uint64 nIndex = GetIndex(vchPubKey);
+        shard &s = vShards[nIndex % SHARD_COUNT];
+        uint nSet = (uint)((nIndex / SHARD_COUNT) % nSets) * SET_WAYS;
+
+        LOCK(s.cs);
+        for(uint i = nSet; i < (nSet + SET_WAYS); i++) {
+            const entry &e = s.vEntries[i];
+            if((e.nSize == vchPubKey.size()) && !memcmp(e.chKey, &vchPubKey[0], e.nSize)) {
+                point = e.point;
+                return(true);
+            }
+        }
+
+        return(false);
+    }
+
+    void Set(const std::vector<uchar> &vchPubKey, const CSecp256k1Point &point) {
+        if(!nSets || !IsCacheable(vchPubKey))
+          return;
+
+        uint64 nIndex = GetIndex(vchPubKey);
+        shard &s = vShards[nIndex % SHARD_COUNT];
+        uint nSet = (uint)((nIndex / SHARD_COUNT) % nSets) * SET_WAYS;
+
+        LOCK(s.cs);
+        uint nPos = nSet + (uint)((nIndex >> 48) % SET_WAYS);
+        for(uint i = nSet; i < (nSet + SET_WAYS); i++) {
+            const entry &e = s.vEntries[i];
+            if(!e.nSize ||
+              ((e.nSize == vchPubKey.size()) && !memcmp(e.chKey, &vchPubKey[0], e.nSize))) {
+                nPos = i;
+                break;
+            }
+        }
+        entry &e = s.vEntries[nPos];
+        e.nSize = (uchar)vchPubKey.size();
+        memcpy(e.chKey, &vchPubKey[0], e.nSize);
+        e.point = point;
+    }
+
+    /* The max. number of entries */
+    uint GetCapacity() const {
+        return(nSets * SET_WAYS * SHARD_COUNT);
+    }
+
+    /* The number of entries in use */
+    uint GetCount() {
+        uint nCount = 0;
+        for(uint i = 0; i < SHARD_COUNT; i++) {
+            LOCK(vShards[i].cs);
+            for(uint j = 0; j < vShards[i].vEntries.size(); j++) {
+                if(vShards[i].vEntries[j].nSize)
+                  nCount++;
+            }
+        }
+        return(nCount);
+    }
+};
+
+#endif /* SIGCACHE_H */
@@ -11,6 +11,7 @@
 #include "main.h"
 #include "wallet.h"
 #include "net.h"
+#include "sigcache.h"
 #include "util.h"
 
 #include <stdint.h>
@@ -298,15 +299,31 @@ BOOST_AUTO_TEST_CASE(DoS_checkSig)
     BOOST_CHECK(!VerifySignature(orphans[1], tx, 1, true, SIGHASH_ALL));
     std::swap(tx.vin[0].scriptSig, tx.vin[1].scriptSig);
 
-    // Exercise -maxsigcachesize code:
+    // Exercise -maxsigcachesize code; a number of entries converted into megabytes:
     mapArgs["-maxsigcachesize"] = "10";
-    // Generate a new, different signature for vin[0] to trigger cache clear:
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), 1U);
+    mapArgs["-maxsigcachesize"] = "50000";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), 2U);
+    mapArgs["-maxsigcachesize"] = "0";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), 0U);
+    mapArgs["-maxsigcachesize"] = "-1";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), 0U);
+    mapArgs["-maxsigcachesize"] = "1000000000000000";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), MAX_SIGCACHE_SIZE);
+    // -sigcachesize takes precedence:
+    mapArgs["-sigcachesize"] = "5";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), 5U);
+    mapArgs.erase("-maxsigcachesize");
+    mapArgs["-sigcachesize"] = "100000";
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), MAX_SIGCACHE_SIZE);
+    mapArgs.erase("-sigcachesize");
+    BOOST_CHECK_EQUAL(GetSigCacheSize(), DEFAULT_SIGCACHE_SIZE);
+    // Generate a new, different signature for vin[0], the cache still serves the others:
     CScript oldSig = tx.vin[0].scriptSig;
     BOOST_CHECK(SignSignature(keystore, orphans[0], tx, 0));
     BOOST_CHECK(tx.vin[0].scriptSig != oldSig);
     for (unsigned int j = 0; j < tx.vin.size(); j++)
         BOOST_CHECK(VerifySignature(orphans[j], tx, j, true, SIGHASH_ALL));
-    mapArgs.erase("-maxsigcachesize");
 
     LimitOrphanTxSize(0);
 }
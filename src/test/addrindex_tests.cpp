@@ -0,0 +1,196 @@
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+
+#include "main.h"
+#include "txdb.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(addrindex_tests)
+
+static std::string SerializeKey(const CAddrIndexKey &key)
+{
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::make_pair(std::string("addr"), key);
+    return ss.str();
+}
+
+// The records of a script must be ordered by height in the data base
+BOOST_AUTO_TEST_CASE(addrindex_key_order)
+{
+    uint160 hashScript = Hash160(std::vector<unsigned char>(25, 0x76));
+    uint160 hashOther = Hash160(std::vector<unsigned char>(23, 0xa9));
+    uint256 hashTx = GetRandHash();
+
+    const int vHeight[] = { 0, 1, 255, 256, 65535, 65536, 1000000, 0x7FFFFFFF };
+    const unsigned int nHeights = sizeof(vHeight) / sizeof(vHeight[0]);
+    for (unsigned int i = 1; i < nHeights; i++)
+    {
+        CAddrIndexKey a(hashScript, vHeight[i - 1], hashTx, 7, true);
+        CAddrIndexKey b(hashScript, vHeight[i], hashTx, 0, false);
+        BOOST_CHECK(SerializeKey(a) < SerializeKey(b));
+
+        // Another script never falls within the range of heights
+        CAddrIndexKey c(hashOther, vHeight[i], hashTx, 0, false);
+        BOOST_CHECK((SerializeKey(c) < SerializeKey(CAddrIndexKey(hashScript, 0, 0, 0, false))) ||
+                    (SerializeKey(c) > SerializeKey(CAddrIndexKey(hashScript, 0x7FFFFFFF, ~uint256(0), ~0U, true))));
+    }
+
+    // Round trip
+    CAddrIndexKey key(hashScript, 123456, hashTx, 3, true), key2;
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << key;
+    ss >> key2;
+    BOOST_CHECK(key2.hashScript == hashScript);
+    BOOST_CHECK_EQUAL(key2.nHeight, 123456);
+    BOOST_CHECK(key2.hashTx == hashTx);
+    BOOST_CHECK_EQUAL(key2.nIndex, 3U);
+    BOOST_CHECK(key2.fSpend);
+}
+
+// Connects a block to the index with the inputs read from the data base
+static bool ConnectAddrIndex(CTxDB &txdb, const CBlock &block, int nHeight)
+{
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+    {
+        MapPrevTx inputs;
+        if (!tx.IsCoinBase())
+        {
+            BOOST_FOREACH(const CTxIn &txin, tx.vin)
+            {
+                if (!txdb.ReadCoins(txin.prevout.hash, inputs[txin.prevout.hash].second))
+                    return false;
+            }
+        }
+        if (!UpdateAddrIndex(txdb, tx.GetHash(), tx, inputs, nHeight, false))
+            return false;
+        if (!txdb.WriteCoins(tx.GetHash(), CCoins(tx)))
+            return false;
+    }
+    return true;
+}
+
+static CAddrIndexRecords ReadRecords(CTxDB &txdb, const CScript &script)
+{
+    CAddrIndexRecords vRecords;
+    BOOST_CHECK(txdb.ReadAddrIndex(Hash160(script), 0, 0x7FFFFFFF, vRecords));
+    return vRecords;
+}
+
+static CAddrIndexRecords ReadUnspent(CTxDB &txdb, const CScript &script)
+{
+    CAddrIndexRecords vRecords;
+    BOOST_CHECK(txdb.ReadAddrIndexUnspent(Hash160(script), vRecords));
+    return vRecords;
+}
+
+// Records are added as blocks are connected and removed as they are disconnected
+BOOST_AUTO_TEST_CASE(addrindex_connect_disconnect)
+{
+    const int nHeight = 1000000000;
+    CKey keyA, keyB;
+    keyA.MakeNewKey(true);
+    keyB.MakeNewKey(false);
+    CScript scriptA, scriptB, scriptP2PK;
+    scriptA.SetDestination(keyA.GetPubKey().GetID());
+    scriptB.SetDestination(keyB.GetPubKey().GetID());
+    scriptP2PK << keyB.GetPubKey() << OP_CHECKSIG;
+
+    // A coin base paying to A, B and the public key of B
+    CBlock block1;
+    CTransaction txBase;
+    txBase.vin.resize(1);
+    txBase.vin[0].prevout.SetNull();
+    txBase.vin[0].scriptSig << GetRandHash();
+    txBase.vout.resize(3);
+    txBase.vout[0].scriptPubKey = scriptA;
+    txBase.vout[0].nValue = 50 * COIN;
+    txBase.vout[1].scriptPubKey = scriptB;
+    txBase.vout[1].nValue = 10 * COIN;
+    txBase.vout[2].scriptPubKey = scriptP2PK;
+    txBase.vout[2].nValue = 5 * COIN;
+    block1.vtx.push_back(txBase);
+
+    // The next block spends the outputs to A and to the public key to B
+    CBlock block2;
+    CTransaction txBase2 = txBase;
+    txBase2.vin[0].scriptSig = CScript() << GetRandHash();
+    txBase2.vout.resize(1);
+    txBase2.vout[0].scriptPubKey = scriptB;
+    block2.vtx.push_back(txBase2);
+    CTransaction tx;
+    tx.vin.resize(2);
+    tx.vin[0].prevout = COutPoint(txBase.GetHash(), 0);
+    tx.vin[1].prevout = COutPoint(txBase.GetHash(), 2);
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = scriptB;
+    tx.vout[0].nValue = 55 * COIN;
+    block2.vtx.push_back(tx);
+
+    CTxDB txdb;
+    BOOST_CHECK(ReadRecords(txdb, scriptA).empty());
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(ConnectAddrIndex(txdb, block1, nHeight));
+    BOOST_CHECK(txdb.TxnCommit());
+    CAddrIndexRecords vRecords = ReadRecords(txdb, scriptA);
+    BOOST_CHECK_EQUAL(vRecords.size(), 1U);
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptB).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptP2PK).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadUnspent(txdb, scriptA).size(), 1U);
+    if (vRecords.size() == 1)
+    {
+        BOOST_CHECK(vRecords[0].first.hashTx == txBase.GetHash());
+        BOOST_CHECK_EQUAL(vRecords[0].first.nHeight, nHeight);
+        BOOST_CHECK_EQUAL(vRecords[0].first.nIndex, 0U);
+        BOOST_CHECK(!vRecords[0].first.fSpend);
+        BOOST_CHECK_EQUAL(vRecords[0].second.nValue, 50 * COIN);
+    }
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(ConnectAddrIndex(txdb, block2, nHeight + 1));
+    BOOST_CHECK(txdb.TxnCommit());
+    vRecords = ReadRecords(txdb, scriptA);
+    BOOST_CHECK_EQUAL(vRecords.size(), 2U);
+    if (vRecords.size() == 2)
+    {
+        BOOST_CHECK(vRecords[1].first.fSpend);
+        BOOST_CHECK(vRecords[1].first.hashTx == tx.GetHash());
+        BOOST_CHECK_EQUAL(vRecords[1].first.nHeight, nHeight + 1);
+        BOOST_CHECK(vRecords[1].second.hashPrevTx == txBase.GetHash());
+        BOOST_CHECK_EQUAL(vRecords[1].second.nPrevOut, 0U);
+    }
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptB).size(), 3U);
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptP2PK).size(), 2U);
+    BOOST_CHECK(ReadUnspent(txdb, scriptA).empty());
+    BOOST_CHECK(ReadUnspent(txdb, scriptP2PK).empty());
+    BOOST_CHECK_EQUAL(ReadUnspent(txdb, scriptB).size(), 3U);
+
+    // Paging
+    BOOST_CHECK(txdb.ReadAddrIndex(Hash160(scriptB), 0, 0x7FFFFFFF, vRecords, 1, 1));
+    BOOST_CHECK_EQUAL(vRecords.size(), 1U);
+    BOOST_CHECK(txdb.ReadAddrIndex(Hash160(scriptB), 0, 0x7FFFFFFF, vRecords, 2, 5));
+    BOOST_CHECK_EQUAL(vRecords.size(), 1U);
+    BOOST_CHECK(txdb.ReadAddrIndex(Hash160(scriptB), nHeight + 1, 0x7FFFFFFF, vRecords));
+    BOOST_CHECK_EQUAL(vRecords.size(), 2U);
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(EraseAddrIndex(txdb, block2, nHeight + 1));
+    BOOST_CHECK(txdb.TxnCommit());
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptA).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptB).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadRecords(txdb, scriptP2PK).size(), 1U);
+    BOOST_CHECK_EQUAL(ReadUnspent(txdb, scriptP2PK).size(), 1U);
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(EraseAddrIndex(txdb, block1, nHeight));
+    for (unsigned int i = 0; i < block2.vtx.size(); i++)
+        BOOST_CHECK(txdb.EraseCoins(block2.vtx[i].GetHash()));
+    BOOST_CHECK(txdb.EraseCoins(txBase.GetHash()));
+    BOOST_CHECK(txdb.TxnCommit());
+    BOOST_CHECK(ReadRecords(txdb, scriptA).empty());
+    BOOST_CHECK(ReadRecords(txdb, scriptB).empty());
+    BOOST_CHECK(ReadRecords(txdb, scriptP2PK).empty());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,120 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include <vector>
+
+#include "arith_uint256.h"
+#include "bignum.h"
+#include "util.h"
+
+BOOST_AUTO_TEST_SUITE(arith_uint256_tests)
+
+/* Pseudo random numbers of various bit lengths */
+static std::vector<arith_uint256> GetTestNumbers()
+{
+    std::vector<arith_uint256> vNum;
+    uint64 nSeed = 0x9E3779B97F4A7C15ULL;
+    for(unsigned int nBits = 0; nBits <= 256; nBits += 7) {
+        arith_uint256 n;
+        for(int i = 0; i < 4; i++) {
+            nSeed = nSeed * 6364136223846793005ULL + 1442695040888963407ULL;
+            n <<= 64;
+            n += nSeed;
+        }
+        if(nBits < 256)
+          n >>= 256 - nBits;
+        vNum.push_back(n);
+    }
+    vNum.push_back(arith_uint256(1));
+    vNum.push_back(~arith_uint256(0));
+    return vNum;
+}
+
+static CBigNum ToBigNum(const arith_uint256 &n)
+{
+    CBigNum bn;
+    bn.setuint256(ArithToUint256(n));
+    return bn;
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_compact)
+{
+    /* Known encodings */
+    bool fNegative, fOverflow;
+    arith_uint256 n;
+    n.SetCompact(0x1d00ffff, &fNegative, &fOverflow);
+    BOOST_CHECK_EQUAL(n.GetHex(), "00000000ffff0000000000000000000000000000000000000000000000000000");
+    BOOST_CHECK(!fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(n.GetCompact(), 0x1d00ffffU);
+
+    n.SetCompact(0x01003456, &fNegative, &fOverflow);
+    BOOST_CHECK(n == 0);
+    BOOST_CHECK_EQUAL(n.GetCompact(), 0U);
+
+    n.SetCompact(0x04923456, &fNegative, &fOverflow);
+    BOOST_CHECK(fNegative && !fOverflow);
+    BOOST_CHECK_EQUAL(n.GetCompact(true), 0x04923456U);
+
+    n.SetCompact(0xff123456, &fNegative, &fOverflow);
+    BOOST_CHECK(!fNegative && fOverflow);
+
+    /* The proof-of-work limit and the NeoScrypt switch difficulty */
+    BOOST_CHECK_EQUAL((~arith_uint256(0) >> 20).GetCompact(), CBigNum(~uint256(0) >> 20).GetCompact());
+    BOOST_CHECK_EQUAL((~arith_uint256(0) >> 26).GetCompact(), CBigNum(~uint256(0) >> 26).GetCompact());
+
+    /* Round trips of positive values must match CBigNum */
+    std::vector<arith_uint256> vNum = GetTestNumbers();
+    BOOST_FOREACH(const arith_uint256 &num, vNum) {
+        uint nCompact = num.GetCompact();
+        BOOST_CHECK_EQUAL(nCompact, ToBigNum(num).GetCompact());
+        arith_uint256 a;
+        a.SetCompact(nCompact, &fNegative, &fOverflow);
+        BOOST_CHECK(!fNegative && !fOverflow);
+        BOOST_CHECK(ArithToUint256(a) == CBigNum().SetCompact(nCompact).getuint256());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(arith_uint256_muldiv)
+{
+    std::vector<arith_uint256> vNum = GetTestNumbers();
+    BOOST_FOREACH(const arith_uint256 &a, vNum) {
+        BOOST_FOREACH(const arith_uint256 &b, vNum) {
+            /* Products are compared modulo 2^256 */
+            CBigNum bnProd = ToBigNum(a) * ToBigNum(b);
+            bnProd = bnProd % (CBigNum(1) << 256);
+            BOOST_CHECK(ArithToUint256(a * b) == bnProd.getuint256());
+            if(b != 0) {
+                CBigNum bnQuot = ToBigNum(a) / ToBigNum(b);
+                BOOST_CHECK(ArithToUint256(a / b) == bnQuot.getuint256());
+            }
+        }
+        for(uint n = 1; n < 1000000; n = n * 3 + 7) {
+            CBigNum bnProd = (ToBigNum(a) * n) % (CBigNum(1) << 256);
+            BOOST_CHECK(ArithToUint256(a * n) == bnProd.getuint256());
+        }
+    }
+
+    BOOST_CHECK_EQUAL(arith_uint256(0).bits(), 0U);
+    BOOST_CHECK_EQUAL(arith_uint256(1).bits(), 1U);
+    BOOST_CHECK_EQUAL((arith_uint256(1) << 255).bits(), 256U);
+    BOOST_CHECK_EQUAL((arith_uint256(1) << 64).getdouble(), 18446744073709551616.0);
+}
+
+/* The chain work of a block is 2^256 / (target + 1) */
+BOOST_AUTO_TEST_CASE(arith_uint256_blockwork)
+{
+    const uint vBits[] = { 0x1e0fffff, 0x1d00ffff, 0x1c05a3f4, 0x1b0404cb, 0x1a0ffff0, 0x03123456, 0x207fffff };
+    for(uint i = 0; i < sizeof(vBits) / sizeof(vBits[0]); i++) {
+        arith_uint256 target;
+        target.SetCompact(vBits[i]);
+        arith_uint256 work = (~target / (target + 1)) + 1;
+
+        CBigNum bnTarget;
+        bnTarget.SetCompact(vBits[i]);
+        CBigNum bnWork = (CBigNum(1) << 256) / (bnTarget + 1);
+
+        BOOST_CHECK(ArithToUint256(work) == bnWork.getuint256());
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
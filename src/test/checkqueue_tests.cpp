@@ -0,0 +1,167 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <vector>
+
+#include "checkqueue.h"
+
+/* Counts the checks performed and fails on request */
+class CCountCheck
+{
+public:
+    static boost::mutex mutex;
+    static int nChecks;
+    bool fOk;
+    int nId;
+
+    CCountCheck(bool fOkIn = true, int nIdIn = 0) : fOk(fOkIn), nId(nIdIn) {}
+
+    bool operator()() const
+    {
+        boost::unique_lock<boost::mutex> lock(mutex);
+        nChecks++;
+        return fOk;
+    }
+
+    void swap(CCountCheck &check)
+    {
+        std::swap(fOk, check.fOk);
+        std::swap(nId, check.nId);
+    }
+};
+
+boost::mutex CCountCheck::mutex;
+int CCountCheck::nChecks = 0;
+
+/* Fails softly or hard on request */
+class CSoftCheck
+{
+public:
+    bool fOk;
+    bool fSoft;
+
+    CSoftCheck(bool fOkIn = true, bool fSoftIn = false) : fOk(fOkIn), fSoft(fSoftIn) {}
+
+    bool operator()() const
+    {
+        return fOk;
+    }
+
+    void swap(CSoftCheck &check)
+    {
+        std::swap(fOk, check.fOk);
+        std::swap(fSoft, check.fSoft);
+    }
+};
+
+template<> inline bool IsSoftCheckFailure<CSoftCheck>(const CSoftCheck &check)
+{
+    return check.fSoft;
+}
+
+static void RunWorker(CCheckQueue<CCountCheck> *pqueue)
+{
+    pqueue->Thread();
+}
+
+static void RunSoftWorker(CCheckQueue<CSoftCheck> *pqueue)
+{
+    pqueue->Thread();
+}
+
+BOOST_AUTO_TEST_SUITE(checkqueue_tests)
+
+BOOST_AUTO_TEST_CASE(checkqueue_results)
+{
+    CCheckQueue<CCountCheck> queue(16);
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(boost::bind(&RunWorker, &queue));
+
+    // All checks succeed and every one of them is run
+    CCountCheck::nChecks = 0;
+    {
+        CCheckQueueControl<CCountCheck> control(&queue);
+        for (int i = 0; i < 100; i++)
+        {
+            std::vector<CCountCheck> vChecks(i % 7);
+            control.Add(vChecks);
+        }
+        BOOST_CHECK(control.Wait());
+    }
+    BOOST_CHECK_EQUAL(CCountCheck::nChecks, 295);
+
+    // A single failure fails the batch
+    {
+        CCheckQueueControl<CCountCheck> control(&queue);
+        std::vector<CCountCheck> vChecks(1000);
+        vChecks[500].fOk = false;
+        vChecks[500].nId = 500;
+        control.Add(vChecks);
+        CCountCheck checkFailed;
+        BOOST_CHECK(!control.Wait(&checkFailed));
+        BOOST_CHECK(!checkFailed.fOk);
+        BOOST_CHECK_EQUAL(checkFailed.nId, 500);
+    }
+
+    // The queue is reusable after a failure
+    {
+        CCheckQueueControl<CCountCheck> control(&queue);
+        std::vector<CCountCheck> vChecks(10);
+        control.Add(vChecks);
+        CCountCheck checkFailed(true, -1);
+        BOOST_CHECK(control.Wait(&checkFailed));
+        BOOST_CHECK_EQUAL(checkFailed.nId, -1);
+    }
+
+    // No queue means nothing to wait for
+    {
+        CCheckQueueControl<CCountCheck> control(NULL);
+        std::vector<CCountCheck> vChecks(1, CCountCheck(false));
+        control.Add(vChecks);
+        BOOST_CHECK(control.Wait());
+    }
+
+    queue.Quit();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_soft_failures)
+{
+    CCheckQueue<CSoftCheck> queue(16);
+    boost::thread_group workers;
+    for (int i = 0; i < 3; i++)
+        workers.create_thread(boost::bind(&RunSoftWorker, &queue));
+
+    // A hard failure is reported whatever the soft ones around it
+    for (int n = 0; n < 20; n++)
+    {
+        CCheckQueueControl<CSoftCheck> control(&queue);
+        std::vector<CSoftCheck> vChecks(1000, CSoftCheck(false, true));
+        vChecks[(n * 97) % 1000].fSoft = false;
+        control.Add(vChecks);
+        CSoftCheck checkFailed;
+        BOOST_CHECK(!control.Wait(&checkFailed));
+        BOOST_CHECK(!checkFailed.fOk);
+        BOOST_CHECK(!checkFailed.fSoft);
+    }
+
+    // Soft failures only
+    {
+        CCheckQueueControl<CSoftCheck> control(&queue);
+        std::vector<CSoftCheck> vChecks(1000);
+        vChecks[100] = CSoftCheck(false, true);
+        vChecks[900] = CSoftCheck(false, true);
+        control.Add(vChecks);
+        CSoftCheck checkFailed;
+        BOOST_CHECK(!control.Wait(&checkFailed));
+        BOOST_CHECK(!checkFailed.fOk);
+        BOOST_CHECK(checkFailed.fSoft);
+    }
+
+    queue.Quit();
+    workers.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 
 #include "init.h"
 #include "main.h"
+#include "txdb.h"
 #include "uint256.h"
 #include "util.h"
 #include "wallet.h"
@@ -187,6 +188,33 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     delete pblock;
     mempool.clear();
 
+    // spending an output with no coins record, as created before the upgrade
+    tx.vin[0].prevout.hash = txFirst[0]->GetHash();
+    tx.vin[0].scriptSig = CScript() << OP_1;
+    tx.vout[0].nValue = 4900000000LL;
+    tx.vout[0].scriptPubKey = CScript() << OP_1;
+    {
+        CTxDB txdb;
+        BOOST_CHECK(txdb.EraseCoins(txFirst[0]->GetHash()));
+    }
+    {
+        // block checks on a read only data base don't write the record
+        CTxDB txdb("r");
+        MapPrevTx mapInputs;
+        std::map<uint256, CTxIndex> mapTestPool;
+        bool fInvalid;
+        BOOST_CHECK(tx.FetchInputs(txdb, mapTestPool, true, false, mapInputs, fInvalid));
+    }
+    {
+        CTxDB txdb;
+        BOOST_CHECK(txdb.EraseCoins(txFirst[0]->GetHash()));
+    }
+    hash = tx.GetHash();
+    mempool.addUnchecked(hash, tx);
+    BOOST_CHECK(pblock = CreateNewBlock(reservekey));
+    delete pblock;
+    mempool.clear();
+
     // subsidy changing
     int nHeight = pindexBest->nHeight;
     pindexBest->nHeight = 209999;
@@ -0,0 +1,50 @@
+#include <boost/test/unit_test.hpp>
+
+#include <cstring>
+
+#include "neoscrypt.h"
+
+BOOST_AUTO_TEST_SUITE(neoscrypt_tests)
+
+/* The batch engine must produce the same hashes as the scalar one
+ * for every batch size, i.e. for full and partial sets of lanes */
+BOOST_AUTO_TEST_CASE(neoscrypt_batch_scalar)
+{
+    const unsigned int nMax = 20;
+    /* NeoScrypt, Scrypt and NeoScrypt with the SSE2 option */
+    const unsigned int profiles[] = { 0x0, 0x3, 0x1000 };
+    unsigned char input[nMax * 80];
+    unsigned char scalar[nMax * 32], batch[nMax * 32];
+    unsigned int i, p, n;
+
+    BOOST_CHECK(neoscrypt_batch_lanes() >= 1);
+    BOOST_CHECK(neoscrypt_batch_lanes() <= 8);
+
+    /* The same header with consecutive nonces */
+    for(i = 0; i < 80; i++)
+      input[i] = (unsigned char)(i * 37 + 11);
+    for(i = 1; i < nMax; i++) {
+        unsigned int nNonce;
+        memcpy(&input[i * 80], &input[0], 80);
+        memcpy(&nNonce, &input[76], 4);
+        nNonce += i;
+        memcpy(&input[i * 80 + 76], &nNonce, 4);
+    }
+
+    for(p = 0; p < sizeof(profiles) / sizeof(profiles[0]); p++) {
+        for(i = 0; i < nMax; i++)
+          neoscrypt(&input[i * 80], &scalar[i * 32], profiles[p]);
+
+        for(n = 1; n <= nMax; n++) {
+            memset(batch, 0, sizeof(batch));
+            neoscrypt_batch(input, batch, profiles[p], n);
+            BOOST_CHECK(!memcmp(scalar, batch, n * 32));
+            /* Nothing written past the last output */
+            for(i = n * 32; i < nMax * 32; i++)
+              if(batch[i]) break;
+            BOOST_CHECK_EQUAL(i, nMax * 32);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
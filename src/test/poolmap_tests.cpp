@@ -0,0 +1,99 @@
+#include <boost/test/unit_test.hpp>
+#include <boost/foreach.hpp>
+
+#include <map>
+#include <vector>
+
+#include "poolmap.h"
+#include "util.h"
+
+/* Counts the objects alive */
+class CTracked
+{
+public:
+    static int nAlive;
+    int nValue;
+
+    CTracked() : nValue(0) { nAlive++; }
+    CTracked(const CTracked &t) : nValue(t.nValue) { nAlive++; }
+    ~CTracked() { nAlive--; }
+};
+
+int CTracked::nAlive = 0;
+
+static uint256 GetTestKey(int n)
+{
+    return Hash(BEGIN(n), END(n));
+}
+
+BOOST_AUTO_TEST_SUITE(poolmap_tests)
+
+// A pool map behaves like a map with the objects owned by the container
+BOOST_AUTO_TEST_CASE(poolmap_like_map)
+{
+    const int nKeys = 50000;
+    std::map<uint256, CTracked *> mapRef;
+    std::vector<uint256> vOrder;
+
+    {
+        poolmap<CTracked> pool;
+        BOOST_CHECK(pool.empty());
+        BOOST_CHECK(pool.find(GetTestKey(0)) == pool.end());
+        BOOST_CHECK(pool[GetTestKey(0)] == NULL);
+
+        for (int i = 0; i < nKeys; i++)
+        {
+            uint256 key = GetTestKey(GetRandInt(nKeys));
+            std::pair<poolmap<CTracked>::iterator, bool> ret = pool.insert(key);
+            BOOST_CHECK_EQUAL(ret.second, !mapRef.count(key));
+            BOOST_CHECK(ret.first->first == key);
+            if (ret.second)
+            {
+                ret.first->second->nValue = i;
+                mapRef[key] = ret.first->second;
+                vOrder.push_back(key);
+            }
+            else
+                BOOST_CHECK(mapRef[key] == ret.first->second);
+        }
+        BOOST_CHECK_EQUAL(pool.size(), mapRef.size());
+        BOOST_CHECK_EQUAL(CTracked::nAlive, (int)mapRef.size());
+
+        // Objects and keys stay in place as the table grows
+        typedef std::pair<const uint256, CTracked *> pair_type;
+        BOOST_FOREACH(const pair_type &item, mapRef)
+        {
+            poolmap<CTracked>::iterator it = pool.find(item.first);
+            BOOST_CHECK(it != pool.end());
+            BOOST_CHECK(it->second == item.second);
+            BOOST_CHECK(pool[item.first] == item.second);
+            BOOST_CHECK_EQUAL(pool.count(item.first), 1U);
+        }
+        BOOST_CHECK_EQUAL(pool.count(GetTestKey(nKeys)), 0U);
+
+        // Iteration follows the order of insertion
+        unsigned int n = 0;
+        BOOST_FOREACH(const pair_type &item, pool)
+        {
+            BOOST_CHECK(item.first == vOrder[n]);
+            BOOST_CHECK(item.second->nValue >= 0);
+            n++;
+        }
+        BOOST_CHECK_EQUAL(n, vOrder.size());
+
+        pool.clear();
+        BOOST_CHECK(pool.empty());
+        BOOST_CHECK_EQUAL(CTracked::nAlive, 0);
+        BOOST_CHECK(pool.find(vOrder[0]) == pool.end());
+
+        // Reusable after clearing
+        pool.reserve(nKeys);
+        BOOST_CHECK(pool.insert(vOrder[0]).second);
+        BOOST_CHECK_EQUAL(CTracked::nAlive, 1);
+    }
+
+    // Destroys the objects on the way out
+    BOOST_CHECK_EQUAL(CTracked::nAlive, 0);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,165 @@
+#include <boost/test/unit_test.hpp>
+
+#include <string>
+#include <vector>
+
+#include "base58.h"
+#include "key.h"
+#include "secp256k1.h"
+#include "uint256.h"
+#include "util.h"
+
+using namespace std;
+
+/* Secrets at the edges of the range and a couple of ordinary ones */
+static const char *pszSecrets[] = {
+    "0000000000000000000000000000000000000000000000000000000000000001",
+    "0000000000000000000000000000000000000000000000000000000000000003",
+    "fffffffffffffffffffffffffffffffebaaedce6af48a03bbfd25e8cd0364140",
+    "7fffffffffffffffffffffffffffffff5d576e7357a4501ddfe92f46681b20a0",
+    "3a1c6e0e9d45e2b8c7b1c05b0a5f4a6f2f1e0d9c8b7a69584736251403f2e1d0",
+    "c0ffee0123456789abcdef0123456789abcdef0123456789abcdef0123456789"
+};
+
+/* The native result must match OpenSSL whenever the native engine decides */
+static void CheckSame(CKey &key, const uint256 &hash, const vector<uchar> &vchSig)
+{
+    CSecp256k1Point point;
+    BOOST_CHECK(Secp256k1ParsePubKey(key.GetPubKey().Raw(), point));
+    int nResult = Secp256k1Verify(hash, vchSig, point);
+    if(nResult >= 0)
+      BOOST_CHECK_EQUAL(nResult == 1, key.Verify(hash, vchSig));
+}
+
+static void CheckKey(CKey &key)
+{
+    for(int i = 0; i < 4; i++) {
+        uint256 hash = GetRandHash();
+        if(!i)
+          hash = 0;
+        else if(i == 1)
+          hash = ~uint256(0);
+
+        vector<uchar> vchSig;
+        BOOST_CHECK(key.Sign(hash, vchSig));
+        CSecp256k1Point point;
+        BOOST_CHECK(Secp256k1ParsePubKey(key.GetPubKey().Raw(), point));
+        BOOST_CHECK_EQUAL(Secp256k1Verify(hash, vchSig, point), 1);
+
+        /* Another hash */
+        uint256 hashOther = hash;
+        *hashOther.begin() ^= 1;
+        BOOST_CHECK_EQUAL(Secp256k1Verify(hashOther, vchSig, point), 0);
+        CheckSame(key, hashOther, vchSig);
+
+        /* Bits flipped anywhere in the signature */
+        for(uint j = 0; j < vchSig.size(); j++) {
+            vector<uchar> vchBad = vchSig;
+            vchBad[j] ^= (uchar)(1 << (j % 8));
+            CheckSame(key, hash, vchBad);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(secp256k1_tests)
+
+BOOST_AUTO_TEST_CASE(secp256k1_vectors)
+{
+    for(uint i = 0; i < (sizeof(pszSecrets) / sizeof(pszSecrets[0])); i++) {
+        vector<uchar> vch = ParseHex(pszSecrets[i]);
+        CSecret secret(vch.begin(), vch.end());
+        for(int nCompressed = 0; nCompressed < 2; nCompressed++) {
+            CKey key;
+            BOOST_CHECK(key.SetSecret(secret, nCompressed == 1));
+            CheckKey(key);
+        }
+    }
+}
+
+/* The key_tests vectors: every signature against every key, both engines */
+BOOST_AUTO_TEST_CASE(secp256k1_key_vectors)
+{
+    const char *pszKeySecrets[] = {
+        "5HxWvvfubhXpYYpS3tJkw6fq9jE9j18THftkZjHHfmFiWtmAbrj",
+        "5KC4ejrDjv152FGwP386VD1i2NYc5KkfSMyv1nGy1VGDxGHqVY3",
+        "Kwr371tjA9u2rFSMZjTNun2PXXP3WPZu2afRHTcta6KxEUdm1vEw",
+        "L3Hq7a8FEQwJkW1M2GNKDW28546Vp5miewcCzSqUD9kCAXrJdS3g"
+    };
+    const uint nKeys = sizeof(pszKeySecrets) / sizeof(pszKeySecrets[0]);
+
+    /* Encoded for another network, so the version byte is skipped */
+    CKey keys[nKeys];
+    for(uint i = 0; i < nKeys; i++) {
+        vector<uchar> vch;
+        BOOST_CHECK(DecodeBase58Check(pszKeySecrets[i], vch));
+        BOOST_CHECK((vch.size() == 33) || ((vch.size() == 34) && (vch[33] == 1)));
+        CSecret secret(vch.begin() + 1, vch.begin() + 33);
+        BOOST_CHECK(keys[i].SetSecret(secret, vch.size() == 34));
+    }
+
+    for(int n = 0; n < 16; n++) {
+        string strMsg = strprintf("Very secret message %i: 11", n);
+        uint256 hashMsg = Hash(strMsg.begin(), strMsg.end());
+
+        for(uint i = 0; i < nKeys; i++) {
+            vector<uchar> vchSig;
+            BOOST_CHECK(keys[i].Sign(hashMsg, vchSig));
+            for(uint j = 0; j < nKeys; j++) {
+                CSecp256k1Point point;
+                BOOST_CHECK(Secp256k1ParsePubKey(keys[j].GetPubKey().Raw(), point));
+                int nResult = Secp256k1Verify(hashMsg, vchSig, point);
+                /* Signed in strict DER, so decided natively */
+                BOOST_CHECK(nResult >= 0);
+                BOOST_CHECK_EQUAL(nResult == 1, keys[j].Verify(hashMsg, vchSig));
+                /* Same secret, either encoding */
+                BOOST_CHECK_EQUAL(nResult == 1, (i % 2) == (j % 2));
+            }
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_random)
+{
+    for(int i = 0; i < 8; i++) {
+        CKey key;
+        key.MakeNewKey(i & 1);
+        CheckKey(key);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(secp256k1_encodings)
+{
+    CKey key;
+    key.MakeNewKey(false);
+    uint256 hash = GetRandHash();
+    vector<uchar> vchSig;
+    BOOST_CHECK(key.Sign(hash, vchSig));
+    vector<uchar> vchPubKey = key.GetPubKey().Raw();
+    CSecp256k1Point point;
+    BOOST_CHECK(Secp256k1ParsePubKey(vchPubKey, point));
+
+    /* Hybrid public keys are left to OpenSSL */
+    vector<uchar> vchHybrid = vchPubKey;
+    vchHybrid[0] = 0x06 | (vchPubKey[64] & 1);
+    BOOST_CHECK(!Secp256k1ParsePubKey(vchHybrid, point));
+
+    /* Not on the curve */
+    vector<uchar> vchBad = vchPubKey;
+    vchBad[64] ^= 1;
+    BOOST_CHECK(!Secp256k1ParsePubKey(vchBad, point));
+    BOOST_CHECK(!Secp256k1ParsePubKey(vector<uchar>(), point));
+
+    /* Signatures not in strict DER are left to OpenSSL */
+    BOOST_CHECK(Secp256k1ParsePubKey(vchPubKey, point));
+    vector<uchar> vchLong = vchSig;
+    vchLong.push_back(0);
+    BOOST_CHECK_EQUAL(Secp256k1Verify(hash, vchLong, point), -1);
+    vector<uchar> vchPadded = vchSig;
+    vchPadded[1]++;
+    vchPadded[3]++;
+    vchPadded.insert(vchPadded.begin() + 4, 0);
+    BOOST_CHECK_EQUAL(Secp256k1Verify(hash, vchPadded, point), -1);
+    BOOST_CHECK_EQUAL(Secp256k1Verify(hash, vector<uchar>(), point), -1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,163 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include <string.h>
+
+#include "sigcache.h"
+#include "util.h"
+
+static std::vector<uchar> GetTestData(int n, uint nSize)
+{
+    std::vector<uchar> vch(nSize);
+    for(uint i = 0; i < nSize; i++)
+      vch[i] = (uchar)(n * 31 + i);
+    return vch;
+}
+
+BOOST_AUTO_TEST_SUITE(sigcache_tests)
+
+BOOST_AUTO_TEST_CASE(sigcache_lookup)
+{
+    CSignatureCache cache(1);
+    BOOST_CHECK_EQUAL(cache.GetCapacity(), (uint)((1 << 20) / sizeof(uint256)));
+
+    std::vector<uchar> vchSig = GetTestData(1, 72), vchPubKey = GetTestData(2, 33);
+    uint256 hash = GetRandHash();
+    BOOST_CHECK(!cache.Get(hash, vchSig, vchPubKey));
+    cache.Set(hash, vchSig, vchPubKey);
+    BOOST_CHECK(cache.Get(hash, vchSig, vchPubKey));
+    cache.Set(hash, vchSig, vchPubKey);
+    BOOST_CHECK_EQUAL(cache.GetCount(), 1U);
+
+    /* Any part of the triple makes a difference */
+    BOOST_CHECK(!cache.Get(GetRandHash(), vchSig, vchPubKey));
+    BOOST_CHECK(!cache.Get(hash, GetTestData(3, 72), vchPubKey));
+    BOOST_CHECK(!cache.Get(hash, vchSig, GetTestData(3, 33)));
+
+    /* The boundary between the signature and the public key too */
+    std::vector<uchar> vchSigShort(vchSig.begin(), vchSig.end() - 1);
+    std::vector<uchar> vchPubKeyLong(vchPubKey.size() + 1);
+    vchPubKeyLong[0] = vchSig.back();
+    memcpy(&vchPubKeyLong[1], &vchPubKey[0], vchPubKey.size());
+    BOOST_CHECK(!cache.Get(hash, vchSigShort, vchPubKeyLong));
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_bounded)
+{
+    CSignatureCache cache(1);
+    std::vector<uchar> vchSig = GetTestData(1, 72), vchPubKey = GetTestData(2, 33);
+    std::vector<uint256> vHashes;
+
+    /* Fills the cache a few times over */
+    uint nCapacity = cache.GetCapacity();
+    for(uint i = 0; i < nCapacity * 3; i++) {
+        vHashes.push_back(GetRandHash());
+        cache.Set(vHashes.back(), vchSig, vchPubKey);
+    }
+    BOOST_CHECK(cache.GetCount() <= nCapacity);
+    BOOST_CHECK(cache.GetCount() > nCapacity * 9 / 10);
+
+    /* The latest entries are found mostly */
+    uint nFound = 0;
+    for(uint i = vHashes.size() - 1000; i < vHashes.size(); i++)
+      nFound += cache.Get(vHashes[i], vchSig, vchPubKey);
+    BOOST_CHECK(nFound > 600);
+
+    /* Disabled */
+    CSignatureCache cacheNone(0);
+    cacheNone.Set(vHashes[0], vchSig, vchPubKey);
+    BOOST_CHECK(!cacheNone.Get(vHashes[0], vchSig, vchPubKey));
+    BOOST_CHECK_EQUAL(cacheNone.GetCapacity(), 0U);
+}
+
+static CSecp256k1Point GetTestPoint(int n)
+{
+    CSecp256k1Point point;
+    for(int i = 0; i < 4; i++) {
+        point.x[i] = (uint64)n * 0x9E3779B97F4A7C15ULL + i;
+        point.y[i] = ~point.x[i];
+    }
+    return point;
+}
+
+static bool IsSamePoint(const CSecp256k1Point &a, const CSecp256k1Point &b)
+{
+    return !memcmp(a.x, b.x, sizeof(a.x)) && !memcmp(a.y, b.y, sizeof(a.y));
+}
+
+BOOST_AUTO_TEST_CASE(pubkeycache_lookup)
+{
+    CPubKeyCache cache(1);
+    BOOST_CHECK(cache.GetCapacity() > 0);
+
+    std::vector<uchar> vchPubKey = GetTestData(1, 33), vchPubKeyFull = GetTestData(1, 65);
+    CSecp256k1Point point;
+    BOOST_CHECK(!cache.Get(vchPubKey, point));
+    cache.Set(vchPubKey, GetTestPoint(1));
+    cache.Set(vchPubKeyFull, GetTestPoint(2));
+    BOOST_CHECK(cache.Get(vchPubKey, point));
+    BOOST_CHECK(IsSamePoint(point, GetTestPoint(1)));
+    BOOST_CHECK(cache.Get(vchPubKeyFull, point));
+    BOOST_CHECK(IsSamePoint(point, GetTestPoint(2)));
+
+    /* Set again replaces the entry rather than adds another */
+    cache.Set(vchPubKey, GetTestPoint(3));
+    BOOST_CHECK_EQUAL(cache.GetCount(), 2U);
+    BOOST_CHECK(cache.Get(vchPubKey, point));
+    BOOST_CHECK(IsSamePoint(point, GetTestPoint(3)));
+
+    /* A difference in any byte is another key */
+    for(uint i = 0; i < vchPubKey.size(); i++) {
+        std::vector<uchar> vchOther = vchPubKey;
+        vchOther[i] ^= 0x80;
+        BOOST_CHECK(!cache.Get(vchOther, point));
+    }
+
+    /* Other sizes are not cached */
+    std::vector<uchar> vchOdd = GetTestData(1, 34);
+    cache.Set(vchOdd, GetTestPoint(4));
+    BOOST_CHECK(!cache.Get(vchOdd, point));
+    cache.Set(std::vector<uchar>(), GetTestPoint(4));
+    BOOST_CHECK(!cache.Get(std::vector<uchar>(), point));
+    BOOST_CHECK_EQUAL(cache.GetCount(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(pubkeycache_bounded)
+{
+    CPubKeyCache cache(1);
+    uint nCapacity = cache.GetCapacity();
+    std::vector<std::vector<uchar> > vKeys;
+
+    /* Fills the cache a few times over */
+    for(uint i = 0; i < nCapacity * 3; i++) {
+        uint256 hash = GetRandHash();
+        std::vector<uchar> vchPubKey(33);
+        vchPubKey[0] = 0x02 | (i & 1);
+        memcpy(&vchPubKey[1], hash.begin(), 32);
+        vKeys.push_back(vchPubKey);
+        cache.Set(vchPubKey, GetTestPoint(i));
+    }
+    BOOST_CHECK(cache.GetCount() <= nCapacity);
+    BOOST_CHECK(cache.GetCount() > nCapacity * 9 / 10);
+
+    /* The latest entries are found mostly with the right points */
+    uint nFound = 0;
+    for(uint i = vKeys.size() - 1000; i < vKeys.size(); i++) {
+        CSecp256k1Point point;
+        if(cache.Get(vKeys[i], point)) {
+            BOOST_CHECK(IsSamePoint(point, GetTestPoint(i)));
+            nFound++;
+        }
+    }
+    BOOST_CHECK(nFound > 600);
+
+    /* Disabled */
+    CPubKeyCache cacheNone(0);
+    CSecp256k1Point point;
+    cacheNone.Set(vKeys[0], GetTestPoint(0));
+    BOOST_CHECK(!cacheNone.Get(vKeys[0], point));
+    BOOST_CHECK_EQUAL(cacheNone.GetCapacity(), 0U);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "main.h"
+#include "script.h"
+#include "util.h"
+
+static const opcodetype ops[] = {
+    OP_FALSE, OP_1, OP_2, OP_3, OP_CHECKSIG, OP_IF, OP_VERIF, OP_RETURN, OP_CODESEPARATOR
+};
+
+static void RandomScript(CScript &script)
+{
+    script = CScript();
+    int nOps = GetRand(10);
+    for(int i = 0; i < nOps; i++)
+      script << ops[GetRand(sizeof(ops) / sizeof(ops[0]))];
+}
+
+static void RandomTransaction(CTransaction &tx, bool fSingle)
+{
+    tx.nVersion = GetRand(0x100000000ULL);
+    tx.vin.clear();
+    tx.vout.clear();
+    tx.nLockTime = (GetRand(2)) ? GetRand(0x100000000ULL) : 0;
+    int nIns = GetRand(4) + 1;
+    int nOuts = fSingle ? nIns : GetRand(4) + 1;
+    for(int in = 0; in < nIns; in++) {
+        tx.vin.push_back(CTxIn());
+        CTxIn &txin = tx.vin.back();
+        txin.prevout.hash = GetRandHash();
+        txin.prevout.n = GetRand(4);
+        RandomScript(txin.scriptSig);
+        txin.nSequence = (GetRand(2)) ? GetRand(0x100000000ULL) : (uint)-1;
+    }
+    for(int out = 0; out < nOuts; out++) {
+        tx.vout.push_back(CTxOut());
+        CTxOut &txout = tx.vout.back();
+        txout.nValue = GetRand(100000000);
+        RandomScript(txout.scriptPubKey);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE(sighash_tests)
+
+BOOST_AUTO_TEST_CASE(sighash_context)
+{
+    static const int nHashTypes[] = {
+        SIGHASH_ALL, SIGHASH_NONE, SIGHASH_SINGLE,
+        SIGHASH_ALL | SIGHASH_ANYONECANPAY, SIGHASH_NONE | SIGHASH_ANYONECANPAY,
+        SIGHASH_SINGLE | SIGHASH_ANYONECANPAY, 0, 0x1f, -1
+    };
+
+    for(int i = 0; i < 2000; i++) {
+        CTransaction txTo;
+        RandomTransaction(txTo, (i % 10) == 0);
+        CSigHashContext sighash(txTo);
+
+        CScript scriptCode;
+        RandomScript(scriptCode);
+        uint nIn = GetRand(txTo.vin.size());
+        int nHashType = (i & 1) ? nHashTypes[GetRand(sizeof(nHashTypes) / sizeof(nHashTypes[0]))] :
+          (int)GetRand(0x100000000ULL);
+
+        BOOST_CHECK(sighash.SignatureHash(scriptCode, nIn, nHashType) ==
+          SignatureHash(scriptCode, txTo, nIn, nHashType));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sighash_ranges)
+{
+    CTransaction txTo;
+    RandomTransaction(txTo, false);
+    txTo.vout.resize(1);
+    CSigHashContext sighash(txTo);
+    CScript scriptCode;
+    RandomScript(scriptCode);
+
+    /* Out of range inputs and outputs hash to one as before */
+    uint nIns = txTo.vin.size();
+    BOOST_CHECK(sighash.SignatureHash(scriptCode, nIns, SIGHASH_ALL) == 1);
+    BOOST_CHECK(SignatureHash(scriptCode, txTo, nIns, SIGHASH_ALL) == 1);
+    if(nIns > 1) {
+        BOOST_CHECK(sighash.SignatureHash(scriptCode, 1, SIGHASH_SINGLE) == 1);
+        BOOST_CHECK(SignatureHash(scriptCode, txTo, 1, SIGHASH_SINGLE) == 1);
+    }
+
+    CTransaction txEmpty;
+    CSigHashContext sighashEmpty(txEmpty);
+    BOOST_CHECK(sighashEmpty.SignatureHash(scriptCode, 0, SIGHASH_ALL) == 1);
+}
+
+BOOST_AUTO_TEST_CASE(sighash_signing)
+{
+    /* The input scripts aren't signed, so the context remains valid */
+    CTransaction txTo;
+    RandomTransaction(txTo, true);
+    CSigHashContext sighash(txTo);
+    CScript scriptCode;
+    RandomScript(scriptCode);
+
+    for(uint i = 0; i < txTo.vin.size(); i++) {
+        RandomScript(txTo.vin[i].scriptSig);
+        for(int nHashType = SIGHASH_ALL; nHashType <= SIGHASH_SINGLE; nHashType++) {
+            BOOST_CHECK(sighash.SignatureHash(scriptCode, i, nHashType) ==
+              SignatureHash(scriptCode, txTo, i, nHashType));
+            BOOST_CHECK(sighash.SignatureHash(scriptCode, i, nHashType | SIGHASH_ANYONECANPAY) ==
+              SignatureHash(scriptCode, txTo, i, nHashType | SIGHASH_ANYONECANPAY));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
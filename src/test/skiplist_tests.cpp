@@ -0,0 +1,90 @@
+#include <boost/test/unit_test.hpp>
+
+#include <vector>
+
+#include "main.h"
+#include "util.h"
+
+#define SKIPLIST_LENGTH 300000
+
+BOOST_AUTO_TEST_SUITE(skiplist_tests)
+
+// Ancestors found through the skip pointers match those by the previous pointers
+BOOST_AUTO_TEST_CASE(skiplist_ancestors)
+{
+    std::vector<CBlockIndex> vIndex(SKIPLIST_LENGTH);
+
+    for (int i = 0; i < SKIPLIST_LENGTH; i++)
+    {
+        vIndex[i].nHeight = i;
+        vIndex[i].pprev = (i == 0) ? NULL : &vIndex[i - 1];
+        vIndex[i].BuildSkip();
+    }
+
+    for (int i = 0; i < SKIPLIST_LENGTH; i++)
+    {
+        if (i > 0)
+        {
+            BOOST_CHECK(vIndex[i].pskip == &vIndex[vIndex[i].pskip->nHeight]);
+            BOOST_CHECK(vIndex[i].pskip->nHeight < i);
+        }
+        else
+            BOOST_CHECK(vIndex[i].pskip == NULL);
+    }
+
+    for (int i = 0; i < 1000; i++)
+    {
+        int from = GetRandInt(SKIPLIST_LENGTH - 1);
+        int to = GetRandInt(from + 1);
+
+        BOOST_CHECK(vIndex[SKIPLIST_LENGTH - 1].GetAncestor(from) == &vIndex[from]);
+        BOOST_CHECK(vIndex[from].GetAncestor(to) == &vIndex[to]);
+        BOOST_CHECK(vIndex[from].GetAncestor(0) == &vIndex[0]);
+        BOOST_CHECK(vIndex[from].GetAncestor(from + 1) == NULL);
+        BOOST_CHECK(vIndex[from].GetAncestor(-1) == NULL);
+    }
+}
+
+// The chain array follows the tip through forks
+BOOST_AUTO_TEST_CASE(skiplist_chain)
+{
+    std::vector<CBlockIndex> vMain(1000), vFork(500);
+
+    for (int i = 0; i < 1000; i++)
+    {
+        vMain[i].nHeight = i;
+        vMain[i].pprev = (i == 0) ? NULL : &vMain[i - 1];
+        vMain[i].BuildSkip();
+    }
+    // Forks off the main chain at height 499
+    for (int i = 0; i < 500; i++)
+    {
+        vFork[i].nHeight = 500 + i;
+        vFork[i].pprev = (i == 0) ? &vMain[499] : &vFork[i - 1];
+        vFork[i].BuildSkip();
+    }
+
+    CChain chain;
+    BOOST_CHECK(chain.Tip() == NULL);
+    BOOST_CHECK_EQUAL(chain.Height(), -1);
+
+    chain.SetTip(&vMain[999]);
+    BOOST_CHECK(chain.Tip() == &vMain[999]);
+    BOOST_CHECK_EQUAL(chain.Height(), 999);
+    for (int i = 0; i < 1000; i++)
+        BOOST_CHECK(chain[i] == &vMain[i]);
+    BOOST_CHECK(chain[1000] == NULL);
+    BOOST_CHECK(chain[-1] == NULL);
+
+    chain.SetTip(&vFork[200]);
+    BOOST_CHECK_EQUAL(chain.Height(), 700);
+    BOOST_CHECK(chain[499] == &vMain[499]);
+    for (int i = 500; i <= 700; i++)
+        BOOST_CHECK(chain[i] == &vFork[i - 500]);
+    BOOST_CHECK(chain[701] == NULL);
+
+    BOOST_CHECK(vFork[499].GetAncestor(499) == &vMain[499]);
+    BOOST_CHECK(vFork[499].GetAncestor(100) == &vMain[100]);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 #include <boost/test/unit_test.hpp>
 
 #include "db.h"
+#include "txdb.h"
 #include "main.h"
 #include "wallet.h"
 
@@ -27,6 +28,7 @@ struct TestingSetup {
         delete pwalletMain;
         pwalletMain = NULL;
         bitdb.Flush(true);
+        CloseTxDB();
     }
 };
 
@@ -4,6 +4,7 @@
 #include "json/json_spirit_writer_template.h"
 
 #include "main.h"
+#include "txdb.h"
 #include "wallet.h"
 
 using namespace std;
@@ -261,4 +262,101 @@ BOOST_AUTO_TEST_CASE(test_GetThrow)
     BOOST_CHECK_THROW(t1.GetValueIn(missingInputs), runtime_error);
 }
 
+BOOST_AUTO_TEST_CASE(test_Coins)
+{
+    CTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    tx.vin[0].prevout.n = 0;
+    tx.vout.resize(2);
+    tx.vout[0].nValue = 90*CENT;
+    tx.vout[0].scriptPubKey << OP_1;
+    tx.vout[1].nValue = 10*CENT;
+    tx.vout[1].scriptPubKey << OP_2;
+    uint256 hash = tx.GetHash();
+
+    // Spent outputs keep their positions
+    CCoins coins(tx);
+    BOOST_CHECK(coins.IsAvailable(0) && coins.IsAvailable(1) && !coins.IsAvailable(2));
+    coins.Spend(0);
+    BOOST_CHECK(!coins.IsAvailable(0) && coins.IsAvailable(1));
+    BOOST_CHECK_EQUAL(coins.vout.size(), 2U);
+    BOOST_CHECK(!coins.IsPruned());
+    coins.Spend(1);
+    BOOST_CHECK(coins.IsPruned());
+
+    // Changes of a transaction are seen by it only until committed
+    CTxDB txdb;
+    CCoins coinsRead;
+    BOOST_CHECK(txdb.WriteCoins(hash, CCoins(tx)));
+    BOOST_CHECK(txdb.TxnBegin());
+    coins = CCoins(tx);
+    coins.Spend(0);
+    BOOST_CHECK(txdb.WriteCoins(hash, coins));
+    BOOST_CHECK(txdb.ReadCoins(hash, coinsRead) && !coinsRead.IsAvailable(0));
+    BOOST_CHECK(txdb.TxnAbort());
+    BOOST_CHECK(txdb.ReadCoins(hash, coinsRead) && coinsRead.IsAvailable(0));
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.WriteCoins(hash, coins));
+    BOOST_CHECK(txdb.TxnCommit());
+    BOOST_CHECK(txdb.ReadCoins(hash, coinsRead) && !coinsRead.IsAvailable(0));
+
+    BOOST_CHECK(txdb.TxnBegin());
+    BOOST_CHECK(txdb.EraseCoins(hash));
+    BOOST_CHECK(!txdb.ReadCoins(hash, coinsRead));
+    BOOST_CHECK(txdb.TxnAbort());
+    BOOST_CHECK(txdb.ReadCoins(hash, coinsRead));
+    BOOST_CHECK(txdb.EraseCoins(hash));
+    BOOST_CHECK(!txdb.ReadCoins(hash, coinsRead));
+}
+
+BOOST_AUTO_TEST_CASE(test_BlockTxHash)
+{
+    CBlock block;
+    block.vtx.resize(2);
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+    {
+        block.vtx[i].vin.resize(1);
+        block.vtx[i].vin[0].prevout.hash = GetRandHash();
+        block.vtx[i].vin[0].prevout.n = i;
+        block.vtx[i].vout.resize(1);
+        block.vtx[i].vout[0].nValue = 90*CENT;
+        block.vtx[i].vout[0].scriptPubKey << OP_1;
+    }
+
+    // Assembled in memory: hashed on demand until the merkle tree is built
+    BOOST_CHECK(block.vMerkleTree.empty());
+    BOOST_CHECK(block.GetTxHash(1) == block.vtx[1].GetHash());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(block.GetTxHash(i) == block.vMerkleTree[i]);
+
+    // Changed: taken again when the merkle tree is rebuilt
+    block.vtx[1].vout[0].nValue = 80*CENT;
+    BOOST_CHECK(block.BuildMerkleTree() != block.hashMerkleRoot);
+    BOOST_CHECK(block.GetTxHash(1) == block.vtx[1].GetHash());
+    block.hashMerkleRoot = block.BuildMerkleTree();
+
+    // Appended to: the tree built for fewer transactions isn't used
+    block.vtx.push_back(block.vtx[1]);
+    block.vtx[2].vin[0].prevout.n = 2;
+    for (unsigned int i = 0; i < block.vtx.size(); i++)
+        BOOST_CHECK(block.GetTxHash(i) == block.vtx[i].GetHash());
+    block.vtx.pop_back();
+
+    // Deserialised: not hashed until needed
+    CDataStream ss(SER_NETWORK, PROTOCOL_VERSION);
+    ss << block;
+    CBlock blockRead(block);
+    ss >> blockRead;
+    BOOST_CHECK(blockRead.vMerkleTree.empty());
+    BOOST_CHECK(blockRead.BuildMerkleTree() == block.hashMerkleRoot);
+    for (unsigned int i = 0; i < blockRead.vtx.size(); i++)
+        BOOST_CHECK(blockRead.GetTxHash(i) == block.vtx[i].GetHash());
+
+    blockRead.SetNull();
+    BOOST_CHECK(blockRead.vMerkleTree.empty());
+}
+
 BOOST_AUTO_TEST_SUITE_END()
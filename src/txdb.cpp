@@ -0,0 +1,1380 @@
+// Copyright (c) 2009-2010 Satoshi Nakamoto
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#include <algorithm>
+#include <list>
+
+#include <boost/bind.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+#include <leveldb/cache.h>
+#include <leveldb/db.h>
+#include <leveldb/env.h>
+#include <leveldb/filter_policy.h>
+#include <leveldb/iterator.h>
+#include <leveldb/write_batch.h>
+#include <memenv.h>
+
+#include "util.h"
+#include "main.h"
+#include "checkpoints.h" /* for hashSyncCheckpoint */
+#include "checkqueue.h"
+#include "ui_interface.h"
+#include "db.h"
+#include "txdb.h"
+
+using namespace std;
+using namespace boost;
+
+
+/* Bounded LRU cache of transaction outputs shared by all CTxDB instances;
+ * holds committed records only, the changes of a data base transaction
+ * are applied after the batch has been written successfully */
+class CCoinsCache {
+private:
+    typedef std::list<uint256> lru_type;
+    typedef std::map<uint256, std::pair<CCoins, lru_type::iterator> > map_type;
+
+    CCriticalSection cs;
+    map_type mapCoins;
+    lru_type lruCoins;
+    uint64 nSize;
+    uint64 nMaxSize;
+
+    static uint64 GetRecordSize(const CCoins &coins) {
+        /* Approximate memory usage including the containers */
+        return(::GetSerializeSize(coins, SER_DISK, CLIENT_VERSION) +
+          coins.vout.size() * sizeof(CTxOut) + 128);
+    }
+
+public:
+    CCoinsCache() : nSize(0), nMaxSize(0) {}
+
+    bool Get(const uint256 &hash, CCoins &coins) {
+        LOCK(cs);
+        map_type::iterator it = mapCoins.find(hash);
+        if(it == mapCoins.end())
+          return(false);
+        /* Most recently used go to the front */
+        lruCoins.splice(lruCoins.begin(), lruCoins, it->second.second);
+        coins = it->second.first;
+        return(true);
+    }
+
+    void Put(const uint256 &hash, const CCoins &coins) {
+        LOCK(cs);
+        if(!nMaxSize)
+          nMaxSize = (uint64)std::max((int64)1, GetArg("-coinscache", 32)) * 1048576;
+        map_type::iterator it = mapCoins.find(hash);
+        if(it != mapCoins.end()) {
+            lruCoins.splice(lruCoins.begin(), lruCoins, it->second.second);
+            nSize -= GetRecordSize(it->second.first);
+            it->second.first = coins;
+            nSize += GetRecordSize(coins);
+            return;
+        }
+        lruCoins.push_front(hash);
+        mapCoins.insert(make_pair(hash, make_pair(coins, lruCoins.begin())));
+        nSize += GetRecordSize(coins);
+        while((nSize > nMaxSize) && !lruCoins.empty()) {
+            map_type::iterator itOld = mapCoins.find(lruCoins.back());
+            nSize -= GetRecordSize(itOld->second.first);
+            mapCoins.erase(itOld);
+            lruCoins.pop_back();
+        }
+    }
+
+    void Erase(const uint256 &hash) {
+        LOCK(cs);
+        map_type::iterator it = mapCoins.find(hash);
+        if(it == mapCoins.end())
+          return;
+        nSize -= GetRecordSize(it->second.first);
+        lruCoins.erase(it->second.second);
+        mapCoins.erase(it);
+    }
+
+    void Clear() {
+        LOCK(cs);
+        mapCoins.clear();
+        lruCoins.clear();
+        nSize = 0;
+    }
+};
+
+static CCoinsCache coinscache;
+
+
+/* The data base is opened once and shared by all CTxDB instances */
+static CCriticalSection cs_txdb;
+static leveldb::DB *ptxdb = NULL;
+static leveldb::Env *ptxdbenv = NULL;
+static leveldb::Options txdboptions;
+
+static leveldb::Options GetTxDBOptions() {
+    leveldb::Options options;
+    int nCacheSize = GetArg("-dbcache", 25);
+    if(nCacheSize < 4) nCacheSize = 4;
+    options.block_cache = leveldb::NewLRUCache(nCacheSize * 1048576);
+    /* Every lookup of a missing transaction costs a disk seek otherwise */
+    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.write_buffer_size = 4 * 1048576;
+    options.max_open_files = 64;
+    options.create_if_missing = true;
+    return(options);
+}
+
+/* Copies all records of a legacy blkindex.dat into the new data base
+ * and retires the old file; no record format changes are required;
+ * the version record is skipped as it marks a completed import and is
+ * written by the caller after the old file has been retired */
+static bool ImportLegacyTxDB(leveldb::DB *pdb, const std::string &strVersionKey) {
+    boost::filesystem::path pathOld = GetDataDir() / "blkindex.dat";
+    if(!boost::filesystem::exists(pathOld))
+      return(true);
+
+    uiInterface.InitMessage(_("Upgrading block index..."));
+    printf("ImportLegacyTxDB() : importing blkindex.dat\n");
+
+    int64 nStart = GetTimeMillis();
+    uint nRecords = 0;
+    {
+        CBlkIndexDB dbOld;
+        Dbc *pcursor = dbOld.GetCursor();
+        if(!pcursor)
+          return(error("ImportLegacyTxDB() : cannot open a cursor to blkindex.dat"));
+
+        leveldb::WriteBatch batch;
+        while(true) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+            int ret = dbOld.ReadAtCursor(pcursor, ssKey, ssValue);
+            if(ret == DB_NOTFOUND)
+              break;
+            if(ret) {
+                pcursor->close();
+                return(error("ImportLegacyTxDB() : blkindex.dat read failure %d", ret));
+            }
+
+            if(!ssKey.str().compare(strVersionKey))
+              continue;
+
+            batch.Put(leveldb::Slice(&ssKey[0], ssKey.size()),
+              leveldb::Slice(&ssValue[0], ssValue.size()));
+
+            /* Keep the memory footprint of the batch low */
+            if(!(++nRecords % 10000)) {
+                leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+                if(!status.ok()) {
+                    pcursor->close();
+                    return(error("ImportLegacyTxDB() : %s", status.ToString().c_str()));
+                }
+                batch.Clear();
+            }
+        }
+        pcursor->close();
+
+        leveldb::WriteOptions syncoptions;
+        syncoptions.sync = true;
+        leveldb::Status status = pdb->Write(syncoptions, &batch);
+        if(!status.ok())
+          return(error("ImportLegacyTxDB() : %s", status.ToString().c_str()));
+    }
+
+    /* Detach the old file from the environment before renaming it */
+    {
+        LOCK(bitdb.cs_db);
+        bitdb.CloseDb("blkindex.dat");
+        bitdb.CheckpointLSN("blkindex.dat");
+        bitdb.mapFileUseCount.erase("blkindex.dat");
+    }
+    /* Imported again on the next start otherwise, which is harmless
+     * as long as the version record hasn't been written yet */
+    if(!RenameOver(pathOld, GetDataDir() / "blkindex.dat.old"))
+      return(error("ImportLegacyTxDB() : failed to rename blkindex.dat"));
+
+    printf("ImportLegacyTxDB() : %u records imported in %" PRI64d "ms\n",
+      nRecords, GetTimeMillis() - nStart);
+
+    return(true);
+}
+
+static leveldb::DB *OpenTxDB() {
+    LOCK(cs_txdb);
+
+    if(ptxdb)
+      return(ptxdb);
+
+    txdboptions = GetTxDBOptions();
+
+    boost::filesystem::path pathTxDB = GetDataDir() / "txleveldb";
+    if(bitdb.IsMock()) {
+        /* Unit tests run entirely in memory */
+        ptxdbenv = leveldb::NewMemEnv(leveldb::Env::Default());
+        txdboptions.env = ptxdbenv;
+    } else {
+        boost::filesystem::create_directory(pathTxDB);
+    }
+
+    printf("Opening the transaction data base in %s\n", pathTxDB.string().c_str());
+    leveldb::DB *pdb = NULL;
+    leveldb::Status status = leveldb::DB::Open(txdboptions, pathTxDB.string(), &pdb);
+    if(!status.ok())
+      throw(runtime_error(strprintf("CTxDB() : error opening the transaction data base: %s",
+        status.ToString().c_str())));
+
+    /* A fresh data base; import the old one if any and mark the version;
+     * an interrupted import leaves no version record and is restarted */
+    std::string strValue;
+    CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+    ssKey << std::string("version");
+    if(pdb->Get(leveldb::ReadOptions(), ssKey.str(), &strValue).IsNotFound()) {
+        if(!bitdb.IsMock() && !ImportLegacyTxDB(pdb, ssKey.str())) {
+            delete(pdb);
+            throw(runtime_error("CTxDB() : failed to import blkindex.dat"));
+        }
+        CDataStream ssValue(SER_DISK, CLIENT_VERSION);
+        ssValue << CLIENT_VERSION;
+        leveldb::WriteOptions syncoptions;
+        syncoptions.sync = true;
+        status = pdb->Put(syncoptions, ssKey.str(), ssValue.str());
+        if(!status.ok()) {
+            delete(pdb);
+            throw(runtime_error(strprintf("CTxDB() : error writing the version: %s",
+              status.ToString().c_str())));
+        }
+    }
+
+    ptxdb = pdb;
+
+    return(ptxdb);
+}
+
+void CloseTxDB() {
+    LOCK(cs_txdb);
+
+    coinscache.Clear();
+
+    if(!ptxdb)
+      return;
+
+    delete(ptxdb);
+    ptxdb = NULL;
+    delete(txdboptions.filter_policy);
+    txdboptions.filter_policy = NULL;
+    delete(txdboptions.block_cache);
+    txdboptions.block_cache = NULL;
+    if(ptxdbenv) {
+        delete(ptxdbenv);
+        ptxdbenv = NULL;
+    }
+}
+
+
+
+
+//
+// CTxDB
+//
+
+CTxDB::CTxDB(const char *pszMode) {
+    pdb = OpenTxDB();
+    fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
+    fTxnActive = false;
+}
+
+void CTxDB::Close() {
+    /* Uncommitted changes are discarded like on abort */
+    mapTxn.clear();
+    mapCoinsTxn.clear();
+    fTxnActive = false;
+}
+
+bool CTxDB::ReadRaw(const std::string &strKey, std::string &strValue) {
+
+    if(fTxnActive) {
+        std::map<std::string, std::pair<bool, std::string> >::const_iterator it =
+          mapTxn.find(strKey);
+        if(it != mapTxn.end()) {
+            if(!it->second.first)
+              return(false);
+            strValue = it->second.second;
+            return(true);
+        }
+    }
+
+    leveldb::Status status = pdb->Get(leveldb::ReadOptions(), strKey, &strValue);
+    if(!status.ok()) {
+        if(!status.IsNotFound())
+          printf("CTxDB::ReadRaw() : LevelDB read failure: %s\n", status.ToString().c_str());
+        return(false);
+    }
+
+    return(true);
+}
+
+bool CTxDB::WriteRaw(const std::string &strKey, const std::string &strValue) {
+
+    if(fTxnActive) {
+        mapTxn[strKey] = make_pair(true, strValue);
+        return(true);
+    }
+
+    leveldb::Status status = pdb->Put(leveldb::WriteOptions(), strKey, strValue);
+    if(!status.ok())
+      return(error("CTxDB::WriteRaw() : LevelDB write failure: %s", status.ToString().c_str()));
+
+    return(true);
+}
+
+bool CTxDB::EraseRaw(const std::string &strKey) {
+
+    if(fTxnActive) {
+        mapTxn[strKey] = make_pair(false, std::string());
+        return(true);
+    }
+
+    leveldb::Status status = pdb->Delete(leveldb::WriteOptions(), strKey);
+    if(!status.ok() && !status.IsNotFound())
+      return(error("CTxDB::EraseRaw() : LevelDB erase failure: %s", status.ToString().c_str()));
+
+    return(true);
+}
+
+bool CTxDB::TxnBegin() {
+    if(fTxnActive)
+      return(false);
+    fTxnActive = true;
+    return(true);
+}
+
+bool CTxDB::TxnCommit() {
+    if(!fTxnActive)
+      return(false);
+
+    leveldb::WriteBatch batch;
+    std::map<std::string, std::pair<bool, std::string> >::const_iterator it;
+    for(it = mapTxn.begin(); it != mapTxn.end(); it++) {
+        if(it->second.first)
+          batch.Put(it->first, it->second.second);
+        else
+          batch.Delete(it->first);
+    }
+    mapTxn.clear();
+    fTxnActive = false;
+    std::map<uint256, std::pair<bool, CCoins> > mapCoinsCommit;
+    mapCoinsCommit.swap(mapCoinsTxn);
+
+    /* The records may refer to the blocks queued for writing, so these are
+     * to be written first; the block files are committed in groups and the
+     * records written previously are synchronised right after, so the disk
+     * isn't waited for on every block */
+    if(!FlushBlockWrites())
+      return(error("CTxDB::TxnCommit() : failed to write the blocks referred to"));
+    if(CommitBlockFiles())
+      Sync();
+    leveldb::Status status = pdb->Write(leveldb::WriteOptions(), &batch);
+    if(!status.ok())
+      return(error("CTxDB::TxnCommit() : LevelDB batch write failure: %s",
+        status.ToString().c_str()));
+
+    /* Written successfully, so the cache may reflect the changes now */
+    std::map<uint256, std::pair<bool, CCoins> >::const_iterator itCoins;
+    for(itCoins = mapCoinsCommit.begin(); itCoins != mapCoinsCommit.end(); itCoins++) {
+        if(itCoins->second.first)
+          coinscache.Put(itCoins->first, itCoins->second.second);
+        else
+          coinscache.Erase(itCoins->first);
+    }
+
+    return(true);
+}
+
+bool CTxDB::Sync() {
+    /* An empty synchronous batch flushes the log with everything before it */
+    leveldb::WriteBatch batch;
+    leveldb::WriteOptions options;
+    options.sync = true;
+    leveldb::Status status = pdb->Write(options, &batch);
+    if(!status.ok())
+      return(error("CTxDB::Sync() : LevelDB write failure: %s", status.ToString().c_str()));
+
+    return(true);
+}
+
+bool CTxDB::TxnAbort() {
+    if(!fTxnActive)
+      return(false);
+    mapTxn.clear();
+    mapCoinsTxn.clear();
+    fTxnActive = false;
+    return(true);
+}
+
+bool CTxDB::ReadTxIndex(uint256 hash, CTxIndex& txindex)
+{
+    assert(!fClient);
+    txindex.SetNull();
+    return Read(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::UpdateTxIndex(uint256 hash, const CTxIndex& txindex)
+{
+    assert(!fClient);
+    return Write(make_pair(string("tx"), hash), txindex);
+}
+
+bool CTxDB::EraseTxIndex(uint256 hash)
+{
+    assert(!fClient);
+    return Erase(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ContainsTx(uint256 hash)
+{
+    assert(!fClient);
+    return Exists(make_pair(string("tx"), hash));
+}
+
+bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex)
+{
+    assert(!fClient);
+    tx.SetNull();
+    if (!ReadTxIndex(hash, txindex))
+        return false;
+    return (tx.ReadFromDisk(txindex.pos));
+}
+
+bool CTxDB::ReadDiskTx(uint256 hash, CTransaction& tx)
+{
+    CTxIndex txindex;
+    return ReadDiskTx(hash, tx, txindex);
+}
+
+bool CTxDB::ReadDiskTx(COutPoint outpoint, CTransaction& tx, CTxIndex& txindex)
+{
+    return ReadDiskTx(outpoint.hash, tx, txindex);
+}
+
+bool CTxDB::ReadDiskTx(COutPoint outpoint, CTransaction& tx)
+{
+    CTxIndex txindex;
+    return ReadDiskTx(outpoint.hash, tx, txindex);
+}
+
+bool CTxDB::ReadCoins(uint256 hash, CCoins &coins) {
+    assert(!fClient);
+
+    /* Changes of the active transaction come first */
+    if(fTxnActive) {
+        std::map<uint256, std::pair<bool, CCoins> >::const_iterator it =
+          mapCoinsTxn.find(hash);
+        if(it != mapCoinsTxn.end()) {
+            if(!it->second.first)
+              return(false);
+            coins = it->second.second;
+            return(true);
+        }
+    }
+
+    if(coinscache.Get(hash, coins))
+      return(true);
+
+    if(!Read(make_pair(string("coins"), hash), coins))
+      return(false);
+
+    coinscache.Put(hash, coins);
+    return(true);
+}
+
+bool CTxDB::WriteCoins(uint256 hash, const CCoins &coins) {
+    assert(!fClient);
+
+    if(!Write(make_pair(string("coins"), hash), coins))
+      return(false);
+
+    if(fTxnActive)
+      mapCoinsTxn[hash] = make_pair(true, coins);
+    else
+      coinscache.Put(hash, coins);
+
+    return(true);
+}
+
+bool CTxDB::EraseCoins(uint256 hash) {
+    assert(!fClient);
+
+    if(!Erase(make_pair(string("coins"), hash)))
+      return(false);
+
+    if(fTxnActive)
+      mapCoinsTxn[hash] = make_pair(false, CCoins());
+    else
+      coinscache.Erase(hash);
+
+    return(true);
+}
+
+void CTxDB::CacheCoins(uint256 hash, const CCoins &coins) {
+
+    /* The record may be derived from uncommitted index entries,
+     * so it becomes visible to others after a successful commit only */
+    if(fTxnActive)
+      mapCoinsTxn[hash] = make_pair(true, coins);
+    else
+      coinscache.Put(hash, coins);
+}
+
+bool CTxDB::WriteAddrIndex(const CAddrIndexKey &key, const CAddrIndexValue &value) {
+    assert(!fClient);
+
+    return(Write(make_pair(string("addr"), key), value));
+}
+
+bool CTxDB::EraseAddrIndex(const CAddrIndexKey &key) {
+    assert(!fClient);
+
+    return(Erase(make_pair(string("addr"), key)));
+}
+
+/* Reads the committed records only */
+bool CTxDB::ReadAddrIndex(const uint160 &hashScript, int nHeightStart, int nHeightEnd,
+  CAddrIndexRecords &vRecords, uint nSkip, uint nCount) {
+
+    vRecords.clear();
+    if(!pdb)
+      return(false);
+    if(!nCount)
+      return(true);
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("addr"), CAddrIndexKey(hashScript, nHeightStart, 0, 0, false));
+
+    bool fOk = true;
+    for(iterator->Seek(ssStartKey.str()); iterator->Valid(); iterator->Next()) {
+        leveldb::Slice slKey = iterator->key();
+        leveldb::Slice slValue = iterator->value();
+        try {
+            CMemoryStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            string strType;
+            CAddrIndexKey key;
+            ssKey >> strType;
+            if(strType != "addr")
+              break;
+            ssKey >> key;
+            if((key.hashScript != hashScript) || (key.nHeight > nHeightEnd))
+              break;
+            if(nSkip) {
+                nSkip--;
+                continue;
+            }
+
+            CMemoryStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddrIndexValue value;
+            ssValue >> value;
+            vRecords.push_back(make_pair(key, value));
+            if(vRecords.size() == nCount)
+              break;
+        } catch(std::exception &e) {
+            fOk = false;
+            break;
+        }
+    }
+    delete(iterator);
+
+    return(fOk);
+}
+
+static bool CompareAddrIndexRecords(const pair<CAddrIndexKey, CAddrIndexValue> &a,
+  const pair<CAddrIndexKey, CAddrIndexValue> &b) {
+    return(a.first.IsBefore(b.first));
+}
+
+/* The outputs are spent at the same or a greater height,
+ * so only those not spent yet are kept while reading */
+bool CTxDB::ReadAddrIndexUnspent(const uint160 &hashScript, CAddrIndexRecords &vRecords) {
+
+    vRecords.clear();
+    if(!pdb)
+      return(false);
+
+    leveldb::Iterator *iterator = pdb->NewIterator(leveldb::ReadOptions());
+
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("addr"), CAddrIndexKey(hashScript, 0, 0, 0, false));
+
+    map<pair<uint256, uint>, pair<CAddrIndexKey, CAddrIndexValue> > mapUnspent;
+    bool fOk = true;
+    for(iterator->Seek(ssStartKey.str()); iterator->Valid(); iterator->Next()) {
+        leveldb::Slice slKey = iterator->key();
+        leveldb::Slice slValue = iterator->value();
+        try {
+            CMemoryStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+            string strType;
+            CAddrIndexKey key;
+            ssKey >> strType;
+            if(strType != "addr")
+              break;
+            ssKey >> key;
+            if(key.hashScript != hashScript)
+              break;
+
+            CMemoryStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+            CAddrIndexValue value;
+            ssValue >> value;
+            if(key.fSpend) {
+                mapUnspent.erase(make_pair(value.hashPrevTx, value.nPrevOut));
+            } else {
+                mapUnspent[make_pair(key.hashTx, key.nIndex)] = make_pair(key, value);
+            }
+        } catch(std::exception &e) {
+            fOk = false;
+            break;
+        }
+    }
+    delete(iterator);
+
+    vRecords.reserve(mapUnspent.size());
+    map<pair<uint256, uint>, pair<CAddrIndexKey, CAddrIndexValue> >::const_iterator it;
+    for(it = mapUnspent.begin(); it != mapUnspent.end(); it++)
+      vRecords.push_back(it->second);
+    sort(vRecords.begin(), vRecords.end(), CompareAddrIndexRecords);
+
+    return(fOk);
+}
+
+bool CTxDB::ReadFlag(const string &strName, bool &fValue) {
+    return(Read(make_pair(string("flag"), strName), fValue));
+}
+
+bool CTxDB::WriteFlag(const string &strName, bool fValue) {
+    return(Write(make_pair(string("flag"), strName), fValue));
+}
+
+bool CTxDB::ReadBlockUndoPos(uint256 hash, uint &nFile, uint &nPos) {
+    pair<uint, uint> pos;
+
+    if(!Read(make_pair(string("blockundo"), hash), pos))
+      return(false);
+
+    nFile = pos.first;
+    nPos = pos.second;
+
+    return(true);
+}
+
+bool CTxDB::WriteBlockUndoPos(uint256 hash, uint nFile, uint nPos) {
+    assert(!fClient);
+
+    return(Write(make_pair(string("blockundo"), hash), make_pair(nFile, nPos)));
+}
+
+bool CTxDB::EraseBlockUndoPos(uint256 hash) {
+    assert(!fClient);
+
+    return(Erase(make_pair(string("blockundo"), hash)));
+}
+
+bool CTxDB::WriteBlockIndex(const CDiskBlockIndex& blockindex)
+{
+    return(Write(make_pair(string("blockindex"), blockindex.GetBlockHash()), blockindex,
+      std::max(CLIENT_VERSION, BLOCK_INDEX_POW_VERSION)));
+}
+
+bool CTxDB::ReadHashBestChain(uint256& hashBestChain)
+{
+    return Read(string("hashBestChain"), hashBestChain);
+}
+
+bool CTxDB::WriteHashBestChain(uint256 hashBestChain)
+{
+    return Write(string("hashBestChain"), hashBestChain);
+}
+
+/* Recorded as CBigNum for compatibility with the existing data bases */
+bool CTxDB::ReadBestInvalidWork(arith_uint256 &nBestInvalidWork) {
+    CBigNum bnBestInvalidWork;
+
+    if(!Read(string("bnBestInvalidWork"), bnBestInvalidWork))
+      return(false);
+
+    nBestInvalidWork = UintToArith256(bnBestInvalidWork.getuint256());
+
+    return(true);
+}
+
+bool CTxDB::WriteBestInvalidWork(const arith_uint256 &nBestInvalidWork) {
+    CBigNum bnBestInvalidWork;
+
+    bnBestInvalidWork.setuint256(ArithToUint256(nBestInvalidWork));
+
+    return(Write(string("bnBestInvalidWork"), bnBestInvalidWork));
+}
+
+bool CTxDB::ReadSyncCheckpoint(uint256 &hashCheckpoint) {
+    return(Read(string("hashSyncCheckpoint"), hashCheckpoint));
+}
+
+bool CTxDB::WriteSyncCheckpoint(uint256 hashCheckpoint) {
+    return(Write(string("hashSyncCheckpoint"), hashCheckpoint));
+}
+
+bool CTxDB::ReadCheckpointPubKey(string &strPubKey) {
+    return(Read(string("strCheckpointPubKey"), strPubKey));
+}
+
+bool CTxDB::WriteCheckpointPubKey(const string &strPubKey) {
+    return(Write(string("strCheckpointPubKey"), strPubKey));
+}
+
+CBlockIndex static * InsertBlockIndex(uint256 hash)
+{
+    if (hash == 0)
+        return NULL;
+
+    // Return existing
+    CBlockIndexMap::iterator mi = mapBlockIndex.find(hash);
+    if (mi != mapBlockIndex.end())
+        return (*mi).second;
+
+    // Create new
+    mi = mapBlockIndex.insert(hash).first;
+    CBlockIndex* pindexNew = (*mi).second;
+    pindexNew->phashBlock = &((*mi).first);
+
+    return pindexNew;
+}
+
+/* Block index snapshot:
+ * magic, nonce, hashBestChain, number of entries, the entries ordered by
+ * height (block hash, CDiskBlockIndex, nChainWork) and a checksum of all
+ * the preceding data; valid only if the nonce matches the one recorded in
+ * the data base at the time of writing, which is erased on loading, so
+ * the snapshot becomes stale as soon as the node is running again */
+
+static const char pchSnapshotMagic[4] = { 'p', 'x', 'c', 'w' };
+
+static boost::filesystem::path SnapshotPath() {
+    return(GetDataDir() / "blkindex.snap");
+}
+
+bool WipeTxDB() {
+    LOCK(cs_txdb);
+
+    if(ptxdb)
+      return(error("WipeTxDB() : the data base is open"));
+
+    try {
+        boost::filesystem::remove_all(GetDataDir() / "txleveldb");
+        boost::filesystem::remove(SnapshotPath());
+        /* Don't let a legacy block index be imported again */
+        boost::filesystem::path pathOld = GetDataDir() / "blkindex.dat";
+        if(boost::filesystem::exists(pathOld) &&
+          !RenameOver(pathOld, GetDataDir() / "blkindex.dat.old"))
+          return(error("WipeTxDB() : failed to rename blkindex.dat"));
+    } catch(boost::filesystem::filesystem_error &e) {
+        return(error("WipeTxDB() : %s", e.what()));
+    }
+
+    return(true);
+}
+
+bool CTxDB::WriteBlockIndexSnapshot() {
+    int64 nStart = GetTimeMillis();
+    const int nSnapVersion = std::max(CLIENT_VERSION, BLOCK_INDEX_POW_VERSION);
+    uint64 nNonce = GetRand(std::numeric_limits<uint64>::max());
+    uint256 hashBest;
+
+    if(!ReadHashBestChain(hashBest) || !mapBlockIndex.count(hashBest))
+      return(false);
+
+    vector<pair<int, CBlockIndex *> > vSortedByHeight;
+    vSortedByHeight.reserve(mapBlockIndex.size());
+    BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex *) &item, mapBlockIndex)
+      vSortedByHeight.push_back(make_pair(item.second->nHeight, item.second));
+    sort(vSortedByHeight.begin(), vSortedByHeight.end());
+
+    CDataStream ss(SER_DISK, nSnapVersion);
+    ss.reserve(vSortedByHeight.size() * 200 + 128);
+    ss << FLATDATA(pchSnapshotMagic) << nNonce << hashBest << (uint)vSortedByHeight.size();
+    BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex *) &item, vSortedByHeight) {
+        CBlockIndex *pindex = item.second;
+        ss << pindex->GetBlockHash() << CDiskBlockIndex(pindex) << ArithToUint256(pindex->nChainWork);
+    }
+    ss << Hash(ss.begin(), ss.end());
+
+    boost::filesystem::path pathTmp = GetDataDir() / "blkindex.snap.new";
+    FILE *file = fopen(pathTmp.string().c_str(), "wb");
+    if(!file)
+      return(error("CTxDB::WriteBlockIndexSnapshot() : failed to open %s", pathTmp.string().c_str()));
+    bool fOk = (fwrite(&ss[0], 1, ss.size(), file) == ss.size());
+    fflush(file);
+    fOk = fOk && !FileCommit(file);
+    fclose(file);
+    if(!fOk || !RenameOver(pathTmp, SnapshotPath())) {
+        boost::filesystem::remove(pathTmp);
+        return(error("CTxDB::WriteBlockIndexSnapshot() : failed to write the snapshot"));
+    }
+
+    if(!Write(string("indexsnapshot"), nNonce))
+      return(error("CTxDB::WriteBlockIndexSnapshot() : failed to record the snapshot"));
+
+    printf("Block index snapshot of %" PRIszu " entries written in %" PRI64d " ms\n",
+      vSortedByHeight.size(), GetTimeMillis() - nStart);
+
+    return(true);
+}
+
+bool CTxDB::LoadBlockIndexSnapshot() {
+    int64 nStart = GetTimeMillis();
+    boost::filesystem::path pathSnap = SnapshotPath();
+    uint64 nNonce = 0, nNonceDB = 0;
+
+    if(!boost::filesystem::exists(pathSnap))
+      return(false);
+
+    /* Invalidate the snapshot in advance, it is about to become stale */
+    bool fRecorded = Read(string("indexsnapshot"), nNonceDB);
+    if(fRecorded)
+      Erase(string("indexsnapshot"));
+    if(!fRecorded || !GetBoolArg("-indexsnapshot", true)) {
+        boost::filesystem::remove(pathSnap);
+        return(false);
+    }
+
+    /* A single sequential read */
+    vector<char> vData;
+    FILE *file = fopen(pathSnap.string().c_str(), "rb");
+    if(!file)
+      return(false);
+    if(!fseek(file, 0, SEEK_END)) {
+        long nSize = ftell(file);
+        if((nSize > (long)(sizeof(pchSnapshotMagic) + sizeof(uint256))) && !fseek(file, 0, SEEK_SET)) {
+            vData.resize(nSize);
+            if(fread(&vData[0], 1, nSize, file) != (size_t)nSize)
+              vData.clear();
+        }
+    }
+    fclose(file);
+    boost::filesystem::remove(pathSnap);
+
+    if(vData.empty())
+      return(error("CTxDB::LoadBlockIndexSnapshot() : failed to read the snapshot"));
+
+    uint256 hashCheck;
+    memcpy(&hashCheck, &vData[vData.size() - sizeof(uint256)], sizeof(uint256));
+    if(Hash(vData.begin(), vData.end() - sizeof(uint256)) != hashCheck)
+      return(error("CTxDB::LoadBlockIndexSnapshot() : checksum mismatch"));
+
+    uint256 hashBest, hashBestDB;
+    uint nCount = 0, i;
+    try {
+        CMemoryStream ss(&vData[0], &vData[vData.size() - sizeof(uint256)], SER_DISK, CLIENT_VERSION);
+        char pchMagic[4];
+
+        ss >> FLATDATA(pchMagic) >> nNonce >> hashBest >> nCount;
+        if(memcmp(pchMagic, pchSnapshotMagic, sizeof(pchMagic)) || (nNonce != nNonceDB) ||
+          !ReadHashBestChain(hashBestDB) || (hashBest != hashBestDB)) {
+            printf("CTxDB::LoadBlockIndexSnapshot() : the snapshot is stale\n");
+            return(false);
+        }
+
+        mapBlockIndex.reserve(nCount);
+
+        for(i = 0; (i < nCount) && !fRequestShutdown; i++) {
+            uint256 hash;
+            CDiskBlockIndex diskindex;
+            uint256 nChainWork;
+
+            ss >> hash >> diskindex >> nChainWork;
+
+            CBlockIndex *pindexNew = InsertBlockIndex(hash);
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nBlockPos      = diskindex.nBlockPos;
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->hashPoW        = diskindex.hashPoW;
+            pindexNew->nChainWork     = UintToArith256(nChainWork);
+            pindexNew->BuildSkip();
+
+            if(!pindexGenesisBlock && (hash == hashGenesisBlock))
+              pindexGenesisBlock = pindexNew;
+        }
+    } catch(std::exception &e) {
+        i = 0;
+    }
+
+    if(fRequestShutdown)
+      return(true);
+
+    if(i != nCount) {
+        /* Start over from the data base */
+        mapBlockIndex.clear();
+        pindexGenesisBlock = NULL;
+        return(error("CTxDB::LoadBlockIndexSnapshot() : deserialize error"));
+    }
+
+    printf("Block index snapshot of %u entries loaded in %" PRI64d " ms\n",
+      nCount, GetTimeMillis() - nStart);
+
+    return(true);
+}
+
+/* Number of blocks verified at startup per batch */
+static const uint BLOCKCHECK_BATCH_SIZE = 1024;
+
+/* Outcome of reading and verifying a single block */
+struct CBlockCheckResult {
+    bool fRead;
+    bool fValid;
+    bool fIndexValid;
+    uint256 hashPoW;
+
+    CBlockCheckResult() : fRead(false), fValid(false), fIndexValid(true), hashPoW(0) {}
+};
+
+/* Positions of the blocks verified at startup mapped to their heights */
+typedef map<pair<uint, uint>, int> CBlockPosMap;
+
+/* Reads a block of the best chain and performs the context free checks
+ * on it, then verifies the transaction index against it at check levels 2
+ * and above; the index and the data base are not modified here, so it can
+ * run in the worker threads of a check queue */
+class CBlockCheck {
+private:
+    CBlockIndex *pindex;
+    int nCheckLevel;
+    bool fCheckPoW;
+    CTxDB *ptxdb;
+    const CBlockPosMap *pmapBlockPos;
+    CBlockCheckResult *presult;
+
+    bool CheckTxIndex(const CBlock &block) const;
+
+public:
+    CBlockCheck() : pindex(NULL), nCheckLevel(0), fCheckPoW(false), ptxdb(NULL),
+      pmapBlockPos(NULL), presult(NULL) {}
+    CBlockCheck(CBlockIndex *pindexIn, int nCheckLevelIn, bool fCheckPoWIn, CTxDB *ptxdbIn,
+      const CBlockPosMap *pmapBlockPosIn, CBlockCheckResult *presultIn) :
+      pindex(pindexIn), nCheckLevel(nCheckLevelIn), fCheckPoW(fCheckPoWIn), ptxdb(ptxdbIn),
+      pmapBlockPos(pmapBlockPosIn), presult(presultIn) {}
+
+    /* Always succeeds, the results are evaluated by the caller */
+    bool operator()() const {
+        try {
+            CBlock block;
+            if(!block.ReadFromDisk(pindex))
+              return(true);
+            presult->fRead = true;
+            if(nCheckLevel <= 0)
+              return(true);
+            /* The hash recorded in the index is trusted unless verified
+             * explicitly; computed if not recorded yet */
+            presult->hashPoW = fCheckPoW ? 0 : pindex->hashPoW;
+            if(presult->hashPoW == 0)
+              presult->hashPoW = block.GetHashPoW(pindex->nHeight);
+            presult->fValid = block.CheckBlock(false) &&
+              CheckProofOfWork(presult->hashPoW, pindex->nBits);
+            if(nCheckLevel > 1)
+              presult->fIndexValid = CheckTxIndex(block);
+        } catch(std::exception &e) {
+            printf("CBlockCheck() : %s\n", e.what());
+        }
+        return(true);
+    }
+
+    void swap(CBlockCheck &check) {
+        std::swap(pindex, check.pindex);
+        std::swap(nCheckLevel, check.nCheckLevel);
+        std::swap(fCheckPoW, check.fCheckPoW);
+        std::swap(ptxdb, check.ptxdb);
+        std::swap(pmapBlockPos, check.pmapBlockPos);
+        std::swap(presult, check.presult);
+    }
+};
+
+/* Verifies the transaction index records of the block against its transactions
+ * and the spends recorded against the blocks of the best chain verified;
+ * returns false if the best chain is to be moved back before the block */
+bool CBlockCheck::CheckTxIndex(const CBlock &block) const {
+    bool fOk = true;
+
+    // check level 2: verify transaction index validity
+    BOOST_FOREACH(const CTransaction &tx, block.vtx)
+    {
+        uint256 hashTx = tx.GetHash();
+        CTxIndex txindex;
+        if (ptxdb->ReadTxIndex(hashTx, txindex))
+        {
+            // check level 3: checker transaction hashes
+            if (nCheckLevel>2 || pindex->nFile != txindex.pos.nFile || pindex->nBlockPos != txindex.pos.nBlockPos)
+            {
+                // either an error or a duplicate transaction
+                CTransaction txFound;
+                if (!txFound.ReadFromDisk(txindex.pos))
+                {
+                    printf("LoadBlockIndex() : *** cannot read mislocated transaction %s\n", hashTx.ToString().c_str());
+                    fOk = false;
+                }
+                else
+                    if (txFound.GetHash() != hashTx) // not a duplicate tx
+                    {
+                        printf("LoadBlockIndex(): *** invalid tx position for %s\n", hashTx.ToString().c_str());
+                        fOk = false;
+                    }
+            }
+            // check level 4: check whether spent txouts were spent within the main chain
+            unsigned int nOutput = 0;
+            if (nCheckLevel>3)
+            {
+                BOOST_FOREACH(const CDiskTxPos &txpos, txindex.vSpent)
+                {
+                    if (!txpos.IsNull())
+                    {
+                        /* Spent by this block or any of the blocks verified above it */
+                        CBlockPosMap::const_iterator mi = pmapBlockPos->find(make_pair(txpos.nFile, txpos.nBlockPos));
+                        if ((mi == pmapBlockPos->end()) || (mi->second < pindex->nHeight))
+                        {
+                            printf("LoadBlockIndex(): *** found bad spend at %d, hashBlock=%s, hashTx=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str(), hashTx.ToString().c_str());
+                            fOk = false;
+                        }
+                        // check level 6: check whether spent txouts were spent by a valid transaction that consume them
+                        if (nCheckLevel>5)
+                        {
+                            CTransaction txSpend;
+                            if (!txSpend.ReadFromDisk(txpos))
+                            {
+                                printf("LoadBlockIndex(): *** cannot read spending transaction of %s:%i from disk\n", hashTx.ToString().c_str(), nOutput);
+                                fOk = false;
+                            }
+                            else if (!txSpend.CheckTransaction())
+                            {
+                                printf("LoadBlockIndex(): *** spending transaction of %s:%i is invalid\n", hashTx.ToString().c_str(), nOutput);
+                                fOk = false;
+                            }
+                            else
+                            {
+                                bool fFound = false;
+                                BOOST_FOREACH(const CTxIn &txin, txSpend.vin)
+                                    if (txin.prevout.hash == hashTx && txin.prevout.n == nOutput)
+                                        fFound = true;
+                                if (!fFound)
+                                {
+                                    printf("LoadBlockIndex(): *** spending transaction of %s:%i does not spend it\n", hashTx.ToString().c_str(), nOutput);
+                                    fOk = false;
+                                }
+                            }
+                        }
+                    }
+                    nOutput++;
+                }
+            }
+        }
+        // check level 5: check whether all prevouts are marked spent
+        if (nCheckLevel>4)
+        {
+             BOOST_FOREACH(const CTxIn &txin, tx.vin)
+             {
+                  CTxIndex txindex;
+                  if (ptxdb->ReadTxIndex(txin.prevout.hash, txindex))
+                      if (txindex.vSpent.size()-1 < txin.prevout.n || txindex.vSpent[txin.prevout.n].IsNull())
+                      {
+                          printf("LoadBlockIndex(): *** found unspent prevout %s:%i in %s\n", txin.prevout.hash.ToString().c_str(), txin.prevout.n, hashTx.ToString().c_str());
+                          fOk = false;
+                      }
+             }
+        }
+    }
+
+    return(fOk);
+}
+
+static void ThreadBlockCheck(CCheckQueue<CBlockCheck> *pqueue) {
+
+    RenameThread("pxc-blockcheck");
+
+    pqueue->Thread();
+}
+
+/* Collects the next batch of blocks down the best chain to be verified */
+static void GetBlockCheckBatch(CBlockIndex *&pindexNext, int nMinHeight,
+  vector<CBlockIndex *> &vBatch) {
+
+    vBatch.clear();
+    while(pindexNext && pindexNext->pprev && (pindexNext->nHeight >= nMinHeight) &&
+      (vBatch.size() < BLOCKCHECK_BATCH_SIZE)) {
+        vBatch.push_back(pindexNext);
+        pindexNext = pindexNext->pprev;
+    }
+}
+
+/* Advises the system to read the block file ranges of the batch in advance */
+static void PrefetchBlocks(const vector<CBlockIndex *> &vBatch) {
+    map<uint, pair<uint, uint> > mapRange;
+
+    BOOST_FOREACH(const CBlockIndex *pindex, vBatch) {
+        map<uint, pair<uint, uint> >::iterator mi = mapRange.find(pindex->nFile);
+        if(mi == mapRange.end()) {
+            mapRange[pindex->nFile] = make_pair(pindex->nBlockPos, pindex->nBlockPos);
+        } else {
+            mi->second.first = min(mi->second.first, pindex->nBlockPos);
+            mi->second.second = max(mi->second.second, pindex->nBlockPos);
+        }
+    }
+
+    /* The end of the last block is unknown, so the range is extended
+     * by the maximal block size and clamped to the file later */
+    for(map<uint, pair<uint, uint> >::const_iterator mi = mapRange.begin(); mi != mapRange.end(); mi++)
+      PrefetchBlockFile(mi->first, mi->second.first, mi->second.second + MAX_BLOCK_SIZE);
+}
+
+bool CTxDB::LoadBlockIndex()
+{
+    if(!LoadBlockIndexSnapshot()) {
+
+        if (!LoadBlockIndexGuts())
+            return false;
+
+        if (fRequestShutdown)
+            return true;
+
+        // Calculate nChainWork
+        vector<pair<int, CBlockIndex*> > vSortedByHeight;
+        vSortedByHeight.reserve(mapBlockIndex.size());
+        BOOST_FOREACH(const PAIRTYPE(uint256, CBlockIndex*)& item, mapBlockIndex)
+        {
+            CBlockIndex* pindex = item.second;
+            vSortedByHeight.push_back(make_pair(pindex->nHeight, pindex));
+        }
+        sort(vSortedByHeight.begin(), vSortedByHeight.end());
+        BOOST_FOREACH(const PAIRTYPE(int, CBlockIndex*)& item, vSortedByHeight)
+        {
+            CBlockIndex* pindex = item.second;
+            pindex->nChainWork = (pindex->pprev ? pindex->pprev->nChainWork : arith_uint256(0)) + pindex->GetBlockWork();
+            pindex->BuildSkip();
+        }
+
+    } else if(fRequestShutdown) {
+        return(true);
+    }
+
+    // Load hashBestChain pointer to end of best chain
+    if (!ReadHashBestChain(hashBestChain))
+    {
+        if (pindexGenesisBlock == NULL)
+            return true;
+        return error("CTxDB::LoadBlockIndex() : hashBestChain not loaded");
+    }
+    if (!mapBlockIndex.count(hashBestChain))
+        return error("CTxDB::LoadBlockIndex() : hashBestChain not found in the block index");
+    pindexBest = mapBlockIndex[hashBestChain];
+    chainActive.SetTip(pindexBest);
+    nBestHeight = pindexBest->nHeight;
+    nBestChainWork = pindexBest->nChainWork;
+    printf("LoadBlockIndex(): hashBestChain=%s  height=%d  date=%s\n",
+      hashBestChain.ToString().substr(0,20).c_str(), nBestHeight,
+      DateTimeStrFormat("%x %H:%M:%S", pindexBest->GetBlockTime()).c_str());
+
+    /* Load sync checkpoint */
+    if(!ReadSyncCheckpoint(Checkpoints::hashSyncCheckpoint)) {
+        printf("LoadBlockIndex(): advanced checkpoint cannot be read\n");
+    } else {
+        printf("LoadBlockIndex(): advanced checkpoint is %s\n",
+          Checkpoints::hashSyncCheckpoint.ToString().c_str());
+    }
+
+    // Load nBestInvalidWork, OK if it doesn't exist
+    ReadBestInvalidWork(nBestInvalidWork);
+
+    // Verify blocks in the best chain
+    int nCheckLevel = GetArg("-checklevel", 1);
+    int nCheckDepth = GetArg( "-checkblocks", 2500);
+    /* The proof-of-work hashes recorded in the index are trusted unless
+     * verified explicitly, independent of the check level */
+    bool fCheckPoW = GetBoolArg("-checkpow");
+    if (fCheckPoW && (nCheckLevel < 1))
+        nCheckLevel = 1;
+    if (nCheckDepth == 0)
+        nCheckDepth = 1000000000; // suffices until the year 19000
+    if (nCheckDepth > nBestHeight)
+        nCheckDepth = nBestHeight;
+    printf("Verifying last %i blocks at level %i%s\n", nCheckDepth, nCheckLevel,
+      fCheckPoW ? " with proof-of-work" : "");
+    CBlockIndex* pindexFork = NULL;
+
+    /* The blocks are read and checked by the worker threads in batches,
+     * the results are processed in the original order here */
+    CCheckQueue<CBlockCheck> blockcheckqueue(16);
+    thread_group threadsBlockCheck;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadsBlockCheck.create_thread(boost::bind(&ThreadBlockCheck, &blockcheckqueue));
+
+    int nCheckHeight = nBestHeight - nCheckDepth;
+
+    /* The spends are verified against all blocks of the range checked
+     * above the spent ones, so the positions are collected in advance */
+    CBlockPosMap mapBlockPos;
+    if (nCheckLevel > 3)
+    {
+        for (CBlockIndex* pindex = pindexBest; pindex && pindex->pprev && (pindex->nHeight >= nCheckHeight);
+          pindex = pindex->pprev)
+            mapBlockPos[make_pair(pindex->nFile, pindex->nBlockPos)] = pindex->nHeight;
+    }
+
+    CBlockIndex* pindexNext = pindexBest;
+    vector<CBlockIndex*> vBatch, vBatchNext;
+    GetBlockCheckBatch(pindexNext, nCheckHeight, vBatch);
+    PrefetchBlocks(vBatch);
+    bool fReadFailed = false;
+    while (!vBatch.empty() && !fReadFailed && !fRequestShutdown)
+    {
+        vector<CBlockCheckResult> vResult(vBatch.size());
+        {
+            CCheckQueueControl<CBlockCheck> control(&blockcheckqueue);
+            vector<CBlockCheck> vChecks;
+            vChecks.reserve(vBatch.size());
+            for (unsigned int i = 0; i < vBatch.size(); i++)
+                vChecks.push_back(CBlockCheck(vBatch[i], nCheckLevel,
+                  fCheckPoW, this, &mapBlockPos, &vResult[i]));
+            control.Add(vChecks);
+
+            /* Read ahead the next batch while this one is being checked */
+            GetBlockCheckBatch(pindexNext, nCheckHeight, vBatchNext);
+            PrefetchBlocks(vBatchNext);
+
+            control.Wait();
+        }
+
+        for (unsigned int i = 0; i < vBatch.size(); i++)
+        {
+            CBlockIndex* pindex = vBatch[i];
+            const CBlockCheckResult &result = vResult[i];
+            if (!result.fRead)
+            {
+                fReadFailed = true;
+                break;
+            }
+            // check level 1: verify block validity;
+            // the proof-of-work hash is recorded in the index if not there yet;
+            // -checkpow: replace it if it doesn't match the one of the block
+            if (nCheckLevel > 0)
+            {
+                if (pindex->hashPoW != result.hashPoW)
+                {
+                    if (pindex->hashPoW != 0)
+                        printf("LoadBlockIndex() : proof-of-work hash mismatch in the index of block %s\n",
+                          pindex->GetBlockHash().ToString().substr(0,20).c_str());
+                    pindex->hashPoW = result.hashPoW;
+                    if (!WriteBlockIndex(CDiskBlockIndex(pindex)))
+                        printf("LoadBlockIndex() : failed to update the index of block %s\n",
+                          pindex->GetBlockHash().ToString().substr(0,20).c_str());
+                }
+                if (!result.fValid)
+                {
+                    printf("LoadBlockIndex() : *** found bad block at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString().c_str());
+                    pindexFork = pindex->pprev;
+                }
+            }
+            // check levels 2 to 6: verify transaction index validity
+            if (!result.fIndexValid)
+                pindexFork = pindex->pprev;
+        }
+
+        vBatch.swap(vBatchNext);
+    }
+    blockcheckqueue.Quit();
+    threadsBlockCheck.join_all();
+    if (fReadFailed)
+        return error("LoadBlockIndex() : block.ReadFromDisk failed");
+
+    if (pindexFork && !fRequestShutdown)
+    {
+        // Reorg back to the fork
+        printf("LoadBlockIndex() : *** moving best chain pointer back to block %d\n", pindexFork->nHeight);
+        CBlock block;
+        if (!block.ReadFromDisk(pindexFork))
+            return error("LoadBlockIndex() : block.ReadFromDisk failed");
+        CTxDB txdb;
+        block.SetBestChain(txdb, pindexFork);
+    }
+
+    return true;
+}
+
+
+
+
+
+bool CTxDB::LoadBlockIndexGuts()
+{
+    leveldb::ReadOptions options;
+    /* The whole index is read once, don't evict the useful entries */
+    options.fill_cache = false;
+    leveldb::Iterator *iterator = pdb->NewIterator(options);
+
+    // Seek to the first block index record
+    CDataStream ssStartKey(SER_DISK, CLIENT_VERSION);
+    ssStartKey << make_pair(string("blockindex"), uint256(0));
+    iterator->Seek(ssStartKey.str());
+
+    // Load mapBlockIndex
+    for(; iterator->Valid(); iterator->Next()) {
+        leveldb::Slice slKey = iterator->key();
+        leveldb::Slice slValue = iterator->value();
+        CDataStream ssKey(slKey.data(), slKey.data() + slKey.size(), SER_DISK, CLIENT_VERSION);
+        CDataStream ssValue(slValue.data(), slValue.data() + slValue.size(), SER_DISK, CLIENT_VERSION);
+
+        // Unserialize
+
+        try {
+        string strType;
+        ssKey >> strType;
+        if (strType == "blockindex" && !fRequestShutdown)
+        {
+            CDiskBlockIndex diskindex;
+            ssValue >> diskindex;
+
+            // Construct block index object
+            CBlockIndex* pindexNew = InsertBlockIndex(diskindex.GetBlockHash());
+            pindexNew->pprev          = InsertBlockIndex(diskindex.hashPrev);
+            pindexNew->pnext          = InsertBlockIndex(diskindex.hashNext);
+            pindexNew->nFile          = diskindex.nFile;
+            pindexNew->nBlockPos      = diskindex.nBlockPos;
+            pindexNew->nHeight        = diskindex.nHeight;
+            pindexNew->nVersion       = diskindex.nVersion;
+            pindexNew->hashMerkleRoot = diskindex.hashMerkleRoot;
+            pindexNew->nTime          = diskindex.nTime;
+            pindexNew->nBits          = diskindex.nBits;
+            pindexNew->nNonce         = diskindex.nNonce;
+            pindexNew->hashPoW        = diskindex.hashPoW;
+
+            // Watch for genesis block
+            if (pindexGenesisBlock == NULL && diskindex.GetBlockHash() == hashGenesisBlock)
+                pindexGenesisBlock = pindexNew;
+        }
+        else
+        {
+            break; // if shutdown requested or finished loading block index
+        }
+        }    // try
+        catch (std::exception &e) {
+            delete(iterator);
+            return error("%s() : deserialize error", __PRETTY_FUNCTION__);
+        }
+    }
+    delete(iterator);
+
+    return true;
+}
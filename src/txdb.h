@@ -0,0 +1,270 @@
+// Copyright (c) 2009-2012 The Bitcoin developers
+// Copyright (c) 2013-2026 Phoenixcoin Developers
+// Distributed under the MIT/X11 software licence, see the accompanying
+// file LICENCE or http://opensource.org/license/mit
+
+#ifndef TXDB_H
+#define TXDB_H
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "serialize.h"
+#include "arith_uint256.h"
+#include "bignum.h"
+#include "uint256.h"
+#include "version.h"
+
+namespace leveldb {
+    class DB;
+}
+
+class CBlockIndex;
+class CCoins;
+class CDiskBlockIndex;
+class CDiskTxPos;
+class COutPoint;
+class CTransaction;
+class CTxIndex;
+
+/** Key of an address index record: an output paid to or spent from
+ * the script identified; the height is serialised big endian, so the records
+ * of a script are ordered by height in the data base */
+class CAddrIndexKey
+{
+public:
+    uint160 hashScript;
+    int nHeight;
+    uint256 hashTx;
+    /* The output number if received, the input number if spent */
+    uint nIndex;
+    bool fSpend;
+
+    CAddrIndexKey() : hashScript(0), nHeight(0), hashTx(0), nIndex(0), fSpend(false) {}
+    CAddrIndexKey(const uint160 &hashScriptIn, int nHeightIn, const uint256 &hashTxIn,
+      uint nIndexIn, bool fSpendIn) : hashScript(hashScriptIn), nHeight(nHeightIn),
+      hashTx(hashTxIn), nIndex(nIndexIn), fSpend(fSpendIn) {}
+
+    /* Compares in the order of the records of a script in the data base */
+    bool IsBefore(const CAddrIndexKey &b) const {
+        if(nHeight != b.nHeight)
+          return(nHeight < b.nHeight);
+        int nCmp = memcmp(&hashTx, &b.hashTx, sizeof(hashTx));
+        if(nCmp)
+          return(nCmp < 0);
+        /* Serialised in little endian */
+        nCmp = memcmp(&nIndex, &b.nIndex, sizeof(nIndex));
+        if(nCmp)
+          return(nCmp < 0);
+        return(!fSpend && b.fSpend);
+    }
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(hashScript);
+        uchar pchHeight[4];
+        pchHeight[0] = (uchar)(nHeight >> 24);
+        pchHeight[1] = (uchar)(nHeight >> 16);
+        pchHeight[2] = (uchar)(nHeight >> 8);
+        pchHeight[3] = (uchar)nHeight;
+        READWRITE(FLATDATA(pchHeight));
+        if(fRead)
+          const_cast<CAddrIndexKey *>(this)->nHeight =
+            (pchHeight[0] << 24) | (pchHeight[1] << 16) | (pchHeight[2] << 8) | pchHeight[3];
+        READWRITE(hashTx);
+        READWRITE(nIndex);
+        READWRITE(fSpend);
+    )
+};
+
+/** Value of an address index record; the output spent is known
+ * for the records of spending only */
+class CAddrIndexValue
+{
+public:
+    int64 nValue;
+    uint256 hashPrevTx;
+    uint nPrevOut;
+
+    CAddrIndexValue() : nValue(0), hashPrevTx(0), nPrevOut(0) {}
+    CAddrIndexValue(int64 nValueIn, const uint256 &hashPrevTxIn, uint nPrevOutIn) :
+      nValue(nValueIn), hashPrevTx(hashPrevTxIn), nPrevOut(nPrevOutIn) {}
+
+    IMPLEMENT_SERIALIZE
+    (
+        READWRITE(nValue);
+        READWRITE(hashPrevTx);
+        READWRITE(nPrevOut);
+    )
+};
+
+typedef std::vector<std::pair<CAddrIndexKey, CAddrIndexValue> > CAddrIndexRecords;
+
+/* Closes the transaction data base; called on shutdown */
+void CloseTxDB();
+
+/* Removes the transaction data base and the block index snapshot
+ * to be rebuilt from the block files; the data base must not be open */
+bool WipeTxDB();
+
+/** Access to the transaction database (txleveldb);
+ * all instances share one LevelDB handle, transactions are buffered
+ * per instance and written atomically as a single batch on commit */
+class CTxDB
+{
+public:
+    CTxDB(const char *pszMode = "r+");
+    ~CTxDB() { Close(); }
+    void Close();
+private:
+    CTxDB(const CTxDB&);
+    void operator=(const CTxDB&);
+
+    leveldb::DB *pdb;
+    bool fReadOnly;
+    bool fTxnActive;
+    /* Records modified by the active transaction and not committed yet;
+     * erased records are stored with the first member set to false */
+    std::map<std::string, std::pair<bool, std::string> > mapTxn;
+    /* Output records modified or derived from index entries by the active
+     * transaction in the same manner; they go to the shared cache only after
+     * the transaction is committed */
+    std::map<uint256, std::pair<bool, CCoins> > mapCoinsTxn;
+
+    bool ReadRaw(const std::string &strKey, std::string &strValue);
+    bool WriteRaw(const std::string &strKey, const std::string &strValue);
+    bool EraseRaw(const std::string &strKey);
+
+protected:
+    template<typename K, typename T>
+    bool Read(const K &key, T &value) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        std::string strValue;
+        if(!ReadRaw(ssKey.str(), strValue))
+          return(false);
+
+        try {
+            CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(),
+              SER_DISK, CLIENT_VERSION);
+            ssValue >> value;
+        } catch(std::exception &e) {
+            return(false);
+        }
+
+        return(true);
+    }
+
+    /* The value may be serialised in a record format of its own */
+    template<typename K, typename T>
+    bool Write(const K &key, const T &value, int nVersion = CLIENT_VERSION) {
+        assert(!fReadOnly);
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        CDataStream ssValue(SER_DISK, nVersion);
+        ssValue.reserve(10000);
+        ssValue << value;
+
+        return(WriteRaw(ssKey.str(), ssValue.str()));
+    }
+
+    template<typename K>
+    bool Erase(const K &key) {
+        assert(!fReadOnly);
+
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+
+        return(EraseRaw(ssKey.str()));
+    }
+
+    template<typename K>
+    bool Exists(const K &key) {
+        CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+        ssKey.reserve(1000);
+        ssKey << key;
+        std::string strValue;
+
+        return(ReadRaw(ssKey.str(), strValue));
+    }
+
+public:
+    bool TxnBegin();
+    bool TxnCommit();
+    bool TxnAbort();
+
+    bool IsTxnActive() const {
+        return(fTxnActive);
+    }
+    /* Makes all the records written so far durable */
+    bool Sync();
+
+    bool ReadVersion(int &nVersion) {
+        nVersion = 0;
+        return(Read(std::string("version"), nVersion));
+    }
+
+    bool WriteVersion(int nVersion) {
+        return(Write(std::string("version"), nVersion));
+    }
+
+    bool ReadTxIndex(uint256 hash, CTxIndex& txindex);
+    bool UpdateTxIndex(uint256 hash, const CTxIndex& txindex);
+    bool EraseTxIndex(uint256 hash);
+    bool ContainsTx(uint256 hash);
+    bool ReadDiskTx(uint256 hash, CTransaction& tx, CTxIndex& txindex);
+    bool ReadDiskTx(uint256 hash, CTransaction& tx);
+    bool ReadDiskTx(COutPoint outpoint, CTransaction& tx, CTxIndex& txindex);
+    bool ReadDiskTx(COutPoint outpoint, CTransaction& tx);
+
+    /* Calls related to the transaction output cache */
+    bool ReadCoins(uint256 hash, CCoins &coins);
+    bool WriteCoins(uint256 hash, const CCoins &coins);
+    bool EraseCoins(uint256 hash);
+    void CacheCoins(uint256 hash, const CCoins &coins);
+
+    /* Calls related to the address index */
+    bool WriteAddrIndex(const CAddrIndexKey &key, const CAddrIndexValue &value);
+    bool EraseAddrIndex(const CAddrIndexKey &key);
+    /* Reads the records of a script within the range of heights in order;
+     * skips the first nSkip of them and returns nCount at most */
+    bool ReadAddrIndex(const uint160 &hashScript, int nHeightStart, int nHeightEnd,
+      CAddrIndexRecords &vRecords, uint nSkip = 0, uint nCount = ~0U);
+    /* Reads the records of the outputs of a script not spent yet in order */
+    bool ReadAddrIndexUnspent(const uint160 &hashScript, CAddrIndexRecords &vRecords);
+
+    /* Persistent settings of the data base */
+    bool ReadFlag(const std::string &strName, bool &fValue);
+    bool WriteFlag(const std::string &strName, bool fValue);
+
+    /* Calls related to the block undo records */
+    bool ReadBlockUndoPos(uint256 hash, uint &nFile, uint &nPos);
+    bool WriteBlockUndoPos(uint256 hash, uint nFile, uint nPos);
+    bool EraseBlockUndoPos(uint256 hash);
+
+    bool WriteBlockIndex(const CDiskBlockIndex& blockindex);
+    bool ReadHashBestChain(uint256& hashBestChain);
+    bool WriteHashBestChain(uint256 hashBestChain);
+    bool ReadBestInvalidWork(arith_uint256 &nBestInvalidWork);
+    bool WriteBestInvalidWork(const arith_uint256 &nBestInvalidWork);
+    bool LoadBlockIndex();
+    /* Writes the whole block index into a flat file for fast loading */
+    bool WriteBlockIndexSnapshot();
+
+    /* Calls related to sync checkpoints */
+    bool ReadSyncCheckpoint(uint256 &hashCheckpoint);
+    bool WriteSyncCheckpoint(uint256 hashCheckpoint);
+    bool ReadCheckpointPubKey(std::string &strPubKey);
+    bool WriteCheckpointPubKey(const std::string &strPubKey);
+private:
+    bool LoadBlockIndexGuts();
+    bool LoadBlockIndexSnapshot();
+};
+
+#endif /* TXDB_H */
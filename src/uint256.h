@@ -377,6 +377,7 @@ public:
 
     friend class uint160;
     friend class uint256;
+    friend class arith_uint256;
     friend inline int Testuint256AdHoc(std::vector<std::string> vArg);
 };
 
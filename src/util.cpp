@@ -43,7 +43,10 @@ namespace boost {
 #endif
 #include <io.h> /* for _commit */
 #elif defined(__linux__)
+#include <fcntl.h> /* for fallocate */
 #include <sys/prctl.h>
+#else
+#include <fcntl.h>
 #endif
 
 using namespace std;
@@ -1120,6 +1123,27 @@ int FileCommit(FILE *fileout) {
     return(ret);
 }
 
+/* Allocates the space of a file range in advance without changing
+ * the file size, so appending continues at the same position;
+ * no effect where not supported */
+void AllocateFileRange(FILE *file, uint nOffset, uint nLength) {
+#if defined(__linux__) && defined(FALLOC_FL_KEEP_SIZE)
+    fallocate(fileno(file), FALLOC_FL_KEEP_SIZE, (off_t)nOffset, (off_t)nLength);
+#elif defined(__APPLE__) && defined(F_PREALLOCATE)
+    /* Relative to the physical end of file */
+    fstore_t fst;
+    fst.fst_flags = F_ALLOCATECONTIG;
+    fst.fst_posmode = F_PEOFPOSMODE;
+    fst.fst_offset = 0;
+    fst.fst_length = (off_t)nLength;
+    fst.fst_bytesalloc = 0;
+    if(fcntl(fileno(file), F_PREALLOCATE, &fst) == -1) {
+        fst.fst_flags = F_ALLOCATEALL;
+        fcntl(fileno(file), F_PREALLOCATE, &fst);
+    }
+#endif
+}
+
 int GetFilesize(FILE* file)
 {
     int nSavePos = ftell(file);
@@ -8,6 +8,7 @@
 #include "base58.h"
 #include "crypter.h"
 #include "walletdb.h"
+#include "txdb.h"
 #include "wallet.h"
 
 using namespace std;
@@ -549,9 +550,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn)
 // Add a transaction to the wallet, or update it.
 // pblock is optional, but should be provided if the transaction is known to be in a block.
 // If fUpdate is true, existing transactions will be updated.
-bool CWallet::AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fFindBlock)
+bool CWallet::AddToWalletIfInvolvingMe(const uint256 &hash, const CTransaction& tx, const CBlock* pblock, bool fUpdate, bool fFindBlock)
 {
-    uint256 hash = tx.GetHash();
     {
         LOCK(cs_wallet);
         bool fExisted = mapWallet.count(hash);
@@ -832,9 +832,9 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         {
             CBlock block;
             block.ReadFromDisk(pindex, true);
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
+            for (unsigned int i = 0; i < block.vtx.size(); i++)
             {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
+                if (AddToWalletIfInvolvingMe(block.GetTxHash(i), block.vtx[i], &block, fUpdate))
                     ret++;
             }
             pindex = pindex->pnext;
@@ -847,7 +847,7 @@ int CWallet::ScanForWalletTransaction(const uint256& hashTx)
 {
     CTransaction tx;
     tx.ReadFromDisk(COutPoint(hashTx, 0));
-    if (AddToWalletIfInvolvingMe(tx, NULL, true, true))
+    if (AddToWalletIfInvolvingMe(tx.GetHash(), tx, NULL, true, true))
         return 1;
     return 0;
 }
@@ -1335,9 +1335,10 @@ bool CWallet::CreateTransaction(const vector<pair<CScript, int64> > &vecSend, CW
                   wtxNew.vin.push_back(CTxIn(coin.first->GetHash(), coin.second));
 
                 /* Sign the transaction */
+                CSigHashContext sighash(wtxNew);
                 int nIn = 0;
                 BOOST_FOREACH(const PAIRTYPE(const CWalletTx *, uint) &coin, setCoins)
-                  if(!SignSignature(*this, *coin.first, wtxNew, nIn++)) return(false);
+                  if(!SignSignature(*this, *coin.first, wtxNew, nIn++, SIGHASH_ALL, &sighash)) return(false);
 
                 /* Limit size */
                 uint nBytes = ::GetSerializeSize(*(CTransaction *) &wtxNew, SER_NETWORK, PROTOCOL_VERSION);
@@ -1936,7 +1937,7 @@ void CWallet::GetKeyBirthTimes(std::map<CKeyID, int64> &mapKeyBirth) const {
       it != mapWallet.end(); it++) {
         /* Iterate over all wallet transactions */
         const CWalletTx &wtx = (*it).second;
-        std::map<uint256, CBlockIndex *>::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
+        CBlockIndexMap::const_iterator blit = mapBlockIndex.find(wtx.hashBlock);
         if((blit != mapBlockIndex.end()) && (blit->second->IsInMainChain())) {
             /* Those already in blocks */
             int nHeight = blit->second->nHeight;